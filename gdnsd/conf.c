@@ -21,6 +21,7 @@
 #include "monio.h"
 #include "dnsio_udp.h"
 #include "dnsio_tcp.h"
+#include "dnsio_tls.h"
 #include "gdnsd/misc.h"
 #include "gdnsd/log.h"
 #include "gdnsd/paths.h"
@@ -57,6 +58,10 @@ global_config_t gconfig = {
     .dns_threads = NULL,
     .http_addrs = NULL,
     .username = DEF_USERNAME,
+    .tls_cert = NULL,
+    .tls_key = NULL,
+    .query_log = NULL,
+    .stats_shm = NULL,
     .chaos = NULL,
     .include_optional_ns = false,
     .realtime_stats = false,
@@ -67,6 +72,7 @@ global_config_t gconfig = {
     .zones_strict_data = false,
     .zones_strict_startup = true,
     .zones_rfc1035_auto = true,
+    .udp_rx_timestamps = false,
     .chaos_len = 0,
      // legal values are -20 to 20, so -21
      //  is really just an indicator that the user
@@ -77,12 +83,25 @@ global_config_t gconfig = {
     .log_stats = 3600U,
     .max_http_clients = 128U,
     .http_timeout = 5U,
+    .http_keepalive = 30U,
+    .metrics_cache = 1U,
     .num_dns_addrs = 0U,
     .num_dns_threads = 0U,
     .num_http_addrs = 0U,
     .max_response = 16384U,
     .max_cname_depth = 16U,
     .max_addtl_rrsets = 64U,
+    .query_log_buffer = 4096U,
+    .query_log_max_size = 100U,
+    .query_log_rotate = 5U,
+    .heavy_hitters = 256U,
+    .heavy_hitters_top = 10U,
+    .rrl_rate = 0U,
+    .rrl_burst = 0U,
+    .rrl_slip = 2U,
+    .rrl_ipv4_prefix = 24U,
+    .rrl_ipv6_prefix = 56U,
+    .rrl_table_size = 16384U,
     .zones_rfc1035_auto_interval = 31U,
     .zones_rfc1035_quiesce = 5.0,
     .zones_rfc1035_min_quiesce = 0.0,
@@ -422,6 +441,8 @@ static void fill_dns_addrs(const vscf_data_t* listen_opt, const dns_addr_t* addr
                 log_warn("DNS listen address '%s': option 'tcp_clients_per_socket' is deprecated and is replaced by 'tcp_clients_per_thread'", lspec);
             CFG_OPT_UINT_ALTSTORE(addr_opts, tcp_timeout, 3LU, 60LU, addrconf->tcp_timeout);
             CFG_OPT_UINT_ALTSTORE_0MIN(addr_opts, tcp_threads, 1024LU, addrconf->tcp_threads);
+            CFG_OPT_UINT_ALTSTORE(addr_opts, tls_port, 1LU, 65535LU, addrconf->tls_port);
+            CFG_OPT_UINT_ALTSTORE_0MIN(addr_opts, tls_threads, 1024LU, addrconf->tls_threads);
 
             bool tcp_disabled = false;
             CFG_OPT_BOOL_ALTSTORE(addr_opts, disable_tcp, tcp_disabled);
@@ -443,6 +464,10 @@ static void fill_dns_addrs(const vscf_data_t* listen_opt, const dns_addr_t* addr
                     log_warn("DNS listen address '%s': option 'tcp_threads' was reduced from the configured value of %u to 1 for lack of SO_REUSEPORT support", lspec, addrconf->tcp_threads);
                     addrconf->tcp_threads = 1;
                 }
+                if(addrconf->tls_threads > 1) {
+                    log_warn("DNS listen address '%s': option 'tls_threads' was reduced from the configured value of %u to 1 for lack of SO_REUSEPORT support", lspec, addrconf->tls_threads);
+                    addrconf->tls_threads = 1;
+                }
             }
 
             make_addr(lspec, addrconf->dns_port, &addrconf->addr);
@@ -470,14 +495,28 @@ static void process_listen(const vscf_data_t* listen_opt, const dns_addr_t* addr
     if(!gconfig.num_dns_addrs)
         dmn_log_fatal("DNS listen addresses explicitly configured as an empty set - cannot continue without at least one address!");
 
+    // TLS listeners share the address of the plain listener, on tls_port
+    for(unsigned i = 0; i < gconfig.num_dns_addrs; i++) {
+        dns_addr_t* a = &gconfig.dns_addrs[i];
+        memcpy(&a->tls_addr, &a->addr, sizeof(anysin_t));
+        if(a->tls_addr.sa.sa_family == AF_INET6)
+            a->tls_addr.sin6.sin6_port = htons(a->tls_port);
+        else
+            a->tls_addr.sin.sin_port = htons(a->tls_port);
+#ifndef USE_TLS
+        if(a->tls_threads)
+            log_fatal("DNS listen address %s: 'tls_threads' is non-zero, but this build of gdnsd lacks DNS-over-TLS support", logf_anysin(&a->addr));
+#endif
+    }
+
     // use dns_addrs to populate dns_threads....
 
     gconfig.num_dns_threads = 0;
     for(unsigned i = 0; i < gconfig.num_dns_addrs; i++)
-        gconfig.num_dns_threads += (gconfig.dns_addrs[i].udp_threads + gconfig.dns_addrs[i].tcp_threads);
+        gconfig.num_dns_threads += (gconfig.dns_addrs[i].udp_threads + gconfig.dns_addrs[i].tcp_threads + gconfig.dns_addrs[i].tls_threads);
 
     if(!gconfig.num_dns_threads)
-        dmn_log_fatal("All listen addresses configured for zero UDP and zero TCP threads - cannot continue without at least one listener!");
+        dmn_log_fatal("All listen addresses configured for zero UDP, TCP, and TLS threads - cannot continue without at least one listener!");
 
     gconfig.dns_threads = calloc(gconfig.num_dns_threads, sizeof(dns_thread_t));
 
@@ -496,7 +535,17 @@ static void process_listen(const vscf_data_t* listen_opt, const dns_addr_t* addr
             t->is_udp = false;
             t->threadnum = tnum++;
         }
-        if(!(a->udp_threads + a->tcp_threads))
+        for(unsigned j = 0; j < a->tls_threads; j++) {
+            dns_thread_t* t = &gconfig.dns_threads[tnum];
+            t->ac = a;
+            t->is_udp = false;
+            t->is_tls = true;
+            t->threadnum = tnum++;
+        }
+        if(a->tls_threads)
+            dmn_log_info("DNS-over-TLS listener threads (%u) configured for %s",
+                a->tls_threads, logf_anysin(&a->tls_addr));
+        if(!(a->udp_threads + a->tcp_threads + a->tls_threads))
             dmn_log_warn("DNS listen address %s explicitly configured with no UDP or TCP threads - nothing is actually listening on this address!",
                 logf_anysin(&a->addr));
         else
@@ -566,6 +615,8 @@ void conf_load(const bool force_zss, const bool force_zsd) {
         .tcp_clients_per_thread = 128U,
         .tcp_timeout = 5U,
         .tcp_threads = 1U,
+        .tls_port = 853U,
+        .tls_threads = 0U,
     };
 
     bool def_tcp_disabled = false;
@@ -587,6 +638,8 @@ void conf_load(const bool force_zss, const bool force_zsd) {
         CFG_OPT_UINT(options, log_stats, 1LU, 2147483647LU);
         CFG_OPT_UINT(options, max_http_clients, 1LU, 65535LU);
         CFG_OPT_UINT(options, http_timeout, 3LU, 60LU);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, http_keepalive, 3600LU, gconfig.http_keepalive);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, metrics_cache, 3600LU, gconfig.metrics_cache);
 
         CFG_OPT_UINT_ALTSTORE_0MIN(options, late_bind_secs, 300LU, addr_defs.late_bind_secs);
         if(addr_defs.late_bind_secs)
@@ -596,6 +649,7 @@ void conf_load(const bool force_zss, const bool force_zsd) {
         CFG_OPT_UINT_ALTSTORE(options, udp_rcvbuf, 4096LU, 1048576LU, addr_defs.udp_rcvbuf);
         CFG_OPT_UINT_ALTSTORE(options, udp_sndbuf, 4096LU, 1048576LU, addr_defs.udp_sndbuf);
         CFG_OPT_UINT_ALTSTORE_0MIN(options, udp_threads, 1024LU, addr_defs.udp_threads);
+        CFG_OPT_BOOL(options, udp_rx_timestamps);
         CFG_OPT_UINT_ALTSTORE(options, tcp_timeout, 3LU, 60LU, addr_defs.tcp_timeout);
 
         // store deprecated + new names of this option to same spot
@@ -605,6 +659,23 @@ void conf_load(const bool force_zss, const bool force_zsd) {
             log_warn("The global option 'tcp_clients_per_socket' is deprecated and is replaced by 'tcp_clients_per_thread'");
 
         CFG_OPT_UINT_ALTSTORE_0MIN(options, tcp_threads, 1024LU, addr_defs.tcp_threads);
+        CFG_OPT_UINT_ALTSTORE(options, tls_port, 1LU, 65535LU, addr_defs.tls_port);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, tls_threads, 1024LU, addr_defs.tls_threads);
+        CFG_OPT_STR(options, tls_cert);
+        CFG_OPT_STR(options, tls_key);
+        CFG_OPT_STR(options, stats_shm);
+        CFG_OPT_STR(options, query_log);
+        CFG_OPT_UINT(options, query_log_buffer, 64LU, 1048576LU);
+        CFG_OPT_UINT(options, query_log_max_size, 1LU, 1048576LU);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, query_log_rotate, 99LU, gconfig.query_log_rotate);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, heavy_hitters, 4096LU, gconfig.heavy_hitters);
+        CFG_OPT_UINT(options, heavy_hitters_top, 1LU, 1000LU);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, rrl_rate, 1000000LU, gconfig.rrl_rate);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, rrl_burst, 10000000LU, gconfig.rrl_burst);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, rrl_slip, 10LU, gconfig.rrl_slip);
+        CFG_OPT_UINT(options, rrl_ipv4_prefix, 8LU, 32LU);
+        CFG_OPT_UINT(options, rrl_ipv6_prefix, 16LU, 64LU);
+        CFG_OPT_UINT(options, rrl_table_size, 64LU, 16777216LU);
         CFG_OPT_BOOL_ALTSTORE(options, disable_tcp, def_tcp_disabled);
         if(vscf_hash_get_data_byconstkey(options, "disable_tcp", false)) {
             log_warn("The global option 'disable_tcp' is deprecated.  Replace with 'tcp_threads = 0'");
@@ -624,6 +695,10 @@ void conf_load(const bool force_zss, const bool force_zsd) {
                 log_warn("The global option 'tcp_threads' was reduced from the configured value of %u to 1 for lack of SO_REUSEPORT support", addr_defs.tcp_threads);
                 addr_defs.tcp_threads = 1;
             }
+            if(addr_defs.tls_threads > 1) {
+                log_warn("The global option 'tls_threads' was reduced from the configured value of %u to 1 for lack of SO_REUSEPORT support", addr_defs.tls_threads);
+                addr_defs.tls_threads = 1;
+            }
         }
 
         CFG_OPT_UINT_ALTSTORE(options, http_port, 1LU, 65535LU, def_http_port);
@@ -746,6 +821,12 @@ bool dns_lsock_init(void) {
             if(udp_sock_setup(t))
                 need_caps = true;
         }
+#ifdef USE_TLS
+        else if(t->is_tls) {
+            if(tls_dns_listen_setup(t))
+                need_caps = true;
+        }
+#endif
         else {
             if(tcp_dns_listen_setup(t))
                 need_caps = true;
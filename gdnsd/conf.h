@@ -38,6 +38,9 @@ typedef struct {
     unsigned tcp_timeout;
     unsigned tcp_clients_per_thread;
     unsigned tcp_threads;
+    anysin_t tls_addr;
+    unsigned tls_port;
+    unsigned tls_threads;
 } dns_addr_t;
 
 typedef struct {
@@ -46,6 +49,7 @@ typedef struct {
     unsigned threadnum;
     int sock;
     bool is_udp;
+    bool is_tls;
     bool need_late_bind;
     bool autoscan_bind_failed;
 } dns_thread_t;
@@ -55,6 +59,10 @@ typedef struct {
     dns_thread_t*  dns_threads;
     anysin_t*      http_addrs;
     const char*    username;
+    const char*    tls_cert;
+    const char*    tls_key;
+    const char*    query_log;
+    const char*    stats_shm;
     const uint8_t* chaos;
     bool     include_optional_ns;
     bool     realtime_stats;
@@ -65,18 +73,32 @@ typedef struct {
     bool     zones_strict_data;
     bool     zones_strict_startup;
     bool     zones_rfc1035_auto;
+    bool     udp_rx_timestamps;
     int      priority;
     unsigned chaos_len;
     unsigned zones_default_ttl;
     unsigned log_stats;
     unsigned max_http_clients;
     unsigned http_timeout;
+    unsigned http_keepalive;
+    unsigned metrics_cache;
     unsigned num_http_addrs;
     unsigned num_dns_addrs;
     unsigned num_dns_threads;
     unsigned max_response;
     unsigned max_cname_depth;
     unsigned max_addtl_rrsets;
+    unsigned query_log_buffer;
+    unsigned query_log_max_size;
+    unsigned query_log_rotate;
+    unsigned heavy_hitters;
+    unsigned heavy_hitters_top;
+    unsigned rrl_rate;
+    unsigned rrl_burst;
+    unsigned rrl_slip;
+    unsigned rrl_ipv4_prefix;
+    unsigned rrl_ipv6_prefix;
+    unsigned rrl_table_size;
     unsigned zones_rfc1035_auto_interval;
     double zones_rfc1035_min_quiesce;
     double zones_rfc1035_quiesce;
@@ -14,14 +14,14 @@ bool dnsio_bind(dns_thread_t* t) {
     dmn_assert(t); dmn_assert(t->ac);
     dmn_assert(t->sock > -1);
 
-    const anysin_t* asin = &t->ac->addr;
+    const anysin_t* asin = t->is_tls ? &t->ac->tls_addr : &t->ac->addr;
 
     if(!bind(t->sock, &asin->sa, asin->len))
         return false;
 
     // first bind() attempt failed...
 
-    const char* ptxt = t->is_udp ? "UDP" : "TCP";
+    const char* ptxt = t->is_udp ? "UDP" : t->is_tls ? "TLS" : "TCP";
     const bool isv6 = asin->sa.sa_family == AF_INET6 ? true : false;
     int bind_err = errno;
 
@@ -91,7 +91,7 @@ static void tcp_timeout_handler(struct ev_loop* loop V_UNUSED, ev_timer* t, cons
     dmn_assert(revents == EV_TIMER);
 
     tcpdns_conn_t* tdata = (tcpdns_conn_t*)t->data;
-    log_debug("TCP DNS Connection timed out while %s %s",
+    hotlog_debug(tdata->thread_ctx->pctx->hlog, "TCP DNS Connection timed out while %s %s",
         tdata->state == WRITING ? "writing to" : "reading from", logf_anysin(tdata->asin));
 
     if(tdata->state == WRITING)
@@ -114,7 +114,7 @@ static void tcp_write_handler(struct ev_loop* loop, ev_io* io, const int revents
     const ssize_t written = send(io->fd, source, wanted, 0);
     if(unlikely(written == -1)) {
         if(errno != EAGAIN) {
-            log_debug("TCP DNS send() failed, dropping response to %s: %s", logf_anysin(tdata->asin), logf_errno());
+            hotlog_debug(tdata->thread_ctx->pctx->hlog, "TCP DNS send() failed, dropping response to %s: %s", logf_anysin(tdata->asin), logf_errno());
             stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.sendfail);
             cleanup_conn_watchers(loop, tdata);
             return;
@@ -168,10 +168,10 @@ static void tcp_read_handler(struct ev_loop* loop, ev_io* io, const int revents
 #                   endif
                     return;
                 }
-                log_debug("TCP DNS recv() from %s: %s", logf_anysin(tdata->asin), logf_errno());
+                hotlog_debug(tdata->thread_ctx->pctx->hlog, "TCP DNS recv() from %s: %s", logf_anysin(tdata->asin), logf_errno());
             }
             else if(tdata->size_done) {
-                log_debug("TCP DNS recv() from %s: Unexpected EOF", logf_anysin(tdata->asin));
+                hotlog_debug(tdata->thread_ctx->pctx->hlog, "TCP DNS recv() from %s: Unexpected EOF", logf_anysin(tdata->asin));
             }
             stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.recvfail);
         }
@@ -185,7 +185,7 @@ static void tcp_read_handler(struct ev_loop* loop, ev_io* io, const int revents
         if(likely(tdata->size_done > 1)) {
             tdata->size = (tdata->buffer[0] << 8) + tdata->buffer[1] + 2;
             if(unlikely(tdata->size > DNS_RECV_SIZE)) {
-                log_debug("Oversized TCP DNS query of length %u from %s", tdata->size, logf_anysin(tdata->asin));
+                hotlog_debug(tdata->thread_ctx->pctx->hlog, "Oversized TCP DNS query of length %u from %s", tdata->size, logf_anysin(tdata->asin));
                 stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.recvfail);
                 cleanup_conn_watchers(loop, tdata);
                 return;
@@ -250,20 +250,20 @@ static void accept_handler(struct ev_loop* loop, ev_io* io, const int revents V_
             case EHOSTDOWN:
             case EHOSTUNREACH:
             case ENETUNREACH:
-                log_debug("TCP DNS: early tcp socket death: %s", logf_errno());
+                hotlog_debug(thread_ctx->pctx->hlog, "TCP DNS: early tcp socket death: %s", logf_errno());
                 break;
             default:
-                log_err("TCP DNS: accept() failed: %s", logf_errno());
+                hotlog_err(thread_ctx->pctx->hlog, "TCP DNS: accept() failed: %s", logf_errno());
         }
         return;
     }
 
-    log_debug("Received TCP DNS connection from %s", logf_anysin(asin));
+    hotlog_debug(thread_ctx->pctx->hlog, "Received TCP DNS connection from %s", logf_anysin(asin));
 
     if(unlikely(fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0)) | O_NONBLOCK) == -1)) {
         free(asin);
         close(sock);
-        log_err("Failed to set O_NONBLOCK on inbound TCP DNS socket: %s", logf_errno());
+        hotlog_err(thread_ctx->pctx->hlog, "Failed to set O_NONBLOCK on inbound TCP DNS socket: %s", logf_errno());
         return;
     }
 
@@ -0,0 +1,526 @@
+/* Copyright © 2026 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "dnsio_tls.h"
+
+#ifdef USE_TLS
+
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "conf.h"
+#include "dnswire.h"
+#include "dnspacket.h"
+#include "dnsio.h"
+#include "dnsio_tcp.h"
+#include "gdnsd/log.h"
+#include "gdnsd/net.h"
+#include "gdnsd/paths.h"
+#include "gdnsd/prcu-priv.h"
+
+// DNS-over-TLS (RFC 7858).  The connection handling mirrors dnsio_tcp.c,
+//  with the handshake done in userspace by OpenSSL.  Where the library
+//  and kernel support it (OpenSSL 3.0+, Linux "tls" ULP), the record
+//  layer is then pushed into the kernel after the handshake, so that
+//  SSL_read()/SSL_write() in the steady state are plain recv()/send()
+//  on the socket with no userspace crypto.  Session resumption uses
+//  stateless tickets from the single shared SSL_CTX, so resumption works
+//  across all TLS threads without any shared session cache locking.
+
+typedef enum {
+    TLS_HANDSHAKE = 0,
+    TLS_READING_INITIAL,
+    TLS_READING_MORE,
+    TLS_WRITING,
+} tlsdns_state_t;
+
+// per-thread state
+typedef struct {
+    dnspacket_context_t* pctx;
+    unsigned timeout;
+    unsigned max_clients;
+    ev_io* accept_watcher;
+    unsigned int num_conn_watchers;
+} tlsdns_thread_t;
+
+// per-connection state
+typedef struct {
+    tlsdns_thread_t* thread_ctx;
+    anysin_t* asin;
+    SSL* ssl;
+    uint8_t* buffer;
+    ev_io* io_watcher;
+    ev_timer* timeout_watcher;
+    unsigned size;
+    unsigned size_done;
+    tlsdns_state_t state;
+} tlsdns_conn_t;
+
+// Shared by all TLS threads, read-only after tls_dns_listen_setup()
+static SSL_CTX* tls_ctx = NULL;
+
+static const char* logf_tlserr(const int ssl_err) {
+    if(ssl_err == SSL_ERROR_SYSCALL && errno)
+        return logf_errno();
+    const unsigned long e = ERR_get_error();
+    if(!e)
+        return ssl_err == SSL_ERROR_SYSCALL ? "Unexpected EOF" : "Unknown TLS error";
+    char* buf = dmn_fmtbuf_alloc(256);
+    ERR_error_string_n(e, buf, 256);
+    ERR_clear_error();
+    return buf;
+}
+
+static void tls_ctx_setup(void) {
+    if(!gconfig.tls_cert || !gconfig.tls_key)
+        log_fatal("DNS-over-TLS listeners require both of the options 'tls_cert' and 'tls_key'");
+
+    tls_ctx = SSL_CTX_new(TLS_server_method());
+    if(!tls_ctx)
+        log_fatal("Failed to create TLS server context: %s", logf_tlserr(SSL_ERROR_SSL));
+
+    // RFC 8310 5.1
+    SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+
+    SSL_CTX_set_options(tls_ctx, SSL_OP_NO_COMPRESSION
+        | SSL_OP_NO_RENEGOTIATION
+        | SSL_OP_CIPHER_SERVER_PREFERENCE
+#ifdef SSL_OP_ENABLE_KTLS
+        | SSL_OP_ENABLE_KTLS
+#endif
+    );
+
+    // Stateless tickets only: no cross-thread session cache.  The
+    //  ticket keys are generated randomly per-process by OpenSSL.
+    SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_num_tickets(tls_ctx, 1);
+    SSL_CTX_set_session_id_context(tls_ctx, (const unsigned char*)PACKAGE_NAME, sizeof(PACKAGE_NAME) - 1);
+
+    char* cert_path = gdnsd_resolve_path_cfg(gconfig.tls_cert, NULL);
+    if(SSL_CTX_use_certificate_chain_file(tls_ctx, cert_path) != 1)
+        log_fatal("Failed to load TLS certificate chain from '%s': %s", logf_pathname(cert_path), logf_tlserr(SSL_ERROR_SSL));
+    free(cert_path);
+
+    char* key_path = gdnsd_resolve_path_cfg(gconfig.tls_key, NULL);
+    if(SSL_CTX_use_PrivateKey_file(tls_ctx, key_path, SSL_FILETYPE_PEM) != 1)
+        log_fatal("Failed to load TLS private key from '%s': %s", logf_pathname(key_path), logf_tlserr(SSL_ERROR_SSL));
+    free(key_path);
+
+    if(SSL_CTX_check_private_key(tls_ctx) != 1)
+        log_fatal("TLS private key does not match certificate: %s", logf_tlserr(SSL_ERROR_SSL));
+}
+
+F_NONNULL
+static void cleanup_conn_watchers(struct ev_loop* loop, tlsdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+
+    // best-effort close_notify, we never wait for the peer's
+    if(SSL_is_init_finished(tdata->ssl))
+        SSL_shutdown(tdata->ssl);
+    SSL_free(tdata->ssl);
+    ERR_clear_error();
+
+    shutdown(tdata->io_watcher->fd, SHUT_RDWR);
+    close(tdata->io_watcher->fd);
+    ev_timer_stop(loop, tdata->timeout_watcher);
+    ev_io_stop(loop, tdata->io_watcher);
+    free(tdata->buffer);
+    free(tdata->timeout_watcher);
+    free(tdata->io_watcher);
+    free(tdata->asin);
+
+    if((tdata->thread_ctx->num_conn_watchers-- == tdata->thread_ctx->max_clients))
+        ev_io_start(loop, tdata->thread_ctx->accept_watcher);
+
+    free(tdata);
+}
+
+// If OpenSSL is blocked on the socket, (re-)arm the io watcher for the
+//  direction it needs and return true.  False means a real error.
+F_NONNULL
+static bool tls_wait_for(struct ev_loop* loop, tlsdns_conn_t* tdata, const int ssl_err) {
+    dmn_assert(loop); dmn_assert(tdata);
+
+    int events;
+    if(ssl_err == SSL_ERROR_WANT_READ)
+        events = EV_READ;
+    else if(ssl_err == SSL_ERROR_WANT_WRITE)
+        events = EV_WRITE;
+    else
+        return false;
+
+    ev_io* io = tdata->io_watcher;
+    if(!ev_is_active(io) || (io->events & (EV_READ|EV_WRITE)) != events) {
+        ev_io_stop(loop, io);
+        ev_io_set(io, io->fd, events);
+        ev_io_start(loop, io);
+    }
+    return true;
+}
+
+F_NONNULL
+static void tls_do_write(struct ev_loop* loop, tlsdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+    dmn_assert(tdata->state == TLS_WRITING);
+
+    // No SSL_MODE_ENABLE_PARTIAL_WRITE: this either writes the whole
+    //  response or must be retried later with the same arguments.
+    const int rv = SSL_write(tdata->ssl, tdata->buffer, (int)tdata->size);
+    if(unlikely(rv <= 0)) {
+        const int ssl_err = SSL_get_error(tdata->ssl, rv);
+        if(tls_wait_for(loop, tdata, ssl_err))
+            return;
+        hotlog_debug(tdata->thread_ctx->pctx->hlog, "TLS DNS write failed, dropping response to %s: %s", logf_anysin(tdata->asin), logf_tlserr(ssl_err));
+        stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.sendfail);
+        cleanup_conn_watchers(loop, tdata);
+        return;
+    }
+
+    dmn_assert((unsigned)rv == tdata->size);
+    ev_timer_again(loop, tdata->timeout_watcher);
+    tdata->state = TLS_READING_INITIAL;
+    tdata->size_done = 0;
+    tdata->size = 0;
+
+    // Wait for the next query.  Pipelined queries may already be
+    //  decrypted and buffered inside OpenSSL, in which case no EV_READ
+    //  would ever fire, so queue one up.  Either way this connection
+    //  gets at most one query per loop iteration, so that a client with
+    //  a long pipeline can't starve the others on this thread.
+    tls_wait_for(loop, tdata, SSL_ERROR_WANT_READ);
+    if(SSL_has_pending(tdata->ssl))
+        ev_feed_event(loop, tdata->io_watcher, EV_READ);
+}
+
+F_NONNULL
+static void tls_do_read(struct ev_loop* loop, tlsdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+    dmn_assert(tdata->state == TLS_READING_INITIAL || tdata->state == TLS_READING_MORE);
+
+    // Read exactly the 2-byte length, then exactly the message, so that
+    //  anything beyond this query stays buffered for the next one.
+    do {
+        const unsigned wanted =
+            (tdata->state == TLS_READING_INITIAL ? 2 : tdata->size)
+            - tdata->size_done;
+        const int rv = SSL_read(tdata->ssl, &tdata->buffer[tdata->size_done], (int)wanted);
+        if(rv <= 0) {
+            const int ssl_err = SSL_get_error(tdata->ssl, rv);
+            if(tls_wait_for(loop, tdata, ssl_err))
+                return;
+            if(ssl_err != SSL_ERROR_ZERO_RETURN || tdata->size_done) {
+                hotlog_debug(tdata->thread_ctx->pctx->hlog, "TLS DNS read from %s: %s", logf_anysin(tdata->asin),
+                    ssl_err == SSL_ERROR_ZERO_RETURN ? "Unexpected EOF" : logf_tlserr(ssl_err));
+                stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.recvfail);
+            }
+            cleanup_conn_watchers(loop, tdata);
+            return;
+        }
+
+        tdata->size_done += rv;
+
+        if(tdata->state == TLS_READING_INITIAL && tdata->size_done == 2) {
+            tdata->size = (tdata->buffer[0] << 8) + tdata->buffer[1] + 2;
+            if(unlikely(tdata->size > DNS_RECV_SIZE || tdata->size == 2)) {
+                hotlog_debug(tdata->thread_ctx->pctx->hlog, "Bad TLS DNS query length %u from %s", tdata->size - 2, logf_anysin(tdata->asin));
+                stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.recvfail);
+                cleanup_conn_watchers(loop, tdata);
+                return;
+            }
+            tdata->state = TLS_READING_MORE;
+        }
+    } while(tdata->state == TLS_READING_INITIAL || tdata->size_done < tdata->size);
+
+    //  Process the query and start the writer
+    tdata->size = process_dns_query(tdata->thread_ctx->pctx, tdata->asin, &tdata->buffer[2], tdata->size - 2);
+    if(!tdata->size) {
+        cleanup_conn_watchers(loop, tdata);
+        return;
+    }
+
+    gdnsd_put_una16(htons(tdata->size), tdata->buffer);
+    tdata->size += 2;
+    tdata->size_done = 0;
+    tdata->state = TLS_WRITING;
+
+    // As with TCP, a complete write can almost always proceed immediately
+    tls_do_write(loop, tdata);
+}
+
+F_NONNULL
+static void tls_do_handshake(struct ev_loop* loop, tlsdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+    dmn_assert(tdata->state == TLS_HANDSHAKE);
+
+    const int rv = SSL_accept(tdata->ssl);
+    if(rv != 1) {
+        const int ssl_err = SSL_get_error(tdata->ssl, rv);
+        if(tls_wait_for(loop, tdata, ssl_err))
+            return;
+        hotlog_debug(tdata->thread_ctx->pctx->hlog, "TLS DNS handshake with %s failed: %s", logf_anysin(tdata->asin), logf_tlserr(ssl_err));
+        stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.recvfail);
+        cleanup_conn_watchers(loop, tdata);
+        return;
+    }
+
+#ifdef BIO_get_ktls_send
+    hotlog_debug(tdata->thread_ctx->pctx->hlog, "TLS DNS handshake with %s complete (%s%s, kTLS tx: %s rx: %s)",
+        logf_anysin(tdata->asin), SSL_get_version(tdata->ssl),
+        SSL_session_reused(tdata->ssl) ? " resumed" : "",
+        BIO_get_ktls_send(SSL_get_wbio(tdata->ssl)) ? "yes" : "no",
+        BIO_get_ktls_recv(SSL_get_rbio(tdata->ssl)) ? "yes" : "no");
+#else
+    hotlog_debug(tdata->thread_ctx->pctx->hlog, "TLS DNS handshake with %s complete (%s%s)",
+        logf_anysin(tdata->asin), SSL_get_version(tdata->ssl),
+        SSL_session_reused(tdata->ssl) ? " resumed" : "");
+#endif
+
+    ev_timer_again(loop, tdata->timeout_watcher);
+    tdata->state = TLS_READING_INITIAL;
+    tls_do_read(loop, tdata);
+}
+
+F_NONNULL
+static void tls_timeout_handler(struct ev_loop* loop V_UNUSED, ev_timer* t, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(t);
+    dmn_assert(revents == EV_TIMER);
+
+    tlsdns_conn_t* tdata = (tlsdns_conn_t*)t->data;
+    hotlog_debug(tdata->thread_ctx->pctx->hlog, "TLS DNS Connection timed out while %s %s",
+        tdata->state == TLS_WRITING ? "writing to"
+            : tdata->state == TLS_HANDSHAKE ? "handshaking with" : "reading from",
+        logf_anysin(tdata->asin));
+
+    if(tdata->state == TLS_WRITING)
+        stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.sendfail);
+    else
+        stats_own_inc(&tdata->thread_ctx->pctx->stats->tcp.recvfail);
+
+    cleanup_conn_watchers(loop, tdata);
+}
+
+// A single watcher per connection; OpenSSL decides which direction it
+//  needs (e.g. reads can require writes during the handshake), and we
+//  just resume whatever operation the connection was in the middle of.
+F_NONNULL
+static void tls_io_handler(struct ev_loop* loop, ev_io* io, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(io);
+    dmn_assert(revents & (EV_READ|EV_WRITE));
+
+    tlsdns_conn_t* tdata = (tlsdns_conn_t*)io->data;
+    dmn_assert(tdata);
+
+    switch(tdata->state) {
+        case TLS_HANDSHAKE:
+            tls_do_handshake(loop, tdata);
+            break;
+        case TLS_READING_INITIAL:
+        case TLS_READING_MORE:
+            tls_do_read(loop, tdata);
+            break;
+        case TLS_WRITING:
+            tls_do_write(loop, tdata);
+            break;
+        default:
+            dmn_assert(0);
+    }
+}
+
+F_NONNULL
+static void accept_handler(struct ev_loop* loop, ev_io* io, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(io);
+    dmn_assert(revents == EV_READ);
+
+    tlsdns_thread_t* thread_ctx = (tlsdns_thread_t*)io->data;
+
+    anysin_t* asin = malloc(sizeof(anysin_t));
+    asin->len = ANYSIN_MAXLEN;
+
+    const int sock = accept(io->fd, &asin->sa, &asin->len);
+
+    if(unlikely(sock < 0)) {
+        free(asin);
+        switch(errno) {
+            case EAGAIN:
+            case EINTR:
+                break;
+#ifdef ENONET
+            case ENONET:
+#endif
+            case ENETDOWN:
+            case EPROTO:
+            case EHOSTDOWN:
+            case EHOSTUNREACH:
+            case ENETUNREACH:
+                hotlog_debug(thread_ctx->pctx->hlog, "TLS DNS: early tcp socket death: %s", logf_errno());
+                break;
+            default:
+                hotlog_err(thread_ctx->pctx->hlog, "TLS DNS: accept() failed: %s", logf_errno());
+        }
+        return;
+    }
+
+    hotlog_debug(thread_ctx->pctx->hlog, "Received TLS DNS connection from %s", logf_anysin(asin));
+
+    if(unlikely(fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0)) | O_NONBLOCK) == -1)) {
+        free(asin);
+        close(sock);
+        hotlog_err(thread_ctx->pctx->hlog, "Failed to set O_NONBLOCK on inbound TLS DNS socket: %s", logf_errno());
+        return;
+    }
+
+    SSL* ssl = SSL_new(tls_ctx);
+    if(unlikely(!ssl || !SSL_set_fd(ssl, sock))) {
+        hotlog_err(thread_ctx->pctx->hlog, "Failed to create TLS state for %s: %s", logf_anysin(asin), logf_tlserr(SSL_ERROR_SSL));
+        if(ssl) SSL_free(ssl);
+        free(asin);
+        close(sock);
+        return;
+    }
+    SSL_set_accept_state(ssl);
+
+    if((++thread_ctx->num_conn_watchers == thread_ctx->max_clients))
+        ev_io_stop(loop, thread_ctx->accept_watcher);
+
+    tlsdns_conn_t* tdata = calloc(1, sizeof(tlsdns_conn_t));
+    tdata->buffer = malloc(gconfig.max_response + 2);
+    tdata->thread_ctx = thread_ctx;
+    tdata->state = TLS_HANDSHAKE;
+    tdata->asin = asin;
+    tdata->ssl = ssl;
+
+    ev_io* io_watcher = malloc(sizeof(ev_io));
+    tdata->io_watcher = io_watcher;
+    io_watcher->data = tdata;
+    ev_io_init(io_watcher, tls_io_handler, sock, EV_READ);
+    ev_set_priority(io_watcher, 0);
+
+    ev_timer* timeout_watcher = malloc(sizeof(ev_timer));
+    timeout_watcher->data = tdata;
+    tdata->timeout_watcher = timeout_watcher;
+    ev_timer_init(timeout_watcher, tls_timeout_handler, 0, thread_ctx->timeout);
+    ev_set_priority(timeout_watcher, -1);
+    ev_timer_again(loop, timeout_watcher);
+
+    // With TCP_DEFER_ACCEPT the ClientHello is likely already queued,
+    //  and otherwise SSL_accept() will just ask for EV_READ.
+    tls_do_handshake(loop, tdata);
+}
+
+bool tls_dns_listen_setup(dns_thread_t* t) {
+    dmn_assert(t);
+    dmn_assert(t->is_tls);
+
+    if(!tls_ctx)
+        tls_ctx_setup();
+
+    const dns_addr_t* addrconf = t->ac;
+    dmn_assert(addrconf);
+
+    const anysin_t* asin = &addrconf->tls_addr;
+
+    t->sock = tcp_listen_pre_setup(asin, addrconf->tcp_timeout, t->ac->tls_threads > 1);
+    const bool need_caps = dnsio_bind(t);
+    if(!t->autoscan_bind_failed && listen(t->sock, addrconf->tcp_clients_per_thread) == -1)
+        log_fatal("Failed to listen(s, %i) on TLS socket %s: %s", addrconf->tcp_clients_per_thread, logf_anysin(asin), logf_errno());
+    return need_caps;
+}
+
+static void thread_clean(void* arg_unused V_UNUSED) {
+    gdnsd_prcu_rdr_thread_end();
+}
+
+static void ztstate_offline(struct ev_loop* loop V_UNUSED, ev_prepare* w V_UNUSED, int revents V_UNUSED) {
+    gdnsd_prcu_rdr_offline();
+}
+
+static void ztstate_online(struct ev_loop* loop V_UNUSED, ev_check* w V_UNUSED, int revents V_UNUSED) {
+    gdnsd_prcu_rdr_online();
+}
+
+void* dnsio_tls_start(void* thread_asvoid) {
+    dmn_assert(thread_asvoid);
+
+    const dns_thread_t* t = (const dns_thread_t*)thread_asvoid;
+    const dns_addr_t* addrconf = t->ac;
+
+    tlsdns_thread_t* thread_ctx = malloc(sizeof(tlsdns_thread_t));
+    thread_ctx->pctx = dnspacket_context_new(t->threadnum, false);
+
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+    thread_ctx->num_conn_watchers = 0;
+    thread_ctx->timeout = addrconf->tcp_timeout;
+    thread_ctx->max_clients = addrconf->tcp_clients_per_thread;
+
+    if(t->need_late_bind) {
+        const anysin_t* asin = &addrconf->tls_addr;
+        while(bind(t->sock, &asin->sa, asin->len)) {
+            if(errno != EADDRNOTAVAIL) {
+                log_err("Failed late bind() of TLS socket to %s: %s.  This listener thread is now shutting down.  Late bind attempts for this socket will no longer be attempted!", logf_anysin(asin), logf_errno());
+                pthread_exit(NULL);
+            }
+            sleep(addrconf->late_bind_secs);
+        }
+
+        if(listen(t->sock, addrconf->tcp_clients_per_thread) == -1)
+            log_fatal("Failed to listen(s, %i) on late-bound TLS socket %s: %s", addrconf->tcp_clients_per_thread, logf_anysin(asin), logf_errno());
+
+        log_info("Late bind() of TLS socket to %s succeeded, serving requests now", logf_anysin(asin));
+    }
+    else if(t->autoscan_bind_failed) {
+        // see the matching comment in dnsio_tcp_start()
+        pthread_exit(NULL);
+    }
+
+    struct ev_io* accept_watcher = thread_ctx->accept_watcher = malloc(sizeof(struct ev_io));
+    ev_io_init(accept_watcher, accept_handler, t->sock, EV_READ);
+    ev_set_priority(accept_watcher, -2);
+    accept_watcher->data = thread_ctx;
+
+    struct ev_loop* loop = ev_loop_new(EVFLAG_AUTO);
+    if(!loop) log_fatal("ev_loop_new() failed");
+    ev_set_timeout_collect_interval(loop, 0.1);
+
+    ev_io_start(loop, accept_watcher);
+
+    gdnsd_prcu_rdr_thread_start();
+    pthread_cleanup_push(thread_clean, NULL);
+
+    struct ev_prepare* prep_watcher = malloc(sizeof(struct ev_prepare));
+    struct ev_check* check_watcher = malloc(sizeof(struct ev_check));
+    ev_prepare_init(prep_watcher, ztstate_offline);
+    ev_check_init(check_watcher, ztstate_online);
+    ev_set_priority(check_watcher, EV_MAXPRI);
+    ev_prepare_start(loop, prep_watcher);
+    ev_check_start(loop, check_watcher);
+    ev_run(loop, 0);
+
+    pthread_cleanup_pop(1);
+
+    return NULL;
+}
+
+#endif // USE_TLS
@@ -0,0 +1,41 @@
+/* Copyright © 2026 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDNSD_DNSIO_TLS_H
+#define GDNSD_DNSIO_TLS_H
+
+#include "config.h"
+#include "conf.h"
+
+#ifdef USE_TLS
+
+F_NONNULL
+void* dnsio_tls_start(void* thread_asvoid);
+
+// Sets up the listening socket exactly as tcp_dns_listen_setup() does,
+//  but on the address's tls_addr.  The first call also loads the
+//  certificate and key (while we still have privileges to read them)
+//  and builds the server context shared by all TLS threads.
+// retval indicates network bind caps needed for late binding
+F_NONNULL
+bool tls_dns_listen_setup(dns_thread_t* t);
+
+#endif // USE_TLS
+
+#endif // GDNSD_DNSIO_TLS_H
@@ -30,8 +30,14 @@
 #include <netinet/ip.h>
 #include <netinet/udp.h>
 #include <pthread.h>
+#include <time.h>
 #include <sys/mman.h>
 
+#if defined SO_TIMESTAMPING && defined SCM_TIMESTAMPING
+#include <linux/net_tstamp.h>
+#define USE_RX_TSTAMP 1
+#endif
+
 #include "conf.h"
 #include "dnswire.h"
 #include "dnspacket.h"
@@ -237,6 +243,16 @@ bool udp_sock_setup(dns_thread_t* t) {
     else
         udp_sock_opts_v4(sock, gdnsd_anysin_is_anyaddr(asin));
 
+    if(gconfig.udp_rx_timestamps) {
+#ifdef USE_RX_TSTAMP
+        const int ts_flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags, sizeof ts_flags) == -1)
+            log_warn("Failed to set SO_TIMESTAMPING on UDP socket %s, no receive latency stats for it: %s", logf_anysin(asin), logf_errno());
+#else
+        log_warn("udp_rx_timestamps: SO_TIMESTAMPING not supported on this platform");
+#endif
+    }
+
     t->sock = sock;
     return dnsio_bind(t);
 }
@@ -245,9 +261,46 @@ bool udp_sock_setup(dns_thread_t* t) {
 #define MAP_ANONYMOUS MAP_ANON
 #endif
 
-// A reasonable guess for v4/v6 dstaddr pktinfo + cmsg header?
+// A reasonable guess for v4/v6 dstaddr pktinfo + cmsg header,
+//  plus a receive timestamp?
 #define CMSG_BUFSIZE 256
 
+#ifdef USE_RX_TSTAMP
+
+static uint64_t realtime_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+// Finds the kernel's receive timestamp in the control data and counts the
+//  time since then in the rxq histogram.  The timestamp cmsg is removed,
+//  as the rest of the control data is handed back to sendmsg(), which
+//  would reject it.
+F_NONNULL
+static void take_rx_tstamp(dnspacket_context_t* pctx, struct msghdr* mh, const uint64_t now) {
+    dmn_assert(pctx); dmn_assert(mh);
+
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(mh); cmsg; cmsg = CMSG_NXTHDR(mh, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct timespec ts; // first of three, the software stamp
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            const uint64_t rx = (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+            if(rx && now >= rx)
+                stats_own_inc(&pctx->stats->lat_rxq[lat_bucket(now - rx)]);
+
+            char* ctl_end = (char*)mh->msg_control + mh->msg_controllen;
+            const struct cmsghdr* next = CMSG_NXTHDR(mh, cmsg);
+            char* next_start = next ? (char*)next : ctl_end;
+            memmove(cmsg, next_start, ctl_end - next_start);
+            mh->msg_controllen -= next_start - (char*)cmsg;
+            return;
+        }
+    }
+}
+
+#endif // USE_RX_TSTAMP
+
 F_NORETURN F_NONNULL
 static void mainloop(const int fd, dnspacket_context_t* pctx, const bool use_cmsg) {
     dmn_assert(pctx);
@@ -278,18 +331,22 @@ static void mainloop(const int fd, dnspacket_context_t* pctx, const bool use_cms
         gdnsd_prcu_rdr_online();
         if(likely(buf_in_len >= 0)) {
             asin.len = msg_hdr.msg_namelen;
+#ifdef USE_RX_TSTAMP
+            if(gconfig.udp_rx_timestamps)
+                take_rx_tstamp(pctx, &msg_hdr, realtime_ns());
+#endif
             iov.iov_len = process_dns_query(pctx, &asin, (void*)iov.iov_base, buf_in_len);
             if(likely(iov.iov_len)) {
                 const int sent = sendmsg(fd, &msg_hdr, 0);
                 if(unlikely(sent < 0)) {
                     stats_own_inc(&pctx->stats->udp.sendfail);
-                    log_err("UDP sendmsg() of %li bytes failed with retval %i for client %s: %s", (long)iov.iov_len, sent, logf_anysin(&asin), logf_errno());
+                    hotlog_err(pctx->hlog, "UDP sendmsg() of %li bytes failed with retval %i for client %s: %s", (long)iov.iov_len, sent, logf_anysin(&asin), logf_errno());
                 }
             }
         }
         else {
             stats_own_inc(&pctx->stats->udp.recvfail);
-            log_err("UDP recvmsg() error: %s", logf_errno());
+            hotlog_err(pctx->hlog, "UDP recvmsg() error: %s", logf_errno());
         }
     }
 }
@@ -323,6 +380,9 @@ static void mainloop_mmsg(const unsigned width, const int fd, dnspacket_context_
     struct mmsghdr dgrams[width];
     char cmsg_buf[width][cmsg_size];
     anysin_t asin[width];
+    unsigned lens[width];
+
+    const bool prefetch = dnspacket_batch_setup(pctx, width);
 
     /* Set up packet buffers */
     uint8_t* pbuf = mmap(NULL, max_rounded * width, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
@@ -351,7 +411,21 @@ static void mainloop_mmsg(const unsigned width, const int fd, dnspacket_context_
         if(likely(pkts > 0)) {
             for(int i = 0; i < pkts; i++) {
                 asin[i].len = dgrams[i].msg_hdr.msg_namelen;
-                iov[i][0].iov_len = process_dns_query(pctx, &asin[i], buf[i], dgrams[i].msg_len);
+                lens[i] = dgrams[i].msg_len;
+            }
+#ifdef USE_RX_TSTAMP
+            if(gconfig.udp_rx_timestamps) {
+                const uint64_t now = realtime_ns();
+                for(int i = 0; i < pkts; i++)
+                    take_rx_tstamp(pctx, &dgrams[i].msg_hdr, now);
+            }
+#endif
+            if(prefetch)
+                dnspacket_prefetch_dynaddr(pctx, (unsigned)pkts, buf, lens, asin);
+            for(int i = 0; i < pkts; i++) {
+                if(prefetch)
+                    dnspacket_prefetch_select(pctx, (unsigned)i);
+                iov[i][0].iov_len = process_dns_query(pctx, &asin[i], buf[i], lens[i]);
             }
 
             /* This block adjusts the array of mmsg entries to account for skips where
@@ -388,7 +462,7 @@ static void mainloop_mmsg(const unsigned width, const int fd, dnspacket_context_
                     (void)getsockopt(fd, SOL_SOCKET, SO_ERROR, &sockerr, &sock_len);
                     stats_own_inc(&pctx->stats->udp.sendfail);
                     if(sent < 0) sent = 0;
-                    log_err("UDP sendmmsg() of %li bytes to client %s failed: %s", dgptr[sent].msg_hdr.msg_iov[0].iov_len, logf_anysin(dgptr[sent].msg_hdr.msg_name), logf_errnum(sockerr));
+                    hotlog_err(pctx->hlog, "UDP sendmmsg() of %li bytes to client %s failed: %s", dgptr[sent].msg_hdr.msg_iov[0].iov_len, logf_anysin(dgptr[sent].msg_hdr.msg_name), logf_errnum(sockerr));
                     dgptr += sent; // skip past the successes
                     dgptr++; // skip the failed one too
                     pkts--; // drop one count for the failed message
@@ -398,7 +472,7 @@ static void mainloop_mmsg(const unsigned width, const int fd, dnspacket_context_
         }
         else {
             stats_own_inc(&pctx->stats->udp.recvfail);
-            log_err("UDP recvmmsg() error: %s", logf_errno());
+            hotlog_err(pctx->hlog, "UDP recvmmsg() error: %s", logf_errno());
         }
     }
 }
@@ -455,7 +529,8 @@ void* dnsio_udp_start(void* thread_asvoid) {
         pthread_exit(NULL);
     }
 
-    const bool need_cmsg = needs_cmsg(&addrconf->addr);
+    // receive timestamps arrive as control data too
+    const bool need_cmsg = needs_cmsg(&addrconf->addr) || gconfig.udp_rx_timestamps;
 
     gdnsd_prcu_rdr_thread_start();
     pthread_cleanup_push(thread_clean, NULL);
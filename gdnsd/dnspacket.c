@@ -23,6 +23,7 @@
 #include <stddef.h>
 #include <pthread.h>
 #include <time.h>
+#include <sys/mman.h>
 
 #include "conf.h"
 #include "dnswire.h"
@@ -31,6 +32,11 @@
 #include "gdnsd/plugapi-priv.h"
 #include "gdnsd/prcu-priv.h"
 #include "ztree.h"
+#include "statshm.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
 
 static pthread_mutex_t stats_init_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t stats_init_cond = PTHREAD_COND_INITIALIZER;
@@ -38,6 +44,11 @@ static unsigned stats_initialized = 0;
 
 dnspacket_stats_t** dnspacket_stats;
 
+const char* const qtype_bin_names[QTYPE_BINS] = {
+    "A", "NS", "CNAME", "SOA", "PTR", "MX", "TXT", "AAAA", "SRV", "NAPTR",
+    "DS", "DNSKEY", "SPF", "CAA", "IXFR", "AXFR", "ANY", "other"
+};
+
 // Allocates the array of pointers to stats structures, one per I/O thread
 // Called from main thread before I/O threads are spawned
 void dnspacket_global_setup(void) {
@@ -55,13 +66,31 @@ void dnspacket_wait_stats(void) {
     pthread_mutex_unlock(&stats_init_mutex);
 }
 
+// Each thread's stats get whole pages of their own, so that the owner's
+//  constant writes never share a cache line with anything else (such as
+//  another thread's stats, which statio reads all of).  The owner thread
+//  allocates and touches them first, so that with the default first-touch
+//  NUMA policy they also land on the owner's node.  With stats_shm, the
+//  pages come from the shared stats segment instead.
+static dnspacket_stats_t* dnspacket_stats_alloc(const unsigned this_threadnum) {
+    void* mem = statshm_thread_stats(this_threadnum);
+    if(!mem) {
+        mem = mmap(NULL, sizeof(dnspacket_stats_t), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED)
+            log_fatal("mmap() of %u bytes for stats failed: %s", (unsigned)sizeof(dnspacket_stats_t), logf_errno());
+    }
+    memset(mem, 0, sizeof(dnspacket_stats_t));
+    return mem;
+}
+
 // Called (indirectly via dnspacket_context_new) by each I/O thread to init
 //  its own stats structure, signals the above.  Also invokes the plugins'
 //  iothread_init callbacks.
 static dnspacket_stats_t* dnspacket_init_stats(unsigned int this_threadnum, const bool is_udp) {
+    dnspacket_stats_t* retval = dnspacket_stats_alloc(this_threadnum);
+
     pthread_mutex_lock(&stats_init_mutex);
-    dnspacket_stats_t* retval = dnspacket_stats[this_threadnum]
-        = calloc(1, sizeof(dnspacket_stats_t));
+    dnspacket_stats[this_threadnum] = retval;
 
     retval->is_udp = is_udp;
 
@@ -79,17 +108,35 @@ dnspacket_context_t* dnspacket_context_new(const unsigned int this_threadnum, co
 
     retval->rand_state = gdnsd_rand_init();
     retval->stats = dnspacket_init_stats(this_threadnum, is_udp);
+    retval->qlog = querylog_ring(this_threadnum);
+    retval->topn = topn_thread(this_threadnum);
+    retval->rrl = is_udp ? rrl_new() : NULL;
+    retval->hlog = hotlog_ring(this_threadnum);
     retval->is_udp = is_udp;
     retval->threadnum = this_threadnum;
     retval->addtl_rrsets = malloc(gconfig.max_addtl_rrsets * sizeof(addtl_rrset_t));
     retval->comptargets = malloc(COMPTARGETS_MAX * sizeof(comptarget_t));
     retval->dync_store = malloc(gconfig.max_cname_depth * 256);
     retval->addtl_store = malloc(gconfig.max_response);
-    retval->dynaddr = malloc(sizeof(dynaddr_result_t));
+    retval->dynaddr = retval->dynaddr_buf = malloc(sizeof(dynaddr_result_t));
 
     return retval;
 }
 
+bool dnspacket_batch_setup(dnspacket_context_t* c, const unsigned width) {
+    dmn_assert(c); dmn_assert(c->is_udp); dmn_assert(width);
+
+    if(width < 2 || !gdnsd_plugins_have_dynaddr_batch())
+        return false;
+
+    c->prefetch_width = width;
+    c->prefetch = calloc(width, sizeof(dynaddr_prefetch_t));
+    c->prefetch_resnums = malloc(width * sizeof(unsigned));
+    c->prefetch_cinfos = malloc(width * sizeof(client_info_t*));
+    c->prefetch_results = malloc(width * sizeof(dynaddr_result_t*));
+    return true;
+}
+
 F_NONNULL
 static void reset_context(dnspacket_context_t* c) {
     dmn_assert(c);
@@ -366,6 +413,8 @@ static rcode_rv_t decode_query(dnspacket_context_t* c, uint8_t* lqname, unsigned
             break;
         }
 
+        stats_own_inc(&c->stats->qtype[qtype_bin(c->qtype)]);
+
         if(DNSH_GET_OPCODE(hdr)) {
             log_debug("Non-QUERY request (NOTIMP) from %s, opcode is %u", logf_anysin(asin), (DNSH_GET_OPCODE(hdr) >> 3U));
             rcode = DECODE_NOTIMP;
@@ -711,15 +760,29 @@ static unsigned int enc_aaaa_dynamic(dnspacket_context_t* c, unsigned int offset
 // Invoke dynaddr callback for DYNA rr 'rrset', taking care of zeroing
 //   out c->dynaddr, setting up the ttl from the zonefile, and accounting
 //   for the packet's scope_mask after the callback.
+// If the batch prefetch already resolved this exact lookup for this query,
+//   its result is used instead of calling into the plugin again.
 // After invoking this function, code can assume c->dynaddr contains proper results
 F_NONNULL
 static void do_dynaddr_callback(dnspacket_context_t* c, const ltree_rrset_addr_t* rrset) {
     dmn_assert(c); dmn_assert(rrset); dmn_assert(!rrset->gen.is_static);
 
-    dynaddr_result_t* dr = c->dynaddr;
-    memset(dr, 0, sizeof(dynaddr_result_t));
-    dr->ttl = ntohl(rrset->gen.ttl);
-    rrset->dyn.func(c->threadnum, rrset->dyn.resource, &c->client_info, dr);
+    const dynaddr_result_t* dr;
+    const dynaddr_prefetch_t* pf = c->prefetch_cur;
+    if(pf && pf->batch_func && pf->func == rrset->dyn.func
+      && pf->resource == rrset->dyn.resource
+      && pf->ttl == rrset->gen.ttl) {
+        dr = &pf->result;
+        c->prefetch_cur = NULL;
+    }
+    else {
+        dynaddr_result_t* dr_buf = c->dynaddr_buf;
+        memset(dr_buf, 0, sizeof(dynaddr_result_t));
+        dr_buf->ttl = ntohl(rrset->gen.ttl);
+        rrset->dyn.func(c->threadnum, rrset->dyn.resource, &c->client_info, dr_buf);
+        dr = dr_buf;
+    }
+    c->dynaddr = dr;
     if(dr->edns_scope_mask > c->edns_client_scope_mask)
         c->edns_client_scope_mask = dr->edns_scope_mask;
 }
@@ -1649,6 +1712,8 @@ static unsigned int answer_from_db(dnspacket_context_t* c, const uint8_t* qname,
     zone_t* query_zone = ztree_find_zone_for(qname, &auth_depth);
 
     if(query_zone) { // matches auth space somewhere
+        stats_own_inc(&zstats_thread(query_zone->stats, c->threadnum)->queries);
+
         // In the initial search, it's known that "qname" is in fact the real query name and therefore
         //  uncompressed, which is what makes the simplistic c->auth_comp calculation possible.
         resauth = query_zone->root;
@@ -1709,6 +1774,8 @@ static unsigned int answer_from_db(dnspacket_context_t* c, const uint8_t* qname,
             res_hdr->flags2 = DNS_RCODE_NXDOMAIN;
             offset = encode_rr_soa(c, offset, soa, false);
             stats_own_inc(&c->stats->nxdomain);
+            stats_own_inc(&zstats_thread(query_zone->stats, c->threadnum)->nxdomain);
+            c->nxdomain_zone_hash = query_zone->hash;
         }
     }
     else if(status == DNAME_DELEG) {
@@ -1768,10 +1835,106 @@ static unsigned int answer_from_db_outer(dnspacket_context_t* c, uint8_t* qname,
     return offset;
 }
 
-unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uint8_t* packet, const unsigned int packet_len) {
-    dmn_assert(c && asin && packet);
+// Decodes a whole UDP receive batch up front, saving the results for
+//  answer_query(), and resolves, via the plugins' resolve_dynaddr_batch
+//  callbacks, the dynamic address answers of every query that directly
+//  hits a DYNA rrset (qtype A, AAAA, or ANY).  One batch call is made
+//  per plugin, rather than one resolve_dynaddr call per query.  Anything
+//  else (CNAME chains, additional-section addresses, plugins without
+//  batch support) is left to the normal per-query path.
+void dnspacket_prefetch_dynaddr(dnspacket_context_t* c, const unsigned count, uint8_t* const* packets, const unsigned* packet_lens, const anysin_t* asins) {
+    dmn_assert(c); dmn_assert(packets); dmn_assert(packet_lens); dmn_assert(asins);
+    dmn_assert(count <= c->prefetch_width);
+
+    unsigned pending = 0;
+    gdnsd_prcu_rdr_lock();
+
+    for(unsigned i = 0; i < count; i++) {
+        dynaddr_prefetch_t* pf = &c->prefetch[i];
+        pf->batch_func = NULL;
+
+        reset_context(c);
+        c->packet = packets[i];
+
+        pf->question_len = 0;
+        const rcode_rv_t status = decode_query(c, pf->lqname, &pf->question_len, packet_lens[i], &asins[i]);
+        pf->decode_status = status;
+        pf->qtype = c->qtype;
+        pf->this_max_response = c->this_max_response;
+        pf->clientsub_opt_code = c->clientsub_opt_code;
+        pf->use_edns = c->use_edns;
+        pf->use_edns_client_subnet = c->use_edns_client_subnet;
+        pf->chaos = c->chaos;
+        memcpy(&pf->client_info, &c->client_info, sizeof(client_info_t));
+
+        if(status != DECODE_OK
+          || c->chaos
+          || (c->qtype != DNS_TYPE_A && c->qtype != DNS_TYPE_AAAA && c->qtype != DNS_TYPE_ANY))
+            continue;
+
+        const uint8_t* lqname = pf->lqname;
+        unsigned auth_depth;
+        const zone_t* zone = ztree_find_zone_for(lqname, &auth_depth);
+        if(!zone)
+            continue;
+
+        const ltree_node_t* node = NULL;
+        if(search_zone_for_dname(lqname, zone, &node, &auth_depth) != DNAME_AUTH || !node)
+            continue;
+
+        const ltree_rrset_t* rrset = node->rrsets;
+        while(rrset && (rrset->gen.type != DNS_TYPE_A || rrset->gen.is_static))
+            rrset = rrset->gen.next;
+        if(!rrset)
+            continue;
+
+        const ltree_rrset_addr_t* arrset = &rrset->addr;
+        gdnsd_resolve_dynaddr_batch_cb_t batch_func
+            = gdnsd_plugins_find_dynaddr_batch(arrset->dyn.func);
+        if(!batch_func)
+            continue;
+
+        pf->func = arrset->dyn.func;
+        pf->batch_func = batch_func;
+        pf->resource = arrset->dyn.resource;
+        pf->ttl = arrset->gen.ttl;
+        pf->dispatched = false;
+        memcpy(&pf->client_info.dns_source, &asins[i], sizeof(anysin_t));
+        memset(&pf->result, 0, sizeof(dynaddr_result_t));
+        pf->result.ttl = ntohl(arrset->gen.ttl);
+        pending++;
+    }
+
+    // One batch call per distinct plugin, in order of first appearance
+    for(unsigned i = 0; pending && i < count; i++) {
+        gdnsd_resolve_dynaddr_batch_cb_t batch_func = c->prefetch[i].batch_func;
+        if(!batch_func || c->prefetch[i].dispatched)
+            continue;
+        unsigned n = 0;
+        for(unsigned j = i; j < count; j++) {
+            dynaddr_prefetch_t* pf = &c->prefetch[j];
+            if(pf->batch_func == batch_func) {
+                dmn_assert(!pf->dispatched);
+                pf->dispatched = true;
+                c->prefetch_resnums[n] = pf->resource;
+                c->prefetch_cinfos[n] = &pf->client_info;
+                c->prefetch_results[n] = &pf->result;
+                n++;
+            }
+        }
+        batch_func(c->threadnum, n, c->prefetch_resnums, c->prefetch_cinfos, c->prefetch_results);
+        pending -= n;
+    }
+
+    gdnsd_prcu_rdr_unlock();
+}
+
+F_NONNULL
+static unsigned int answer_query(dnspacket_context_t* c, const anysin_t* asin, uint8_t* packet, const unsigned int packet_len, uint8_t* lqname) {
+    dmn_assert(c && asin && packet && lqname);
 
     reset_context(c);
+    c->nxdomain_zone_hash = 0;
     c->packet = packet;
 
 /*
@@ -1785,10 +1948,30 @@ unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uin
     if(asin->sa.sa_family == AF_INET6)
         stats_own_inc(&c->stats->v6);
 
-    uint8_t lqname[256];
     unsigned question_len = 0;
-
-    const rcode_rv_t status = decode_query(c, lqname, &question_len, packet_len, asin);
+    rcode_rv_t status;
+
+    // A batch slot from dnspacket_prefetch_dynaddr() already has this
+    //  packet decoded, and only needs to be kept around for the dynaddr
+    //  result if there is one.
+    const dynaddr_prefetch_t* pf = c->prefetch_cur;
+    if(pf) {
+        status = (rcode_rv_t)pf->decode_status;
+        question_len = pf->question_len;
+        memcpy(lqname, pf->lqname, 256);
+        c->qtype = pf->qtype;
+        c->this_max_response = pf->this_max_response;
+        c->clientsub_opt_code = pf->clientsub_opt_code;
+        c->use_edns = pf->use_edns;
+        c->use_edns_client_subnet = pf->use_edns_client_subnet;
+        c->chaos = pf->chaos;
+        memcpy(&c->client_info, &pf->client_info, sizeof(client_info_t));
+        if(!pf->batch_func)
+            c->prefetch_cur = NULL;
+    }
+    else {
+        status = decode_query(c, lqname, &question_len, packet_len, asin);
+    }
 
     if(status == DECODE_IGNORE) {
         stats_own_inc(&c->stats->dropped);
@@ -1899,3 +2082,130 @@ unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uin
 
     return res_offset;
 }
+
+// Appends a record for a completed response to this thread's query log
+//   ring.  lqname and c->qtype are valid for any response we send.
+F_NONNULL
+static void log_query(dnspacket_context_t* c, const anysin_t* asin, const uint8_t* lqname, const unsigned int res_len) {
+    dmn_assert(c && asin && lqname);
+
+    qlog_rec_t* rec = querylog_reserve(c->qlog);
+    if(!rec)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec->sec = htonl((uint32_t)now.tv_sec);
+    rec->nsec = htonl((uint32_t)now.tv_nsec);
+
+    memset(rec->client, 0, 16);
+    if(asin->sa.sa_family == AF_INET6) {
+        rec->family = 6;
+        memcpy(rec->client, asin->sin6.sin6_addr.s6_addr, 16);
+        rec->client_port = asin->sin6.sin6_port;
+    }
+    else {
+        rec->family = 4;
+        memcpy(rec->client, &asin->sin.sin_addr.s_addr, 4);
+        rec->client_port = asin->sin.sin_port;
+    }
+
+    const wire_dns_header_t* hdr = (const wire_dns_header_t*)c->packet;
+    unsigned flags = 0;
+    if(!c->is_udp)
+        flags |= QLOG_FLAG_TCP;
+    if(c->use_edns)
+        flags |= QLOG_FLAG_EDNS;
+    if(hdr->flags1 & 0x2)
+        flags |= QLOG_FLAG_TC;
+    if(c->chaos)
+        flags |= QLOG_FLAG_CH;
+
+    memset(rec->ecs_client, 0, 16);
+    if(c->use_edns_client_subnet) {
+        flags |= QLOG_FLAG_ECS;
+        if(c->client_info.edns_client.sa.sa_family == AF_INET6)
+            memcpy(rec->ecs_client, c->client_info.edns_client.sin6.sin6_addr.s6_addr, 16);
+        else
+            memcpy(rec->ecs_client, &c->client_info.edns_client.sin.sin_addr.s_addr, 4);
+        rec->ecs_source = c->client_info.edns_client_mask;
+        rec->ecs_scope = c->edns_client_scope_mask;
+    }
+    else {
+        rec->ecs_source = 0;
+        rec->ecs_scope = 0;
+    }
+
+    rec->flags = flags;
+    rec->qtype = htons(c->qtype);
+    rec->rcode = hdr->flags2 & 0xF;
+    rec->resp_len = htons(res_len);
+    rec->qname_len = *lqname;
+    memcpy(rec->qname, lqname + 1, *lqname);
+    // ring slots are re-used, and the whole record is written out
+    memset(rec->qname + *lqname, 0, sizeof(rec->qname) - *lqname);
+
+    querylog_commit(c->qlog);
+}
+
+// Applies the response rate limits to a response (see rrl.h), returning
+//  its new length: the same, zero to drop it, or just the header and
+//  question for a slipped (empty, truncated) response.
+F_NONNULL
+static unsigned int rrl_response(dnspacket_context_t* c, const anysin_t* asin, const uint8_t* lqname, const unsigned int res_len, const uint64_t now) {
+    dmn_assert(c); dmn_assert(c->rrl); dmn_assert(asin); dmn_assert(lqname);
+
+    wire_dns_header_t* hdr = (wire_dns_header_t*)c->packet;
+    const unsigned rcode = DNSH_GET_RCODE(hdr);
+
+    uint32_t name_hash = 0;
+    if(rcode == DNS_RCODE_NOERROR)
+        name_hash = gdnsd_lookup2((const char*)lqname + 1, *lqname) + c->qtype;
+    else if(rcode == DNS_RCODE_NXDOMAIN)
+        name_hash = c->nxdomain_zone_hash;
+
+    const rrl_action_t action = rrl_check(c->rrl, asin, rcode, name_hash, now);
+    if(likely(action == RRL_PASS))
+        return res_len;
+
+    stats_own_inc(&c->stats->udp.rrl_limited);
+    if(action == RRL_DROP)
+        return 0;
+
+    stats_own_inc(&c->stats->udp.rrl_slipped);
+    hdr->flags1 |= 0x2; // TC bit
+    gdnsd_put_una16(0, &hdr->ancount);
+    gdnsd_put_una16(0, &hdr->nscount);
+    gdnsd_put_una16(0, &hdr->arcount);
+    if(!DNSH_GET_QDCOUNT(hdr))
+        return sizeof(wire_dns_header_t);
+    return sizeof(wire_dns_header_t) + *lqname + 4U;
+}
+
+unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uint8_t* packet, const unsigned int packet_len) {
+    dmn_assert(c && asin && packet);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint8_t lqname[256];
+    unsigned int res_len = answer_query(c, asin, packet, packet_len, lqname);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const uint64_t ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000U
+        + (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+    stats_own_inc(&c->stats->lat_proc[lat_bucket(ns)]);
+
+    // no response (and possibly no question) for ignored requests
+    if(res_len) {
+        if(c->topn)
+            topn_record(c->topn, lqname, asin);
+        if(c->rrl)
+            res_len = rrl_response(c, asin, lqname, res_len,
+                ((uint64_t)end.tv_sec * 1000000000U) + (uint64_t)end.tv_nsec);
+        if(c->qlog && res_len)
+            log_query(c, asin, lqname, res_len);
+    }
+
+    return res_len;
+}
@@ -22,10 +22,108 @@
 
 #include "config.h"
 #include "ltree.h"
+#include "querylog.h"
+#include "topn.h"
+#include "rrl.h"
+#include "hotlog.h"
 #include "gdnsd/misc.h"
 
 #define COMPTARGETS_MAX 256
 
+// Latency histograms are log-linear over nanoseconds: values below
+//  2^LAT_SUB_BITS get a bucket each, and above that every power-of-two
+//  range is split into 2^LAT_SUB_BITS equal buckets (so each bucket is
+//  within 12.5% of its values).  Everything from 2^(LAT_MAX_MSB+1)ns
+//  (~8.6s) up lands in the last bucket.
+#define LAT_SUB_BITS 3U
+#define LAT_MAX_MSB 32U
+#define LAT_BUCKETS (((LAT_MAX_MSB - LAT_SUB_BITS + 2U) << LAT_SUB_BITS))
+
+// Index of the most significant set bit, "x" must be non-zero
+#ifdef HAVE_BUILTIN_CLZ
+#  define lat_msb64(_x) (63U - (unsigned)__builtin_clzll(_x))
+#else
+F_CONST
+static inline unsigned lat_msb64(uint64_t x) {
+    unsigned msb = 0;
+    while(x >>= 1U)
+        msb++;
+    return msb;
+}
+#endif
+
+F_CONST
+static inline unsigned lat_bucket(const uint64_t ns) {
+    if(ns < (1U << LAT_SUB_BITS))
+        return (unsigned)ns;
+    const unsigned msb = lat_msb64(ns);
+    if(msb > LAT_MAX_MSB)
+        return LAT_BUCKETS - 1U;
+    return ((msb - LAT_SUB_BITS + 1U) << LAT_SUB_BITS)
+        | ((unsigned)(ns >> (msb - LAT_SUB_BITS)) & ((1U << LAT_SUB_BITS) - 1U));
+}
+
+// The largest value (in ns) counted in a given bucket
+F_CONST
+static inline uint64_t lat_bucket_max(const unsigned idx) {
+    if(idx < (1U << LAT_SUB_BITS))
+        return idx;
+    const unsigned shift = (idx >> LAT_SUB_BITS) - 1U;
+    const uint64_t base = (uint64_t)((1U << LAT_SUB_BITS) | (idx & ((1U << LAT_SUB_BITS) - 1U))) << shift;
+    return base + (1ULL << shift) - 1U;
+}
+
+// Query types counted separately in dnspacket_stats_t.qtype[],
+//  indexed by qtype_bin().  Everything else is QTYPE_BIN_OTHER.
+typedef enum {
+    QTYPE_BIN_A = 0,
+    QTYPE_BIN_NS,
+    QTYPE_BIN_CNAME,
+    QTYPE_BIN_SOA,
+    QTYPE_BIN_PTR,
+    QTYPE_BIN_MX,
+    QTYPE_BIN_TXT,
+    QTYPE_BIN_AAAA,
+    QTYPE_BIN_SRV,
+    QTYPE_BIN_NAPTR,
+    QTYPE_BIN_DS,
+    QTYPE_BIN_DNSKEY,
+    QTYPE_BIN_SPF,
+    QTYPE_BIN_CAA,
+    QTYPE_BIN_IXFR,
+    QTYPE_BIN_AXFR,
+    QTYPE_BIN_ANY,
+    QTYPE_BIN_OTHER,
+    QTYPE_BINS
+} qtype_bin_t;
+
+// The names of the above, for output
+extern const char* const qtype_bin_names[QTYPE_BINS];
+
+F_CONST
+static inline qtype_bin_t qtype_bin(const unsigned qtype) {
+    switch(qtype) {
+        case DNS_TYPE_A:      return QTYPE_BIN_A;
+        case DNS_TYPE_NS:     return QTYPE_BIN_NS;
+        case DNS_TYPE_CNAME:  return QTYPE_BIN_CNAME;
+        case DNS_TYPE_SOA:    return QTYPE_BIN_SOA;
+        case DNS_TYPE_PTR:    return QTYPE_BIN_PTR;
+        case DNS_TYPE_MX:     return QTYPE_BIN_MX;
+        case DNS_TYPE_TXT:    return QTYPE_BIN_TXT;
+        case DNS_TYPE_AAAA:   return QTYPE_BIN_AAAA;
+        case DNS_TYPE_SRV:    return QTYPE_BIN_SRV;
+        case DNS_TYPE_NAPTR:  return QTYPE_BIN_NAPTR;
+        case DNS_TYPE_DS:     return QTYPE_BIN_DS;
+        case DNS_TYPE_DNSKEY: return QTYPE_BIN_DNSKEY;
+        case DNS_TYPE_SPF:    return QTYPE_BIN_SPF;
+        case DNS_TYPE_CAA:    return QTYPE_BIN_CAA;
+        case DNS_TYPE_IXFR:   return QTYPE_BIN_IXFR;
+        case DNS_TYPE_AXFR:   return QTYPE_BIN_AXFR;
+        case DNS_TYPE_ANY:    return QTYPE_BIN_ANY;
+        default:              return QTYPE_BIN_OTHER;
+    }
+}
+
 // dnspacket-layer statistics, per-thread
 typedef struct {
   bool is_udp;
@@ -38,6 +136,8 @@ typedef struct {
       stats_t tc;
       stats_t edns_big;
       stats_t edns_tc;
+      stats_t rrl_limited; // responses over the rate limit, dropped or slipped
+      stats_t rrl_slipped; // ... which were sent as empty TC responses
     } udp;
     struct { // TCP stats
       stats_t recvfail;
@@ -67,6 +167,17 @@ typedef struct {
 
   // A percentage of "edns" above:
   stats_t edns_clientsub;
+
+  // Requests by query type, indexed by qtype_bin().  Every request
+  //  with a parseable question is counted, whatever its response.
+  stats_t qtype[QTYPE_BINS];
+
+  // Latency histograms, indexed by lat_bucket().  "proc" is the time
+  //  spent in process_dns_query(), "rxq" (UDP only, and only with
+  //  udp_rx_timestamps) is the time from the kernel's receive timestamp
+  //  until the packet was read from the socket.
+  stats_t lat_proc[LAT_BUCKETS];
+  stats_t lat_rxq[LAT_BUCKETS];
 } dnspacket_stats_t;
 
 typedef struct {
@@ -81,6 +192,34 @@ typedef struct {
     unsigned prev_arcount; // c->arcount before this rrset was added
 } addtl_rrset_t;
 
+// One slot per packet of a UDP receive batch, filled in by
+//  dnspacket_prefetch_dynaddr().  Every packet is decoded there, and
+//  answer_query() picks up the decoded question from here rather than
+//  decoding it again.  If the packet's answer is a DYNA rrset whose
+//  plugin implements resolve_dynaddr_batch, batch_func is set and
+//  func/resource/ttl identify what was resolved, so that
+//  do_dynaddr_callback() only uses "result" for exactly the same lookup.
+typedef struct {
+    // decode_query() results for the packet
+    int decode_status;
+    unsigned question_len;
+    unsigned qtype;
+    unsigned this_max_response;
+    unsigned clientsub_opt_code;
+    bool use_edns;
+    bool use_edns_client_subnet;
+    bool chaos;
+    uint8_t lqname[256];
+    client_info_t client_info;
+
+    gdnsd_resolve_dynaddr_cb_t func;
+    gdnsd_resolve_dynaddr_batch_cb_t batch_func; // NULL if nothing to prefetch
+    unsigned resource;
+    uint32_t ttl; // network order, as in the rrset
+    bool dispatched; // already handed to batch_func
+    dynaddr_result_t result;
+} dynaddr_prefetch_t;
+
 // DNS request context.  You must have a unique
 //  one of these for each thread that might call
 //  into process_dns_query().
@@ -112,6 +251,22 @@ typedef struct {
     // stats...
     dnspacket_stats_t* stats;
 
+    // this thread's query log ring, NULL if the query log is disabled
+    qlog_ring_t* qlog;
+
+    // heavy-hitter sketches, NULL if disabled
+    topn_thread_t* topn;
+
+    // for logging from the I/O thread's per-request paths
+    hotlog_ring_t* hlog;
+
+    // response rate limits, NULL if disabled or not UDP
+    rrl_t* rrl;
+
+    // For NXDOMAIN responses, the hash of the zone's name (for RRL).
+    //  answer_query() zeroes it for each request.
+    unsigned nxdomain_zone_hash;
+
     // used to pseudo-randomly rotate some RRsets (A, AAAA, NS, PTR)
     gdnsd_rstate_t* rand_state;
 
@@ -126,7 +281,20 @@ typedef struct {
     uint8_t* packet;
 
     // allocated at startup, memset to zero before each callback
-    dynaddr_result_t* dynaddr;
+    dynaddr_result_t* dynaddr_buf;
+
+    // points at dynaddr_buf, or at a prefetched result (see below)
+    const dynaddr_result_t* dynaddr;
+
+    // Batched dynaddr prefetch, only allocated by
+    //  dnspacket_batch_setup() for UDP recvmmsg() threads when
+    //  some plugin supports resolve_dynaddr_batch.
+    unsigned prefetch_width;
+    dynaddr_prefetch_t* prefetch;
+    const dynaddr_prefetch_t* prefetch_cur; // slot for current query, or NULL
+    unsigned* prefetch_resnums;
+    const client_info_t** prefetch_cinfos;
+    dynaddr_result_t** prefetch_results;
 
 // From this point (answer_addr_rrset) on, all of this gets reset to zero
 //  at the start of each request...
@@ -171,6 +339,23 @@ typedef struct {
 F_NONNULL
 unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uint8_t* packet, const unsigned int packet_len);
 
+// Called by UDP threads which process packets in batches of up to
+//  "width".  Returns true if batched dynaddr prefetch is in use, in
+//  which case each batch should be passed to dnspacket_prefetch_dynaddr()
+//  before the individual process_dns_query() calls, and each of those
+//  preceded by dnspacket_prefetch_select() for the matching index.
+F_NONNULL
+bool dnspacket_batch_setup(dnspacket_context_t* c, const unsigned width);
+
+F_NONNULL
+void dnspacket_prefetch_dynaddr(dnspacket_context_t* c, const unsigned count, uint8_t* const* packets, const unsigned* packet_lens, const anysin_t* asins);
+
+F_NONNULL
+static inline void dnspacket_prefetch_select(dnspacket_context_t* c, const unsigned idx) {
+    dmn_assert(idx < c->prefetch_width);
+    c->prefetch_cur = &c->prefetch[idx];
+}
+
 F_MALLOC F_WUNUSED
 dnspacket_context_t* dnspacket_context_new(const unsigned int this_threadnum, const bool is_udp);
 
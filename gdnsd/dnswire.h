@@ -118,10 +118,13 @@ typedef struct S_PACKED {
 #define DNS_TYPE_SRV	33
 #define DNS_TYPE_NAPTR	35
 #define DNS_TYPE_OPT	41
+#define DNS_TYPE_DS	43
+#define DNS_TYPE_DNSKEY	48
 #define DNS_TYPE_SPF	99
 #define DNS_TYPE_IXFR   251
 #define DNS_TYPE_AXFR   252
 #define DNS_TYPE_ANY    255
+#define DNS_TYPE_CAA    257
 
 #define DNS_CLASS_IN	1
 #define DNS_CLASS_ANY	255
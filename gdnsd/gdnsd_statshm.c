@@ -0,0 +1,148 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Reads the daemon's stats_shm segment, and prints one "name value" line
+//  per counter (summed over threads, or per-thread with -t) and one
+//  "service name state" line per monitored service.  This is also meant
+//  as a reference for other readers of the segment; see statshm.h.
+
+#include "config.h"
+
+#define STATSHM_READER
+#include "statshm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static const char* const proto_txt[] = { "all", "udp", "tcp", "tls" };
+static const char* const state_txt[] = { "UNINIT", "DOWN", "DANGER", "UP" };
+
+static const char* base;
+static const statshm_hdr_t* hdr;
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [-t] <stats_shm path>\n"
+        "  -t  Output per-thread counters instead of totals\n", argv0);
+    exit(2);
+}
+
+static uint64_t read_counter(const char* p) {
+    if(hdr->word_size == 8)
+        return *(const volatile uint64_t*)p;
+    return *(const volatile uint32_t*)p;
+}
+
+static bool thread_has(const unsigned thread, const statshm_field_t* f) {
+    const statshm_thread_t* t = (const statshm_thread_t*)(base + hdr->threads_offset) + thread;
+    if(f->proto == STATSHM_PROTO_ALL)
+        return true;
+    if(f->proto == STATSHM_PROTO_TCP)
+        return t->proto == STATSHM_PROTO_TCP || t->proto == STATSHM_PROTO_TLS;
+    return t->proto == f->proto;
+}
+
+// Histograms are reported as their total count
+static uint64_t field_value(const unsigned thread, const statshm_field_t* f) {
+    const char* p = base + hdr->stats_offset + ((size_t)thread * hdr->thread_stride) + f->offset;
+    uint64_t v = 0;
+    for(unsigned i = 0; i < f->count; i++)
+        v += read_counter(p + (i * hdr->word_size));
+    return v;
+}
+
+int main(int argc, char* argv[]) {
+    bool per_thread = false;
+    int opt;
+    while((opt = getopt(argc, argv, "t")) != -1) {
+        if(opt == 't')
+            per_thread = true;
+        else
+            usage(argv[0]);
+    }
+    if(optind != argc - 1)
+        usage(argv[0]);
+    const char* path = argv[optind];
+
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "Cannot open '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+    if((size_t)st.st_size < sizeof(statshm_hdr_t)) {
+        fprintf(stderr, "'%s' is not a gdnsd stats segment\n", path);
+        return 1;
+    }
+    void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(mem == MAP_FAILED) {
+        fprintf(stderr, "Cannot mmap '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+    close(fd);
+    base = mem;
+    hdr = mem;
+
+    if(memcmp(hdr->magic, STATSHM_MAGIC, 8) || hdr->version != STATSHM_VERSION
+        || (hdr->word_size != 4 && hdr->word_size != 8)
+        || hdr->total_size > (uint64_t)st.st_size) {
+        fprintf(stderr, "'%s' is not a gdnsd stats segment of a version we understand\n", path);
+        return 1;
+    }
+
+    const time_t now = time(NULL);
+    printf("pid %" PRIu64 "\n", hdr->pid);
+    printf("uptime %" PRIu64 "\n", hdr->heartbeat - hdr->start_time);
+    printf("heartbeat_age %" PRIi64 "\n", (int64_t)now - (int64_t)hdr->heartbeat);
+
+    const statshm_field_t* fields = (const statshm_field_t*)(base + hdr->fields_offset);
+    for(unsigned f = 0; f < hdr->num_fields; f++) {
+        const char* suffix = fields[f].count > 1 ? "_count" : "";
+        if(per_thread) {
+            for(unsigned t = 0; t < hdr->num_threads; t++) {
+                if(!thread_has(t, &fields[f]))
+                    continue;
+                const statshm_thread_t* th = (const statshm_thread_t*)(base + hdr->threads_offset) + t;
+                printf("%s%s{thread=%u,proto=%s} %" PRIu64 "\n", fields[f].name, suffix,
+                    t, proto_txt[th->proto & 3U], field_value(t, &fields[f]));
+            }
+        }
+        else {
+            uint64_t total = 0;
+            for(unsigned t = 0; t < hdr->num_threads; t++)
+                if(thread_has(t, &fields[f]))
+                    total += field_value(t, &fields[f]);
+            printf("%s%s %" PRIu64 "\n", fields[f].name, suffix, total);
+        }
+    }
+
+    const statshm_mon_t* mons = (const statshm_mon_t*)(base + hdr->mons_offset);
+    for(unsigned m = 0; m < hdr->num_mons; m++)
+        printf("service %s %s\n", base + mons[m].desc_offset,
+            state_txt[mons[m].state & 3U]);
+
+    return 0;
+}
@@ -0,0 +1,312 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "hotlog.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "conf.h"
+#include "gdnsd/stats.h"
+
+// As in querylog.c, the producer and consumer halves of a ring are kept
+//   on separate cache lines.
+#define HOTLOG_CACHELINE 64U
+
+// Per-thread ring size (a power of two), and max formatted message length
+#define HOTLOG_RING_SIZE 64U
+#define HOTLOG_MSG_MAX 256U
+
+// Distinct message sites.  Should there ever be more sites than this,
+//   the extras share the last slot's rate limit.
+#define HOTLOG_MAX_SITES 32U
+
+// How long the logging thread sleeps when it finds all rings empty
+#define HOTLOG_IDLE_NSEC 50000000L
+
+// Interval for reporting repeat and suppression counts
+#define HOTLOG_REPORT_SECS HOTLOG_SITE_SECS
+
+typedef struct {
+    unsigned site; // index into the sites arrays
+    int level;
+    char text[HOTLOG_MSG_MAX];
+} hotlog_rec_t;
+
+// A site's rate limit state, per ring
+typedef struct {
+    time_t window; // start of the current HOTLOG_SITE_SECS window
+    unsigned sent; // messages admitted in this window
+    stats_t suppressed;
+} hotlog_limit_t;
+
+struct hotlog_ring {
+    // Written only by the owning I/O thread
+    hotlog_rec_t slots[HOTLOG_RING_SIZE];
+    hotlog_limit_t limits[HOTLOG_MAX_SITES];
+    unsigned head;       // count of records ever published
+    unsigned tail_cache; // producer's last-seen copy of tail
+    // Written only by the logging thread
+    unsigned tail __attribute__((__aligned__(HOTLOG_CACHELINE)));
+};
+
+// The logging thread's view of each site, for coalescing and reporting
+typedef struct {
+    char text[HOTLOG_MSG_MAX]; // last message logged
+    int level;
+    unsigned repeats;          // identical messages since, not yet reported
+    stats_uint_t suppressed;   // suppressed count already reported
+} hotlog_out_t;
+
+static hotlog_ring_t** rings = NULL;
+static unsigned num_rings = 0;
+static unsigned next_site_id = 0;
+static hotlog_out_t outs[HOTLOG_MAX_SITES];
+
+static pthread_t writer_threadid;
+static bool writer_started = false;
+static bool writer_stopping = false;
+
+hotlog_ring_t* hotlog_ring(const unsigned threadnum) {
+    return rings ? rings[threadnum] : NULL;
+}
+
+// Site ids are 1-based so that zero means unassigned.  Racing first
+//   uses from two threads may waste an id, which is harmless.
+F_NONNULL
+static unsigned site_index(hotlog_site_t* site) {
+    dmn_assert(site);
+
+    unsigned id = *(volatile unsigned*)&site->id;
+    if(unlikely(!id)) {
+        id = __sync_add_and_fetch(&next_site_id, 1U);
+        if(id > HOTLOG_MAX_SITES)
+            id = HOTLOG_MAX_SITES;
+        const unsigned prev = __sync_val_compare_and_swap(&site->id, 0U, id);
+        if(prev)
+            id = prev;
+    }
+    return id - 1U;
+}
+
+bool hotlog_admit(hotlog_ring_t* ring, hotlog_site_t* site) {
+    dmn_assert(site);
+
+    if(!ring)
+        return true;
+
+    const int saved_errno = errno;
+    hotlog_limit_t* lim = &ring->limits[site_index(site)];
+    bool rv = false;
+
+    const time_t now = time(NULL);
+    if(now - lim->window >= HOTLOG_SITE_SECS) {
+        lim->window = now;
+        lim->sent = 0;
+    }
+
+    if(lim->sent < HOTLOG_SITE_MSGS) {
+        const unsigned head = ring->head;
+        if(head - ring->tail_cache >= HOTLOG_RING_SIZE)
+            ring->tail_cache = *(volatile unsigned*)&ring->tail;
+        if(head - ring->tail_cache < HOTLOG_RING_SIZE) {
+            // the writer is done reading the slot we're about to reuse
+            __sync_synchronize();
+            lim->sent++;
+            rv = true;
+        }
+    }
+
+    if(!rv)
+        stats_own_inc(&lim->suppressed);
+
+    errno = saved_errno;
+    return rv;
+}
+
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+void hotlog_msg(hotlog_ring_t* ring, const hotlog_site_t* site, const char* fmt, ...) {
+    dmn_assert(site); dmn_assert(fmt);
+
+    va_list ap;
+    va_start(ap, fmt);
+
+    if(!ring) {
+        dmn_loggerv(site->level, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    hotlog_rec_t* rec = &ring->slots[ring->head & (HOTLOG_RING_SIZE - 1U)];
+    rec->site = site->id - 1U;
+    rec->level = site->level;
+    vsnprintf(rec->text, HOTLOG_MSG_MAX, fmt, ap);
+    va_end(ap);
+
+    // the arguments may have used logf_*() formatters
+    dmn_fmtbuf_reset();
+
+    // record contents must be visible before the new head
+    __sync_synchronize();
+    *(volatile unsigned*)&ring->head = ring->head + 1U;
+}
+
+static stats_uint_t site_suppressed(const unsigned idx) {
+    stats_uint_t total = 0;
+    for(unsigned i = 0; i < num_rings; i++)
+        total += stats_get(&rings[i]->limits[idx].suppressed);
+    return total;
+}
+
+// Reports any coalesced repeats and new suppressions for a site
+static void report_site(const unsigned idx) {
+    hotlog_out_t* out = &outs[idx];
+
+    if(out->repeats) {
+        dmn_logger(out->level, "%s (repeated %u more times)", out->text, out->repeats);
+        out->repeats = 0;
+    }
+
+    const stats_uint_t suppressed = site_suppressed(idx);
+    if(suppressed != out->suppressed) {
+        if(out->text[0])
+            dmn_logger(out->level, "%s (%" PRIuPTR " similar messages suppressed)", out->text, suppressed - out->suppressed);
+        else
+            dmn_logger(LOG_WARNING, "%" PRIuPTR " messages from the DNS threads suppressed", suppressed - out->suppressed);
+        out->suppressed = suppressed;
+    }
+}
+
+F_NONNULL
+static void emit(const hotlog_rec_t* rec) {
+    dmn_assert(rec);
+
+    hotlog_out_t* out = &outs[rec->site];
+    if(out->level == rec->level && !strcmp(out->text, rec->text)) {
+        out->repeats++;
+        return;
+    }
+
+    if(out->repeats) {
+        dmn_logger(out->level, "%s (repeated %u more times)", out->text, out->repeats);
+        out->repeats = 0;
+    }
+    memcpy(out->text, rec->text, HOTLOG_MSG_MAX);
+    out->level = rec->level;
+    dmn_logger(rec->level, "%s", rec->text);
+}
+
+// Logs everything in one ring, returns true if there was anything in it
+F_NONNULL
+static bool drain_ring(hotlog_ring_t* ring) {
+    dmn_assert(ring);
+
+    const unsigned head = *(volatile unsigned*)&ring->head;
+    unsigned tail = ring->tail;
+    if(head == tail)
+        return false;
+
+    // see the record contents published along with head
+    __sync_synchronize();
+
+    while(tail != head) {
+        emit(&ring->slots[tail & (HOTLOG_RING_SIZE - 1U)]);
+        tail++;
+        // done with this slot, hand it back to the producer
+        __sync_synchronize();
+        *(volatile unsigned*)&ring->tail = tail;
+    }
+
+    return true;
+}
+
+static void* hotlog_writer(void* unused V_UNUSED) {
+    const struct timespec idle = { 0, HOTLOG_IDLE_NSEC };
+    time_t next_report = time(NULL) + HOTLOG_REPORT_SECS;
+
+    while(1) {
+        // sample the flag first, so that the last pass below
+        //   happens entirely after hotlog_stop() was called.
+        const bool last_pass = *(volatile bool*)&writer_stopping;
+        __sync_synchronize();
+
+        bool busy = false;
+        for(unsigned i = 0; i < num_rings; i++)
+            if(drain_ring(rings[i]))
+                busy = true;
+
+        const time_t now = time(NULL);
+        if(last_pass || now >= next_report) {
+            for(unsigned i = 0; i < HOTLOG_MAX_SITES; i++)
+                report_site(i);
+            next_report = now + HOTLOG_REPORT_SECS;
+        }
+
+        if(last_pass)
+            break;
+
+        if(!busy)
+            nanosleep(&idle, NULL);
+    }
+
+    return NULL;
+}
+
+void hotlog_init(void) {
+    num_rings = gconfig.num_dns_threads;
+    rings = malloc(num_rings * sizeof(hotlog_ring_t*));
+    for(unsigned i = 0; i < num_rings; i++) {
+        void* mem = NULL;
+        const int pm_err = posix_memalign(&mem, HOTLOG_CACHELINE, sizeof(hotlog_ring_t));
+        if(pm_err)
+            log_fatal("posix_memalign() failed: %s", logf_errnum(pm_err));
+        memset(mem, 0, sizeof(hotlog_ring_t));
+        rings[i] = mem;
+    }
+}
+
+void hotlog_start(void) {
+    if(!rings)
+        return;
+
+    // As with the other threads, the caller has all signals blocked
+    int pthread_err = pthread_create(&writer_threadid, NULL, hotlog_writer, NULL);
+    if(pthread_err)
+        log_fatal("pthread_create() of DNS thread logging thread failed: %s", logf_errnum(pthread_err));
+    writer_started = true;
+}
+
+void hotlog_stop(void) {
+    if(!writer_started)
+        return;
+
+    __sync_synchronize();
+    *(volatile bool*)&writer_stopping = true;
+    int pthread_err = pthread_join(writer_threadid, NULL);
+    if(pthread_err)
+        log_err("pthread_join() of DNS thread logging thread failed: %s", logf_errnum(pthread_err));
+    writer_started = false;
+}
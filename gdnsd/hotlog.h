@@ -0,0 +1,100 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDNSD_HOTLOG_H
+#define GDNSD_HOTLOG_H
+
+#include "config.h"
+#include "gdnsd/compiler.h"
+#include "gdnsd/log.h"
+
+#include <stdbool.h>
+
+/*
+ * Logging for the DNS I/O threads' per-request error paths (failed
+ *   sends and receives, accept() errors, etc), which can fire on every
+ *   packet during a flood.  Rather than calling syslog() inline, each
+ *   message is formatted into the thread's own single-producer ring, and
+ *   a dedicated thread passes them on to the normal log functions.  Each
+ *   message site is limited to HOTLOG_SITE_MSGS messages per thread every
+ *   HOTLOG_SITE_SECS seconds, which is checked before any formatting is
+ *   done.  The logging thread also coalesces repeats of identical text
+ *   from the same site, and periodically reports the counts of both.
+ *   Nothing here ever blocks the I/O thread: when its ring is full, the
+ *   message is counted as suppressed instead.
+ *
+ * Each call site has its own static hotlog_site_t, so use the macros
+ *   below rather than hotlog_msg() directly.  A NULL ring (before
+ *   hotlog_init(), or for threads without one) logs synchronously.
+ */
+
+#define HOTLOG_SITE_MSGS 10U
+#define HOTLOG_SITE_SECS 10
+
+typedef struct hotlog_ring hotlog_ring_t;
+
+typedef struct {
+    const int level;
+    unsigned id; // assigned on first use, owned by hotlog.c
+} hotlog_site_t;
+
+// Allocates a ring per DNS thread, before the DNS threads start.
+void hotlog_init(void);
+
+// Starts and stops the logging thread.  hotlog_stop() does a final
+//   drain, and should be called after the DNS threads have exited.
+void hotlog_start(void);
+void hotlog_stop(void);
+
+// Returns the ring for the given DNS thread number, or NULL before
+//   hotlog_init().
+F_PURE F_WUNUSED
+hotlog_ring_t* hotlog_ring(const unsigned threadnum);
+
+// hotlog_admit() applies the site's rate limit and reserves ring space
+//   for the message, counting it as suppressed if either fails, before
+//   the arguments are ever evaluated.  It preserves errno for them.
+//   hotlog_msg() then formats the message into the reserved space.
+F_NONNULLX(2) F_WUNUSED
+bool hotlog_admit(hotlog_ring_t* ring, hotlog_site_t* site);
+F_NONNULLX(2, 3) DMN_F_PRINTF(3, 4)
+void hotlog_msg(hotlog_ring_t* ring, const hotlog_site_t* site, const char* fmt, ...);
+
+#define hotlog_site_(_ring, _level, ...) do {\
+    static hotlog_site_t hotlog_site_ = { _level, 0 };\
+    hotlog_ring_t* hotlog_ring_ = (_ring);\
+    if(hotlog_admit(hotlog_ring_, &hotlog_site_))\
+        hotlog_msg(hotlog_ring_, &hotlog_site_, __VA_ARGS__);\
+} while(0)
+
+#define hotlog_err(_ring, ...) hotlog_site_(_ring, LOG_ERR, __VA_ARGS__)
+#define hotlog_warn(_ring, ...) hotlog_site_(_ring, LOG_WARNING, __VA_ARGS__)
+
+// As with log_debug(), a no-op unless built without NDEBUG and
+//   running in debug mode.
+#ifdef NDEBUG
+#  define hotlog_debug(_ring, ...) ((void)(0))
+#else
+#  define hotlog_debug(_ring, ...) do {\
+     if(dmn_get_debug())\
+         hotlog_site_(_ring, LOG_DEBUG, __VA_ARGS__);\
+     } while(0)
+#endif
+
+#endif // GDNSD_HOTLOG_H
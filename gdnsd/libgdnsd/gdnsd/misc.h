@@ -33,7 +33,9 @@ char* gdnsd_str_combine(const char* s1, const char* s2, const char** s2_offs);
 
 // PRNG:
 // gdnsd_rand_init() allocates an opaque PRNG state which can
-//   be later free()'d when no longer required.
+//   be later free()'d when no longer required.  Each state is
+//   cache-line aligned and padded, so per-thread states never
+//   false-share.
 typedef struct _gdnsd_rstate_t gdnsd_rstate_t;
 gdnsd_rstate_t* gdnsd_rand_init(void);
 
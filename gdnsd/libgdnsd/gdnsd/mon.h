@@ -93,4 +93,27 @@ typedef struct {
 F_NONNULL
 void gdnsd_mon_state_updater(mon_smgr_t* smgr, const bool latest);
 
+// Generation number for the whole set of monitored states.  It is
+//   bumped by gdnsd_mon_state_updater() (in the monitoring thread)
+//   whenever any monitored state actually changes, and is never zero.
+// Resolver plugins can keep per-thread results precomputed from
+//   mon_state_t values and only rebuild them when this changes, via
+//   gdnsd_mon_gen_stale() below.
+extern stats_t gdnsd_mon_gen;
+
+// Returns false if "*cached_gen" is still current.  Otherwise updates
+//   it and returns true, and the caller must rebuild whatever it was
+//   caching from the current mon_state_t values.  A zero-initialized
+//   *cached_gen is always stale.
+F_NONNULL
+static inline bool gdnsd_mon_gen_stale(stats_uint_t* cached_gen) {
+    dmn_assert(cached_gen);
+    const stats_uint_t gen = stats_get(&gdnsd_mon_gen);
+    if(likely(*cached_gen == gen))
+        return false;
+    __sync_synchronize(); // pairs with gdnsd_mon_state_updater()
+    *cached_gen = gen;
+    return true;
+}
+
 #endif // GDNSD_MON_H
@@ -0,0 +1,92 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDNSD_MONTIMER_H
+#define GDNSD_MONTIMER_H
+
+#include <gdnsd/compiler.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <ev.h>
+
+/*
+ * Timers for monitoring plugins, for the per-monitor interval and timeout
+ *   timers that would otherwise each be a separate ev_timer.  All of them
+ *   live in one hierarchical timing wheel, driven by a single ev_timer
+ *   ticking every GDNSD_MON_TICK seconds while any are active, so that
+ *   starting, stopping, and firing are O(1) regardless of the number of
+ *   monitors.  Expiry times have a resolution of one tick.
+ *
+ * The wheel belongs to the first loop it's used with, and like the rest
+ *   of libev, is not thread-safe.  Since it only holds a reference on that
+ *   loop while timers are active, the monitoring startup code's pattern of
+ *   running the loop until it runs out of events still works.
+ */
+
+#define GDNSD_MON_TICK 0.02
+
+typedef struct gdnsd_mon_timer gdnsd_mon_timer_t;
+typedef void (*gdnsd_mon_timer_cb_t)(struct ev_loop* loop, gdnsd_mon_timer_t* t);
+
+struct gdnsd_mon_timer {
+    // private to the implementation
+    gdnsd_mon_timer_t* next;
+    gdnsd_mon_timer_t** pprev; // NULL when inactive
+    uint64_t expire;           // in ticks
+    uint64_t repeat;           // in ticks, zero for one-shot timers
+    // set by gdnsd_mon_timer_init()
+    gdnsd_mon_timer_cb_t cb;
+    void* data;
+};
+
+F_NONNULLX(1, 2)
+void gdnsd_mon_timer_init(gdnsd_mon_timer_t* t, gdnsd_mon_timer_cb_t cb, void* data);
+
+// Starts (or restarts) the timer to fire "after" seconds from now, and
+//   then every "repeat" seconds after that if "repeat" is non-zero.
+//   Repeats are scheduled from the previous expiry rather than from the
+//   callback, so they don't drift.
+F_NONNULL
+void gdnsd_mon_timer_start(struct ev_loop* loop, gdnsd_mon_timer_t* t, const double after, const double repeat);
+
+// Stops the timer if it's active, which is safe from any callback.
+F_NONNULL
+void gdnsd_mon_timer_stop(gdnsd_mon_timer_t* t);
+
+F_NONNULL F_PURE
+static inline bool gdnsd_mon_timer_active(const gdnsd_mon_timer_t* t) {
+    return t->pprev != NULL;
+}
+
+// Deterministic per-monitor jitter in [0, 1), from a hash of a string
+//   which identifies the monitor (e.g. mon_smgr_t.desc), so that a given
+//   monitor is always checked at the same point within its interval.
+F_NONNULL F_PURE
+double gdnsd_mon_jitter(const char* desc);
+
+// For spreading out the initial round of checks at startup: the window
+//   (in seconds) to spread "num_mons" initial checks over, so that no more
+//   than GDNSD_MON_INIT_RATE of them start per second, or "interval" if
+//   that's smaller.
+#define GDNSD_MON_INIT_RATE 10000U
+F_CONST
+double gdnsd_mon_init_spread(const unsigned num_mons, const unsigned interval);
+
+#endif // GDNSD_MONTIMER_H
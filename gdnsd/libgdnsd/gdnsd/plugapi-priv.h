@@ -34,6 +34,13 @@ const plugin_t* gdnsd_plugin_load(const char* pname);
 F_NONNULL
 const plugin_t* gdnsd_plugin_find_or_load(const char* pname);
 
+// Batched dynaddr support, for dnspacket.c.  The first returns
+//   NULL if the plugin owning "func" has no batch callback.
+F_NONNULL F_PURE
+gdnsd_resolve_dynaddr_batch_cb_t gdnsd_plugins_find_dynaddr_batch(gdnsd_resolve_dynaddr_cb_t func);
+F_PURE
+bool gdnsd_plugins_have_dynaddr_batch(void);
+
 // action iterators
 void gdnsd_plugins_action_full_config(const unsigned num_threads);
 void gdnsd_plugins_action_post_daemonize(void);
@@ -45,7 +45,7 @@
  *   because libgdnsd is missing symbols it wants to link against that
  *   were dropped in the new API.  This is just to protect other cases).
  ***/
-#define GDNSD_PLUGIN_API_VERSION 12
+#define GDNSD_PLUGIN_API_VERSION 13
 
 /*** Data Types ***/
 
@@ -98,6 +98,7 @@ typedef void (*gdnsd_post_daemonize_cb_t)(void);
 typedef void (*gdnsd_pre_run_cb_t)(struct ev_loop* loop);
 typedef void (*gdnsd_iothread_init_cb_t)(unsigned threadnum);
 typedef bool (*gdnsd_resolve_dynaddr_cb_t)(unsigned threadnum, unsigned resnum, const client_info_t* cinfo, dynaddr_result_t* result);
+typedef void (*gdnsd_resolve_dynaddr_batch_cb_t)(unsigned threadnum, unsigned count, const unsigned* resnums, const client_info_t* const* cinfos, dynaddr_result_t* const* results);
 typedef void (*gdnsd_resolve_dyncname_cb_t)(unsigned threadnum, unsigned resnum, const uint8_t* origin, const client_info_t* cinfo, dyncname_result_t* result);
 typedef void (*gdnsd_exit_cb_t)(void);
 
@@ -121,6 +122,7 @@ typedef struct {
     gdnsd_pre_run_cb_t pre_run;
     gdnsd_iothread_init_cb_t iothread_init;
     gdnsd_resolve_dynaddr_cb_t resolve_dynaddr;
+    gdnsd_resolve_dynaddr_batch_cb_t resolve_dynaddr_batch;
     gdnsd_resolve_dyncname_cb_t resolve_dyncname;
     gdnsd_exit_cb_t exit;
     gdnsd_add_svctype_cb_t add_svctype;
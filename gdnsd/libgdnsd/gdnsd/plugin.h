@@ -30,6 +30,7 @@
 #include <gdnsd/net.h>
 #include <gdnsd/log.h>
 #include <gdnsd/mon.h>
+#include <gdnsd/montimer.h>
 #include <gdnsd/plugapi.h>
 #include <gdnsd/misc.h>
 #include <gdnsd/paths.h>
@@ -54,6 +55,7 @@
 #define xSYM_PRE_RUN(x)       plugin_ ## x ## _pre_run
 #define xSYM_IOTH_INIT(x)     plugin_ ## x ## _iothread_init
 #define xSYM_RESOLVE_DYNA(x)  plugin_ ## x ## _resolve_dynaddr
+#define xSYM_RESOLVE_DYNAB(x) plugin_ ## x ## _resolve_dynaddr_batch
 #define xSYM_RESOLVE_DYNC(x)  plugin_ ## x ## _resolve_dyncname
 #define xSYM_EXIT(x)          plugin_ ## x ## _exit
 #define xSYM_ADD_SVC(x)       plugin_ ## x ## _add_svctype
@@ -70,6 +72,7 @@
 #define SYM_PRE_RUN(x)        xSYM_PRE_RUN(x)
 #define SYM_IOTH_INIT(x)      xSYM_IOTH_INIT(x)
 #define SYM_RESOLVE_DYNA(x)   xSYM_RESOLVE_DYNA(x)
+#define SYM_RESOLVE_DYNAB(x)  xSYM_RESOLVE_DYNAB(x)
 #define SYM_RESOLVE_DYNC(x)   xSYM_RESOLVE_DYNC(x)
 #define SYM_EXIT(x)           xSYM_EXIT(x)
 #define SYM_ADD_SVC(x)        xSYM_ADD_SVC(x)
@@ -93,6 +96,8 @@ void SYM_IOTH_INIT(GDNSD_PLUGIN_NAME)(unsigned threadnum);
 F_NONNULL
 bool SYM_RESOLVE_DYNA(GDNSD_PLUGIN_NAME)(unsigned threadnum, unsigned resnum, const client_info_t* cinfo, dynaddr_result_t* result);
 F_NONNULL
+void SYM_RESOLVE_DYNAB(GDNSD_PLUGIN_NAME)(unsigned threadnum, unsigned count, const unsigned* resnums, const client_info_t* const* cinfos, dynaddr_result_t* const* results);
+F_NONNULL
 void SYM_RESOLVE_DYNC(GDNSD_PLUGIN_NAME)(unsigned threadnum, unsigned resnum, const uint8_t* origin, const client_info_t* cinfo, dyncname_result_t* result);
 void SYM_EXIT(GDNSD_PLUGIN_NAME)(void);
 F_NONNULLX(1)
@@ -115,6 +120,7 @@ void SYM_START_MONS(GDNSD_PLUGIN_NAME)(struct ev_loop* mon_loop);
 #undef SYM_PRE_RUN
 #undef SYM_IOTH_INIT
 #undef SYM_RESOLVE_DYNA
+#undef SYM_RESOLVE_DYNAB
 #undef SYM_RESOLVE_DYNC
 #undef SYM_EXIT
 #undef SYM_ADD_SVC
@@ -132,6 +138,7 @@ void SYM_START_MONS(GDNSD_PLUGIN_NAME)(struct ev_loop* mon_loop);
 #undef xSYM_PRE_RUN
 #undef xSYM_IOTH_INIT
 #undef xSYM_RESOLVE_DYNA
+#undef xSYM_RESOLVE_DYNAB
 #undef xSYM_RESOLVE_DYNC
 #undef xSYM_EXIT
 #undef xSYM_ADD_SVC
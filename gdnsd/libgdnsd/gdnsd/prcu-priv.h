@@ -44,23 +44,33 @@
 
 #else // !HAVE_QSBR
 
-#include <pthread.h>
-
-extern pthread_rwlock_t gdnsd_prcu_rwlock;
+/*
+ * Without liburcu, a minimal built-in equivalent of urcu-qsbr with the
+ *   same usage rules: reader threads register, and are "online" except
+ *   around blocking calls.  A reader's only writes are to its own
+ *   cache-line-sized state (while going online or offline, not per-query),
+ *   and the lock/unlock around each query are no-ops.
+ * The updater waits in gdnsd_prcu_upd_unlock() until every reader has
+ *   been offline or re-onlined since the assignment, after which nothing
+ *   can still be using the old data.
+ */
 
-#define gdnsd_prcu_rdr_thread_start() do { } while(0)
-#define gdnsd_prcu_rdr_online() do { } while(0)
-#define gdnsd_prcu_rdr_lock() pthread_rwlock_rdlock(&gdnsd_prcu_rwlock)
-#define gdnsd_prcu_rdr_deref(s) (s)
-#define gdnsd_prcu_rdr_unlock() pthread_rwlock_unlock(&gdnsd_prcu_rwlock)
-#define gdnsd_prcu_rdr_offline() do { } while(0)
-#define gdnsd_prcu_rdr_thread_end() do { } while(0)
+void gdnsd_prcu_rdr_thread_start(void);
+void gdnsd_prcu_rdr_online(void);
+#define gdnsd_prcu_rdr_lock() do { } while(0)
+#define gdnsd_prcu_rdr_deref(s) (*(__typeof__(s) volatile*)&(s))
+#define gdnsd_prcu_rdr_unlock() do { } while(0)
+void gdnsd_prcu_rdr_offline(void);
+void gdnsd_prcu_rdr_thread_end(void);
 
-void gdnsd_prcu_setup_lock(void);
-#define gdnsd_prcu_upd_lock() pthread_rwlock_wrlock(&gdnsd_prcu_rwlock)
-#define gdnsd_prcu_upd_assign(d,s) (d) = (s)
-#define gdnsd_prcu_upd_unlock() pthread_rwlock_unlock(&gdnsd_prcu_rwlock)
-void gdnsd_prcu_destroy_lock(void);
+#define gdnsd_prcu_setup_lock() do { } while(0)
+#define gdnsd_prcu_upd_lock() do { } while(0)
+#define gdnsd_prcu_upd_assign(d,s) do { \
+    __sync_synchronize(); \
+    *(__typeof__(d) volatile*)&(d) = (s); \
+} while(0)
+void gdnsd_prcu_upd_unlock(void);
+#define gdnsd_prcu_destroy_lock() do { } while(0)
 
 #endif // HAVE_QSBR
 
@@ -182,9 +182,20 @@ void gdnsd_rand_meta_init(void) {
     pthread_mutex_unlock(&rand_init_lock);
 }
 
+// PRNG states are written on every call and are normally owned by
+//  different threads, so each gets a cache line (or more) of its own
+//  to avoid false sharing between neighboring allocations.
+#define RSTATE_ALIGN 64U
+#define RSTATE_SIZE ((sizeof(gdnsd_rstate_t) + RSTATE_ALIGN - 1) & ~(RSTATE_ALIGN - 1))
+
 gdnsd_rstate_t* gdnsd_rand_init(void) {
     unsigned throw_away;
-    gdnsd_rstate_t* newstate = calloc(1, sizeof(gdnsd_rstate_t));
+    void* rsmem;
+    const int pmerr = posix_memalign(&rsmem, RSTATE_ALIGN, RSTATE_SIZE);
+    if(pmerr)
+        log_fatal("posix_memalign() failed for PRNG state: %s", logf_errnum(pmerr));
+    memset(rsmem, 0, RSTATE_SIZE);
+    gdnsd_rstate_t* newstate = rsmem;
     pthread_mutex_lock(&rand_init_lock);
     newstate->x = gdnsd_rand_get64(&rand_init_state);
     newstate->y = gdnsd_rand_get64(&rand_init_state);
@@ -22,6 +22,8 @@
 #include "gdnsd/mon.h"
 #include "gdnsd/log.h"
 
+stats_t gdnsd_mon_gen = { 1 };
+
 mon_state_uint_t gdnsd_mon_get_min_state(const mon_state_t* states, const unsigned num_states) {
     dmn_assert(states);
     mon_state_uint_t lowest = MON_STATE_UP;
@@ -113,6 +115,9 @@ void gdnsd_mon_state_updater(mon_smgr_t* smgr, const bool latest) {
     if(new_state != now_state) {
         for(unsigned i = 0; i < smgr->num_state_ptrs; i++)
             stats_own_set(smgr->mon_state_ptrs[i], new_state);
+        // states must be visible before the new generation is
+        __sync_synchronize();
+        stats_own_inc(&gdnsd_mon_gen);
     }
 }
 
@@ -0,0 +1,241 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "gdnsd/montimer.h"
+#include "gdnsd/misc.h"
+#include "gdnsd/log.h"
+
+/*
+ * The wheel has a first level of 256 single-tick slots, and three more
+ *   levels of 64 slots each, each slot of which covers a whole turn of
+ *   the level below it.  That spans 2^26 ticks (~15 days at 20ms), and
+ *   anything further out is clamped to that.  A timer is always kept
+ *   in the lowest level whose span covers its distance from the current
+ *   tick, and each time a level completes a turn, the next slot of the
+ *   level above is re-sorted ("cascaded") down into it.  This is the
+ *   same scheme as the classic Linux kernel timer wheel.
+ */
+
+#define L0_BITS 8U
+#define LN_BITS 6U
+#define L0_SIZE (1U << L0_BITS)
+#define LN_SIZE (1U << LN_BITS)
+#define L0_MASK (L0_SIZE - 1U)
+#define LN_MASK (LN_SIZE - 1U)
+#define NUM_LN 3U
+#define MAX_TICKS (1ULL << (L0_BITS + (NUM_LN * LN_BITS)))
+
+static gdnsd_mon_timer_t* l0[L0_SIZE];
+static gdnsd_mon_timer_t* ln[NUM_LN][LN_SIZE];
+
+static struct ev_loop* wheel_loop = NULL;
+static ev_timer ticker;
+static ev_tstamp wheel_base = 0.; // ev_now() at tick zero
+static uint64_t wheel_tick = 0;   // the next tick to be processed
+static unsigned num_active = 0;
+
+F_NONNULL
+static void wheel_link(gdnsd_mon_timer_t** slot, gdnsd_mon_timer_t* t) {
+    dmn_assert(slot); dmn_assert(t);
+    t->next = *slot;
+    if(t->next)
+        t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+}
+
+F_NONNULL
+static void wheel_unlink(gdnsd_mon_timer_t* t) {
+    dmn_assert(t); dmn_assert(t->pprev);
+    *t->pprev = t->next;
+    if(t->next)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// t->expire must be >= wheel_tick
+F_NONNULL
+static void wheel_insert(gdnsd_mon_timer_t* t) {
+    dmn_assert(t); dmn_assert(t->expire >= wheel_tick);
+
+    uint64_t delta = t->expire - wheel_tick;
+    if(delta < L0_SIZE) {
+        wheel_link(&l0[t->expire & L0_MASK], t);
+        return;
+    }
+
+    if(delta >= MAX_TICKS) {
+        t->expire = wheel_tick + MAX_TICKS - 1U;
+        delta = MAX_TICKS - 1U;
+    }
+
+    unsigned shift = L0_BITS;
+    unsigned level = 0;
+    while(delta >= (1ULL << (shift + LN_BITS))) {
+        shift += LN_BITS;
+        level++;
+    }
+    dmn_assert(level < NUM_LN);
+    wheel_link(&ln[level][(t->expire >> shift) & LN_MASK], t);
+}
+
+static void wheel_cascade(const unsigned level, const unsigned idx) {
+    gdnsd_mon_timer_t* t = ln[level][idx];
+    ln[level][idx] = NULL;
+    while(t) {
+        gdnsd_mon_timer_t* next = t->next;
+        wheel_insert(t);
+        t = next;
+    }
+}
+
+F_NONNULL
+static void wheel_run_tick(struct ev_loop* loop) {
+    dmn_assert(loop);
+
+    const unsigned idx = wheel_tick & L0_MASK;
+    if(!idx) {
+        unsigned shift = L0_BITS;
+        for(unsigned level = 0; level < NUM_LN; level++) {
+            const unsigned lidx = (wheel_tick >> shift) & LN_MASK;
+            wheel_cascade(level, lidx);
+            if(lidx)
+                break;
+            shift += LN_BITS;
+        }
+    }
+
+    // Detach this tick's list before advancing, so that timers started
+    //   from the callbacks land in future ticks, while stopping one of
+    //   the remaining timers on this list still works via its pprev.
+    gdnsd_mon_timer_t* pending = l0[idx];
+    l0[idx] = NULL;
+    if(pending)
+        pending->pprev = &pending;
+    wheel_tick++;
+
+    while(pending) {
+        gdnsd_mon_timer_t* t = pending;
+        wheel_unlink(t);
+        if(t->repeat) {
+            t->expire += t->repeat;
+            if(t->expire < wheel_tick)
+                t->expire = wheel_tick; // we've fallen behind
+            wheel_insert(t);
+        }
+        else {
+            num_active--;
+        }
+        t->cb(loop, t);
+    }
+}
+
+static uint64_t now_tick(struct ev_loop* loop) {
+    const ev_tstamp since = ev_now(loop) - wheel_base;
+    return since > 0. ? (uint64_t)(since / GDNSD_MON_TICK) : 0U;
+}
+
+F_NONNULL
+static void ticker_cb(struct ev_loop* loop, ev_timer* w V_UNUSED, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(w);
+    dmn_assert(revents == EV_TIMER);
+
+    const uint64_t target = now_tick(loop);
+    while(num_active && wheel_tick <= target)
+        wheel_run_tick(loop);
+
+    if(!num_active)
+        ev_timer_stop(loop, &ticker);
+}
+
+void gdnsd_mon_timer_init(gdnsd_mon_timer_t* t, gdnsd_mon_timer_cb_t cb, void* data) {
+    dmn_assert(t); dmn_assert(cb);
+    memset(t, 0, sizeof(gdnsd_mon_timer_t));
+    t->cb = cb;
+    t->data = data;
+}
+
+F_CONST
+static uint64_t secs_to_ticks(const double secs) {
+    if(secs <= 0.)
+        return 0U;
+    const double ticks = secs / GDNSD_MON_TICK;
+    if(ticks >= (double)MAX_TICKS)
+        return MAX_TICKS;
+    const uint64_t whole = (uint64_t)ticks;
+    return (ticks > (double)whole) ? whole + 1U : whole;
+}
+
+void gdnsd_mon_timer_start(struct ev_loop* loop, gdnsd_mon_timer_t* t, const double after, const double repeat) {
+    dmn_assert(loop); dmn_assert(t);
+
+    if(!wheel_loop) {
+        wheel_loop = loop;
+        ev_timer_init(&ticker, ticker_cb, GDNSD_MON_TICK, GDNSD_MON_TICK);
+        wheel_base = ev_now(loop);
+    }
+    dmn_assert(loop == wheel_loop);
+
+    if(t->pprev)
+        wheel_unlink(t);
+    else
+        num_active++;
+
+    // An idle wheel has no timers to process, so just skip ahead
+    const uint64_t now = now_tick(loop);
+    if(!ev_is_active(&ticker)) {
+        if(wheel_tick < now)
+            wheel_tick = now;
+        ev_timer_start(loop, &ticker);
+    }
+
+    // wheel_tick can lag behind the loop's time while the ticker is
+    //   catching up, which shouldn't shorten this timer
+    t->expire = (now > wheel_tick ? now : wheel_tick) + secs_to_ticks(after);
+    t->repeat = secs_to_ticks(repeat);
+    if(repeat > 0. && !t->repeat)
+        t->repeat = 1U;
+    wheel_insert(t);
+}
+
+void gdnsd_mon_timer_stop(gdnsd_mon_timer_t* t) {
+    dmn_assert(t);
+
+    if(t->pprev) {
+        wheel_unlink(t);
+        dmn_assert(num_active);
+        if(!--num_active)
+            ev_timer_stop(wheel_loop, &ticker);
+    }
+}
+
+double gdnsd_mon_jitter(const char* desc) {
+    dmn_assert(desc);
+    return (double)gdnsd_lookup2(desc, strlen(desc)) / 4294967296.0;
+}
+
+double gdnsd_mon_init_spread(const unsigned num_mons, const unsigned interval) {
+    const double spread = (double)num_mons / (double)GDNSD_MON_INIT_RATE;
+    return spread < (double)interval ? spread : (double)interval;
+}
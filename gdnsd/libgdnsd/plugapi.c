@@ -168,6 +168,7 @@ const plugin_t* gdnsd_plugin_load(const char* pname) {
     PSETFUNC(pre_run)
     PSETFUNC(iothread_init)
     PSETFUNC(resolve_dynaddr)
+    PSETFUNC(resolve_dynaddr_batch)
     PSETFUNC(resolve_dyncname)
     PSETFUNC(exit)
     PSETFUNC(add_svctype)
@@ -187,6 +188,26 @@ const plugin_t* gdnsd_plugin_find_or_load(const char* pname) {
     return p ? p : gdnsd_plugin_load(pname);
 }
 
+// Batch variant of a plugin's resolve_dynaddr, if it has one.  The
+//   per-query callback is what gets stored in the zone data, so this
+//   is how the core finds its way back to the plugin's batch callback.
+gdnsd_resolve_dynaddr_batch_cb_t gdnsd_plugins_find_dynaddr_batch(gdnsd_resolve_dynaddr_cb_t func) {
+    dmn_assert(func);
+
+    for(unsigned i = 0; i < num_plugins; i++)
+        if(plugins[i]->resolve_dynaddr == func)
+            return plugins[i]->resolve_dynaddr_batch;
+
+    return NULL;
+}
+
+bool gdnsd_plugins_have_dynaddr_batch(void) {
+    for(unsigned i = 0; i < num_plugins; i++)
+        if(plugins[i]->resolve_dynaddr_batch)
+            return true;
+    return false;
+}
+
 // The action iterators...
 
 void gdnsd_plugins_action_full_config(const unsigned num_threads) {
@@ -24,33 +24,123 @@
 
 #ifndef HAVE_QSBR
 
-// externally visible
-pthread_rwlock_t gdnsd_prcu_rwlock;
-
-void gdnsd_prcu_setup_lock(void) {
-    int pthread_err;
-    pthread_rwlockattr_t lockatt;
-    if((pthread_err = pthread_rwlockattr_init(&lockatt)))
-        log_fatal("pthread_rwlockattr_init() failed: %s", logf_errnum(pthread_err));
-
-    // Non-portable way to boost writer priority.  Our writelocks are held very briefly
-    //  and very rarely, whereas the readlocks could be very spammy, and we don't want to
-    //  block the write operation forever.  This works on Linux+glibc.
-#   ifdef PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
-        if((pthread_err = pthread_rwlockattr_setkind_np(&lockatt, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP)))
-            log_fatal("pthread_rwlockattr_setkind_np(PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP) failed: %s", logf_errnum(pthread_err));
-#   endif
-
-    if((pthread_err = pthread_rwlock_init(&gdnsd_prcu_rwlock, &lockatt)))
-        log_fatal("pthread_rwlock_init() failed: %s", logf_errnum(pthread_err));
-    if((pthread_err = pthread_rwlockattr_destroy(&lockatt)))
-        log_fatal("pthread_rwlockattr_destroy() failed: %s", logf_errnum(pthread_err));
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define PRCU_CACHELINE 64U
+
+// Grace period waits spin (yielding) this many times before sleeping
+#define PRCU_SPINS 1000U
+#define PRCU_SLEEP_NSEC 100000L
+
+// Each reader's state gets a cache line to itself, so that going online
+//   or offline never touches a line that another reader writes.
+typedef struct _prcu_rdr prcu_rdr_t;
+struct _prcu_rdr {
+    // Zero while offline, otherwise the grace period counter as of
+    //   the last time this reader went online.
+    unsigned long ctr;
+    prcu_rdr_t* next;
+} __attribute__((__aligned__(PRCU_CACHELINE)));
+
+// The grace period counter, which only the updater writes.  It starts
+//   at one and advances by two, so that it's never zero.
+static unsigned long gp_ctr = 1UL;
+
+// Protects the list of readers, and serializes updaters
+static pthread_mutex_t rdr_lock = PTHREAD_MUTEX_INITIALIZER;
+static prcu_rdr_t* readers = NULL;
+
+static __thread prcu_rdr_t* self = NULL;
+
+void gdnsd_prcu_rdr_online(void) {
+    dmn_assert(self);
+    *(volatile unsigned long*)&self->ctr = *(volatile unsigned long*)&gp_ctr;
+    // announce ourselves before reading anything protected
+    __sync_synchronize();
+}
+
+void gdnsd_prcu_rdr_offline(void) {
+    dmn_assert(self);
+    // finish all protected reads first
+    __sync_synchronize();
+    *(volatile unsigned long*)&self->ctr = 0UL;
 }
 
-void gdnsd_prcu_destroy_lock(void) {
-    int pthread_err;
-    if((pthread_err = pthread_rwlock_destroy(&gdnsd_prcu_rwlock)))
-        log_fatal("pthread_rwlock_destroy() failed: %s", logf_errnum(pthread_err));
+// As with urcu-qsbr, threads start out online
+void gdnsd_prcu_rdr_thread_start(void) {
+    dmn_assert(!self);
+
+    void* mem = NULL;
+    const int pm_err = posix_memalign(&mem, PRCU_CACHELINE, sizeof(prcu_rdr_t));
+    if(pm_err)
+        log_fatal("posix_memalign() failed: %s", logf_errnum(pm_err));
+    memset(mem, 0, sizeof(prcu_rdr_t));
+    self = mem;
+
+    pthread_mutex_lock(&rdr_lock);
+    self->next = readers;
+    readers = self;
+    gdnsd_prcu_rdr_online();
+    pthread_mutex_unlock(&rdr_lock);
+}
+
+// This can be called from a cancellation cleanup handler while an
+//   updater is waiting on us, so go offline before taking the lock.
+void gdnsd_prcu_rdr_thread_end(void) {
+    if(!self)
+        return;
+
+    gdnsd_prcu_rdr_offline();
+
+    pthread_mutex_lock(&rdr_lock);
+    prcu_rdr_t** rp = &readers;
+    while(*rp != self)
+        rp = &(*rp)->next;
+    *rp = self->next;
+    pthread_mutex_unlock(&rdr_lock);
+
+    free(self);
+    self = NULL;
+}
+
+// Waits for a grace period: until every reader which was online when
+//   it began has since gone offline or come back online.
+void gdnsd_prcu_upd_unlock(void) {
+    dmn_assert(!self); // not from a reader thread
+
+    pthread_mutex_lock(&rdr_lock);
+
+    // the caller's assignment is visible before the new counter value
+    __sync_synchronize();
+    const unsigned long new_ctr = gp_ctr + 2UL;
+    *(volatile unsigned long*)&gp_ctr = new_ctr;
+    __sync_synchronize();
+
+    for(prcu_rdr_t* r = readers; r; r = r->next) {
+        unsigned spins = 0;
+        while(1) {
+            const unsigned long ctr = *(volatile unsigned long*)&r->ctr;
+            if(!ctr || ctr == new_ctr)
+                break;
+            if(spins < PRCU_SPINS) {
+                spins++;
+                sched_yield();
+            }
+            else {
+                const struct timespec nap = { 0, PRCU_SLEEP_NSEC };
+                nanosleep(&nap, NULL);
+            }
+        }
+    }
+
+    // and the readers are done with the old data before the caller frees it
+    __sync_synchronize();
+
+    pthread_mutex_unlock(&rdr_lock);
 }
 
 #endif
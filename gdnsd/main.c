@@ -38,9 +38,14 @@
 #endif
 
 #include "dnsio_tcp.h"
+#include "dnsio_tls.h"
 #include "dnsio_udp.h"
 #include "dnspacket.h"
 #include "statio.h"
+#include "querylog.h"
+#include "hotlog.h"
+#include "statshm.h"
+#include "topn.h"
 #include "monio.h"
 #include "ztree.h"
 #include "zsrc_rfc1035.h"
@@ -64,6 +69,10 @@ static void threads_cleanup(void) {
     pthread_join(zone_data_threadid, NULL);
     for(unsigned i = 0; i < gconfig.num_dns_threads; i++)
         pthread_join(gconfig.dns_threads[i].threadid, NULL);
+
+    // with the DNS threads gone, this gets every last query logged
+    querylog_stop();
+    hotlog_stop();
 }
 
 F_NONNULL
@@ -125,12 +134,16 @@ static void usage(const char* argv0) {
 #       ifdef USE_LINUX_CAPS
             " libcap"
 #       endif
+#       ifdef USE_TLS
+            " tls"
+#       endif
 
 #       if  defined NDEBUG \
         && !defined HAVE_QSBR \
         && !defined USE_SENDMMSG \
         && !defined USE_INOTIFY \
-        && !defined USE_LINUX_CAPS
+        && !defined USE_LINUX_CAPS \
+        && !defined USE_TLS
             " none"
 #       endif
 
@@ -214,16 +227,27 @@ static void start_threads(void) {
         dns_thread_t* t = &gconfig.dns_threads[i];
         if(t->is_udp)
             pthread_err = pthread_create(&t->threadid, &attribs, &dnsio_udp_start, (void*)t);
+#ifdef USE_TLS
+        else if(t->is_tls)
+            pthread_err = pthread_create(&t->threadid, &attribs, &dnsio_tls_start, (void*)t);
+#endif
         else
             pthread_err = pthread_create(&t->threadid, &attribs, &dnsio_tcp_start, (void*)t);
         if(pthread_err)
             log_fatal("pthread_create() of DNS thread %u (for %s:%s) failed: %s",
-                i, t->is_udp ? "UDP" : "TCP", logf_anysin(&t->ac->addr), logf_errnum(pthread_err));
+                i, t->is_udp ? "UDP" : t->is_tls ? "TLS" : "TCP",
+                logf_anysin(t->is_tls ? &t->ac->tls_addr : &t->ac->addr), logf_errnum(pthread_err));
     }
 
     int pthread_err = pthread_create(&zone_data_threadid, &attribs, &zone_data_runtime, NULL);
     if(pthread_err) log_fatal("pthread_create() of zone data thread failed: %s", logf_errnum(pthread_err));
 
+    // Start the query log writer, if enabled
+    querylog_start();
+
+    // ... and the logging thread for the DNS threads' error paths
+    hotlog_start();
+
     // Invoke thread cleanup handlers at exit time
     if(atexit(threads_cleanup))
         log_fatal("atexit(threads_cleanup) failed: %s", logf_errno());
@@ -564,6 +588,18 @@ int main(int argc, char** argv) {
     // init the stats summing/output code
     statio_init();
 
+    // Open the query log (if enabled) while we're still privileged
+    querylog_init();
+
+    // Log rings for the DNS threads
+    hotlog_init();
+
+    // Likewise the shared-memory stats segment
+    statshm_init();
+
+    // Heavy-hitter sketches for the DNS threads
+    topn_init();
+
     // Call plugin pre-privdrop actions
     gdnsd_plugins_action_pre_privdrop();
 
@@ -604,6 +640,8 @@ int main(int argc, char** argv) {
     // Note, this is down here because we depend on
     //  dnspacket_wait_stats() completion.
     statio_start(def_loop);
+    statshm_start(def_loop);
+    topn_start(def_loop);
 
     // Notify the user that the listeners are up
     log_info("DNS listeners started");
@@ -621,6 +659,7 @@ int main(int argc, char** argv) {
     log_info("Final stats:");
     statio_log_uptime();
     statio_log_stats();
+    statshm_stop();
 
     // Bye!
     exit(0);
@@ -0,0 +1,310 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Stress test for the monitoring timers (gdnsd/montimer.h), scheduling
+//   TCP connect checks the way the tcp_connect plugin does, for a large
+//   number of monitors against a set of local listeners.  Reports how
+//   evenly the check starts are spread over time (the peak number of
+//   starts in any 100ms bucket vs. a perfectly even spread) and how late
+//   the timers fire.  This is not part of "make check"; run it via
+//   "make stress".
+
+#include "config.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <gdnsd/dmn.h>
+#include <gdnsd/log.h>
+#include <gdnsd/montimer.h>
+
+#define NUM_LISTENERS 64U
+#define CHECK_TIMEOUT 5.0
+#define BUCKET_SECS 0.1
+
+typedef struct {
+    char desc[32];
+    unsigned port_idx;
+    int sock;
+    bool started; // past the initial round
+    ev_tstamp due;
+    ev_io connect_watcher;
+    gdnsd_mon_timer_t interval_timer;
+    gdnsd_mon_timer_t timeout_timer;
+} smon_t;
+
+static smon_t* mons = NULL;
+static unsigned num_mons;
+static unsigned interval;
+static double spread;
+
+static struct sockaddr_in listen_addrs[NUM_LISTENERS];
+static ev_io listen_watchers[NUM_LISTENERS];
+
+static ev_tstamp start_time;
+static ev_tstamp end_time;
+static unsigned* buckets = NULL;
+static unsigned num_buckets;
+
+static uint64_t checks = 0;
+static uint64_t successes = 0;
+static uint64_t failures = 0;
+static uint64_t timeouts = 0;
+static double late_sum = 0.;
+static double late_max = 0.;
+
+// The checks close with an RST, so that neither end builds up TIME_WAIT
+//   sockets over many thousands of checks per second.  The listeners just
+//   close normally, lest a check see the RST before its connect completes.
+static void abort_close(const int sock) {
+    const struct linger lin = { 1, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    close(sock);
+}
+
+F_NONNULL
+static void listen_cb(struct ev_loop* loop V_UNUSED, ev_io* w, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(w);
+    dmn_assert(revents == EV_READ);
+
+    int sock;
+    while((sock = accept(w->fd, NULL, NULL)) >= 0)
+        close(sock);
+}
+
+F_NONNULL
+static void finish_check(struct ev_loop* loop, smon_t* m) {
+    dmn_assert(loop); dmn_assert(m);
+    abort_close(m->sock);
+    m->sock = -1;
+    ev_io_stop(loop, &m->connect_watcher);
+    gdnsd_mon_timer_stop(&m->timeout_timer);
+}
+
+F_NONNULL
+static void connect_cb(struct ev_loop* loop, ev_io* w, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(w);
+    dmn_assert(revents == EV_WRITE);
+
+    smon_t* m = w->data;
+    int so_error = 0;
+    socklen_t so_error_len = sizeof(so_error);
+    getsockopt(m->sock, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len);
+    if(so_error)
+        failures++;
+    else
+        successes++;
+    finish_check(loop, m);
+}
+
+F_NONNULL
+static void timeout_cb(struct ev_loop* loop, gdnsd_mon_timer_t* t) {
+    dmn_assert(loop); dmn_assert(t);
+    timeouts++;
+    finish_check(loop, t->data);
+}
+
+F_NONNULL
+static void interval_cb(struct ev_loop* loop, gdnsd_mon_timer_t* t) {
+    dmn_assert(loop); dmn_assert(t);
+
+    smon_t* m = t->data;
+    const ev_tstamp now = ev_now(loop);
+
+    const double late = now - m->due;
+
+    // as in extmon_helper: after the initial round, at jitter * interval
+    //   past a multiple of the interval
+    if(!m->started) {
+        const double after = interval + (gdnsd_mon_jitter(m->desc) * (interval - spread));
+        gdnsd_mon_timer_start(loop, t, after, interval);
+        m->due = now + after;
+        m->started = true;
+    }
+    else {
+        m->due += interval;
+    }
+
+    if(now >= end_time)
+        return;
+
+    late_sum += late;
+    if(late > late_max)
+        late_max = late;
+
+    const unsigned bucket = (unsigned)((now - start_time) / BUCKET_SECS);
+    if(bucket < num_buckets)
+        buckets[bucket]++;
+    checks++;
+
+    if(m->sock != -1) {
+        // the previous check is still waiting on its timeout
+        failures++;
+        return;
+    }
+
+    const int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(sock < 0)
+        log_fatal("socket() failed: %s", logf_errno());
+    if(fcntl(sock, F_SETFL, O_NONBLOCK) == -1)
+        log_fatal("fcntl(O_NONBLOCK) failed: %s", logf_errno());
+
+    const struct sockaddr_in* sin = &listen_addrs[m->port_idx];
+    if(!connect(sock, (const struct sockaddr*)sin, sizeof(*sin))) {
+        successes++;
+        abort_close(sock);
+        return;
+    }
+    if(errno != EINPROGRESS) {
+        failures++;
+        abort_close(sock);
+        return;
+    }
+
+    m->sock = sock;
+    ev_io_set(&m->connect_watcher, sock, EV_WRITE);
+    ev_io_start(loop, &m->connect_watcher);
+    gdnsd_mon_timer_start(loop, &m->timeout_timer, CHECK_TIMEOUT, 0);
+}
+
+static void make_listeners(struct ev_loop* loop) {
+    for(unsigned i = 0; i < NUM_LISTENERS; i++) {
+        const int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if(sock < 0)
+            log_fatal("socket() failed: %s", logf_errno());
+        if(fcntl(sock, F_SETFL, O_NONBLOCK) == -1)
+            log_fatal("fcntl(O_NONBLOCK) failed: %s", logf_errno());
+
+        struct sockaddr_in* sin = &listen_addrs[i];
+        memset(sin, 0, sizeof(*sin));
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t sin_len = sizeof(*sin);
+        if(bind(sock, (struct sockaddr*)sin, sin_len)
+            || getsockname(sock, (struct sockaddr*)sin, &sin_len)
+            || listen(sock, SOMAXCONN))
+            log_fatal("Failed to set up listener: %s", logf_errno());
+
+        ev_io_init(&listen_watchers[i], listen_cb, sock, EV_READ);
+        ev_io_start(loop, &listen_watchers[i]);
+    }
+}
+
+static void raise_nofile(void) {
+    struct rlimit rlim;
+    if(!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur < rlim.rlim_max) {
+        rlim.rlim_cur = rlim.rlim_max;
+        if(setrlimit(RLIMIT_NOFILE, &rlim))
+            log_warn("Failed to raise RLIMIT_NOFILE: %s", logf_errno());
+    }
+}
+
+static void end_cb(struct ev_loop* loop, ev_timer* w, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(w);
+    dmn_assert(revents == EV_TIMER);
+
+    for(unsigned i = 0; i < NUM_LISTENERS; i++)
+        ev_io_stop(loop, &listen_watchers[i]);
+    for(unsigned i = 0; i < num_mons; i++) {
+        gdnsd_mon_timer_stop(&mons[i].interval_timer);
+        if(mons[i].sock != -1)
+            finish_check(loop, &mons[i]); // still in flight, not counted
+    }
+}
+
+int main(int argc, char* argv[]) {
+    dmn_init_log("mon_stress", true);
+
+    num_mons = argc > 1 ? (unsigned)atoi(argv[1]) : 100000U;
+    interval = argc > 2 ? (unsigned)atoi(argv[2]) : 10U;
+    const double secs = argc > 3 ? atof(argv[3]) : interval * 3.0;
+    if(!num_mons || !interval || secs < interval)
+        log_fatal("Usage: %s [num_monitors [interval [seconds >= interval]]]", argv[0]);
+
+    raise_nofile();
+
+    struct ev_loop* loop = ev_default_loop(EVFLAG_AUTO);
+    make_listeners(loop);
+
+    spread = gdnsd_mon_init_spread(num_mons, interval);
+    mons = calloc(num_mons, sizeof(smon_t));
+    num_buckets = (unsigned)(secs / BUCKET_SECS) + 1U;
+    buckets = calloc(num_buckets, sizeof(unsigned));
+
+    ev_now_update(loop);
+    start_time = ev_now(loop);
+    end_time = start_time + secs;
+
+    for(unsigned i = 0; i < num_mons; i++) {
+        smon_t* m = &mons[i];
+        snprintf(m->desc, sizeof(m->desc), "stress%u/127.0.0.1", i);
+        m->port_idx = i % NUM_LISTENERS;
+        m->sock = -1;
+        ev_io_init(&m->connect_watcher, connect_cb, -1, 0);
+        m->connect_watcher.data = m;
+        gdnsd_mon_timer_init(&m->interval_timer, interval_cb, m);
+        gdnsd_mon_timer_init(&m->timeout_timer, timeout_cb, m);
+        const double after = spread * gdnsd_mon_jitter(m->desc);
+        gdnsd_mon_timer_start(loop, &m->interval_timer, after, 0);
+        m->due = start_time + after;
+    }
+
+    ev_timer end_timer;
+    ev_timer_init(&end_timer, end_cb, secs, 0);
+    ev_timer_start(loop, &end_timer);
+    ev_run(loop, 0);
+
+    // the initial round, and then the regular rounds, separately
+    const unsigned init_buckets = (unsigned)(spread / BUCKET_SECS) + 1U;
+    unsigned init_peak = 0;
+    unsigned reg_peak = 0;
+    for(unsigned i = 0; i < num_buckets; i++) {
+        if(i < init_buckets) {
+            if(buckets[i] > init_peak)
+                init_peak = buckets[i];
+        }
+        else if(buckets[i] > reg_peak) {
+            reg_peak = buckets[i];
+        }
+    }
+    const double init_ideal = spread > 0. ? num_mons * BUCKET_SECS / spread : num_mons;
+    const double reg_ideal = num_mons * BUCKET_SECS / interval;
+
+    printf("%u monitors, %us interval, %.1fs initial spread, %u listeners, %.0fs\n",
+        num_mons, interval, spread, NUM_LISTENERS, secs);
+    printf("checks: %" PRIu64 " ok: %" PRIu64 " failed: %" PRIu64 " timed out: %" PRIu64 "\n",
+        checks, successes, failures, timeouts);
+    printf("peak starts per %.0fms: initial %u (even: %.0f), regular %u (even: %.0f)\n",
+        BUCKET_SECS * 1000., init_peak, init_ideal, reg_peak, reg_ideal);
+    printf("timer lateness: mean %.2fms, max %.2fms\n",
+        checks ? late_sum * 1000. / checks : 0., late_max * 1000.);
+
+    free(buckets);
+    free(mons);
+    return (failures || timeouts) ? 1 : 0;
+}
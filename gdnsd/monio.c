@@ -325,6 +325,27 @@ static const unsigned json_nl_len = sizeof(json_nl) - 1;
 static const char json_foot[] = "\r\n\t]\r\n";
 static const unsigned json_foot_len = sizeof(json_foot) - 1;
 
+static const char prom_head[] =
+    "# HELP gdnsd_service_state Monitored service states, 1 for the current state and 0 for the others\n"
+    "# TYPE gdnsd_service_state gauge\n";
+static const unsigned prom_head_len = sizeof(prom_head) - 1;
+static const char prom_tmpl[] = "gdnsd_service_state{service=\"%s\",state=\"%s\"} %u\n";
+static const unsigned prom_tmpl_len = sizeof(prom_tmpl) - 7;
+
+unsigned monio_get_num_mons(void) {
+    return num_mons;
+}
+
+const char* monio_get_desc(const unsigned idx) {
+    dmn_assert(idx < num_mons);
+    return mons[idx]->desc;
+}
+
+mon_state_uint_t monio_get_state(const unsigned idx) {
+    dmn_assert(idx < num_mons);
+    return stats_get(mons[idx]->mon_state_ptrs[0]);
+}
+
 // statio calls this at the appropriate time (long after all
 //  basic setup is done, but before monio_start() time).
 // monio's job here is to inform statio of the maximum possible
@@ -354,6 +375,16 @@ unsigned monio_get_max_stats_len(void) {
     return max_stats_len;
 }
 
+// As above, for the Prometheus output.  This is kept separate because it's
+//  much larger per service: every service gets one line per state, and
+//  the service names may need escaping.
+unsigned monio_get_max_prom_len(void) {
+    unsigned len = prom_head_len + 1; // +1 for sprintf \0
+    for(unsigned i = 0; i < num_mons; i++)
+        len += 3 * (prom_tmpl_len + 6 + 1 + (strlen(mons[i]->desc) * 2));
+    return len;
+}
+
 // Output our stats in html form to buf, returning
 //  how many characters we added to the buf.
 unsigned monio_stats_out_html(char* buf) {
@@ -467,3 +498,65 @@ unsigned monio_stats_out_json(char* buf) {
 
     return (buf - buf_start);
 }
+
+// Label values in the Prometheus text format need backslash,
+//  double-quote, and newline escaped.
+F_NONNULL
+static void prom_escape(char* out, const char* in) {
+    dmn_assert(out); dmn_assert(in);
+
+    while(*in) {
+        if(*in == '\\' || *in == '"') {
+            *out++ = '\\';
+            *out++ = *in;
+        }
+        else if(*in == '\n') {
+            *out++ = '\\';
+            *out++ = 'n';
+        }
+        else {
+            *out++ = *in;
+        }
+        in++;
+    }
+    *out = '\0';
+}
+
+// Output our stats in Prometheus text form to buf, which must have
+//  room for monio_get_max_prom_len() bytes.  Returns how many
+//  characters we added to the buf.
+unsigned monio_stats_out_prom(char* buf) {
+    dmn_assert(buf);
+
+    if(!num_mons) return 0;
+
+    const char* const buf_start = buf;
+    int avail = monio_get_max_prom_len();
+
+    memcpy(buf, prom_head, prom_head_len);
+    buf += prom_head_len;
+    avail -= prom_head_len;
+
+    unsigned desc_max = 0;
+    for(unsigned i = 0; i < num_mons; i++) {
+        const unsigned desc_len = strlen(mons[i]->desc);
+        if(desc_len > desc_max)
+            desc_max = desc_len;
+    }
+    char* desc = malloc((desc_max * 2) + 1);
+
+    for(unsigned i = 0; i < num_mons; i++) {
+        prom_escape(desc, mons[i]->desc);
+        const mon_state_uint_t st = stats_get(mons[i]->mon_state_ptrs[0]);
+        for(unsigned j = MON_STATE_UP; j >= MON_STATE_DOWN; j--) {
+            int written = snprintf(buf, avail, prom_tmpl, desc, state_txt[j], (unsigned)(st == j));
+            if(unlikely(written >= avail))
+                log_fatal("BUG: monio stats buf miscalculated (prom data)");
+            buf += written;
+            avail -= written;
+        }
+    }
+
+    free(desc);
+    return (buf - buf_start);
+}
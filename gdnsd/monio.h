@@ -37,5 +37,12 @@ unsigned monio_get_max_stats_len(void);
 F_NONNULL unsigned monio_stats_out_csv(char* buf);
 F_NONNULL unsigned monio_stats_out_json(char* buf);
 F_NONNULL unsigned monio_stats_out_html(char* buf);
+unsigned monio_get_max_prom_len(void);
+F_NONNULL unsigned monio_stats_out_prom(char* buf);
+
+// statshm.c calls these
+F_PURE unsigned monio_get_num_mons(void);
+F_PURE const char* monio_get_desc(const unsigned idx);
+mon_state_uint_t monio_get_state(const unsigned idx);
 
 #endif // GDNSD_MONIO_H
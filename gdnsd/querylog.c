@@ -0,0 +1,361 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "querylog.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "conf.h"
+#include "gdnsd/log.h"
+#include "gdnsd/paths.h"
+
+// The producer-owned and consumer-owned halves of a ring live on
+//   separate cache lines, so that the I/O thread's updates to "head"
+//   don't keep invalidating the writer's "tail" and vice-versa.
+#define QLOG_CACHELINE 64U
+
+// How long the writer sleeps when it finds all rings empty
+#define QLOG_IDLE_NSEC 10000000L
+
+// Interval for logging drop counts, and for retrying a failed open
+#define QLOG_REPORT_SECS 60
+
+struct qlog_ring {
+    // Written only by the owning I/O thread
+    qlog_rec_t* slots;
+    unsigned mask;
+    unsigned head;       // count of records ever published
+    unsigned tail_cache; // producer's last-seen copy of tail
+    stats_t dropped;
+    // Written only by the writer thread
+    unsigned tail __attribute__((__aligned__(QLOG_CACHELINE)));
+};
+
+static qlog_ring_t** rings = NULL;
+static unsigned num_rings = 0;
+
+// writer thread state
+static pthread_t writer_threadid;
+static bool writer_started = false;
+static bool writer_stopping = false;
+static char* log_path = NULL;
+static char* rot_path = NULL; // scratch for rotated names
+static char* rot_from = NULL; // ditto
+static size_t log_path_len = 0;
+static FILE* log_fp = NULL;
+static uint64_t log_size = 0;
+static uint64_t log_max_size = 0;
+static stats_uint_t write_lost = 0; // drained, but not written due to file errors
+static time_t next_open_retry = 0;
+
+qlog_ring_t* querylog_ring(const unsigned threadnum) {
+    return rings ? rings[threadnum] : NULL;
+}
+
+qlog_rec_t* querylog_reserve(qlog_ring_t* ring) {
+    dmn_assert(ring);
+
+    const unsigned head = ring->head;
+    if(unlikely(head - ring->tail_cache > ring->mask)) {
+        ring->tail_cache = *(volatile unsigned*)&ring->tail;
+        if(head - ring->tail_cache > ring->mask) {
+            stats_own_inc(&ring->dropped);
+            return NULL;
+        }
+        // the writer is done reading the slots it released
+        __sync_synchronize();
+    }
+
+    return &ring->slots[head & ring->mask];
+}
+
+void querylog_commit(qlog_ring_t* ring) {
+    dmn_assert(ring);
+
+    // record contents must be visible before the new head
+    __sync_synchronize();
+    *(volatile unsigned*)&ring->head = ring->head + 1U;
+}
+
+F_NONNULL
+static void rot_name(char* out, const unsigned num) {
+    dmn_assert(out);
+    snprintf(out, log_path_len + 12U, "%s.%u", log_path, num);
+}
+
+// Shifts path -> path.1 -> ... -> path.N, discarding the oldest
+static void rotate_files(void) {
+    dmn_assert(log_path); dmn_assert(rot_path);
+
+    const unsigned count = gconfig.query_log_rotate;
+    if(!count) {
+        if(unlink(log_path) && errno != ENOENT)
+            log_err("query log: unlink('%s') failed: %s", log_path, logf_errno());
+        return;
+    }
+
+    for(unsigned i = count; i > 1; i--) {
+        rot_name(rot_from, i - 1U);
+        rot_name(rot_path, i);
+        if(rename(rot_from, rot_path) && errno != ENOENT)
+            log_err("query log: rename('%s', '%s') failed: %s", rot_from, rot_path, logf_errno());
+    }
+    rot_name(rot_path, 1U);
+    if(rename(log_path, rot_path) && errno != ENOENT)
+        log_err("query log: rename('%s', '%s') failed: %s", log_path, rot_path, logf_errno());
+}
+
+// Opens a new, empty log file.  Returns true on failure.
+F_WUNUSED
+static bool open_log(void) {
+    dmn_assert(!log_fp);
+
+    log_fp = fopen(log_path, "w");
+    if(!log_fp) {
+        log_err("query log: cannot open '%s' for writing: %s", log_path, logf_errno());
+        return true;
+    }
+
+    // fully-buffered, roughly a few hundred records per write()
+    setvbuf(log_fp, NULL, _IOFBF, 131072);
+    if(fwrite(QLOG_MAGIC, 8, 1, log_fp) != 1) {
+        log_err("query log: write to '%s' failed: %s", log_path, logf_errno());
+        fclose(log_fp);
+        log_fp = NULL;
+        return true;
+    }
+    log_size = 8;
+    return false;
+}
+
+static void close_log(void) {
+    if(log_fp) {
+        if(fclose(log_fp))
+            log_err("query log: write to '%s' failed: %s", log_path, logf_errno());
+        log_fp = NULL;
+    }
+}
+
+// Called by the writer when a file error left us without an open log
+static void retry_open(void) {
+    dmn_assert(!log_fp);
+
+    const time_t now = time(NULL);
+    if(now >= next_open_retry) {
+        if(open_log())
+            next_open_retry = now + QLOG_REPORT_SECS;
+        else
+            log_info("query log: resumed writing to '%s'", log_path);
+    }
+}
+
+F_NONNULL
+static void write_recs(const qlog_rec_t* recs, unsigned count) {
+    dmn_assert(recs);
+
+    while(count) {
+        if(log_fp && log_size + sizeof(qlog_rec_t) > log_max_size) {
+            close_log();
+            rotate_files();
+            if(open_log())
+                next_open_retry = time(NULL) + QLOG_REPORT_SECS;
+        }
+
+        if(!log_fp) {
+            write_lost += count;
+            return;
+        }
+
+        unsigned fit = (log_max_size - log_size) / sizeof(qlog_rec_t);
+        if(fit > count)
+            fit = count;
+        if(fwrite(recs, sizeof(qlog_rec_t), fit, log_fp) != fit) {
+            log_err("query log: write to '%s' failed: %s", log_path, logf_errno());
+            fclose(log_fp);
+            log_fp = NULL;
+            next_open_retry = time(NULL) + QLOG_REPORT_SECS;
+            write_lost += count;
+            return;
+        }
+        log_size += (uint64_t)fit * sizeof(qlog_rec_t);
+        recs += fit;
+        count -= fit;
+    }
+}
+
+// Drains one ring to the log, returns true if there was anything in it
+F_NONNULL
+static bool drain_ring(qlog_ring_t* ring) {
+    dmn_assert(ring);
+
+    const unsigned head = *(volatile unsigned*)&ring->head;
+    unsigned tail = ring->tail;
+    if(head == tail)
+        return false;
+
+    // see the record contents published along with head
+    __sync_synchronize();
+
+    while(tail != head) {
+        const unsigned idx = tail & ring->mask;
+        unsigned count = head - tail;
+        if(count > ring->mask + 1U - idx)
+            count = ring->mask + 1U - idx; // up to the end of the array
+        write_recs(&ring->slots[idx], count);
+        tail += count;
+
+        // done reading these slots, hand them back to the producer
+        __sync_synchronize();
+        *(volatile unsigned*)&ring->tail = tail;
+    }
+
+    return true;
+}
+
+static stats_uint_t total_dropped(void) {
+    stats_uint_t total = 0;
+    for(unsigned i = 0; i < num_rings; i++)
+        total += stats_get(&rings[i]->dropped);
+    return total;
+}
+
+F_NONNULL
+static void report_losses(stats_uint_t* dropped_reported, stats_uint_t* lost_reported) {
+    dmn_assert(dropped_reported); dmn_assert(lost_reported);
+
+    const stats_uint_t dropped = total_dropped();
+    if(dropped != *dropped_reported) {
+        log_warn("query log: %" PRIuPTR " records dropped due to full buffers (%" PRIuPTR " total), consider raising query_log_buffer", dropped - *dropped_reported, dropped);
+        *dropped_reported = dropped;
+    }
+    if(write_lost != *lost_reported) {
+        log_warn("query log: %" PRIuPTR " records lost due to file errors (%" PRIuPTR " total)", write_lost - *lost_reported, write_lost);
+        *lost_reported = write_lost;
+    }
+}
+
+static void* querylog_writer(void* unused V_UNUSED) {
+    const struct timespec idle = { 0, QLOG_IDLE_NSEC };
+    stats_uint_t dropped_reported = 0;
+    stats_uint_t lost_reported = 0;
+    time_t next_report = time(NULL) + QLOG_REPORT_SECS;
+
+    while(1) {
+        // sample the flag first, so that the last pass below
+        //   happens entirely after querylog_stop() was called.
+        const bool last_pass = *(volatile bool*)&writer_stopping;
+        __sync_synchronize();
+
+        bool busy = false;
+        if(!log_fp)
+            retry_open();
+        for(unsigned i = 0; i < num_rings; i++)
+            if(drain_ring(rings[i]))
+                busy = true;
+
+        if(last_pass)
+            break;
+
+        if(!busy) {
+            if(log_fp && fflush(log_fp)) {
+                log_err("query log: write to '%s' failed: %s", log_path, logf_errno());
+                fclose(log_fp);
+                log_fp = NULL;
+                next_open_retry = time(NULL) + QLOG_REPORT_SECS;
+            }
+            nanosleep(&idle, NULL);
+        }
+
+        const time_t now = time(NULL);
+        if(now >= next_report) {
+            report_losses(&dropped_reported, &lost_reported);
+            next_report = now + QLOG_REPORT_SECS;
+        }
+    }
+
+    close_log();
+    report_losses(&dropped_reported, &lost_reported);
+    return NULL;
+}
+
+void querylog_init(void) {
+    if(!gconfig.query_log)
+        return;
+
+    log_path = gdnsd_resolve_path_cfg(gconfig.query_log, NULL);
+    log_path_len = strlen(log_path);
+    rot_path = malloc(log_path_len + 12U); // ".%u" suffix
+    rot_from = malloc(log_path_len + 12U);
+    log_max_size = (uint64_t)gconfig.query_log_max_size * 1048576U;
+
+    // Never append to a previous run's file, which may end in a
+    //   partial record; start fresh and rotate the old one out.
+    rotate_files();
+    if(open_log())
+        log_fatal("query log: cannot open '%s' for writing", log_path);
+
+    unsigned size = 1U;
+    while(size < gconfig.query_log_buffer)
+        size <<= 1U;
+
+    num_rings = gconfig.num_dns_threads;
+    rings = malloc(num_rings * sizeof(qlog_ring_t*));
+    for(unsigned i = 0; i < num_rings; i++) {
+        void* mem = NULL;
+        const int pm_err = posix_memalign(&mem, QLOG_CACHELINE, sizeof(qlog_ring_t));
+        if(pm_err)
+            log_fatal("posix_memalign() failed: %s", logf_errnum(pm_err));
+        memset(mem, 0, sizeof(qlog_ring_t));
+        rings[i] = mem;
+        rings[i]->slots = malloc(size * sizeof(qlog_rec_t));
+        rings[i]->mask = size - 1U;
+    }
+
+    log_info("query log: logging to '%s', %u records buffered per thread", log_path, size);
+}
+
+void querylog_start(void) {
+    if(!rings)
+        return;
+
+    // As with the other threads, the caller has all signals blocked
+    int pthread_err = pthread_create(&writer_threadid, NULL, querylog_writer, NULL);
+    if(pthread_err)
+        log_fatal("pthread_create() of query log writer thread failed: %s", logf_errnum(pthread_err));
+    writer_started = true;
+}
+
+void querylog_stop(void) {
+    if(!writer_started)
+        return;
+
+    __sync_synchronize();
+    *(volatile bool*)&writer_stopping = true;
+    int pthread_err = pthread_join(writer_threadid, NULL);
+    if(pthread_err)
+        log_err("pthread_join() of query log writer thread failed: %s", logf_errnum(pthread_err));
+    writer_started = false;
+}
@@ -0,0 +1,99 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDNSD_QUERYLOG_H
+#define GDNSD_QUERYLOG_H
+
+#include "config.h"
+#include "gdnsd/compiler.h"
+#include "gdnsd/stats.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/*
+ * Optional binary query log.  Each DNS I/O thread owns a single-producer,
+ *   single-consumer ring of fixed-size records, which it fills in directly
+ *   after answering a query.  A dedicated writer thread drains all of the
+ *   rings to the log file, rotating it by size.  If a ring is full, the
+ *   record is dropped and counted rather than ever blocking the I/O thread.
+ *
+ * The file starts with the 8-byte magic "gdnsdQL1", followed by a stream of
+ *   qlog_rec_t exactly as laid out below.  All multi-byte integers are in
+ *   network byte order, and all fields are naturally aligned, so there is
+ *   no padding anywhere in the record.
+ */
+
+#define QLOG_MAGIC "gdnsdQL1"
+
+// qlog_rec_t.flags bits
+#define QLOG_FLAG_TCP  0x01 // query arrived over TCP (or TLS)
+#define QLOG_FLAG_EDNS 0x02 // query had a valid EDNS0 OPT RR
+#define QLOG_FLAG_ECS  0x04 // ... including a valid edns-client-subnet option
+#define QLOG_FLAG_TC   0x08 // response was truncated
+#define QLOG_FLAG_CH   0x10 // query class was CH rather than IN
+
+typedef struct {
+    uint32_t sec;            // realtime clock at response time
+    uint32_t nsec;
+    uint8_t  client[16];     // source address, IPv4 in the first 4 bytes
+    uint8_t  ecs_client[16]; // edns-client-subnet address, if QLOG_FLAG_ECS
+    uint16_t client_port;
+    uint16_t qtype;
+    uint16_t resp_len;       // response size in bytes
+    uint8_t  family;         // 4 or 6, for both addresses above
+    uint8_t  flags;          // QLOG_FLAG_*
+    uint8_t  rcode;          // response header RCODE
+    uint8_t  ecs_source;     // edns-client-subnet source netmask
+    uint8_t  ecs_scope;      // edns-client-subnet scope netmask of the response
+    uint8_t  qname_len;      // length of qname below, in wire format
+    uint8_t  qname[256];     // lowercased query name in uncompressed wire format
+} qlog_rec_t;
+
+typedef struct qlog_ring qlog_ring_t;
+
+// Reads the configuration from gconfig, and if the query log is enabled,
+//   opens the log file and allocates a ring per DNS thread.  Must be called
+//   before privileges are dropped and before the DNS threads start.
+void querylog_init(void);
+
+// Starts the writer thread, if the query log is enabled.
+void querylog_start(void);
+
+// Stops the writer thread after a final drain of all rings, and closes
+//   the log file.  Called once at shutdown.
+void querylog_stop(void);
+
+// Returns the ring for the given DNS thread number, or NULL if the query
+//   log is disabled.
+F_PURE F_WUNUSED
+qlog_ring_t* querylog_ring(const unsigned threadnum);
+
+// Reserves the next free record in the ring, for the owning thread to fill
+//   in and then publish with querylog_commit().  Returns NULL (and counts
+//   the drop) if the ring is full.
+F_NONNULL F_WUNUSED
+qlog_rec_t* querylog_reserve(qlog_ring_t* ring);
+
+// Makes the record from the last successful querylog_reserve() visible
+//   to the writer thread.
+F_NONNULL
+void querylog_commit(qlog_ring_t* ring);
+
+#endif // GDNSD_QUERYLOG_H
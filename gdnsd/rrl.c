@@ -0,0 +1,147 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "rrl.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "conf.h"
+#include "gdnsd/log.h"
+
+#define RRL_WAYS 4U
+
+typedef struct {
+    uint32_t fp;
+    uint32_t unused;
+    uint64_t tat; // GCRA theoretical arrival time of the next response
+} rrl_entry_t;
+
+typedef struct {
+    rrl_entry_t e[RRL_WAYS];
+} rrl_set_t;
+
+struct rrl {
+    rrl_set_t* sets;
+    unsigned mask;
+    unsigned slip;
+    unsigned slip_count;
+    uint32_t v4_mask;
+    uint32_t v6_mask[2]; // the first 64 bits, as two words
+    uint64_t interval;   // ns per response at rrl_rate
+    uint64_t tolerance;  // (rrl_burst - 1) * interval
+};
+
+F_CONST
+static uint32_t prefix_mask(const unsigned bits) {
+    if(!bits)
+        return 0;
+    if(bits >= 32U)
+        return 0xFFFFFFFFU;
+    return htonl(0xFFFFFFFFU << (32U - bits));
+}
+
+rrl_t* rrl_new(void) {
+    if(!gconfig.rrl_rate)
+        return NULL;
+
+    unsigned nsets = 1U;
+    while(nsets * RRL_WAYS < gconfig.rrl_table_size)
+        nsets <<= 1U;
+
+    rrl_t* r = calloc(1, sizeof(rrl_t));
+    const size_t len = nsets * sizeof(rrl_set_t);
+    if(posix_memalign((void**)&r->sets, sizeof(rrl_set_t), len))
+        log_fatal("posix_memalign() of %zu bytes for the rrl table failed", len);
+    memset(r->sets, 0, len);
+    r->mask = nsets - 1U;
+
+    const unsigned burst = gconfig.rrl_burst ? gconfig.rrl_burst : gconfig.rrl_rate;
+    r->slip = gconfig.rrl_slip;
+    r->interval = 1000000000ULL / gconfig.rrl_rate;
+    r->tolerance = (burst - 1U) * r->interval;
+    r->v4_mask = prefix_mask(gconfig.rrl_ipv4_prefix);
+    r->v6_mask[0] = prefix_mask(gconfig.rrl_ipv6_prefix);
+    r->v6_mask[1] = gconfig.rrl_ipv6_prefix > 32U ? prefix_mask(gconfig.rrl_ipv6_prefix - 32U) : 0;
+
+    return r;
+}
+
+// murmur3's finalizer
+F_CONST
+static uint32_t mix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+    return h;
+}
+
+F_NONNULL F_PURE
+static uint32_t rrl_key(const rrl_t* r, const anysin_t* asin, const unsigned rcode, const uint32_t name_hash) {
+    dmn_assert(r); dmn_assert(asin);
+
+    uint32_t h = mix32(name_hash ^ (rcode << 24));
+    if(asin->sa.sa_family == AF_INET6) {
+        const uint32_t* a = (const uint32_t*)asin->sin6.sin6_addr.s6_addr;
+        h = mix32(h ^ (a[0] & r->v6_mask[0]));
+        h = mix32(h ^ (a[1] & r->v6_mask[1]) ^ 6U);
+    }
+    else {
+        h = mix32(h ^ (asin->sin.sin_addr.s_addr & r->v4_mask));
+    }
+    return h;
+}
+
+rrl_action_t rrl_check(rrl_t* r, const anysin_t* asin, const unsigned rcode, const uint32_t name_hash, const uint64_t now) {
+    dmn_assert(r); dmn_assert(asin);
+
+    const uint32_t fp = rrl_key(r, asin, rcode, name_hash);
+    rrl_set_t* set = &r->sets[fp & r->mask];
+
+    rrl_entry_t* ent = NULL;
+    rrl_entry_t* oldest = &set->e[0];
+    for(unsigned i = 0; i < RRL_WAYS; i++) {
+        if(set->e[i].fp == fp) {
+            ent = &set->e[i];
+            break;
+        }
+        if(set->e[i].tat < oldest->tat)
+            oldest = &set->e[i];
+    }
+
+    if(!ent) {
+        oldest->fp = fp;
+        oldest->tat = now + r->interval;
+        return RRL_PASS;
+    }
+
+    if(ent->tat <= now + r->tolerance) {
+        ent->tat = (ent->tat > now ? ent->tat : now) + r->interval;
+        return RRL_PASS;
+    }
+
+    if(r->slip && ++r->slip_count >= r->slip) {
+        r->slip_count = 0;
+        return RRL_SLIP;
+    }
+    return RRL_DROP;
+}
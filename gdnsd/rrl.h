@@ -0,0 +1,66 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDNSD_RRL_H
+#define GDNSD_RRL_H
+
+#include "config.h"
+#include "gdnsd/compiler.h"
+#include "gdnsd/net.h"
+
+#include <inttypes.h>
+
+/*
+ * Response rate limiting for UDP, against reflection attacks.  Responses
+ *   are grouped by client network (rrl_ipv4_prefix/rrl_ipv6_prefix), rcode,
+ *   and a name: the query name and type for NOERROR, the zone for NXDOMAIN
+ *   (so that random names don't each get their own limit), and nothing at
+ *   all for the other rcodes.  Each group gets "rrl_rate" responses per
+ *   second with bursts of up to "rrl_burst".  Beyond that, responses are
+ *   dropped, except that every "rrl_slip"th one is slipped back as an
+ *   empty truncated response so that real clients can retry over TCP.
+ *
+ * Each UDP thread has its own fixed-size table of limits, which nothing
+ *   else ever touches.  It's organized as sets of RRL_WAYS entries, each
+ *   set a single cache line.  Each entry is just a key fingerprint and a
+ *   GCRA "theoretical arrival time", so checking a response is one hash
+ *   and one cache line.  When a set is full, the entry that's been idle
+ *   (or rather, under its limit) the longest is replaced.
+ */
+
+typedef struct rrl rrl_t;
+
+typedef enum {
+    RRL_PASS = 0,
+    RRL_DROP,
+    RRL_SLIP,
+} rrl_action_t;
+
+// Allocates the calling DNS thread's table, or returns NULL if RRL is
+//  disabled.  Only for UDP threads, as TCP clients can't be spoofed.
+F_WUNUSED
+rrl_t* rrl_new(void);
+
+// Decides what to do with a response.  "name_hash" identifies the name
+//  part of the key as described above, and "now" is any monotonic
+//  clock in nanoseconds.
+F_NONNULL F_WUNUSED
+rrl_action_t rrl_check(rrl_t* r, const anysin_t* asin, const unsigned rcode, const uint32_t name_hash, const uint64_t now);
+
+#endif // GDNSD_RRL_H
@@ -23,6 +23,9 @@
 #include <fcntl.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <stdarg.h>
 #include <sys/uio.h>
 
 #include "conf.h"
@@ -30,6 +33,8 @@
 #include "dnsio_tcp.h"
 #include "dnspacket.h"
 #include "monio.h"
+#include "topn.h"
+#include "zstats.h"
 #include "gdnsd/log.h"
 
 // Macro to add an offset to a void* portably...
@@ -41,6 +46,8 @@ typedef struct {
     stats_uint_t udp_tc;
     stats_uint_t udp_edns_big;
     stats_uint_t udp_edns_tc;
+    stats_uint_t udp_rrl_limited;
+    stats_uint_t udp_rrl_slipped;
     stats_uint_t tcp_recvfail;
     stats_uint_t tcp_sendfail;
     stats_uint_t dns_noerror;
@@ -55,6 +62,15 @@ typedef struct {
     stats_uint_t dns_edns_clientsub;
     stats_uint_t udp_reqs;
     stats_uint_t tcp_reqs;
+    stats_uint_t qtype[QTYPE_BINS];
+    stats_uint_t lat_proc[LAT_BUCKETS];
+    stats_uint_t lat_rxq[LAT_BUCKETS];
+    uint64_t proc_p50;
+    uint64_t proc_p99;
+    uint64_t proc_p999;
+    uint64_t rxq_p50;
+    uint64_t rxq_p99;
+    uint64_t rxq_p999;
 } statio_t;
 
 typedef enum {
@@ -63,23 +79,42 @@ typedef enum {
     READING_JUNK
 } http_state_t;
 
+// A rendered /metrics body.  It's shared by all of the connections
+//  writing it out, and is re-rendered at most once per metrics_cache
+//  seconds.  A rendering that has been replaced is freed when the
+//  last connection writing from it is done.
+typedef struct {
+    char* buf;
+    unsigned len;
+    unsigned refs;
+    ev_tstamp rendered;
+} metrics_body_t;
+
+// Requests (request line and headers) larger than this are answered
+//  based on the request line alone, and the connection is closed after
+//  the response as in the non-persistent case below.
+#define REQ_BUFSIZE 1024U
+
 typedef struct {
     anysin_t* asin;
-    char read_buffer[9];
+    char read_buffer[REQ_BUFSIZE];
     struct iovec outbufs[2];
     char* hdr_buf;
     char* data_buf;
+    unsigned data_buf_size;
+    metrics_body_t* metrics;
     ev_io* read_watcher;
     ev_io* write_watcher;
     ev_timer* timeout_watcher;
     unsigned read_done;
     http_state_t state;
+    bool keepalive;
 } http_data_t;
 
-// After reading the first 8 bytes of the request (all we care
-//  about), we send the response and then linger
-//  draining the remaining input in JUNK_SIZE chunks before
-//  the final SHUT_RDWR/close().  junk_buffer should be per-
+// After reading a whole request, we send the response.  If the connection
+//  is persistent (HTTP/1.1 keep-alive) we go back to reading the next
+//  request.  Otherwise we linger draining the remaining input in JUNK_SIZE
+//  chunks before the final SHUT_RDWR/close().  junk_buffer should be per-
 //  thread, but there's only one statio thread and it doesn't
 //  matter if multiple connections step all over each other writing
 //  to this.
@@ -91,27 +126,31 @@ static char* junk_buffer;
 static const char log_dns[] =
     "noerror:%" PRIuPTR " refused:%" PRIuPTR " nxdomain:%" PRIuPTR " notimp:%" PRIuPTR " badvers:%" PRIuPTR " formerr:%" PRIuPTR " dropped:%" PRIuPTR " v6:%" PRIuPTR " edns:%" PRIuPTR " edns_clientsub:%" PRIuPTR;
 static const char log_udp[] =
-    "udp_reqs:%" PRIuPTR " udp_recvfail:%" PRIuPTR " udp_sendfail:%" PRIuPTR " udp_tc:%" PRIuPTR " udp_edns_big:%" PRIuPTR " udp_edns_tc:%" PRIuPTR;
+    "udp_reqs:%" PRIuPTR " udp_recvfail:%" PRIuPTR " udp_sendfail:%" PRIuPTR " udp_tc:%" PRIuPTR " udp_edns_big:%" PRIuPTR " udp_edns_tc:%" PRIuPTR " udp_rrl_limited:%" PRIuPTR " udp_rrl_slipped:%" PRIuPTR;
 static const char log_tcp[] =
     "tcp_reqs:%" PRIuPTR " tcp_recvfail:%" PRIuPTR " tcp_sendfail:%" PRIuPTR;
+static const char log_lat[] =
+    "proc_p50_ns:%" PRIu64 " proc_p99_ns:%" PRIu64 " proc_p999_ns:%" PRIu64 " rxq_p50_ns:%" PRIu64 " rxq_p99_ns:%" PRIu64 " rxq_p999_ns:%" PRIu64;
 
 static const char http_404_hdr[] =
-    "HTTP/1.0 404 Not Found\r\n"
+    "HTTP/1.1 404 Not Found\r\n"
     "Server: " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n"
     "Content-type: text/plain; charset=utf-8\r\n"
-    "Content-length: 11\r\n\r\n";
+    "Content-length: 11\r\n"
+    "Connection: close\r\n\r\n";
 
 static const char http_404_data[] = "Not Found\r\n";
 
 static const char http_headers[] =
-    "HTTP/1.0 200 OK\r\n"
+    "HTTP/1.1 200 OK\r\n"
     "Server: " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n"
     "Pragma: no-cache\r\n"
     "Expires: Sat, 26 Jul 1997 05:00:00 GMT\r\n"
     "Cache-Control: no-store, no-cache, must-revalidate, post-check=0, pre-check=0, max-age=0\r\n"
     "Refresh: 60\r\n"
     "Content-type: %s; charset=utf-8\r\n"
-    "Content-length: %i\r\n\r\n";
+    "Content-length: %i\r\n"
+    "Connection: %s\r\n\r\n";
 
 static const char csv_fixed[] =
     "uptime\r\n"
@@ -121,7 +160,11 @@ static const char csv_fixed[] =
     "udp_reqs,udp_recvfail,udp_sendfail,udp_tc,udp_edns_big,udp_edns_tc\r\n"
     "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n"
     "tcp_reqs,tcp_recvfail,tcp_sendfail\r\n"
-    "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n";
+    "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n"
+    "proc_p50_ns,proc_p99_ns,proc_p999_ns,rxq_p50_ns,rxq_p99_ns,rxq_p999_ns\r\n"
+    "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\r\n"
+    "udp_rrl_limited,udp_rrl_slipped\r\n"
+    "%" PRIuPTR ",%" PRIuPTR "\r\n";
 
 static const char json_fixed[] =
     "{\r\n"
@@ -144,12 +187,22 @@ static const char json_fixed[] =
     "\t\t\"sendfail\": %" PRIuPTR ",\r\n"
     "\t\t\"tc\": %" PRIuPTR ",\r\n"
     "\t\t\"edns_big\": %" PRIuPTR ",\r\n"
-    "\t\t\"edns_tc\": %" PRIuPTR "\r\n"
+    "\t\t\"edns_tc\": %" PRIuPTR ",\r\n"
+    "\t\t\"rrl_limited\": %" PRIuPTR ",\r\n"
+    "\t\t\"rrl_slipped\": %" PRIuPTR "\r\n"
     "\t},\r\n"
     "\t\"tcp\": {\r\n"
     "\t\t\"reqs\": %" PRIuPTR ",\r\n"
     "\t\t\"recvfail\": %" PRIuPTR ",\r\n"
     "\t\t\"sendfail\": %" PRIuPTR "\r\n"
+    "\t},\r\n"
+    "\t\"latency\": {\r\n"
+    "\t\t\"proc_p50_ns\": %" PRIu64 ",\r\n"
+    "\t\t\"proc_p99_ns\": %" PRIu64 ",\r\n"
+    "\t\t\"proc_p999_ns\": %" PRIu64 ",\r\n"
+    "\t\t\"rxq_p50_ns\": %" PRIu64 ",\r\n"
+    "\t\t\"rxq_p99_ns\": %" PRIu64 ",\r\n"
+    "\t\t\"rxq_p999_ns\": %" PRIu64 "\r\n"
     "\t}";
 
 static const char json_footer[] = "}\r\n";
@@ -175,18 +228,110 @@ static const char html_fixed[] =
     "<tr><th>noerror</th><th>refused</th><th>nxdomain</th><th>notimp</th><th>badvers</th><th>formerr</th><th>dropped</th><th>v6</th><th>edns</th><th>edns_clientsub</th></tr>\r\n"
     "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
     "</table><table>\r\n"
-    "<tr><th>udp_reqs</th><th>udp_recvfail</th><th>udp_sendfail</th><th>udp_tc</th><th>udp_edns_big</th><th>udp_edns_tc</th></tr>\r\n"
-    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "<tr><th>udp_reqs</th><th>udp_recvfail</th><th>udp_sendfail</th><th>udp_tc</th><th>udp_edns_big</th><th>udp_edns_tc</th><th>udp_rrl_limited</th><th>udp_rrl_slipped</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
     "</table><table>\r\n"
     "<tr><th>tcp_reqs</th><th>tcp_recvfail</th><th>tcp_sendfail</th></tr>\r\n"
     "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>proc_p50_ns</th><th>proc_p99_ns</th><th>proc_p999_ns</th><th>rxq_p50_ns</th><th>rxq_p99_ns</th><th>rxq_p999_ns</th></tr>\r\n"
+    "<tr><td>%" PRIu64 "</td><td>%" PRIu64 "</td><td>%" PRIu64 "</td><td>%" PRIu64 "</td><td>%" PRIu64 "</td><td>%" PRIu64 "</td></tr>\r\n"
     "</table>\r\n";
 
+// Query type counts, one per qtype_bin_names[] entry
+static const char json_qtypes_head[] = ",\r\n\t\"qtypes\": {";
+static const char json_qtype[] = "%s\r\n\t\t\"%s\": %" PRIuPTR;
+static const char json_qtypes_foot[] = "\r\n\t}";
+static const char html_qtypes_head[] = "<table>\r\n<tr>";
+static const char html_qtype_th[] = "<th>%s</th>";
+static const char html_qtypes_mid[] = "</tr>\r\n<tr>";
+static const char html_qtype_td[] = "<td>%" PRIuPTR "</td>";
+static const char html_qtypes_foot[] = "</tr>\r\n</table>\r\n";
+
+// Longest qtype_bin_names[] entry
+#define QTYPE_NAME_MAX 6U
+
 static const char html_footer[] =
     "<p>For machine-readable CSV output, use <a href='/csv'>/csv</a></p>\r\n"
     "<p>For machine-readable JSON output, use <a href='/json'>/json</a></p>\r\n"
+    "<p>For Prometheus, use <a href='/metrics'>/metrics</a></p>\r\n"
     "</body></html>\r\n";
 
+// Prometheus text exposition format, for /metrics.  Per-thread counters
+//  are labeled with the DNS I/O thread number and its protocol.
+
+// The longest possible line of our output below, other than monio's
+#define PROM_LINE_MAX 128U
+
+static const char prom_uptime[] =
+    "# HELP gdnsd_uptime_seconds Time since the daemon started\n"
+    "# TYPE gdnsd_uptime_seconds gauge\n"
+    "gdnsd_uptime_seconds %" PRIu64 "\n";
+
+static const char prom_family[] = "# HELP %s %s\n# TYPE %s %s\n";
+static const char prom_thread_result[] = "%s{thread=\"%u\",proto=\"%s\",result=\"%s\"} %" PRIuPTR "\n";
+static const char prom_thread[] = "%s{thread=\"%u\",proto=\"%s\"} %" PRIuPTR "\n";
+static const char prom_bucket[] = "%s_bucket{le=\"%.10g\"} %" PRIu64 "\n";
+static const char prom_bucket_inf[] = "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n%s_count %" PRIu64 "\n";
+
+#define DNSSTAT(_x) offsetof(dnspacket_stats_t, _x)
+
+// All of these together are the DNS-layer request count
+static const struct {
+    const char* result;
+    size_t offset;
+} prom_results[] = {
+    { "noerror",  DNSSTAT(noerror) },
+    { "refused",  DNSSTAT(refused) },
+    { "nxdomain", DNSSTAT(nxdomain) },
+    { "notimp",   DNSSTAT(notimp) },
+    { "badvers",  DNSSTAT(badvers) },
+    { "formerr",  DNSSTAT(formerr) },
+    { "dropped",  DNSSTAT(dropped) },
+};
+#define NUM_PROM_RESULTS (sizeof(prom_results) / sizeof(prom_results[0]))
+
+typedef enum {
+    PROM_ALL = 0,
+    PROM_UDP,
+    PROM_TCP, // TCP and TLS
+} prom_threads_t;
+
+static const struct {
+    const char* name;
+    const char* help;
+    size_t offset;
+    prom_threads_t threads;
+} prom_counters[] = {
+    { "gdnsd_dns_v6_total", "DNS requests from IPv6 clients", DNSSTAT(v6), PROM_ALL },
+    { "gdnsd_dns_edns_total", "DNS requests with an EDNS OPT RR", DNSSTAT(edns), PROM_ALL },
+    { "gdnsd_dns_edns_clientsub_total", "DNS requests with the edns-client-subnet option", DNSSTAT(edns_clientsub), PROM_ALL },
+    { "gdnsd_udp_recvfail_total", "UDP receive errors", DNSSTAT(udp.recvfail), PROM_UDP },
+    { "gdnsd_udp_sendfail_total", "UDP send errors", DNSSTAT(udp.sendfail), PROM_UDP },
+    { "gdnsd_udp_tc_total", "Non-EDNS UDP responses truncated", DNSSTAT(udp.tc), PROM_UDP },
+    { "gdnsd_udp_edns_big_total", "EDNS UDP responses larger than 512 bytes", DNSSTAT(udp.edns_big), PROM_UDP },
+    { "gdnsd_udp_edns_tc_total", "EDNS UDP responses truncated", DNSSTAT(udp.edns_tc), PROM_UDP },
+    { "gdnsd_udp_rrl_limited_total", "UDP responses over the rate limit", DNSSTAT(udp.rrl_limited), PROM_UDP },
+    { "gdnsd_udp_rrl_slipped_total", "UDP responses over the rate limit sent truncated", DNSSTAT(udp.rrl_slipped), PROM_UDP },
+    { "gdnsd_tcp_recvfail_total", "TCP receive errors", DNSSTAT(tcp.recvfail), PROM_TCP },
+    { "gdnsd_tcp_sendfail_total", "TCP send errors", DNSSTAT(tcp.sendfail), PROM_TCP },
+};
+#define NUM_PROM_COUNTERS (sizeof(prom_counters) / sizeof(prom_counters[0]))
+
+// Latency histograms, summed over threads, with one Prometheus bucket
+//  per power of two of our internal buckets
+static const struct {
+    const char* name;
+    const char* help;
+    size_t offset;
+    prom_threads_t threads;
+} prom_hists[] = {
+    { "gdnsd_dns_processing_seconds", "Time spent answering DNS requests", DNSSTAT(lat_proc), PROM_ALL },
+    { "gdnsd_udp_rx_queue_seconds", "Time UDP requests spent queued in the kernel", DNSSTAT(lat_rxq), PROM_UDP },
+};
+#define NUM_PROM_HISTS (sizeof(prom_hists) / sizeof(prom_hists[0]))
+#define PROM_HIST_LINES ((LAT_BUCKETS >> LAT_SUB_BITS) + 1U)
+
 static time_t start_time;
 static time_t pop_statio_time = 0;
 static ev_timer* log_watcher = NULL;
@@ -196,6 +341,8 @@ static unsigned num_lsocks;
 static unsigned num_conn_watchers = 0;
 static unsigned data_buffer_size = 0;
 static unsigned hdr_buffer_size = 0;
+static unsigned metrics_buffer_size = 0;
+static metrics_body_t* metrics_cur = NULL;
 static statio_t statio;
 
 static void accumulate_statio(unsigned threadnum) {
@@ -227,6 +374,8 @@ static void accumulate_statio(unsigned threadnum) {
         statio.udp_tc       += stats_get(&this_stats->udp.tc);
         statio.udp_edns_big += stats_get(&this_stats->udp.edns_big);
         statio.udp_edns_tc  += stats_get(&this_stats->udp.edns_tc);
+        statio.udp_rrl_limited += stats_get(&this_stats->udp.rrl_limited);
+        statio.udp_rrl_slipped += stats_get(&this_stats->udp.rrl_slipped);
     }
     else {
         statio.tcp_reqs     += this_reqs;
@@ -237,6 +386,38 @@ static void accumulate_statio(unsigned threadnum) {
     statio.dns_v6             += stats_get(&this_stats->v6);
     statio.dns_edns           += stats_get(&this_stats->edns);
     statio.dns_edns_clientsub += stats_get(&this_stats->edns_clientsub);
+
+    for(unsigned i = 0; i < QTYPE_BINS; i++)
+        statio.qtype[i] += stats_get(&this_stats->qtype[i]);
+
+    for(unsigned i = 0; i < LAT_BUCKETS; i++) {
+        statio.lat_proc[i] += stats_get(&this_stats->lat_proc[i]);
+        statio.lat_rxq[i]  += stats_get(&this_stats->lat_rxq[i]);
+    }
+}
+
+// Returns the upper bound of the histogram bucket containing the given
+//  quantile (in parts per thousand), or zero for an empty histogram
+F_NONNULL F_PURE
+static uint64_t lat_quantile(const stats_uint_t* hist, const unsigned permille) {
+    dmn_assert(hist);
+
+    uint64_t total = 0;
+    for(unsigned i = 0; i < LAT_BUCKETS; i++)
+        total += hist[i];
+    if(!total)
+        return 0;
+
+    const uint64_t want = (total * permille + 999U) / 1000U;
+    uint64_t seen = 0;
+    unsigned i = 0;
+    while(i < LAT_BUCKETS - 1U) {
+        seen += hist[i];
+        if(seen >= want)
+            break;
+        i++;
+    }
+    return lat_bucket_max(i);
 }
 
 static void populate_stats(void) {
@@ -247,6 +428,13 @@ static void populate_stats(void) {
         const unsigned nio = gconfig.num_dns_threads;
         for(unsigned i = 0; i < nio; i++)
             accumulate_statio(i);
+
+        statio.proc_p50  = lat_quantile(statio.lat_proc, 500U);
+        statio.proc_p99  = lat_quantile(statio.lat_proc, 990U);
+        statio.proc_p999 = lat_quantile(statio.lat_proc, 999U);
+        statio.rxq_p50   = lat_quantile(statio.lat_rxq, 500U);
+        statio.rxq_p99   = lat_quantile(statio.lat_rxq, 990U);
+        statio.rxq_p999  = lat_quantile(statio.lat_rxq, 999U);
         pop_statio_time = now;
     }
     dmn_assert(pop_statio_time >= start_time);
@@ -284,41 +472,94 @@ void statio_log_uptime(void) {
 void statio_log_stats(void) {
     populate_stats();
     log_info(log_dns, statio.dns_noerror, statio.dns_refused, statio.dns_nxdomain, statio.dns_notimp, statio.dns_badvers, statio.dns_formerr, statio.dns_dropped, statio.dns_v6, statio.dns_edns, statio.dns_edns_clientsub);
-    log_info(log_udp, statio.udp_reqs, statio.udp_recvfail, statio.udp_sendfail, statio.udp_tc, statio.udp_edns_big, statio.udp_edns_tc);
+    log_info(log_udp, statio.udp_reqs, statio.udp_recvfail, statio.udp_sendfail, statio.udp_tc, statio.udp_edns_big, statio.udp_edns_tc, statio.udp_rrl_limited, statio.udp_rrl_slipped);
     log_info(log_tcp, statio.tcp_reqs, statio.tcp_recvfail, statio.tcp_sendfail);
+    log_info(log_lat, statio.proc_p50, statio.proc_p99, statio.proc_p999, statio.rxq_p50, statio.rxq_p99, statio.rxq_p999);
 }
 
 F_NONNULL
-static void statio_fill_outbuf_csv(struct iovec* outbufs) {
-    dmn_assert(outbufs);
+static unsigned qtypes_out_csv(char* buf) {
+    dmn_assert(buf);
+
+    char* p = buf;
+    for(unsigned i = 0; i < QTYPE_BINS; i++)
+        p += sprintf(p, "%s%s", i ? "," : "", qtype_bin_names[i]);
+    p += sprintf(p, "\r\n");
+    for(unsigned i = 0; i < QTYPE_BINS; i++)
+        p += sprintf(p, "%s%" PRIuPTR, i ? "," : "", statio.qtype[i]);
+    p += sprintf(p, "\r\n");
+    return p - buf;
+}
+
+F_NONNULL
+static unsigned qtypes_out_json(char* buf) {
+    dmn_assert(buf);
+
+    char* p = buf;
+    memcpy(p, json_qtypes_head, sizeof(json_qtypes_head) - 1U);
+    p += sizeof(json_qtypes_head) - 1U;
+    for(unsigned i = 0; i < QTYPE_BINS; i++)
+        p += sprintf(p, json_qtype, i ? "," : "", qtype_bin_names[i], statio.qtype[i]);
+    memcpy(p, json_qtypes_foot, sizeof(json_qtypes_foot) - 1U);
+    p += sizeof(json_qtypes_foot) - 1U;
+    return p - buf;
+}
+
+F_NONNULL
+static unsigned qtypes_out_html(char* buf) {
+    dmn_assert(buf);
+
+    char* p = buf;
+    memcpy(p, html_qtypes_head, sizeof(html_qtypes_head) - 1U);
+    p += sizeof(html_qtypes_head) - 1U;
+    for(unsigned i = 0; i < QTYPE_BINS; i++)
+        p += sprintf(p, html_qtype_th, qtype_bin_names[i]);
+    memcpy(p, html_qtypes_mid, sizeof(html_qtypes_mid) - 1U);
+    p += sizeof(html_qtypes_mid) - 1U;
+    for(unsigned i = 0; i < QTYPE_BINS; i++)
+        p += sprintf(p, html_qtype_td, statio.qtype[i]);
+    memcpy(p, html_qtypes_foot, sizeof(html_qtypes_foot) - 1U);
+    p += sizeof(html_qtypes_foot) - 1U;
+    return p - buf;
+}
+
+F_NONNULL
+static void statio_fill_outbuf_csv(struct iovec* outbufs, const char* conn_hdr) {
+    dmn_assert(outbufs); dmn_assert(conn_hdr);
     populate_stats();
 
     dmn_assert(pop_statio_time >= start_time);
 
-    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, csv_fixed, (uint64_t)pop_statio_time - start_time, statio.dns_noerror, statio.dns_refused, statio.dns_nxdomain, statio.dns_notimp, statio.dns_badvers, statio.dns_formerr, statio.dns_dropped, statio.dns_v6, statio.dns_edns, statio.dns_edns_clientsub, statio.udp_reqs, statio.udp_recvfail, statio.udp_sendfail, statio.udp_tc, statio.udp_edns_big, statio.udp_edns_tc, statio.tcp_reqs, statio.tcp_recvfail, statio.tcp_sendfail);
+    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, csv_fixed, (uint64_t)pop_statio_time - start_time, statio.dns_noerror, statio.dns_refused, statio.dns_nxdomain, statio.dns_notimp, statio.dns_badvers, statio.dns_formerr, statio.dns_dropped, statio.dns_v6, statio.dns_edns, statio.dns_edns_clientsub, statio.udp_reqs, statio.udp_recvfail, statio.udp_sendfail, statio.udp_tc, statio.udp_edns_big, statio.udp_edns_tc, statio.tcp_reqs, statio.tcp_recvfail, statio.tcp_sendfail, statio.proc_p50, statio.proc_p99, statio.proc_p999, statio.rxq_p50, statio.rxq_p99, statio.rxq_p999, statio.udp_rrl_limited, statio.udp_rrl_slipped);
 
     outbufs[1].iov_len += monio_stats_out_csv(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
-    outbufs[0].iov_len = snprintf(outbufs[0].iov_base, hdr_buffer_size, http_headers, "text/plain", (unsigned)outbufs[1].iov_len);
+    // newer sections go after the original ones, so they don't move
+    outbufs[1].iov_len += qtypes_out_csv(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
+    outbufs[1].iov_len += zstats_out_csv(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
+    outbufs[0].iov_len = snprintf(outbufs[0].iov_base, hdr_buffer_size, http_headers, "text/plain", (unsigned)outbufs[1].iov_len, conn_hdr);
 }
 
 F_NONNULL
-static void statio_fill_outbuf_json(struct iovec* outbufs) {
-    dmn_assert(outbufs);
+static void statio_fill_outbuf_json(struct iovec* outbufs, const char* conn_hdr) {
+    dmn_assert(outbufs); dmn_assert(conn_hdr);
     populate_stats();
 
     dmn_assert(pop_statio_time >= start_time);
 
-    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, json_fixed, (uint64_t)pop_statio_time - start_time, statio.dns_noerror, statio.dns_refused, statio.dns_nxdomain, statio.dns_notimp, statio.dns_badvers, statio.dns_formerr, statio.dns_dropped, statio.dns_v6, statio.dns_edns, statio.dns_edns_clientsub, statio.udp_reqs, statio.udp_recvfail, statio.udp_sendfail, statio.udp_tc, statio.udp_edns_big, statio.udp_edns_tc, statio.tcp_reqs, statio.tcp_recvfail, statio.tcp_sendfail);
+    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, json_fixed, (uint64_t)pop_statio_time - start_time, statio.dns_noerror, statio.dns_refused, statio.dns_nxdomain, statio.dns_notimp, statio.dns_badvers, statio.dns_formerr, statio.dns_dropped, statio.dns_v6, statio.dns_edns, statio.dns_edns_clientsub, statio.udp_reqs, statio.udp_recvfail, statio.udp_sendfail, statio.udp_tc, statio.udp_edns_big, statio.udp_edns_tc, statio.udp_rrl_limited, statio.udp_rrl_slipped, statio.tcp_reqs, statio.tcp_recvfail, statio.tcp_sendfail, statio.proc_p50, statio.proc_p99, statio.proc_p999, statio.rxq_p50, statio.rxq_p99, statio.rxq_p999);
 
+    outbufs[1].iov_len += qtypes_out_json(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
+    outbufs[1].iov_len += zstats_out_json(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
+    outbufs[1].iov_len += topn_out_json(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
     outbufs[1].iov_len += monio_stats_out_json(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
     memcpy(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len), json_footer, (sizeof(json_footer)) - 1);
     outbufs[1].iov_len += (sizeof(json_footer)-1);
-    outbufs[0].iov_len = snprintf(outbufs[0].iov_base, hdr_buffer_size, http_headers, "application/json", (unsigned)outbufs[1].iov_len);
+    outbufs[0].iov_len = snprintf(outbufs[0].iov_base, hdr_buffer_size, http_headers, "application/json", (unsigned)outbufs[1].iov_len, conn_hdr);
 }
 
 F_NONNULL
-static void statio_fill_outbuf_html(struct iovec* outbufs) {
-    dmn_assert(outbufs);
+static void statio_fill_outbuf_html(struct iovec* outbufs, const char* conn_hdr) {
+    dmn_assert(outbufs); dmn_assert(conn_hdr);
     populate_stats();
 
     struct tm now_tm;
@@ -329,12 +570,15 @@ static void statio_fill_outbuf_html(struct iovec* outbufs) {
     if(!asctime_r(&now_tm, now_char))
         log_fatal("asctime_r() failed");
 
-    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, html_fixed, now_char, fmt_uptime(pop_statio_time), statio.dns_noerror, statio.dns_refused, statio.dns_nxdomain, statio.dns_notimp, statio.dns_badvers, statio.dns_formerr, statio.dns_dropped, statio.dns_v6, statio.dns_edns, statio.dns_edns_clientsub, statio.udp_reqs, statio.udp_recvfail, statio.udp_sendfail, statio.udp_tc, statio.udp_edns_big, statio.udp_edns_tc, statio.tcp_reqs, statio.tcp_recvfail, statio.tcp_sendfail);
+    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, html_fixed, now_char, fmt_uptime(pop_statio_time), statio.dns_noerror, statio.dns_refused, statio.dns_nxdomain, statio.dns_notimp, statio.dns_badvers, statio.dns_formerr, statio.dns_dropped, statio.dns_v6, statio.dns_edns, statio.dns_edns_clientsub, statio.udp_reqs, statio.udp_recvfail, statio.udp_sendfail, statio.udp_tc, statio.udp_edns_big, statio.udp_edns_tc, statio.udp_rrl_limited, statio.udp_rrl_slipped, statio.tcp_reqs, statio.tcp_recvfail, statio.tcp_sendfail, statio.proc_p50, statio.proc_p99, statio.proc_p999, statio.rxq_p50, statio.rxq_p99, statio.rxq_p999);
 
+    outbufs[1].iov_len += qtypes_out_html(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
+    outbufs[1].iov_len += topn_out_html(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
     outbufs[1].iov_len += monio_stats_out_html(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
+    outbufs[1].iov_len += zstats_out_html(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
     memcpy(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len), html_footer, (sizeof(html_footer)) - 1);
     outbufs[1].iov_len += (sizeof(html_footer)-1);
-    outbufs[0].iov_len = snprintf(outbufs[0].iov_base, hdr_buffer_size, http_headers, "application/xhtml+xml", (unsigned)outbufs[1].iov_len);
+    outbufs[0].iov_len = snprintf(outbufs[0].iov_base, hdr_buffer_size, http_headers, "application/xhtml+xml", (unsigned)outbufs[1].iov_len, conn_hdr);
 }
 
 // Could be merged to a single iov, but this keeps things
@@ -349,23 +593,259 @@ static void statio_fill_outbuf_404(struct iovec* outbufs) {
     outbufs[1].iov_base = (char*)http_404_data;
 }
 
+static bool thread_matches(const unsigned threadnum, const prom_threads_t which) {
+    const dns_thread_t* t = &gconfig.dns_threads[threadnum];
+    return which == PROM_ALL || (which == PROM_UDP) == t->is_udp;
+}
+
+F_PURE
+static const char* thread_proto(const unsigned threadnum) {
+    const dns_thread_t* t = &gconfig.dns_threads[threadnum];
+    return t->is_udp ? "udp" : t->is_tls ? "tls" : "tcp";
+}
+
+static stats_uint_t thread_stat(const unsigned threadnum, const size_t offset) {
+    dnspacket_stats_t* this_stats = dnspacket_stats[threadnum];
+    dmn_assert(this_stats);
+    return stats_get((stats_t*)ADDVOID(this_stats, offset));
+}
+
+F_NONNULLX(1, 2) DMN_F_PRINTF(2, 3)
+static void prom_out(metrics_body_t* mb, const char* fmt, ...) {
+    dmn_assert(mb); dmn_assert(fmt);
+
+    const unsigned avail = metrics_buffer_size - mb->len;
+    va_list ap;
+    va_start(ap, fmt);
+    const int written = vsnprintf(&mb->buf[mb->len], avail, fmt, ap);
+    va_end(ap);
+    if(unlikely(written < 0 || (unsigned)written >= avail))
+        log_fatal("BUG: metrics buffer miscalculated");
+    mb->len += written;
+}
+
+F_NONNULL
+static void render_metrics(metrics_body_t* mb) {
+    dmn_assert(mb);
+
+    const unsigned nio = gconfig.num_dns_threads;
+    const time_t now = time(NULL);
+    dmn_assert(now >= start_time);
+
+    mb->len = 0;
+    prom_out(mb, prom_uptime, (uint64_t)now - start_time);
+
+    prom_out(mb, prom_family, "gdnsd_dns_requests_total", "DNS requests by result, which is the response RCODE or dropped", "gdnsd_dns_requests_total", "counter");
+    for(unsigned i = 0; i < nio; i++)
+        for(unsigned j = 0; j < NUM_PROM_RESULTS; j++)
+            prom_out(mb, prom_thread_result, "gdnsd_dns_requests_total", i, thread_proto(i), prom_results[j].result, thread_stat(i, prom_results[j].offset));
+
+    for(unsigned c = 0; c < NUM_PROM_COUNTERS; c++) {
+        prom_out(mb, prom_family, prom_counters[c].name, prom_counters[c].help, prom_counters[c].name, "counter");
+        for(unsigned i = 0; i < nio; i++)
+            if(thread_matches(i, prom_counters[c].threads))
+                prom_out(mb, prom_thread, prom_counters[c].name, i, thread_proto(i), thread_stat(i, prom_counters[c].offset));
+    }
+
+    for(unsigned h = 0; h < NUM_PROM_HISTS; h++) {
+        stats_uint_t hist[LAT_BUCKETS];
+        memset(hist, 0, sizeof(hist));
+        for(unsigned i = 0; i < nio; i++)
+            if(thread_matches(i, prom_hists[h].threads))
+                for(unsigned b = 0; b < LAT_BUCKETS; b++)
+                    hist[b] += thread_stat(i, prom_hists[h].offset + (b * sizeof(stats_t)));
+
+        // The last internal bucket also holds everything too large to
+        //  bucket properly, so it only shows up in +Inf
+        prom_out(mb, prom_family, prom_hists[h].name, prom_hists[h].help, prom_hists[h].name, "histogram");
+        uint64_t cumulative = 0;
+        for(unsigned b = 0; b < LAT_BUCKETS - 1U; b++) {
+            cumulative += hist[b];
+            if((b & ((1U << LAT_SUB_BITS) - 1U)) == ((1U << LAT_SUB_BITS) - 1U))
+                prom_out(mb, prom_bucket, prom_hists[h].name, (lat_bucket_max(b) + 1U) / 1e9, cumulative);
+        }
+        cumulative += hist[LAT_BUCKETS - 1U];
+        prom_out(mb, prom_bucket_inf, prom_hists[h].name, cumulative, prom_hists[h].name, cumulative);
+    }
+
+    mb->len += monio_stats_out_prom(&mb->buf[mb->len]);
+}
+
+F_NONNULL
+static void metrics_release(metrics_body_t* mb) {
+    dmn_assert(mb);
+    dmn_assert(mb->refs);
+
+    if(!--mb->refs) {
+        free(mb->buf);
+        free(mb);
+    }
+}
+
+F_NONNULL
+static void statio_fill_outbuf_metrics(struct ev_loop* loop, http_data_t* tdata, const char* conn_hdr) {
+    dmn_assert(loop); dmn_assert(tdata); dmn_assert(conn_hdr);
+
+    const ev_tstamp now = ev_now(loop);
+    if(!metrics_cur || gconfig.realtime_stats || now - metrics_cur->rendered >= gconfig.metrics_cache) {
+        // Re-render in place unless some connection is still writing it out
+        if(!metrics_cur || metrics_cur->refs > 1) {
+            if(metrics_cur)
+                metrics_release(metrics_cur);
+            metrics_cur = malloc(sizeof(metrics_body_t));
+            metrics_cur->buf = malloc(metrics_buffer_size);
+            metrics_cur->refs = 1; // for metrics_cur itself
+        }
+        render_metrics(metrics_cur);
+        metrics_cur->rendered = now;
+    }
+
+    metrics_cur->refs++;
+    tdata->metrics = metrics_cur;
+
+    struct iovec* outbufs = tdata->outbufs;
+    outbufs[1].iov_base = metrics_cur->buf;
+    outbufs[1].iov_len = metrics_cur->len;
+    outbufs[0].iov_len = snprintf(outbufs[0].iov_base, hdr_buffer_size, http_headers, "text/plain; version=0.0.4", (unsigned)outbufs[1].iov_len, conn_hdr);
+}
+
 F_NONNULL
 static void log_watcher_cb(struct ev_loop* loop V_UNUSED, ev_timer* t V_UNUSED, int revents V_UNUSED) {
     dmn_assert(loop); dmn_assert(t);
     statio_log_stats();
 }
 
+// Returns the length of the complete request at the start of the
+//  (NUL-terminated) buffer, including the blank line ending its headers,
+//  or zero if we don't have all of it yet.  A request line without an
+//  HTTP version (HTTP/0.9) is a complete request by itself.
+F_NONNULL F_PURE
+static unsigned request_len(const char* buf) {
+    dmn_assert(buf);
+
+    const char* eol = strchr(buf, '\n');
+    if(!eol)
+        return 0;
+
+    const char* vers = strstr(buf, " HTTP/");
+    if(!vers || vers > eol)
+        return (eol - buf) + 1U;
+
+    const char* crlf_end = strstr(eol, "\n\r\n");
+    const char* lf_end = strstr(eol, "\n\n");
+    if(crlf_end && (!lf_end || crlf_end < lf_end))
+        return (crlf_end - buf) + 3U;
+    if(lf_end)
+        return (lf_end - buf) + 2U;
+    return 0;
+}
+
+// HTTP/1.1 connections are persistent unless the client says otherwise,
+//  and older ones only if the client asks for it.
+F_NONNULL F_PURE
+static bool want_keepalive(const char* req, const unsigned len) {
+    dmn_assert(req);
+
+    const char* end = req + len;
+    const char* eol = memchr(req, '\n', len);
+    dmn_assert(eol);
+
+    const char* vers_end = (eol > req && eol[-1] == '\r') ? eol - 1 : eol;
+    bool keepalive = (vers_end - req) >= 8 && !memcmp(vers_end - 8, "HTTP/1.1", 8);
+
+    const char* line = eol + 1;
+    while(line < end) {
+        const char* next = memchr(line, '\n', end - line);
+        if(!next)
+            break;
+        if((next - line) > 11 && !strncasecmp(line, "Connection:", 11)) {
+            const char* val = line + 11;
+            while(*val == ' ' || *val == '\t')
+                val++;
+            if(!strncasecmp(val, "close", 5))
+                keepalive = false;
+            else if(!strncasecmp(val, "keep-alive", 10))
+                keepalive = true;
+        }
+        line = next + 1;
+    }
+
+    return keepalive;
+}
+
+// The per-zone stats come and go with the zones, so the data buffer
+//  is grown as necessary to fit them before each stats response
 F_NONNULL
-static void process_http_query(char* inbuffer, struct iovec* outbufs) {
-    dmn_assert(inbuffer); dmn_assert(outbufs);
-    if(!memcmp(inbuffer, "GET / ", 6))
-        statio_fill_outbuf_html(outbufs);
-    else if(!memcmp(inbuffer, "GET /csv", 8))
-        statio_fill_outbuf_csv(outbufs);
-    else if(!memcmp(inbuffer, "GET /json", 9))
-        statio_fill_outbuf_json(outbufs);
-    else
+static void size_data_buf(http_data_t* tdata) {
+    dmn_assert(tdata);
+
+    zstats_populate();
+    const unsigned want = data_buffer_size + zstats_get_max_out_len();
+    if(want > tdata->data_buf_size) {
+        free(tdata->data_buf);
+        tdata->data_buf = tdata->outbufs[1].iov_base = malloc(want);
+        tdata->data_buf_size = want;
+    }
+}
+
+F_NONNULL
+static void process_http_query(struct ev_loop* loop, http_data_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+
+    const char* inbuffer = tdata->read_buffer;
+    struct iovec* outbufs = tdata->outbufs;
+    const char* conn_hdr = tdata->keepalive ? "keep-alive" : "close";
+
+    if(!memcmp(inbuffer, "GET / ", 6)) {
+        size_data_buf(tdata);
+        statio_fill_outbuf_html(outbufs, conn_hdr);
+    }
+    else if(!memcmp(inbuffer, "GET /csv", 8)) {
+        size_data_buf(tdata);
+        statio_fill_outbuf_csv(outbufs, conn_hdr);
+    }
+    else if(!memcmp(inbuffer, "GET /json", 9)) {
+        size_data_buf(tdata);
+        statio_fill_outbuf_json(outbufs, conn_hdr);
+    }
+    else if(!memcmp(inbuffer, "GET /metrics", 12))
+        statio_fill_outbuf_metrics(loop, tdata, conn_hdr);
+    else {
+        tdata->keepalive = false;
         statio_fill_outbuf_404(outbufs);
+    }
+}
+
+// If there's a complete request at the start of read_buffer (or it's
+//  full), starts writing the response to it.  Anything after the
+//  request is kept for after the response, if the connection persists.
+F_NONNULL
+static void try_http_query(struct ev_loop* loop, http_data_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+    dmn_assert(tdata->state == READING_REQ);
+
+    unsigned req_len = request_len(tdata->read_buffer);
+    if(req_len) {
+        tdata->keepalive = gconfig.http_keepalive && want_keepalive(tdata->read_buffer, req_len);
+    }
+    else {
+        if(tdata->read_done < REQ_BUFSIZE - 1U)
+            return; // wait for the rest
+        // We're relying on the OS to buffer the rest of the request while
+        //  we write the response.  After we're done writing we'll drain
+        //  the rest of it for a proper lingering close.
+        req_len = tdata->read_done;
+        tdata->keepalive = false;
+    }
+
+    process_http_query(loop, tdata);
+
+    tdata->read_done -= req_len;
+    memmove(tdata->read_buffer, &tdata->read_buffer[req_len], tdata->read_done + 1U); // incl NUL
+
+    tdata->state = WRITING_RES;
+    ev_io_stop(loop, tdata->read_watcher);
+    ev_io_start(loop, tdata->write_watcher);
 }
 
 F_NONNULL
@@ -377,6 +857,8 @@ static void cleanup_conn_watchers(struct ev_loop* loop, http_data_t* tdata) {
     ev_timer_stop(loop, tdata->timeout_watcher);
     ev_io_stop(loop, tdata->read_watcher);
     ev_io_stop(loop, tdata->write_watcher);
+    if(tdata->metrics)
+        metrics_release(tdata->metrics);
     free(tdata->data_buf);
     free(tdata->hdr_buf);
     free(tdata->timeout_watcher);
@@ -458,9 +940,28 @@ static void write_cb(struct ev_loop* loop, ev_io* io, const int revents V_UNUSED
     }
 
     dmn_assert(written == iovs[1].iov_len);
-    tdata->state = READING_JUNK;
+    if(tdata->metrics) {
+        metrics_release(tdata->metrics);
+        tdata->metrics = NULL;
+    }
     ev_io_stop(loop, tdata->write_watcher);
+
+    if(!tdata->keepalive) {
+        tdata->state = READING_JUNK;
+        ev_io_start(loop, tdata->read_watcher);
+        return;
+    }
+
+    // Wait for the next request on this connection, giving the client
+    //  http_keepalive seconds to send it (which it may already have)
+    tdata->state = READING_REQ;
+    iovs[0].iov_base = tdata->hdr_buf;
+    iovs[1].iov_base = tdata->data_buf;
+    ev_timer_stop(loop, tdata->timeout_watcher);
+    ev_timer_set(tdata->timeout_watcher, gconfig.http_keepalive, 0.);
+    ev_timer_start(loop, tdata->timeout_watcher);
     ev_io_start(loop, tdata->read_watcher);
+    try_http_query(loop, tdata);
 }
 
 F_NONNULL
@@ -483,9 +984,9 @@ static void read_cb(struct ev_loop* loop, ev_io* io, const int revents V_UNUSED)
     }
 
     dmn_assert(tdata->state == READING_REQ);
-    dmn_assert(tdata->read_done < 9);
+    dmn_assert(tdata->read_done < REQ_BUFSIZE - 1U);
     char* destination = &tdata->read_buffer[tdata->read_done];
-    const size_t wanted = 9 - tdata->read_done;
+    const size_t wanted = REQ_BUFSIZE - 1U - tdata->read_done;
     ssize_t recvlen = recv(io->fd, destination, wanted, 0);
     if(unlikely(recvlen == -1)) {
         if(errno != EAGAIN && errno != EINTR) {
@@ -494,17 +995,14 @@ static void read_cb(struct ev_loop* loop, ev_io* io, const int revents V_UNUSED)
         }
         return;
     }
+    if(!recvlen) {
+        // EOF, which is the normal end of a persistent connection
+        cleanup_conn_watchers(loop, tdata);
+        return;
+    }
     tdata->read_done += recvlen;
-    if(tdata->read_done < 9) return;
-
-    // We're relying on the OS to buffer the rest of the request while
-    //  we write the response.  After we're done writing we'll drain
-    //  the rest of it for a proper lingering close.
-
-    process_http_query(tdata->read_buffer, tdata->outbufs);
-    tdata->state = WRITING_RES;
-    ev_io_stop(loop, tdata->read_watcher);
-    ev_io_start(loop, tdata->write_watcher);
+    tdata->read_buffer[tdata->read_done] = '\0';
+    try_http_query(loop, tdata);
 }
 
 F_NONNULL
@@ -561,6 +1059,7 @@ static void accept_cb(struct ev_loop* loop, ev_io* io, int revents V_UNUSED) {
 
     tdata->hdr_buf = tdata->outbufs[0].iov_base = malloc(hdr_buffer_size);
     tdata->data_buf = tdata->outbufs[1].iov_base = malloc(data_buffer_size);
+    tdata->data_buf_size = data_buffer_size;
 
     read_watcher->data = tdata;
     write_watcher->data = tdata;
@@ -600,8 +1099,9 @@ void statio_init(void) {
     // The largest our output sizes can possibly be:
     hdr_buffer_size =
         (sizeof(http_headers) - 1)      // http_headers format string
-        + (21 - 2)                      // "application/xhtml+xml" - "%s"
-        + (10 - 2);                     // 32-bit len - "%u"
+        + (25 - 2)                      // "text/plain; version=0.0.4" - "%s"
+        + (10 - 2)                      // 32-bit len - "%u"
+        + (10 - 2);                     // "keep-alive" - "%s"
 
     // stats counters are 32-bit on 32-bit machines, and 64 on 64
     const unsigned stat_len = sizeof(stats_uint_t) == 8 ? 20 : 10;
@@ -616,7 +1116,12 @@ void statio_init(void) {
         fixed                                 // html_fixed format string
         + (25 - 2)                            // max asctime output - 2 for the original %s
         + (IVAL_BUFSZ - 2)                    // max fmt_uptime output, again - 2 for %s
-        + (19 * (stat_len - strlen(PRIuPTR))) // 19 stats, up to 20 bytes long each
+        + (21 * (stat_len - strlen(PRIuPTR))) // 21 stats, up to 20 bytes long each
+        + (6 * (20 - strlen(PRIu64)))         // 6 latency quantiles, ditto
+        + sizeof(html_qtypes_head) + sizeof(html_qtypes_mid) + sizeof(html_qtypes_foot) // qtype counts,
+        + (QTYPE_BINS * (sizeof(html_qtype_th) + QTYPE_NAME_MAX      //  where html is the longest
+            + sizeof(html_qtype_td) + stat_len))
+        + topn_get_max_out_len()              // heavy hitter lists
         + monio_get_max_stats_len()           // whatever monio tells us...
         + (sizeof(html_footer) - 1);          // html_footer fixed string
 
@@ -624,6 +1129,15 @@ void statio_init(void) {
     //   having made any stupid mistakes in the max len calcuations :P
     data_buffer_size <<= 1U;
 
+    // /metrics output, with every line bounded by PROM_LINE_MAX
+    const unsigned nio = gconfig.num_dns_threads;
+    metrics_buffer_size =
+        (sizeof(prom_uptime) - 1)
+        + ((1 + NUM_PROM_COUNTERS + NUM_PROM_HISTS) * 2 * PROM_LINE_MAX) // HELP/TYPE
+        + (nio * (NUM_PROM_RESULTS + NUM_PROM_COUNTERS) * PROM_LINE_MAX) // per-thread
+        + (NUM_PROM_HISTS * (PROM_HIST_LINES + 1) * PROM_LINE_MAX)        // buckets
+        + monio_get_max_prom_len();
+
     // now set up the normal stuff, like libev event watchers
     if(gconfig.log_stats) {
         log_watcher = malloc(sizeof(ev_timer));
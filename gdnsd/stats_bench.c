@@ -0,0 +1,226 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Benchmark for the cost of the per-query dnspacket_stats_t updates as
+//   the number of I/O threads grows, with a statio-like reader summing
+//   all threads' stats concurrently.  Compares per-thread stats allocated
+//   as the daemon does (page-aligned, first touched by the owner thread)
+//   against just the counters each query updates packed end to end for
+//   all threads in one array allocated by the main thread, so that
+//   neighbouring threads' hot counters share cache lines.  (Whole
+//   dnspacket_stats_t's packed end to end wouldn't show that, as the
+//   cold counters between the hot ones keep them lines apart.)  This is
+//   not part of "make check"; run it via "make bench".
+
+#include "config.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <gdnsd/dmn.h>
+#include <gdnsd/log.h>
+
+#include "dnspacket.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define MAX_THREADS 256U
+#define READER_NSEC 1000000L // statio-like reader pass interval
+
+// The simulated per-query latencies, LAT_MIN_NS up to LAT_SPREAD more
+#define LAT_MIN_NS 600U
+#define LAT_SPREAD 512U
+
+// The counters the writers update, for the packed layout.  Only the
+//   latency buckets for LAT_MIN_NS and up are included, "lat_hot" of them.
+typedef struct {
+    stats_t noerror;
+    stats_t edns;
+    stats_t v6;
+    stats_t lat_proc[];
+} hot_stats_t;
+
+// Where one writer's counters are, in either layout.  "lat" is indexed by
+//   lat_bucket() - lat_base.
+typedef struct {
+    stats_t* noerror;
+    stats_t* edns;
+    stats_t* v6;
+    stats_t* lat;
+} counters_t;
+
+typedef struct {
+    hot_stats_t* hot; // packed only
+    dnspacket_stats_t* stats; // padded only, from the writer
+    unsigned idx;
+    uint64_t queries;
+} writer_t;
+
+static counters_t all_counters[MAX_THREADS];
+static volatile bool all_ready[MAX_THREADS];
+static unsigned lat_base;
+static unsigned lat_hot;
+static unsigned num_threads;
+static volatile bool stopping;
+static pthread_barrier_t start_barrier;
+
+// Same per-query updates as a typical UDP query with EDNS, plus
+//   the latency histogram, over a spread of plausible latencies.
+F_NONNULL
+static void* writer(void* arg) {
+    writer_t* w = arg;
+    counters_t* c = &all_counters[w->idx];
+    if(w->hot) {
+        c->noerror = &w->hot->noerror;
+        c->edns = &w->hot->edns;
+        c->v6 = &w->hot->v6;
+        c->lat = w->hot->lat_proc;
+    }
+    else {
+        void* mem = mmap(NULL, sizeof(dnspacket_stats_t), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED)
+            log_fatal("mmap() failed: %s", logf_errno());
+        memset(mem, 0, sizeof(dnspacket_stats_t));
+        w->stats = mem;
+        c->noerror = &w->stats->noerror;
+        c->edns = &w->stats->edns;
+        c->v6 = &w->stats->v6;
+        c->lat = &w->stats->lat_proc[lat_base];
+    }
+    all_ready[w->idx] = true;
+    pthread_barrier_wait(&start_barrier);
+
+    stats_t* noerror = c->noerror;
+    stats_t* edns = c->edns;
+    stats_t* v6 = c->v6;
+    stats_t* lat = c->lat;
+    uint64_t q = 0;
+    while(!stopping) {
+        for(unsigned i = 0; i < 1024U; i++) {
+            stats_own_inc(noerror);
+            stats_own_inc(edns);
+            if(i & 8U)
+                stats_own_inc(v6);
+            stats_own_inc(&lat[lat_bucket(LAT_MIN_NS + (i & (LAT_SPREAD - 1U))) - lat_base]);
+            // as if the rest of process_dns_query() happened here
+            __asm__ __volatile__("" ::: "memory");
+        }
+        q += 1024U;
+    }
+    w->queries = q;
+    return NULL;
+}
+
+// Sums all of the written counters, as accumulate_statio() does
+static void* reader(void* unused V_UNUSED) {
+    const struct timespec ival = { 0, READER_NSEC };
+    pthread_barrier_wait(&start_barrier);
+    stats_uint_t sink = 0;
+    while(!stopping) {
+        for(unsigned t = 0; t < num_threads; t++) {
+            dmn_assert(all_ready[t]);
+            const counters_t* c = &all_counters[t];
+            sink += stats_get(c->noerror) + stats_get(c->edns) + stats_get(c->v6);
+            for(unsigned i = 0; i < lat_hot; i++)
+                sink += stats_get(&c->lat[i]);
+        }
+        nanosleep(&ival, NULL);
+    }
+    return (void*)sink;
+}
+
+static double run(const unsigned nthreads, const bool padded, const double secs) {
+    num_threads = nthreads;
+    stopping = false;
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 2U);
+
+    const size_t hot_size = sizeof(hot_stats_t) + lat_hot * sizeof(stats_t);
+    char* packed = NULL;
+    writer_t w[MAX_THREADS];
+    if(!padded)
+        packed = calloc(nthreads, hot_size);
+
+    pthread_t threads[MAX_THREADS];
+    for(unsigned i = 0; i < nthreads; i++) {
+        all_ready[i] = false;
+        w[i].hot = padded ? NULL : (hot_stats_t*)(packed + i * hot_size);
+        w[i].stats = NULL;
+        w[i].idx = i;
+        w[i].queries = 0;
+        if(pthread_create(&threads[i], NULL, writer, &w[i]))
+            log_fatal("pthread_create() failed");
+    }
+
+    pthread_t reader_tid;
+    if(pthread_create(&reader_tid, NULL, reader, NULL))
+        log_fatal("pthread_create() failed");
+
+    // writers have set up their counters once they hit the barrier,
+    //   and the reader doesn't look until after it
+    pthread_barrier_wait(&start_barrier);
+    const struct timespec dur = { (time_t)secs, (long)((secs - (time_t)secs) * 1e9) };
+    nanosleep(&dur, NULL);
+
+    stopping = true;
+    uint64_t total = 0;
+    for(unsigned i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        total += w[i].queries;
+        if(padded)
+            munmap(w[i].stats, sizeof(dnspacket_stats_t));
+    }
+    pthread_join(reader_tid, NULL);
+    free(packed);
+    pthread_barrier_destroy(&start_barrier);
+
+    return total / secs;
+}
+
+int main(int argc, char* argv[]) {
+    dmn_init_log("stats_bench", true);
+
+    const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const unsigned max_threads = argc > 1 ? (unsigned)atoi(argv[1]) : (ncpus > 0 ? (unsigned)ncpus : 1U);
+    const double secs = argc > 2 ? atof(argv[2]) : 1.0;
+    if(!max_threads || max_threads > MAX_THREADS || secs <= 0.0)
+        log_fatal("Usage: %s [max_threads(1-%u) [seconds_per_run]]", argv[0], MAX_THREADS);
+
+    lat_base = lat_bucket(LAT_MIN_NS);
+    lat_hot = lat_bucket(LAT_MIN_NS + LAT_SPREAD - 1U) - lat_base + 1U;
+
+    printf("padded: %u-byte stats per thread, packed: %u bytes of hot counters per thread\n",
+        (unsigned)sizeof(dnspacket_stats_t), (unsigned)(sizeof(hot_stats_t) + lat_hot * sizeof(stats_t)));
+    printf("reader pass every %lius\n", READER_NSEC / 1000);
+    printf("threads   padded Mq/s (ns/q/thread)   packed Mq/s (ns/q/thread)\n");
+    for(unsigned n = 1; n <= max_threads; n = (n == max_threads) ? n + 1 : (n * 2 > max_threads ? max_threads : n * 2)) {
+        const double padded = run(n, true, secs);
+        const double packed = run(n, false, secs);
+        printf("%7u   %10.1f (%6.2f)          %10.1f (%6.2f)\n", n,
+            padded / 1e6, n * 1e9 / padded, packed / 1e6, n * 1e9 / packed);
+    }
+
+    return 0;
+}
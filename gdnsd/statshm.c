@@ -0,0 +1,238 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "statshm.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "conf.h"
+#include "dnspacket.h"
+#include "monio.h"
+#include "gdnsd/log.h"
+#include "gdnsd/paths.h"
+
+#define SHMSTAT(_x) offsetof(dnspacket_stats_t, _x)
+
+// Names match the CSV/JSON stats output where there's an equivalent
+static const struct {
+    const char* name;
+    size_t offset;
+    unsigned count;
+    unsigned proto;
+} shm_fields[] = {
+    { "noerror",        SHMSTAT(noerror),        1U, STATSHM_PROTO_ALL },
+    { "refused",        SHMSTAT(refused),        1U, STATSHM_PROTO_ALL },
+    { "nxdomain",       SHMSTAT(nxdomain),       1U, STATSHM_PROTO_ALL },
+    { "notimp",         SHMSTAT(notimp),         1U, STATSHM_PROTO_ALL },
+    { "badvers",        SHMSTAT(badvers),        1U, STATSHM_PROTO_ALL },
+    { "formerr",        SHMSTAT(formerr),        1U, STATSHM_PROTO_ALL },
+    { "dropped",        SHMSTAT(dropped),        1U, STATSHM_PROTO_ALL },
+    { "v6",             SHMSTAT(v6),             1U, STATSHM_PROTO_ALL },
+    { "edns",           SHMSTAT(edns),           1U, STATSHM_PROTO_ALL },
+    { "edns_clientsub", SHMSTAT(edns_clientsub), 1U, STATSHM_PROTO_ALL },
+    { "udp_recvfail",   SHMSTAT(udp.recvfail),   1U, STATSHM_PROTO_UDP },
+    { "udp_sendfail",   SHMSTAT(udp.sendfail),   1U, STATSHM_PROTO_UDP },
+    { "udp_tc",         SHMSTAT(udp.tc),         1U, STATSHM_PROTO_UDP },
+    { "udp_edns_big",   SHMSTAT(udp.edns_big),   1U, STATSHM_PROTO_UDP },
+    { "udp_edns_tc",    SHMSTAT(udp.edns_tc),    1U, STATSHM_PROTO_UDP },
+    { "udp_rrl_limited", SHMSTAT(udp.rrl_limited), 1U, STATSHM_PROTO_UDP },
+    { "udp_rrl_slipped", SHMSTAT(udp.rrl_slipped), 1U, STATSHM_PROTO_UDP },
+    { "tcp_recvfail",   SHMSTAT(tcp.recvfail),   1U, STATSHM_PROTO_TCP },
+    { "tcp_sendfail",   SHMSTAT(tcp.sendfail),   1U, STATSHM_PROTO_TCP },
+    { "lat_proc",       SHMSTAT(lat_proc),       LAT_BUCKETS, STATSHM_PROTO_ALL },
+    { "lat_rxq",        SHMSTAT(lat_rxq),        LAT_BUCKETS, STATSHM_PROTO_UDP },
+};
+#define NUM_SHM_FIELDS (sizeof(shm_fields) / sizeof(shm_fields[0]))
+
+static char* shm_base = NULL;
+static statshm_hdr_t* shm_hdr = NULL;
+static statshm_mon_t* shm_mons = NULL;
+static ev_timer* update_watcher = NULL;
+
+F_CONST
+static size_t round_up(const size_t x, const size_t align) {
+    return ((x + align - 1U) / align) * align;
+}
+
+// Allocates "len" bytes of real storage for the new (empty) file "fd",
+//  failing fatally if the filesystem can't provide them.
+F_NONNULL
+static void shm_allocate(const int fd, const size_t len, const char* path) {
+    dmn_assert(path);
+#ifdef HAVE_POSIX_FALLOCATE
+    const int fa_err = posix_fallocate(fd, 0, (off_t)len);
+    if(fa_err)
+        log_fatal("stats_shm: cannot allocate %zu bytes for '%s': %s", len, path, logf_errnum(fa_err));
+#else
+    // ftruncate() alone would leave a sparse file, so write out the zeros
+    if(ftruncate(fd, (off_t)len))
+        log_fatal("stats_shm: cannot allocate %zu bytes for '%s': %s", len, path, logf_errno());
+    static const char zeros[4096];
+    size_t done = 0;
+    while(done < len) {
+        const size_t todo = (len - done) < sizeof(zeros) ? (len - done) : sizeof(zeros);
+        const ssize_t rv = pwrite(fd, zeros, todo, (off_t)done);
+        if(rv < 0) {
+            if(errno == EINTR)
+                continue;
+            log_fatal("stats_shm: cannot allocate %zu bytes for '%s': %s", len, path, logf_errno());
+        }
+        done += (size_t)rv;
+    }
+#endif
+}
+
+void statshm_init(void) {
+    if(!gconfig.stats_shm)
+        return;
+
+    char* path = gdnsd_resolve_path_cfg(gconfig.stats_shm, NULL);
+
+    const long pagesize = sysconf(_SC_PAGESIZE);
+    const size_t page = pagesize > 0 ? (size_t)pagesize : 4096U;
+    const unsigned nthreads = gconfig.num_dns_threads;
+    const unsigned nmons = monio_get_num_mons();
+
+    const size_t threads_offset = round_up(sizeof(statshm_hdr_t), 8U);
+    const size_t fields_offset = threads_offset + (nthreads * sizeof(statshm_thread_t));
+    const size_t mons_offset = fields_offset + (NUM_SHM_FIELDS * sizeof(statshm_field_t));
+    const size_t descs_offset = mons_offset + (nmons * sizeof(statshm_mon_t));
+    size_t descs_len = 0;
+    for(unsigned i = 0; i < nmons; i++)
+        descs_len += strlen(monio_get_desc(i)) + 1U;
+    const size_t stats_offset = round_up(descs_offset + descs_len, page);
+    const size_t stride = round_up(sizeof(dnspacket_stats_t), page);
+    const size_t total = stats_offset + (nthreads * stride);
+
+    // Always a new file, so that readers still mapping a previous daemon's
+    //  segment aren't affected (truncating it under them would SIGBUS them).
+    if(unlink(path) && errno != ENOENT)
+        log_fatal("stats_shm: unlink('%s') failed: %s", path, logf_errno());
+    const int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0)
+        log_fatal("stats_shm: cannot create '%s': %s", path, logf_errno());
+
+    // Allocate the space now, so that a full filesystem is a startup
+    //  error rather than a SIGBUS later.  This does mean the stats pages
+    //  are placed by this thread rather than by first touch in their owners.
+    shm_allocate(fd, total, path);
+
+    void* mem = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mem == MAP_FAILED)
+        log_fatal("stats_shm: mmap() of '%s' failed: %s", path, logf_errno());
+    close(fd);
+
+    shm_base = mem;
+    shm_hdr = mem;
+    shm_hdr->version = STATSHM_VERSION;
+    shm_hdr->word_size = sizeof(stats_uint_t);
+    shm_hdr->pid = (uint64_t)getpid();
+    shm_hdr->start_time = (uint64_t)time(NULL);
+    shm_hdr->heartbeat = shm_hdr->start_time;
+    shm_hdr->num_threads = nthreads;
+    shm_hdr->num_fields = NUM_SHM_FIELDS;
+    shm_hdr->num_mons = nmons;
+    shm_hdr->thread_stride = stride;
+    shm_hdr->threads_offset = threads_offset;
+    shm_hdr->fields_offset = fields_offset;
+    shm_hdr->mons_offset = mons_offset;
+    shm_hdr->stats_offset = stats_offset;
+    shm_hdr->total_size = total;
+
+    statshm_thread_t* threads = (statshm_thread_t*)(shm_base + threads_offset);
+    for(unsigned i = 0; i < nthreads; i++) {
+        const dns_thread_t* t = &gconfig.dns_threads[i];
+        threads[i].proto = t->is_udp ? STATSHM_PROTO_UDP
+            : t->is_tls ? STATSHM_PROTO_TLS : STATSHM_PROTO_TCP;
+    }
+
+    statshm_field_t* fields = (statshm_field_t*)(shm_base + fields_offset);
+    for(unsigned i = 0; i < NUM_SHM_FIELDS; i++) {
+        strcpy(fields[i].name, shm_fields[i].name);
+        fields[i].offset = shm_fields[i].offset;
+        fields[i].count = shm_fields[i].count;
+        fields[i].proto = shm_fields[i].proto;
+    }
+
+    shm_mons = (statshm_mon_t*)(shm_base + mons_offset);
+    size_t desc_offset = descs_offset;
+    for(unsigned i = 0; i < nmons; i++) {
+        const char* desc = monio_get_desc(i);
+        const size_t desc_len = strlen(desc) + 1U;
+        memcpy(shm_base + desc_offset, desc, desc_len);
+        shm_mons[i].desc_offset = desc_offset;
+        desc_offset += desc_len;
+    }
+
+    // readers go by the magic, so it goes last
+    __sync_synchronize();
+    memcpy(shm_hdr->magic, STATSHM_MAGIC, 8);
+
+    log_info("stats_shm: publishing stats for %u threads at '%s'", nthreads, path);
+    free(path);
+}
+
+void* statshm_thread_stats(const unsigned threadnum) {
+    if(!shm_hdr)
+        return NULL;
+    dmn_assert(threadnum < shm_hdr->num_threads);
+    return shm_base + shm_hdr->stats_offset + ((size_t)threadnum * shm_hdr->thread_stride);
+}
+
+static void statshm_update(void) {
+    dmn_assert(shm_hdr);
+
+    const unsigned nmons = shm_hdr->num_mons;
+    for(unsigned i = 0; i < nmons; i++)
+        *(volatile uint64_t*)&shm_mons[i].state = monio_get_state(i);
+    *(volatile uint64_t*)&shm_hdr->heartbeat = (uint64_t)time(NULL);
+}
+
+F_NONNULL
+static void update_cb(struct ev_loop* loop V_UNUSED, ev_timer* t V_UNUSED, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(t);
+    dmn_assert(revents == EV_TIMER);
+    statshm_update();
+}
+
+void statshm_start(struct ev_loop* loop) {
+    dmn_assert(loop);
+
+    if(!shm_hdr)
+        return;
+
+    statshm_update();
+    update_watcher = malloc(sizeof(ev_timer));
+    ev_timer_init(update_watcher, update_cb, 1.0, 1.0);
+    ev_set_priority(update_watcher, -2);
+    ev_timer_start(loop, update_watcher);
+}
+
+void statshm_stop(void) {
+    if(shm_hdr)
+        *(volatile uint64_t*)&shm_hdr->pid = 0;
+}
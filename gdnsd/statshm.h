@@ -0,0 +1,119 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDNSD_STATSHM_H
+#define GDNSD_STATSHM_H
+
+#include <inttypes.h>
+
+/*
+ * Layout of the optional shared-memory stats segment (the "stats_shm"
+ *   option).  The DNS I/O threads' stats structures live directly in this
+ *   mapping, so readers see the live counters with no involvement from
+ *   the daemon at all.  Monitored service states are copied in once per
+ *   second by the main thread, along with the heartbeat.
+ *
+ * Everything is in the daemon's native byte order, and all counters are
+ *   native words of hdr->word_size bytes, each of which can be read
+ *   atomically (but with no ordering guarantees between them).  The
+ *   segment is self-describing: readers should find counters by name
+ *   in the field table rather than assuming offsets, and must reject
+ *   a segment with an unknown magic or version.
+ *
+ * The daemon creates a new file on every start, so readers holding an
+ *   old mapping should check for pid == 0 (clean shutdown) or a stale
+ *   heartbeat, and re-open the path.  The file is not removed at exit.
+ */
+
+#define STATSHM_MAGIC "gdnsdSS1"
+#define STATSHM_VERSION 1U
+
+// statshm_field_t.proto and statshm_thread_t.proto
+#define STATSHM_PROTO_ALL 0U // fields only: valid for every thread
+#define STATSHM_PROTO_UDP 1U
+#define STATSHM_PROTO_TCP 2U // fields: TCP and TLS threads
+#define STATSHM_PROTO_TLS 3U // threads only
+
+#define STATSHM_NAME_LEN 32U
+
+typedef struct {
+    char magic[8];           // STATSHM_MAGIC, no NUL
+    uint32_t version;        // STATSHM_VERSION
+    uint32_t word_size;      // bytes per counter
+    uint64_t pid;            // daemon pid, zeroed at clean shutdown
+    uint64_t start_time;     // daemon start, in unix time
+    uint64_t heartbeat;      // unix time of the last once-per-second update
+    uint32_t num_threads;
+    uint32_t num_fields;
+    uint32_t num_mons;
+    uint32_t thread_stride;  // bytes from one thread's counters to the next
+    uint64_t threads_offset; // statshm_thread_t[num_threads]
+    uint64_t fields_offset;  // statshm_field_t[num_fields]
+    uint64_t mons_offset;    // statshm_mon_t[num_mons]
+    uint64_t stats_offset;   // per-thread counter blocks
+    uint64_t total_size;     // of the whole segment
+} statshm_hdr_t;
+
+typedef struct {
+    uint32_t proto;          // STATSHM_PROTO_UDP, _TCP, or _TLS
+    uint32_t reserved;
+} statshm_thread_t;
+
+typedef struct {
+    char name[STATSHM_NAME_LEN]; // NUL-terminated
+    uint32_t offset;         // bytes from the start of a thread's block
+    uint32_t count;          // consecutive counters (histograms have > 1)
+    uint32_t proto;          // which threads have it, STATSHM_PROTO_*
+    uint32_t reserved;
+} statshm_field_t;
+
+typedef struct {
+    uint64_t state;          // 1 = DOWN, 2 = DANGER, 3 = UP
+    uint64_t desc_offset;    // NUL-terminated service name, from segment start
+} statshm_mon_t;
+
+// The latency histograms ("lat_proc" and "lat_rxq") are bucketed as
+//  lat_bucket() in dnspacket.h does: values below 8ns get a bucket each,
+//  and each power of two above that is split into 8 equal buckets.
+
+#ifndef STATSHM_READER
+
+#include "gdnsd/compiler.h"
+#include <ev.h>
+
+// Creates the segment if "stats_shm" is configured.  Must be called after
+//  all monitored services are known, and before privileges are dropped
+//  and the DNS threads start.
+void statshm_init(void);
+
+// Returns the page-aligned, still-untouched memory for a DNS thread's
+//  stats within the segment, or NULL if it's disabled.
+F_WUNUSED
+void* statshm_thread_stats(const unsigned threadnum);
+
+// Starts the once-per-second monitor state and heartbeat updates
+F_NONNULL
+void statshm_start(struct ev_loop* loop);
+
+// Marks the segment as belonging to a stopped daemon
+void statshm_stop(void);
+
+#endif // STATSHM_READER
+
+#endif // GDNSD_STATSHM_H
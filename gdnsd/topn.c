@@ -0,0 +1,482 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "topn.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "conf.h"
+#include "gdnsd/log.h"
+#include "gdnsd/misc.h"
+#include "gdnsd/stats.h"
+
+#define HK_ROWS 2U
+
+// Counts at or above this never decay (1.08^-256 is ~3e-9 anyways)
+#define HK_DECAY_MAX 256U
+
+#define QNAME_KEY_MAX 255U
+#define CLIENT_KEY_MAX 8U // family byte + /56 of IPv6
+
+// Longest text forms of the above: every byte of a name as "\\DDD" in
+//  JSON, and an IPv6 prefix with its "/56"
+#define QNAME_TEXT_MAX ((QNAME_KEY_MAX * 5U) + 1U)
+#define CLIENT_TEXT_MAX (INET6_ADDRSTRLEN + 4U)
+
+typedef struct {
+    unsigned seq;    // odd while the key is being replaced
+    uint32_t fp;     // full hash of the key
+    stats_t count;
+    uint8_t len;
+    uint8_t key[];
+} hk_bucket_t;
+
+typedef struct {
+    char* buckets; // HK_ROWS * width
+    unsigned stride;
+} hk_sketch_t;
+
+struct topn_thread {
+    hk_sketch_t qnames;
+    hk_sketch_t clients;
+    gdnsd_rstate_t* rstate;
+    unsigned epoch;
+};
+
+// Merged results, for statio
+typedef struct {
+    stats_uint_t count;
+    uint8_t len;
+    uint8_t key[QNAME_KEY_MAX];
+} hk_top_t;
+
+// One bucket's snapshot during merging
+typedef struct {
+    const uint8_t* key;
+    stats_uint_t count;
+    uint32_t fp;
+    unsigned thread;
+    uint8_t len;
+} hk_entry_t;
+
+static topn_thread_t** threads = NULL;
+static unsigned num_threads = 0;
+static unsigned hk_width = 0;
+static unsigned hk_mask = 0;
+static uint32_t hk_decay[HK_DECAY_MAX];
+static unsigned decay_epoch = 0;
+static ev_timer* decay_watcher = NULL;
+
+// merge scratch and results, used only by the main thread
+static hk_entry_t* merge_entries = NULL;
+static uint8_t* merge_keys = NULL;
+static hk_top_t* top_qnames = NULL;
+static hk_top_t* top_clients = NULL;
+static unsigned num_top_qnames = 0;
+static unsigned num_top_clients = 0;
+static time_t merge_time = 0;
+
+F_CONST
+static unsigned hk_stride(const unsigned key_max) {
+    return (offsetof(hk_bucket_t, key) + key_max + 7U) & ~7U;
+}
+
+F_NONNULL
+static void hk_sketch_init(hk_sketch_t* s, const unsigned key_max) {
+    dmn_assert(s);
+    s->stride = hk_stride(key_max);
+    s->buckets = calloc(HK_ROWS * hk_width, s->stride);
+}
+
+F_NONNULL F_PURE
+static hk_bucket_t* hk_bucket(const hk_sketch_t* s, const unsigned row, const unsigned idx) {
+    dmn_assert(s);
+    return (hk_bucket_t*)(s->buckets + ((((size_t)row * hk_width) + idx) * s->stride));
+}
+
+void topn_init(void) {
+    if(!gconfig.heavy_hitters)
+        return;
+
+    hk_width = 1U;
+    while(hk_width < gconfig.heavy_hitters)
+        hk_width <<= 1U;
+    hk_mask = hk_width - 1U;
+
+    // decay probability 1.08^-count, scaled to uint32_t
+    double p = 4294967295.0;
+    for(unsigned i = 0; i < HK_DECAY_MAX; i++) {
+        hk_decay[i] = (uint32_t)p;
+        p /= 1.08;
+    }
+
+    num_threads = gconfig.num_dns_threads;
+    threads = malloc(num_threads * sizeof(topn_thread_t*));
+    for(unsigned i = 0; i < num_threads; i++) {
+        topn_thread_t* t = threads[i] = calloc(1, sizeof(topn_thread_t));
+        hk_sketch_init(&t->qnames, QNAME_KEY_MAX);
+        hk_sketch_init(&t->clients, CLIENT_KEY_MAX);
+        t->rstate = gdnsd_rand_init();
+    }
+
+    const size_t max_entries = (size_t)num_threads * HK_ROWS * hk_width;
+    merge_entries = malloc(max_entries * sizeof(hk_entry_t));
+    merge_keys = malloc(max_entries * QNAME_KEY_MAX);
+    top_qnames = malloc(gconfig.heavy_hitters_top * sizeof(hk_top_t));
+    top_clients = malloc(gconfig.heavy_hitters_top * sizeof(hk_top_t));
+}
+
+topn_thread_t* topn_thread(const unsigned threadnum) {
+    return threads ? threads[threadnum] : NULL;
+}
+
+F_NONNULL
+static void hk_replace(hk_bucket_t* b, const uint8_t* key, const unsigned len, const uint32_t fp) {
+    dmn_assert(b); dmn_assert(key);
+
+    *(volatile unsigned*)&b->seq = b->seq + 1U;
+    __sync_synchronize();
+    b->fp = fp;
+    b->len = len;
+    memcpy(b->key, key, len);
+    stats_own_set(&b->count, 1U);
+    __sync_synchronize();
+    *(volatile unsigned*)&b->seq = b->seq + 1U;
+}
+
+F_NONNULL
+static void hk_update(hk_sketch_t* s, gdnsd_rstate_t* rstate, const uint8_t* key, const unsigned len) {
+    dmn_assert(s); dmn_assert(rstate); dmn_assert(key);
+
+    const uint32_t fp = gdnsd_lookup2((const char*)key, len);
+
+    // The rows use different halves of the hash (width is at most 2^16)
+    for(unsigned row = 0; row < HK_ROWS; row++) {
+        const uint32_t h = row ? ((fp >> 16) | (fp << 16)) : fp;
+        hk_bucket_t* b = hk_bucket(s, row, h & hk_mask);
+        const stats_uint_t count = stats_own_get(&b->count);
+
+        if(count) {
+            if(b->fp == fp && b->len == len && !memcmp(b->key, key, len)) {
+                stats_own_set(&b->count, count + 1U);
+                continue;
+            }
+            if(count >= HK_DECAY_MAX || gdnsd_rand_get32(rstate) >= hk_decay[count])
+                continue;
+            if(count > 1U) {
+                stats_own_set(&b->count, count - 1U);
+                continue;
+            }
+        }
+
+        // empty, or just decayed to zero
+        hk_replace(b, key, len, fp);
+    }
+}
+
+F_NONNULL
+static void hk_halve(hk_sketch_t* s) {
+    dmn_assert(s);
+    for(unsigned row = 0; row < HK_ROWS; row++) {
+        for(unsigned i = 0; i < hk_width; i++) {
+            hk_bucket_t* b = hk_bucket(s, row, i);
+            stats_own_set(&b->count, stats_own_get(&b->count) >> 1U);
+        }
+    }
+}
+
+void topn_record(topn_thread_t* t, const uint8_t* lqname, const anysin_t* asin) {
+    dmn_assert(t); dmn_assert(lqname); dmn_assert(asin);
+
+    const unsigned epoch = *(volatile unsigned*)&decay_epoch;
+    if(unlikely(t->epoch != epoch)) {
+        t->epoch = epoch;
+        hk_halve(&t->qnames);
+        hk_halve(&t->clients);
+    }
+
+    hk_update(&t->qnames, t->rstate, lqname + 1, *lqname);
+
+    uint8_t ckey[CLIENT_KEY_MAX];
+    unsigned clen;
+    if(asin->sa.sa_family == AF_INET6) {
+        ckey[0] = 6;
+        memcpy(&ckey[1], asin->sin6.sin6_addr.s6_addr, 7); // /56
+        clen = 8;
+    }
+    else {
+        ckey[0] = 4;
+        memcpy(&ckey[1], &asin->sin.sin_addr.s_addr, 3); // /24
+        clen = 4;
+    }
+    hk_update(&t->clients, t->rstate, ckey, clen);
+}
+
+F_NONNULL
+static void decay_cb(struct ev_loop* loop V_UNUSED, ev_timer* w V_UNUSED, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(w);
+    dmn_assert(revents == EV_TIMER);
+    *(volatile unsigned*)&decay_epoch = decay_epoch + 1U;
+}
+
+void topn_start(struct ev_loop* loop) {
+    dmn_assert(loop);
+
+    if(!threads)
+        return;
+
+    decay_watcher = malloc(sizeof(ev_timer));
+    ev_timer_init(decay_watcher, decay_cb, TOPN_DECAY_SECS, TOPN_DECAY_SECS);
+    ev_set_priority(decay_watcher, -2);
+    ev_timer_start(loop, decay_watcher);
+}
+
+/*** Merging, from the main thread ***/
+
+static int entry_cmp(const void* a_v, const void* b_v) {
+    const hk_entry_t* a = a_v;
+    const hk_entry_t* b = b_v;
+    if(a->fp != b->fp)
+        return a->fp < b->fp ? -1 : 1;
+    if(a->len != b->len)
+        return a->len < b->len ? -1 : 1;
+    const int rv = memcmp(a->key, b->key, a->len);
+    if(rv)
+        return rv;
+    return a->thread < b->thread ? -1 : a->thread > b->thread ? 1 : 0;
+}
+
+// Inserts into a list sorted by descending count, keeping at most "max"
+F_NONNULL
+static void top_insert(hk_top_t* list, unsigned* num, const unsigned max, const hk_entry_t* e, const stats_uint_t count) {
+    dmn_assert(list); dmn_assert(num); dmn_assert(e);
+
+    if(*num == max && list[max - 1U].count >= count)
+        return;
+    unsigned pos = (*num < max) ? (*num)++ : max - 1U;
+    while(pos && list[pos - 1U].count < count) {
+        list[pos] = list[pos - 1U];
+        pos--;
+    }
+    list[pos].count = count;
+    list[pos].len = e->len;
+    memcpy(list[pos].key, e->key, e->len);
+}
+
+// Snapshots every live bucket of one kind of sketch across all threads,
+//  then sums the per-thread estimates for each key (a thread's estimate
+//  is the largest of its rows' counts, as a key may be in both rows).
+F_NONNULL
+static void merge_sketches(const size_t sketch_offset, hk_top_t* list, unsigned* num) {
+    dmn_assert(list); dmn_assert(num);
+
+    unsigned n = 0;
+    uint8_t* keyspace = merge_keys;
+    for(unsigned t = 0; t < num_threads; t++) {
+        const hk_sketch_t* s = (const hk_sketch_t*)((const char*)threads[t] + sketch_offset);
+        for(unsigned row = 0; row < HK_ROWS; row++) {
+            for(unsigned i = 0; i < hk_width; i++) {
+                hk_bucket_t* b = hk_bucket(s, row, i);
+                const unsigned seq = *(volatile unsigned*)&b->seq;
+                if(seq & 1U)
+                    continue;
+                __sync_synchronize();
+                hk_entry_t* e = &merge_entries[n];
+                e->count = stats_get(&b->count);
+                e->fp = b->fp;
+                e->len = b->len;
+                memcpy(keyspace, b->key, e->len);
+                __sync_synchronize();
+                if(!e->count || *(volatile unsigned*)&b->seq != seq)
+                    continue;
+                e->key = keyspace;
+                e->thread = t;
+                keyspace += e->len;
+                n++;
+            }
+        }
+    }
+
+    qsort(merge_entries, n, sizeof(hk_entry_t), entry_cmp);
+
+    *num = 0;
+    unsigned i = 0;
+    while(i < n) {
+        const hk_entry_t* first = &merge_entries[i];
+        stats_uint_t total = 0;
+        stats_uint_t thread_max = 0;
+        unsigned thread = first->thread;
+        do {
+            const hk_entry_t* e = &merge_entries[i];
+            if(e->thread != thread) {
+                total += thread_max;
+                thread_max = 0;
+                thread = e->thread;
+            }
+            if(e->count > thread_max)
+                thread_max = e->count;
+            i++;
+        } while(i < n && first->fp == merge_entries[i].fp && first->len == merge_entries[i].len
+            && !memcmp(first->key, merge_entries[i].key, first->len));
+        total += thread_max;
+        top_insert(list, num, gconfig.heavy_hitters_top, first, total);
+    }
+
+    dmn_assert(*num <= gconfig.heavy_hitters_top);
+}
+
+static void merge_all(void) {
+    dmn_assert(threads);
+
+    const time_t now = time(NULL);
+    if(gconfig.realtime_stats || now > merge_time) {
+        merge_sketches(offsetof(topn_thread_t, qnames), top_qnames, &num_top_qnames);
+        merge_sketches(offsetof(topn_thread_t, clients), top_clients, &num_top_clients);
+        merge_time = now;
+    }
+}
+
+/*** Output ***/
+
+// Wire-format name to text, with anything but [-_0-9a-z] escaped as \DDD
+//  (with the backslash itself escaped, for JSON).
+F_NONNULL
+static void qname_text(char* out, const uint8_t* wire, const bool json) {
+    dmn_assert(out); dmn_assert(wire);
+
+    if(!*wire) {
+        strcpy(out, ".");
+        return;
+    }
+
+    unsigned llen;
+    while((llen = *wire++)) {
+        while(llen--) {
+            const uint8_t c = *wire++;
+            if((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_') {
+                *out++ = c;
+            }
+            else {
+                if(json)
+                    *out++ = '\\';
+                out += sprintf(out, "\\%03u", c);
+            }
+        }
+        *out++ = '.';
+    }
+    *out = '\0';
+}
+
+F_NONNULL
+static void client_text(char* out, const hk_top_t* top) {
+    dmn_assert(out); dmn_assert(top);
+
+    uint8_t addr[16];
+    memset(addr, 0, sizeof(addr));
+    memcpy(addr, &top->key[1], top->len - 1U);
+    const int af = top->key[0] == 6 ? AF_INET6 : AF_INET;
+    if(!inet_ntop(af, addr, out, INET6_ADDRSTRLEN))
+        strcpy(out, "?");
+    strcat(out, af == AF_INET6 ? "/56" : "/24");
+}
+
+static const char json_head[] = ",\r\n\t\"heavy_hitters\": {\r\n\t\t\"qnames\": [";
+static const char json_qname[] = "%s\r\n\t\t\t{ \"qname\": \"%s\", \"count\": %" PRIuPTR " }";
+static const char json_mid[] = "\r\n\t\t],\r\n\t\t\"clients\": [";
+static const char json_client[] = "%s\r\n\t\t\t{ \"prefix\": \"%s\", \"count\": %" PRIuPTR " }";
+static const char json_foot[] = "\r\n\t\t]\r\n\t}";
+
+static const char html_head[] = "<p><span class='bold big'>Heavy Hitters:</span></p><table>\r\n"
+    "<tr><th>Query Name</th><th>Count</th></tr>\r\n";
+static const char html_row[] = "<tr><td>%s</td><td>%" PRIuPTR "</td></tr>\r\n";
+static const char html_mid[] = "</table><table>\r\n"
+    "<tr><th>Client Network</th><th>Count</th></tr>\r\n";
+static const char html_foot[] = "</table>\r\n";
+
+unsigned topn_get_max_out_len(void) {
+    if(!gconfig.heavy_hitters)
+        return 0;
+
+    // JSON is obviously the larger in all respects
+    const unsigned stat_len = sizeof(stats_uint_t) == 8 ? 20 : 10;
+    const unsigned fixed = sizeof(json_head) + sizeof(json_mid) + sizeof(json_foot);
+    const unsigned per_qname = sizeof(json_qname) + QNAME_TEXT_MAX + stat_len;
+    const unsigned per_client = sizeof(json_client) + CLIENT_TEXT_MAX + stat_len;
+    return fixed + (gconfig.heavy_hitters_top * (per_qname + per_client)) + 1U;
+}
+
+unsigned topn_out_json(char* buf) {
+    dmn_assert(buf);
+
+    if(!threads)
+        return 0;
+    merge_all();
+
+    char text[QNAME_TEXT_MAX];
+    char* p = buf;
+    memcpy(p, json_head, sizeof(json_head) - 1U);
+    p += sizeof(json_head) - 1U;
+    for(unsigned i = 0; i < num_top_qnames; i++) {
+        qname_text(text, top_qnames[i].key, true);
+        p += sprintf(p, json_qname, i ? "," : "", text, top_qnames[i].count);
+    }
+    memcpy(p, json_mid, sizeof(json_mid) - 1U);
+    p += sizeof(json_mid) - 1U;
+    for(unsigned i = 0; i < num_top_clients; i++) {
+        client_text(text, &top_clients[i]);
+        p += sprintf(p, json_client, i ? "," : "", text, top_clients[i].count);
+    }
+    memcpy(p, json_foot, sizeof(json_foot) - 1U);
+    p += sizeof(json_foot) - 1U;
+
+    return p - buf;
+}
+
+unsigned topn_out_html(char* buf) {
+    dmn_assert(buf);
+
+    if(!threads)
+        return 0;
+    merge_all();
+
+    char text[QNAME_TEXT_MAX];
+    char* p = buf;
+    memcpy(p, html_head, sizeof(html_head) - 1U);
+    p += sizeof(html_head) - 1U;
+    for(unsigned i = 0; i < num_top_qnames; i++) {
+        qname_text(text, top_qnames[i].key, false);
+        p += sprintf(p, html_row, text, top_qnames[i].count);
+    }
+    memcpy(p, html_mid, sizeof(html_mid) - 1U);
+    p += sizeof(html_mid) - 1U;
+    for(unsigned i = 0; i < num_top_clients; i++) {
+        client_text(text, &top_clients[i]);
+        p += sprintf(p, html_row, text, top_clients[i].count);
+    }
+    memcpy(p, html_foot, sizeof(html_foot) - 1U);
+    p += sizeof(html_foot) - 1U;
+
+    return p - buf;
+}
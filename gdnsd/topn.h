@@ -0,0 +1,71 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDNSD_TOPN_H
+#define GDNSD_TOPN_H
+
+#include "config.h"
+#include "gdnsd/compiler.h"
+#include "gdnsd/net.h"
+
+#include <inttypes.h>
+#include <ev.h>
+
+/*
+ * Heavy-hitter tracking for query names and client network prefixes (/24
+ *   for IPv4, /56 for IPv6).  Each DNS I/O thread keeps its own small
+ *   HeavyKeeper sketch for each: two rows of counting buckets, where a
+ *   colliding key decays a bucket's count with probability 1.08^-count
+ *   and takes it over when the count reaches zero.  A query costs one hash
+ *   per sketch and touches two buckets in each.  All counts are halved
+ *   every TOPN_DECAY_SECS, so the lists follow recent traffic.
+ *
+ * statio merges all threads' sketches into the top "heavy_hitters_top"
+ *   lists, at most once per second.
+ */
+
+#define TOPN_DECAY_SECS 30
+
+typedef struct topn_thread topn_thread_t;
+
+// Allocates the sketches for each DNS thread, if the "heavy_hitters"
+//  option is non-zero.  Must be called before the DNS threads start.
+void topn_init(void);
+
+// Starts the timer which triggers the periodic decay
+F_NONNULL
+void topn_start(struct ev_loop* loop);
+
+// Returns the sketches for the given DNS thread, or NULL if disabled
+F_PURE F_WUNUSED
+topn_thread_t* topn_thread(const unsigned threadnum);
+
+// Counts one query, from the owning I/O thread.  lqname is the
+//  length-prefixed, lowercased query name as decoded by dnspacket.c.
+F_NONNULL
+void topn_record(topn_thread_t* t, const uint8_t* lqname, const anysin_t* asin);
+
+// For statio: the maximum size of either output below, and the outputs
+//  themselves, which return the number of bytes written.  The JSON
+//  output starts with a separating comma and has no trailing newline.
+unsigned topn_get_max_out_len(void);
+F_NONNULL unsigned topn_out_json(char* buf);
+F_NONNULL unsigned topn_out_html(char* buf);
+
+#endif // GDNSD_TOPN_H
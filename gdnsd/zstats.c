@@ -0,0 +1,260 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "zstats.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "conf.h"
+#include "gdnsd/dname.h"
+#include "gdnsd/log.h"
+
+// The registry of all zstats_t by name.  Zones are created and destroyed
+//  from the zone source threads, and statio reads them from the main
+//  thread, so it's all under zstats_lock.  None of this is touched by the
+//  DNS threads, which only ever see a zstats_t through a zone_t.
+static pthread_mutex_t zstats_lock = PTHREAD_MUTEX_INITIALIZER;
+static zstats_t** zs_table = NULL;
+static unsigned zs_mask = 0;
+static unsigned zs_count = 0;
+
+#define ZS_TABLE_INIT 256U
+
+// A zone in the output snapshot.  "json" is "text" with its escaping
+//  backslashes doubled.
+typedef struct {
+    char* text;
+    char* json;
+    stats_uint_t queries;
+    stats_uint_t nxdomain;
+} zs_snap_t;
+
+static zs_snap_t* snap = NULL;
+static unsigned snap_count = 0;
+static unsigned snap_text_len = 0; // sum of strlen(snap[].json)
+static time_t snap_time = 0;
+
+static void zs_table_grow(void) {
+    const unsigned new_mask = (zs_mask << 1U) | 1U;
+    zstats_t** new_table = calloc(new_mask + 1U, sizeof(zstats_t*));
+    for(unsigned i = 0; i <= zs_mask; i++) {
+        zstats_t* zs = zs_table[i];
+        while(zs) {
+            zstats_t* next = zs->next;
+            const unsigned slot = zs->hash & new_mask;
+            zs->next = new_table[slot];
+            new_table[slot] = zs;
+            zs = next;
+        }
+    }
+    free(zs_table);
+    zs_table = new_table;
+    zs_mask = new_mask;
+}
+
+zstats_t* zstats_acquire(const uint8_t* dname, const unsigned hash) {
+    dmn_assert(dname);
+
+    pthread_mutex_lock(&zstats_lock);
+
+    if(!zs_table) {
+        zs_table = calloc(ZS_TABLE_INIT, sizeof(zstats_t*));
+        zs_mask = ZS_TABLE_INIT - 1U;
+    }
+
+    zstats_t* zs = zs_table[hash & zs_mask];
+    while(zs && (zs->hash != hash || dname_cmp(zs->dname, dname)))
+        zs = zs->next;
+
+    if(zs) {
+        zs->refs++;
+    }
+    else {
+        if(zs_count > zs_mask)
+            zs_table_grow();
+        zs = malloc(sizeof(zstats_t));
+        const size_t tlen = gconfig.num_dns_threads * sizeof(zstats_thread_t);
+        if(posix_memalign((void**)&zs->threads, ZSTATS_LINE, tlen))
+            log_fatal("posix_memalign() of %zu bytes for zone stats failed", tlen);
+        memset(zs->threads, 0, tlen);
+        zs->dname = malloc(*dname + 1U);
+        memcpy(zs->dname, dname, *dname + 1U);
+        zs->hash = hash;
+        zs->refs = 1;
+        const unsigned slot = hash & zs_mask;
+        zs->next = zs_table[slot];
+        zs_table[slot] = zs;
+        zs_count++;
+    }
+
+    pthread_mutex_unlock(&zstats_lock);
+    return zs;
+}
+
+void zstats_release(zstats_t* zs) {
+    dmn_assert(zs);
+
+    pthread_mutex_lock(&zstats_lock);
+    dmn_assert(zs->refs);
+    if(!--zs->refs) {
+        zstats_t** link = &zs_table[zs->hash & zs_mask];
+        while(*link != zs)
+            link = &(*link)->next;
+        *link = zs->next;
+        zs_count--;
+        free(zs->threads);
+        free(zs->dname);
+        free(zs);
+    }
+    pthread_mutex_unlock(&zstats_lock);
+}
+
+// Same as the heavy-hitters output: bytes other than [-_0-9a-z] are
+//  escaped as \DDD, which keeps the text safe for all of the formats
+//  as-is (other than doubling the backslashes for JSON).
+F_NONNULL
+static char* zone_text(const uint8_t* dname, const bool json) {
+    dmn_assert(dname);
+
+    char* out = malloc((*dname * 5U) + 2U);
+    char* p = out;
+    const uint8_t* wire = dname + 1;
+    if(!*wire)
+        *p++ = '.';
+
+    unsigned llen;
+    while((llen = *wire++)) {
+        while(llen--) {
+            const uint8_t c = *wire++;
+            if((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_') {
+                *p++ = c;
+            }
+            else {
+                if(json)
+                    *p++ = '\\';
+                p += sprintf(p, "\\%03u", c);
+            }
+        }
+        *p++ = '.';
+    }
+    *p = '\0';
+    return out;
+}
+
+F_NONNULL F_PURE
+static int snap_cmp(const void* a, const void* b) {
+    return strcmp(((const zs_snap_t*)a)->text, ((const zs_snap_t*)b)->text);
+}
+
+void zstats_populate(void) {
+    const time_t now = time(NULL);
+    if(!gconfig.realtime_stats && now <= snap_time && snap)
+        return;
+
+    for(unsigned i = 0; i < snap_count; i++) {
+        free(snap[i].text);
+        free(snap[i].json);
+    }
+
+    const unsigned nio = gconfig.num_dns_threads;
+    pthread_mutex_lock(&zstats_lock);
+    snap = realloc(snap, (zs_count + 1U) * sizeof(zs_snap_t));
+    snap_count = 0;
+    snap_text_len = 0;
+    for(unsigned i = 0; zs_table && i <= zs_mask; i++) {
+        for(const zstats_t* zs = zs_table[i]; zs; zs = zs->next) {
+            zs_snap_t* s = &snap[snap_count++];
+            s->text = zone_text(zs->dname, false);
+            s->json = zone_text(zs->dname, true);
+            snap_text_len += strlen(s->json);
+            s->queries = 0;
+            s->nxdomain = 0;
+            for(unsigned t = 0; t < nio; t++) {
+                s->queries += stats_get(&zs->threads[t].queries);
+                s->nxdomain += stats_get(&zs->threads[t].nxdomain);
+            }
+        }
+    }
+    pthread_mutex_unlock(&zstats_lock);
+
+    qsort(snap, snap_count, sizeof(zs_snap_t), snap_cmp);
+    snap_time = now;
+}
+
+static const char json_head[] = ",\r\n\t\"zones\": [";
+static const char json_zone[] = "%s\r\n\t\t{ \"zone\": \"%s\", \"queries\": %" PRIuPTR ", \"nxdomain\": %" PRIuPTR " }";
+static const char json_foot[] = "\r\n\t]";
+static const char csv_head[] = "zone,queries,nxdomain\r\n";
+static const char csv_zone[] = "%s,%" PRIuPTR ",%" PRIuPTR "\r\n";
+static const char html_head[] = "<p><span class='bold big'>Zones:</span></p><table>\r\n"
+    "<tr><th>Zone</th><th>queries</th><th>nxdomain</th></tr>\r\n";
+static const char html_zone[] = "<tr><td>%s</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n";
+static const char html_foot[] = "</table>\r\n";
+
+unsigned zstats_get_max_out_len(void) {
+    const unsigned stat_len = sizeof(stats_uint_t) == 8 ? 20 : 10;
+    const unsigned fixed = sizeof(json_head) + sizeof(json_foot) + sizeof(html_head) + sizeof(html_foot);
+    const unsigned per_zone = sizeof(json_zone) + (2U * stat_len);
+    return fixed + (snap_count * per_zone) + snap_text_len;
+}
+
+unsigned zstats_out_json(char* buf) {
+    dmn_assert(buf);
+
+    char* p = buf;
+    memcpy(p, json_head, sizeof(json_head) - 1U);
+    p += sizeof(json_head) - 1U;
+    for(unsigned i = 0; i < snap_count; i++)
+        p += sprintf(p, json_zone, i ? "," : "", snap[i].json, snap[i].queries, snap[i].nxdomain);
+    memcpy(p, json_foot, sizeof(json_foot) - 1U);
+    p += sizeof(json_foot) - 1U;
+
+    return p - buf;
+}
+
+unsigned zstats_out_csv(char* buf) {
+    dmn_assert(buf);
+
+    char* p = buf;
+    memcpy(p, csv_head, sizeof(csv_head) - 1U);
+    p += sizeof(csv_head) - 1U;
+    for(unsigned i = 0; i < snap_count; i++)
+        p += sprintf(p, csv_zone, snap[i].text, snap[i].queries, snap[i].nxdomain);
+
+    return p - buf;
+}
+
+unsigned zstats_out_html(char* buf) {
+    dmn_assert(buf);
+
+    char* p = buf;
+    memcpy(p, html_head, sizeof(html_head) - 1U);
+    p += sizeof(html_head) - 1U;
+    for(unsigned i = 0; i < snap_count; i++)
+        p += sprintf(p, html_zone, snap[i].text, snap[i].queries, snap[i].nxdomain);
+    memcpy(p, html_foot, sizeof(html_foot) - 1U);
+    p += sizeof(html_foot) - 1U;
+
+    return p - buf;
+}
@@ -0,0 +1,88 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDNSD_ZSTATS_H
+#define GDNSD_ZSTATS_H
+
+#include "config.h"
+#include "gdnsd/compiler.h"
+#include "gdnsd/stats.h"
+
+#include <inttypes.h>
+
+/*
+ * Per-zone query counters.  Each zone name has one zstats_t, which is
+ *   shared by every zone_t for that name (all sources, and old and new
+ *   data across reloads), so the counts persist for as long as the zone
+ *   exists at all.  Each DNS I/O thread has its own cache line of counters
+ *   within it, written with stats_own_inc() and no atomics, which statio
+ *   sums up for output.
+ */
+
+// One cache line per DNS I/O thread
+#define ZSTATS_LINE 64U
+
+typedef union {
+    struct {
+        stats_t queries;  // all requests answered from this zone
+        stats_t nxdomain; // ... which were NXDOMAIN
+    };
+    char pad[ZSTATS_LINE];
+} zstats_thread_t;
+
+struct _zstats_struct;
+typedef struct _zstats_struct zstats_t;
+
+struct _zstats_struct {
+    zstats_thread_t* threads; // [num_dns_threads], cache line aligned
+    zstats_t* next;           // registry hash chain, owned by zstats.c
+    uint8_t* dname;
+    unsigned hash;
+    unsigned refs;
+};
+
+// Returns the (referenced) stats for a zone name, creating them if this
+//  is the first zone_t for the name.  "hash" is dname_hash(dname).
+F_NONNULL F_WUNUSED
+zstats_t* zstats_acquire(const uint8_t* dname, const unsigned hash);
+
+// Drops a reference from zstats_acquire().  The stats are destroyed
+//  with the last reference, which must only happen after no DNS thread
+//  can still see a zone_t using them.
+F_NONNULL
+void zstats_release(zstats_t* zs);
+
+// For the owning DNS I/O thread to count with
+F_NONNULL F_PURE
+static inline zstats_thread_t* zstats_thread(const zstats_t* zs, const unsigned threadnum) {
+    return &zs->threads[threadnum];
+}
+
+// For statio: zstats_populate() takes a snapshot of the sums for all
+//  current zones (at most once per second, unless realtime_stats), and
+//  the rest output it.  zstats_get_max_out_len() is the largest output
+//  of any of the formats for the current snapshot.  The JSON output
+//  starts with a separating comma and has no trailing newline.
+void zstats_populate(void);
+unsigned zstats_get_max_out_len(void);
+F_NONNULL unsigned zstats_out_json(char* buf);
+F_NONNULL unsigned zstats_out_csv(char* buf);
+F_NONNULL unsigned zstats_out_html(char* buf);
+
+#endif // GDNSD_ZSTATS_H
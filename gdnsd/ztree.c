@@ -64,6 +64,8 @@ void zone_delete(zone_t* zone) {
     dmn_assert(zone);
     if(zone->root)
         ltree_destroy(zone->root);
+    if(zone->stats)
+        zstats_release(zone->stats);
     lta_destroy(zone->arena);
     free(zone->src);
     free(zone);
@@ -365,6 +367,11 @@ static void _ztree_update(ztree_t* root, zone_t* z_old, zone_t* z_new, const boo
         dmn_assert(!strcmp(z_old->src, z_new->src));
     }
 
+    // The new zone_t carries on counting wherever any other zone_t of
+    //  the same name left off.  This must happen before it's published.
+    if(z_new && !z_new->stats)
+        z_new->stats = zstats_acquire(z_new->dname, z_new->hash);
+
     ztree_t* this_zt;
     zone_t** new_list = NULL;
     zone_t** old_list = NULL;
@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "ltarena.h"
+#include "zstats.h"
 
 // high-res mtime stuff, for zsrc_*.c to use internally...
 #if defined HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
@@ -62,6 +63,8 @@ struct _zone_struct {
     const uint8_t* dname; // zone name as a dname (stored in ->arena)
     ltarena_t* arena;     // arena for dname/label storage
     ltree_node_t* root;   // the zone root
+    zstats_t* stats;      // query counters, shared by all zone_t's of this name,
+                          //    set by ztree when the zone_t is first inserted/updated
     zone_t* next;         // init to NULL, owned by ztree...
 };
 
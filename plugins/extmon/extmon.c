@@ -37,12 +37,13 @@ typedef struct {
     unsigned num_args;
     unsigned timeout;
     unsigned interval;
+    bool persistent;
 } svc_t;
 
 typedef struct {
     const svc_t* svc;
     mon_smgr_t* smgr;
-    ev_timer* local_timeout;
+    gdnsd_mon_timer_t local_timeout;
     bool seen_once;
 } mon_t;
 
@@ -87,7 +88,7 @@ static void total_helper_failure(struct ev_loop* loop) {
             // fall-through
         case FAIL_STASIS:
             for(unsigned i = 0; i < num_mons; i++)
-                ev_timer_stop(loop, mons[i].local_timeout);
+                gdnsd_mon_timer_stop(&mons[i].local_timeout);
             break;
         case FAIL_DIE:
             log_fatal("plugin_extmon: gdnsd_extmon_helper died");
@@ -127,8 +128,7 @@ static void helper_child_cb(struct ev_loop* loop, ev_child* w, int revents V_UNU
 // common code to bump the local_timeout timer for (interval+timeout)*2,
 //   starting it if not already running.
 static void bump_local_timeout(struct ev_loop* loop, mon_t* mon) {
-    mon->local_timeout->repeat = ((mon->svc->timeout + mon->svc->interval) << 1);
-    ev_timer_again(loop, mon->local_timeout);
+    gdnsd_mon_timer_start(loop, &mon->local_timeout, ((mon->svc->timeout + mon->svc->interval) << 1), 0);
 }
 
 static void helper_read_cb(struct ev_loop* loop, ev_io* w, int revents V_UNUSED) {
@@ -136,9 +136,12 @@ static void helper_read_cb(struct ev_loop* loop, ev_io* w, int revents V_UNUSED)
     dmn_assert(w->fd == helper_read_fd);
 
     while(1) { // loop on all immediately-available results
-        uint32_t data;
-        int rv = read(helper_read_fd, &data, 4);
-        if(rv != 4) {
+        // The helper writes results in batches of whole 4-byte results
+        //   no larger than PIPE_BUF, so reads of a multiple of 4 bytes
+        //   always get whole results.
+        uint32_t data[256];
+        int rv = read(helper_read_fd, data, sizeof(data));
+        if(rv < 4 || (rv & 3)) {
             if(rv < 0) {
                 if(errno == EAGAIN || errno == EINTR)
                     return;
@@ -155,36 +158,42 @@ static void helper_read_cb(struct ev_loop* loop, ev_io* w, int revents V_UNUSED)
             return;
         }
 
-        const unsigned idx = emc_decode_mon_idx(data);
-        const bool failed = emc_decode_mon_failed(data);
-        if(idx >= num_mons)
-            log_fatal("plugin_extmon: BUG: got helper result for out of range index %u", idx);
-        mon_t* this_mon = &mons[idx];
-        gdnsd_mon_state_updater(this_mon->smgr, !failed); // wants true for success
-        if(init_phase) {
-            ev_timer_stop(loop, this_mon->local_timeout);
-            if(!this_mon->seen_once) {
-                this_mon->seen_once = true;
-                if(++init_phase_count == num_mons) {
-                    ev_io_stop(loop, w);
-                    return;
+        bool init_done = false;
+        const unsigned nres = (unsigned)rv >> 2;
+        for(unsigned i = 0; i < nres; i++) {
+            const unsigned idx = emc_decode_mon_idx(data[i]);
+            const bool failed = emc_decode_mon_failed(data[i]);
+            if(idx >= num_mons)
+                log_fatal("plugin_extmon: BUG: got helper result for out of range index %u", idx);
+            mon_t* this_mon = &mons[idx];
+            gdnsd_mon_state_updater(this_mon->smgr, !failed); // wants true for success
+            if(init_phase) {
+                gdnsd_mon_timer_stop(&this_mon->local_timeout);
+                if(!this_mon->seen_once) {
+                    this_mon->seen_once = true;
+                    if(++init_phase_count == num_mons)
+                        init_done = true;
                 }
             }
+            else {
+                bump_local_timeout(loop, this_mon);
+            }
         }
-        else {
-            bump_local_timeout(loop, this_mon);
+
+        if(init_done) {
+            ev_io_stop(loop, w);
+            return;
         }
     }
 }
 
 // This fires if it's been way too long since helper
 //   updated us about a given monitored resource
-static void local_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents V_UNUSED) {
+static void local_timeout_cb(struct ev_loop* loop, gdnsd_mon_timer_t* w) {
     dmn_assert(loop); dmn_assert(w);
-    dmn_assert(revents == EV_TIMER);
 
     mon_t* this_mon = w->data;
-    dmn_assert(this_mon->local_timeout == w);
+    dmn_assert(&this_mon->local_timeout == w);
 
     log_info("plugin_extmon: '%s': helper is very late for a status update, locally applying a negative update...", this_mon->smgr->desc);
     gdnsd_mon_state_updater(this_mon->smgr, false);
@@ -192,7 +201,6 @@ static void local_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents V_UN
         bump_local_timeout(loop, this_mon);
     }
     else {
-        ev_timer_stop(loop, w);
         dmn_assert(!this_mon->seen_once);
         this_mon->seen_once = true;
         if(++init_phase_count == num_mons)
@@ -246,8 +254,12 @@ static void send_cmd(const unsigned idx, const mon_t* mon) {
     const unsigned addrstr_len = strlen(addrstr);
     dmn_assert(addrstr_len);
 
+    // A persistent worker is shared by all of the service type's
+    //   monitors, and gets the address in each request instead
     for(unsigned i = 0; i < mon->svc->num_args; i++)
-        this_args[i] = ipaddr_xlate(mon->svc->args[i], addrstr, addrstr_len);
+        this_args[i] = mon->svc->persistent
+            ? strdup(mon->svc->args[i])
+            : ipaddr_xlate(mon->svc->args[i], addrstr, addrstr_len);
 
     extmon_cmd_t this_cmd = {
         .idx = idx,
@@ -256,6 +268,8 @@ static void send_cmd(const unsigned idx, const mon_t* mon) {
         .num_args = mon->svc->num_args,
         .args = (const char**)this_args,
         .desc = mon->smgr->desc,
+        .addr = addrstr,
+        .persistent = mon->svc->persistent,
     };
 
     if(emc_write_command(helper_write_fd, &this_cmd)
@@ -391,6 +405,11 @@ void plugin_extmon_add_svctype(const char* name, const vscf_data_t* svc_cfg, con
             log_fatal("plugin_extmon: service_type '%s': option 'cmd': all elements must be simple strings", name);
         this_svc->args[i] = strdup(vscf_simple_get_data(arg_cfg));
     }
+
+    this_svc->persistent = false;
+    const vscf_data_t* pers_cfg = vscf_hash_get_data_byconstkey(svc_cfg, "persistent", true);
+    if(pers_cfg && (!vscf_is_simple(pers_cfg) || !vscf_simple_get_as_bool(pers_cfg, &this_svc->persistent)))
+        log_fatal("plugin_extmon: service_type '%s': option 'persistent' must be 'true' or 'false'", name);
 }
 
 void plugin_extmon_add_monitor(const char* svc_name, mon_smgr_t* smgr) {
@@ -408,7 +427,6 @@ void plugin_extmon_add_monitor(const char* svc_name, mon_smgr_t* smgr) {
         }
     }
     dmn_assert(this_mon->svc);
-    this_mon->local_timeout = NULL;
     this_mon->seen_once = false;
 }
 
@@ -431,10 +449,7 @@ void plugin_extmon_init_monitors(struct ev_loop* mon_loop) {
         ev_unref(mon_loop); // don't let child watcher hold things up
         for(unsigned i = 0; i < num_mons; i++) {
             mon_t* this_mon = &mons[i];
-            this_mon->local_timeout = malloc(sizeof(ev_timer));
-            ev_timer_init(this_mon->local_timeout, local_timeout_cb, 0., 0.);
-            this_mon->local_timeout->data = this_mon;
-            ev_set_priority(this_mon->local_timeout, 0);
+            gdnsd_mon_timer_init(&this_mon->local_timeout, local_timeout_cb, this_mon);
             bump_local_timeout(mon_loop, this_mon);
         }
     }
@@ -99,6 +99,9 @@ bool emc_write_command(const int fd, const extmon_cmd_t* cmd) {
     // skip 2-byte len for rest of packet at offset 8
     len += 2;
 
+    // 1-byte flags
+    buf[len++] = cmd->persistent ? 1 : 0;
+
     // arg count + NUL-terminated arguments
     buf[len++] = cmd->num_args;
     for(unsigned i = 0; i < cmd->num_args; i++) {
@@ -120,9 +123,18 @@ bool emc_write_command(const int fd, const extmon_cmd_t* cmd) {
     memcpy(&buf[len], cmd->desc, desc_len);
     len += desc_len;
 
+    // NUL-terminated address string
+    const unsigned addr_len = strlen(cmd->addr) + 1;
+    while((len + addr_len + 16) > alloc) {
+        alloc *= 2;
+        buf = realloc(buf, alloc);
+    }
+    memcpy(&buf[len], cmd->addr, addr_len);
+    len += addr_len;
+
     // now go back and fill in the overall len
-    //   of the variable area for desc/args.
-    const unsigned var_len = len - 10;
+    //   of the variable area for desc/args/addr.
+    const unsigned var_len = len - 11;
     buf[8] = var_len >> 8;
     buf[9] = var_len & 0xFF;
 
@@ -147,8 +159,8 @@ extmon_cmd_t* emc_read_command(const int fd) {
     extmon_cmd_t* cmd = NULL;
 
     {
-        uint8_t fixed_part[10];
-        if(emc_read_nbytes(fd, 10, fixed_part)
+        uint8_t fixed_part[11];
+        if(emc_read_nbytes(fd, 11, fixed_part)
             || strncmp((char*)fixed_part, "CMD:", 4)) {
             log_debug("emc_read_command() failed to read CMD: prefix");
             goto out_error;
@@ -158,14 +170,18 @@ extmon_cmd_t* emc_read_command(const int fd) {
         cmd->idx = ((unsigned)fixed_part[4] << 8) + fixed_part[5];
         cmd->timeout = fixed_part[6];
         cmd->interval = fixed_part[7];
+        cmd->persistent = !!(fixed_part[10] & 1);
         cmd->args = NULL;
         cmd->num_args = 0;
+        cmd->desc = NULL;
+        cmd->addr = NULL;
 
         // note we add an extra NULL at the end of args here, for execl()
         const unsigned var_len = ((unsigned)fixed_part[8] << 8) + fixed_part[9];
-        if(var_len < 4) {
-            // 4 bytes would be enough for num_args, a single 1-byte argument
-            //   and its NUL termiantor, and a zero-length NUL-terminated desc
+        if(var_len < 5) {
+            // 5 bytes would be enough for num_args, a single 1-byte argument
+            //   and its NUL termiantor, and zero-length NUL-terminated desc
+            //   and addr
             log_debug("emc_read_command() variable section too short (%u)!", var_len);
             goto out_error;
         }
@@ -205,6 +221,15 @@ extmon_cmd_t* emc_read_command(const int fd) {
         cmd->desc = strdup((const char*)current);
         current += strlen((const char*)current);
         current++;
+        len_remain = (var_part + var_len) - current;
+
+        if(!nul_within_n_bytes(current, len_remain)) {
+            log_debug("emc_read_command(): address runs off end of buffer");
+            goto out_error;
+        }
+        cmd->addr = strdup((const char*)current);
+        current += strlen((const char*)current);
+        current++;
 
         if(current != (var_part + var_len)) {
             log_debug("emc_read_command(): unused len at end of buffer!");
@@ -221,6 +246,8 @@ extmon_cmd_t* emc_read_command(const int fd) {
                 free((char*)cmd->args[x]);
             free(cmd->args);
         }
+        free((char*)cmd->desc);
+        free((char*)cmd->addr);
         free(cmd);
     }
     return NULL;
@@ -35,6 +35,8 @@ typedef struct {
     // all strings NUL-terminated
     const char** args; // array-of-strings NULL-terminated
     const char* desc;
+    const char* addr; // the monitored address, for persistent mode
+    bool persistent;  // args are a persistent worker, see extmon_helper.c
 } extmon_cmd_t;
 
 // these are used for simple protocol messages during
@@ -20,6 +20,7 @@
 #include "config.h"
 #include "gdnsd/compiler.h"
 #include "gdnsd/log.h"
+#include "gdnsd/montimer.h"
 
 #include "extmon_comms.h"
 
@@ -28,24 +29,67 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
 
 #include <ev.h>
 
+// Longest line accepted from a persistent worker
+#define WORKER_LINE_MAX 128U
+
+// A persistent worker process, which is shared by all of the
+//   persistent-mode monitors with the same command.  Rather than
+//   being executed once per check, it's started once and then reads
+//   one check request per line on its stdin, "<id> <seq> <address>",
+//   and writes a line "<id> <seq> <status>" to its stdout for each
+//   result, with a status of zero for success as with an exit value.
+//   The per-monitor sequence number keeps a late result for a check
+//   which already timed out from being credited to the next one.
+//   Requests may be outstanding for several monitors at a time, and the
+//   results can come back in any order.  If the worker exits or closes
+//   its stdout, all outstanding checks fail, and it's restarted at the
+//   next check.
+typedef struct {
+    const char* const* args; // from the first monitor using it
+    pid_t pid; // zero when not running (and reaped)
+    int write_fd;
+    int read_fd;
+    ev_io* write_watcher;
+    ev_io* read_watcher;
+    ev_child* child_watcher;
+    char* outbuf; // pending request data, when the pipe is full
+    unsigned outbuf_len;
+    unsigned outbuf_alloc;
+    unsigned inbuf_len;
+    char inbuf[WORKER_LINE_MAX];
+    unsigned long lines; // result lines read, to detect hung workers
+} worker_t;
+
 typedef struct {
     extmon_cmd_t* cmd;
-    ev_timer* interval_timer;
-    ev_timer* cmd_timeout;
+    worker_t* worker; // NULL unless persistent
+    gdnsd_mon_timer_t interval_timer;
+    gdnsd_mon_timer_t cmd_timeout;
     ev_child* child_watcher;
     pid_t cmd_pid;
+    unsigned long worker_lines; // worker->lines when the request was sent
+    unsigned long worker_seq; // of the latest request sent to the worker
     bool result_pending;
+    bool started; // past the initial round
 } mon_t;
 
 static unsigned num_mons = 0;
 static mon_t* mons = NULL;
 
+static unsigned num_workers = 0;
+static worker_t** workers = NULL;
+
+// For all spawned commands, see main()
+static posix_spawnattr_t spawn_attr;
+
 F_NONNULL
 static void syserr_for_ev(const char* msg) { dmn_assert(msg); log_fatal("%s: %s", msg, logf_errno()); }
 
@@ -95,33 +139,364 @@ static void sendq_enq(uint32_t new_data) {
 
 // de-queue is split into a data-fetch (_peek()) and
 //   a commit operation which actually deletes the
-//   fetched item from the queue.  This allows for
+//   fetched items from the queue.  This allows for
 //   temporary failure of network write of the
-//   item being dequeued without having to push back
+//   items being dequeued without having to push back
 //   onto the queue.
-// Callers must check _empty() before de-queueing since
-//   _peek()'s return is a literal value and thus there's
-//   no good way to signal emptiness from it.
+// Callers must check _empty() before de-queueing.
 
-static uint32_t sendq_deq_peek(void) {
+// Returns a pointer to as many items as are contiguous in the
+//   array at the head of the queue, up to "max", with the count in
+//   "*count".
+F_NONNULL
+static const uint32_t* sendq_deq_peek(const unsigned max, unsigned* count) {
+    dmn_assert(count);
     dmn_assert(!sendq_empty());
-    return sendq[sendq_head];
+    unsigned n = sendq_alloc - sendq_head;
+    if(n > sendq_len)
+        n = sendq_len;
+    if(n > max)
+        n = max;
+    *count = n;
+    return &sendq[sendq_head];
 }
 
-static void sendq_deq_commit(void) {
-    dmn_assert(!sendq_empty());
-    sendq_head++;
+static void sendq_deq_commit(const unsigned count) {
+    dmn_assert(count <= sendq_len);
+    sendq_head += count;
     sendq_head &= (sendq_alloc - 1);
-    sendq_len--;
+    sendq_len -= count;
 }
 
 /*************************************************************************/
 
-static void mon_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents V_UNUSED) {
-    dmn_assert(loop); dmn_assert(w); dmn_assert(revents == EV_TIMER);
+F_NONNULL
+static void send_result(struct ev_loop* loop, mon_t* this_mon, const bool failed) {
+    dmn_assert(loop); dmn_assert(this_mon);
+    dmn_assert(this_mon->result_pending);
+
+    sendq_enq(emc_encode_mon(this_mon->cmd->idx, failed));
+    ev_io_start(loop, plugin_write_watcher);
+    this_mon->result_pending = false;
+}
+
+/*************************************************************************/
+// Persistent workers, see worker_t above
+
+// Shuts down the worker's pipes and fails all of its outstanding
+//   checks.  If it's still running, it's killed, and the child
+//   watcher reaps it later.
+F_NONNULL
+static void worker_fail(struct ev_loop* loop, worker_t* wk) {
+    dmn_assert(loop); dmn_assert(wk);
+
+    if(wk->write_fd != -1) {
+        ev_io_stop(loop, wk->write_watcher);
+        close(wk->write_fd);
+        wk->write_fd = -1;
+    }
+    if(wk->read_fd != -1) {
+        ev_io_stop(loop, wk->read_watcher);
+        close(wk->read_fd);
+        wk->read_fd = -1;
+    }
+    wk->outbuf_len = 0;
+    wk->inbuf_len = 0;
+
+    if(wk->pid)
+        kill(wk->pid, SIGKILL);
+
+    for(unsigned i = 0; i < num_mons; i++) {
+        mon_t* this_mon = &mons[i];
+        if(this_mon->worker == wk && this_mon->result_pending) {
+            gdnsd_mon_timer_stop(&this_mon->cmd_timeout);
+            send_result(loop, this_mon, true);
+        }
+    }
+}
+
+// Handles a result line from the worker in wk->inbuf
+F_NONNULL
+static void worker_line(struct ev_loop* loop, worker_t* wk) {
+    dmn_assert(loop); dmn_assert(wk);
+
+    wk->lines++;
+
+    char* end;
+    const unsigned long idx = strtoul(wk->inbuf, &end, 10);
+    if(end == wk->inbuf || *end != ' ') {
+        log_err("Persistent monitor worker '%s': invalid result line '%s'", wk->args[0], wk->inbuf);
+        return;
+    }
+    const char* seq_str = end + 1;
+    const unsigned long seq = strtoul(seq_str, &end, 10);
+    if(end == seq_str || *end != ' ') {
+        log_err("Persistent monitor worker '%s': invalid result line '%s'", wk->args[0], wk->inbuf);
+        return;
+    }
+    const char* status_str = end + 1;
+    const long status = strtol(status_str, &end, 10);
+    if(end == status_str) {
+        log_err("Persistent monitor worker '%s': invalid result line '%s'", wk->args[0], wk->inbuf);
+        return;
+    }
+    if(idx >= num_mons || mons[idx].worker != wk) {
+        log_err("Persistent monitor worker '%s': result for unknown id %lu", wk->args[0], idx);
+        return;
+    }
+
+    // A result for a check which already timed out is ignored, even
+    //   if it only arrives after the next check was sent
+    mon_t* this_mon = &mons[idx];
+    if(seq != this_mon->worker_seq) {
+        log_debug("Persistent monitor worker '%s': ignoring late result for '%s'", wk->args[0], this_mon->cmd->desc);
+        return;
+    }
+    if(this_mon->result_pending) {
+        gdnsd_mon_timer_stop(&this_mon->cmd_timeout);
+        send_result(loop, this_mon, !!status);
+    }
+}
+
+// Reads and handles whatever the worker has written so far, failing
+//   the worker on EOF or error
+F_NONNULL
+static void worker_drain(struct ev_loop* loop, worker_t* wk) {
+    dmn_assert(loop); dmn_assert(wk);
+    dmn_assert(wk->read_fd != -1);
+
+    while(1) {
+        char buf[1024];
+        const ssize_t rv = read(wk->read_fd, buf, sizeof(buf));
+        if(rv < 1) {
+            if(rv < 0 && errno == EAGAIN)
+                return;
+            if(rv < 0 && errno == EINTR)
+                continue;
+            if(rv < 0)
+                log_err("Persistent monitor worker '%s': read() failed: %s", wk->args[0], dmn_strerror(errno));
+            else
+                log_debug("Persistent monitor worker '%s' closed its output", wk->args[0]);
+            worker_fail(loop, wk);
+            return;
+        }
+
+        for(ssize_t i = 0; i < rv; i++) {
+            if(buf[i] == '\n') {
+                wk->inbuf[wk->inbuf_len] = '\0';
+                wk->inbuf_len = 0;
+                worker_line(loop, wk);
+            }
+            else if(wk->inbuf_len < WORKER_LINE_MAX - 1U) {
+                wk->inbuf[wk->inbuf_len++] = buf[i];
+            }
+        }
+    }
+}
+
+static void worker_read_cb(struct ev_loop* loop, ev_io* w, int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(w); dmn_assert(revents == EV_READ);
+    worker_drain(loop, w->data);
+}
+
+static void worker_child_cb(struct ev_loop* loop, ev_child* w, int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(w); dmn_assert(revents == EV_CHILD);
+
+    ev_child_stop(loop, w); // always single-shot
+
+    worker_t* wk = w->data;
+    const bool shut_down = (wk->write_fd == -1);
+    int status = w->rstatus;
+    if(WIFEXITED(status))
+        dmn_log_warn("Persistent monitor worker '%s' exited with status %u", wk->args[0], WEXITSTATUS(status));
+    else if(WIFSIGNALED(status) && !shut_down)
+        dmn_log_warn("Persistent monitor worker '%s' terminated by signal %u", wk->args[0], WTERMSIG(status));
+
+    // The worker's last results may still be in the pipe, depending on
+    //   which of these libev noticed first
+    wk->pid = 0;
+    if(!shut_down)
+        worker_drain(loop, wk);
+    if(wk->read_fd != -1)
+        worker_fail(loop, wk);
+}
+
+static void worker_write_cb(struct ev_loop* loop, ev_io* w, int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(w); dmn_assert(revents == EV_WRITE);
+
+    worker_t* wk = w->data;
+    dmn_assert(wk->outbuf_len);
+    const ssize_t rv = write(wk->write_fd, wk->outbuf, wk->outbuf_len);
+    if(rv < 0) {
+        if(errno == EAGAIN || errno == EINTR)
+            return;
+        log_err("Persistent monitor worker '%s': write() failed: %s", wk->args[0], dmn_strerror(errno));
+        worker_fail(loop, wk);
+        return;
+    }
+
+    wk->outbuf_len -= rv;
+    if(wk->outbuf_len)
+        memmove(wk->outbuf, wk->outbuf + rv, wk->outbuf_len);
+    else
+        ev_io_stop(loop, w);
+}
+
+// Sends a request line to the worker, buffering whatever doesn't fit
+//   in the pipe.  A failure here fails the worker.
+F_NONNULL
+static void worker_send(struct ev_loop* loop, worker_t* wk, const char* data, unsigned len) {
+    dmn_assert(loop); dmn_assert(wk); dmn_assert(data);
+    dmn_assert(wk->write_fd != -1);
+
+    if(!wk->outbuf_len) {
+        ssize_t rv = write(wk->write_fd, data, len);
+        if(rv < 0) {
+            if(errno != EAGAIN && errno != EINTR) {
+                log_err("Persistent monitor worker '%s': write() failed: %s", wk->args[0], dmn_strerror(errno));
+                worker_fail(loop, wk);
+                return;
+            }
+            rv = 0;
+        }
+        data += rv;
+        len -= rv;
+        if(!len)
+            return;
+    }
+
+    if(wk->outbuf_len + len > wk->outbuf_alloc) {
+        while(wk->outbuf_len + len > wk->outbuf_alloc)
+            wk->outbuf_alloc = wk->outbuf_alloc ? wk->outbuf_alloc << 1 : 1024U;
+        wk->outbuf = realloc(wk->outbuf, wk->outbuf_alloc);
+    }
+    memcpy(wk->outbuf + wk->outbuf_len, data, len);
+    wk->outbuf_len += len;
+    ev_io_start(loop, wk->write_watcher);
+}
+
+static void set_cloexec(const int fd) {
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC))
+        log_fatal("Failed to set FD_CLOEXEC: %s", dmn_strerror(errno));
+}
+
+F_NONNULL
+static bool worker_spawn(struct ev_loop* loop, worker_t* wk) {
+    dmn_assert(loop); dmn_assert(wk);
+    dmn_assert(!wk->pid);
+
+    int to_worker[2];
+    int from_worker[2];
+    if(pipe(to_worker)) {
+        log_err("pipe() failed: %s", dmn_strerror(errno));
+        return false;
+    }
+    if(pipe(from_worker)) {
+        log_err("pipe() failed: %s", dmn_strerror(errno));
+        close(to_worker[0]);
+        close(to_worker[1]);
+        return false;
+    }
+
+    // dup2() of the worker's ends onto its stdin/stdout clears FD_CLOEXEC
+    set_cloexec(to_worker[0]);
+    set_cloexec(to_worker[1]);
+    set_cloexec(from_worker[0]);
+    set_cloexec(from_worker[1]);
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, to_worker[0], 0);
+    posix_spawn_file_actions_adddup2(&fa, from_worker[1], 1);
+    const int spawn_err = posix_spawn(&wk->pid, wk->args[0], &fa, &spawn_attr, (char* const*)wk->args, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(to_worker[0]);
+    close(from_worker[1]);
+
+    if(spawn_err) {
+        log_err("posix_spawn(%s, ...) failed: %s", wk->args[0], dmn_strerror(spawn_err));
+        wk->pid = 0;
+        close(to_worker[1]);
+        close(from_worker[0]);
+        return false;
+    }
+
+    if(fcntl(to_worker[1], F_SETFL, (fcntl(to_worker[1], F_GETFL, 0)) | O_NONBLOCK) == -1
+        || fcntl(from_worker[0], F_SETFL, (fcntl(from_worker[0], F_GETFL, 0)) | O_NONBLOCK) == -1)
+        log_fatal("Failed to set O_NONBLOCK on pipe: %s", logf_errno());
+
+    log_debug("Started persistent monitor worker '%s' as pid %li", wk->args[0], (long)wk->pid);
+    wk->write_fd = to_worker[1];
+    wk->read_fd = from_worker[0];
+    ev_io_set(wk->write_watcher, wk->write_fd, EV_WRITE);
+    ev_io_set(wk->read_watcher, wk->read_fd, EV_READ);
+    ev_io_start(loop, wk->read_watcher);
+    ev_child_set(wk->child_watcher, wk->pid, 0);
+    ev_child_start(loop, wk->child_watcher);
+    return true;
+}
+
+F_NONNULL
+static bool same_args(const extmon_cmd_t* a, const extmon_cmd_t* b) {
+    dmn_assert(a); dmn_assert(b);
+    if(a->num_args != b->num_args)
+        return false;
+    for(unsigned i = 0; i < a->num_args; i++)
+        if(strcmp(a->args[i], b->args[i]))
+            return false;
+    return true;
+}
+
+// Finds or creates the worker for a persistent-mode command
+F_NONNULL
+static worker_t* worker_get(const extmon_cmd_t* cmd) {
+    dmn_assert(cmd);
+
+    for(unsigned i = 0; i < num_workers; i++)
+        for(unsigned j = 0; j < num_mons; j++)
+            if(mons[j].worker == workers[i] && same_args(mons[j].cmd, cmd))
+                return workers[i];
+
+    worker_t* wk = calloc(1, sizeof(worker_t));
+    wk->args = cmd->args;
+    wk->write_fd = -1;
+    wk->read_fd = -1;
+    wk->write_watcher = malloc(sizeof(ev_io));
+    ev_io_init(wk->write_watcher, worker_write_cb, -1, EV_WRITE);
+    wk->write_watcher->data = wk;
+    wk->read_watcher = malloc(sizeof(ev_io));
+    ev_io_init(wk->read_watcher, worker_read_cb, -1, EV_READ);
+    wk->read_watcher->data = wk;
+    wk->child_watcher = malloc(sizeof(ev_child));
+    ev_child_init(wk->child_watcher, worker_child_cb, 0, 0);
+    wk->child_watcher->data = wk;
+
+    workers = realloc(workers, (num_workers + 1) * sizeof(worker_t*));
+    workers[num_workers++] = wk;
+    return wk;
+}
+
+/*************************************************************************/
+
+static void mon_timeout_cb(struct ev_loop* loop, gdnsd_mon_timer_t* w) {
+    dmn_assert(loop); dmn_assert(w);
 
     mon_t* this_mon = w->data;
     dmn_assert(this_mon->result_pending);
+
+    if(this_mon->worker) {
+        // If the worker hasn't said anything at all since this request,
+        //   assume it's hung and restart it, failing its other checks
+        worker_t* wk = this_mon->worker;
+        dmn_log_warn("Persistent monitor worker '%s' timed out after %u seconds for '%s'.  Marking failed...", wk->args[0], this_mon->cmd->timeout, this_mon->cmd->desc);
+        send_result(loop, this_mon, true);
+        if(wk->lines == this_mon->worker_lines && wk->write_fd != -1) {
+            dmn_log_warn("Persistent monitor worker '%s' appears to be hung, restarting it...", wk->args[0]);
+            worker_fail(loop, wk);
+        }
+        return;
+    }
+
     dmn_log_warn("Monitor child process for '%s' timed out after %u seconds.  Marking failed and sending SIGKILL...", this_mon->cmd->desc, this_mon->cmd->timeout);
     kill(this_mon->cmd_pid, SIGKILL);
     // note we don't stop the child_watcher because we still
@@ -131,9 +506,7 @@ static void mon_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents V_UNUS
     //   and restart the child watcher for a new child, effectively
     //   giving up on waitpid() of this child.  Not much else we
     //   could do in that case anyways.
-    sendq_enq(emc_encode_mon(this_mon->cmd->idx, true));
-    ev_io_start(loop, plugin_write_watcher);
-    this_mon->result_pending = false;
+    send_result(loop, this_mon, true);
 }
 
 static void mon_child_cb(struct ev_loop* loop, ev_child* w, int revents V_UNUSED) {
@@ -142,7 +515,7 @@ static void mon_child_cb(struct ev_loop* loop, ev_child* w, int revents V_UNUSED
     ev_child_stop(loop, w); // always single-shot
 
     mon_t* this_mon = w->data;
-    ev_timer_stop(loop, this_mon->cmd_timeout);
+    gdnsd_mon_timer_stop(&this_mon->cmd_timeout);
     this_mon->cmd_pid = 0;
 
     bool failed = true;
@@ -160,34 +533,57 @@ static void mon_child_cb(struct ev_loop* loop, ev_child* w, int revents V_UNUSED
 
     // If timeout already sent a failure, don't double-send
     //   here when we reap the SIGKILL'd child
-    if(this_mon->result_pending) {
-        sendq_enq(emc_encode_mon(this_mon->cmd->idx, failed));
-        ev_io_start(loop, plugin_write_watcher);
-        this_mon->result_pending = false;
-    }
+    if(this_mon->result_pending)
+        send_result(loop, this_mon, failed);
 }
 
-static void mon_interval_cb(struct ev_loop* loop, ev_timer* w, int revents V_UNUSED) {
-    dmn_assert(loop); dmn_assert(w); dmn_assert(revents == EV_TIMER);
+static void mon_interval_cb(struct ev_loop* loop, gdnsd_mon_timer_t* w) {
+    dmn_assert(loop); dmn_assert(w);
 
     mon_t* this_mon = w->data;
     dmn_assert(!this_mon->result_pending);
 
-    this_mon->cmd_pid = fork();
-    if(this_mon->cmd_pid == -1)
-        log_fatal("fork() failed: %s", dmn_strerror(errno));
-
-    if(!this_mon->cmd_pid) { // child
-        // technically, we could go ahead and close off stdout/stderr
-        //   here for the "startfg" case, but why bother?  If the user
-        //   is debugging via startfg they might want to see this crap anyways.
-        execv(this_mon->cmd->args[0], (char* const *)this_mon->cmd->args);
-        log_fatal("execv(%s, ...) failed: %s", this_mon->cmd->args[0], dmn_strerror(errno));
+    // After the initial round (at jitter * spread, see below), the regular
+    //   ones are at jitter * interval past a multiple of the interval, which
+    //   also leaves at least a full interval before the next one.
+    if(!this_mon->started) {
+        const double ival = this_mon->cmd->interval;
+        const double jitter = gdnsd_mon_jitter(this_mon->cmd->desc);
+        const double spread = gdnsd_mon_init_spread(num_mons, this_mon->cmd->interval);
+        gdnsd_mon_timer_start(loop, w, ival + (jitter * (ival - spread)), ival);
+        this_mon->started = true;
     }
 
     this_mon->result_pending = true;
-    ev_timer_set(this_mon->cmd_timeout, this_mon->cmd->timeout, 0);
-    ev_timer_start(loop, this_mon->cmd_timeout);
+
+    if(this_mon->worker) {
+        worker_t* wk = this_mon->worker;
+        // A killed worker which hasn't been reaped yet can't be restarted
+        if(wk->write_fd == -1 && (wk->pid || !worker_spawn(loop, wk))) {
+            send_result(loop, this_mon, true);
+            return;
+        }
+        this_mon->worker_lines = wk->lines;
+        this_mon->worker_seq++;
+        gdnsd_mon_timer_start(loop, &this_mon->cmd_timeout, this_mon->cmd->timeout, 0);
+        char req[WORKER_LINE_MAX];
+        const int req_len = snprintf(req, WORKER_LINE_MAX, "%u %lu %s\n", this_mon->cmd->idx, this_mon->worker_seq, this_mon->cmd->addr);
+        dmn_assert(req_len > 0 && req_len < (int)WORKER_LINE_MAX);
+        worker_send(loop, wk, req, (unsigned)req_len);
+        return;
+    }
+
+    // posix_spawn() rather than fork()+execv(), so that we don't have to
+    //   copy our page tables for every check.
+    const int spawn_err = posix_spawn(&this_mon->cmd_pid, this_mon->cmd->args[0], NULL, &spawn_attr, (char* const*)this_mon->cmd->args, environ);
+    if(spawn_err) {
+        log_err("posix_spawn(%s, ...) failed: %s", this_mon->cmd->args[0], dmn_strerror(spawn_err));
+        this_mon->cmd_pid = 0;
+        send_result(loop, this_mon, true);
+        return;
+    }
+
+    gdnsd_mon_timer_start(loop, &this_mon->cmd_timeout, this_mon->cmd->timeout, 0);
     ev_child_set(this_mon->child_watcher, this_mon->cmd_pid, 0);
     ev_child_start(loop, this_mon->child_watcher);
 }
@@ -196,9 +592,14 @@ static void plugin_write_cb(struct ev_loop* loop, ev_io* w, int revents V_UNUSED
     dmn_assert(loop); dmn_assert(w); dmn_assert(revents == EV_WRITE);
 
     while(!sendq_empty()) {
-        const uint32_t data = sendq_deq_peek();
-        int rv = write(plugin_write_fd, &data, 4);
-        if(rv != 4) {
+        // As many results as we have per write(), but no more than
+        //   PIPE_BUF bytes so that it's atomic, which keeps the plugin
+        //   from ever seeing a partial result.
+        unsigned count;
+        const uint32_t* data = sendq_deq_peek(PIPE_BUF / 4U, &count);
+        const int len = (int)(count * 4U);
+        int rv = write(plugin_write_fd, data, len);
+        if(rv != len) {
             if(rv < 0) {
                 if(errno == EAGAIN)
                     return; // pipe full, wait for more libev notification of write-ready
@@ -214,10 +615,10 @@ static void plugin_write_cb(struct ev_loop* loop, ev_io* w, int revents V_UNUSED
                 return;
             }
             else {
-                log_fatal("BUG: atomic pipe write of 4 bytes was not atomic, retval was %u", rv);
+                log_fatal("BUG: atomic pipe write of %i bytes was not atomic, retval was %i", len, rv);
             }
         }
-        sendq_deq_commit();
+        sendq_deq_commit(count);
     }
     ev_io_stop(loop, w); // queue now empty
 }
@@ -302,6 +703,11 @@ int main(int argc, char** argv) {
             log_fatal("Failed to write CMD_ACK for command %u to plugin", i);
     }
 
+    // persistent-mode commands share workers by identical arguments
+    for(unsigned i = 0; i < num_mons; i++)
+        if(mons[i].cmd->persistent)
+            mons[i].worker = worker_get(mons[i].cmd);
+
     if(emc_read_exact(plugin_read_fd, "END_CMDS"))
         log_fatal("Failed to read END_CMDS from plugin");
     if(emc_write_string(plugin_write_fd, "END_CMDS_ACK", 12))
@@ -315,6 +721,25 @@ int main(int argc, char** argv) {
     // init results-sending queue
     sendq_init();
 
+    // Writes to a persistent worker which has exited should fail with
+    //   EPIPE rather than kill us, but spawned commands still get the
+    //   SIGPIPE handling we started with, as they would from fork().
+    posix_spawnattr_init(&spawn_attr);
+    struct sigaction sa_pipe;
+    sigemptyset(&sa_pipe.sa_mask);
+    sa_pipe.sa_flags = 0;
+    sa_pipe.sa_handler = SIG_IGN;
+    struct sigaction sa_pipe_prev;
+    if(sigaction(SIGPIPE, &sa_pipe, &sa_pipe_prev))
+        log_fatal("sigaction to ignore SIGPIPE failed: %s", dmn_strerror(errno));
+    if(sa_pipe_prev.sa_handler != SIG_IGN) {
+        sigset_t sigdef;
+        sigemptyset(&sigdef);
+        sigaddset(&sigdef, SIGPIPE);
+        posix_spawnattr_setsigdefault(&spawn_attr, &sigdef);
+        posix_spawnattr_setflags(&spawn_attr, POSIX_SPAWN_SETSIGDEF);
+    }
+
     // Set up libev error callback
     ev_set_syserr_cb(&syserr_for_ev);
 
@@ -330,22 +755,18 @@ int main(int argc, char** argv) {
     ev_io_init(plugin_write_watcher, plugin_write_cb, plugin_write_fd, EV_WRITE);
     ev_set_priority(plugin_write_watcher, 1);
 
-    // set up interval watchers for each monitor, initially for immediate firing
-    //   for the daemon's monitoring init cycle, then repeating every interval.
+    // set up interval timers for each monitor, initially firing right away
+    //   (spread out a bit if there are a lot of them) for the daemon's
+    //   monitoring init cycle, then repeating every interval.
     for(unsigned i = 0; i < num_mons; i++) {
         mon_t* this_mon = &mons[i];
-        this_mon->interval_timer = malloc(sizeof(ev_timer));
-        ev_timer_init(this_mon->interval_timer, mon_interval_cb, 0., this_mon->cmd->interval);
-        this_mon->interval_timer->data = this_mon;
-        ev_set_priority(this_mon->interval_timer, 0);
-        ev_timer_start(def_loop, this_mon->interval_timer);
+        const double spread = gdnsd_mon_init_spread(num_mons, this_mon->cmd->interval);
+        gdnsd_mon_timer_init(&this_mon->interval_timer, mon_interval_cb, this_mon);
+        gdnsd_mon_timer_start(def_loop, &this_mon->interval_timer, spread * gdnsd_mon_jitter(this_mon->cmd->desc), 0);
 
         // initialize the other watchers in the mon_t here as well,
         //   but do not start them (the interval callback starts them each interval)
-        this_mon->cmd_timeout = malloc(sizeof(ev_timer));
-        ev_timer_init(this_mon->cmd_timeout, mon_timeout_cb, 0, 0);
-        ev_set_priority(this_mon->cmd_timeout, -1);
-        this_mon->cmd_timeout->data = this_mon;
+        gdnsd_mon_timer_init(&this_mon->cmd_timeout, mon_timeout_cb, this_mon);
 
         this_mon->child_watcher = malloc(sizeof(ev_child));
         ev_child_init(this_mon->child_watcher, mon_child_cb, 0, 0);
@@ -364,6 +785,9 @@ int main(int argc, char** argv) {
     for(unsigned i = 0; i < num_mons; i++)
         if(mons[i].cmd_pid)
             kill(mons[i].cmd_pid, SIGKILL);
+    for(unsigned i = 0; i < num_workers; i++)
+        if(workers[i]->pid)
+            kill(workers[i]->pid, SIGKILL);
 
     // Bye!
     exit(0);
@@ -99,6 +99,7 @@ static const uint8_t* map_get_dclist(const unsigned mapnum, const client_info_t*
 #define CB_MAP_A plugin_geoip_map_resource_dyna
 #define CB_MAP_C plugin_geoip_map_resource_dync
 #define CB_RES_A plugin_geoip_resolve_dynaddr
+#define CB_RES_A_BATCH plugin_geoip_resolve_dynaddr_batch
 #define CB_RES_C plugin_geoip_resolve_dyncname
 #define CB_EXIT plugin_geoip_exit
 #include "meta_core.c"
@@ -0,0 +1,363 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "dbwalk.h"
+#include "ntree.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <gdnsd/dmn.h>
+#include <gdnsd/log.h>
+
+// Number of real branchings (nodes whose children are both nodes)
+//   below the root at which we split off subtrees for the worker
+//   threads, and the max thread count.  Single-child chains don't
+//   count, so that e.g. an IPv6 database which is mostly IPv4 data
+//   under ::/96 still splits into useful subtrees.
+#define DBWALK_SPLIT_BITS 6U
+#define DBWALK_MAX_THREADS 16U
+
+// Each thread's cache of leaf record -> dclist translations, as an
+//   open-addressed (linear probing) hash in a single flat allocation.
+//   Record zero is the root node of any tree we walk at all, so it
+//   marks an empty slot.
+typedef struct {
+    uint32_t rec;
+    unsigned dclist;
+} dccache_item_t;
+#define DCCACHE_INIT_BITS 12U
+
+// One address-ordered range of the output, translated into an nlist of
+//   its own.  Subtree tasks are walked by the worker threads, the rest
+//   are runs of leaves found above the split and are filled in up front.
+typedef struct {
+    nlist_t* nl;
+    struct in6_addr ip;
+    unsigned depth;
+    uint32_t node;
+    bool is_subtree;
+    bool err;
+} task_t;
+
+typedef struct {
+    const dbwalk_cfg_t* cfg;
+    task_t* tasks;
+    unsigned count;
+    unsigned alloc;
+    unsigned subtrees;
+    unsigned next;
+    pthread_mutex_t auto_lock;
+} tasks_t;
+
+typedef struct {
+    tasks_t* tasks;
+    dccache_item_t* cache;
+    unsigned cache_bits;
+    unsigned cache_count;
+} worker_t;
+
+F_CONST
+static unsigned dccache_slot(const uint32_t rec, const unsigned bits) {
+    return (uint32_t)(rec * 2654435761U) >> (32U - bits);
+}
+
+F_NONNULL
+static void dccache_grow(worker_t* wk) {
+    dmn_assert(wk);
+
+    const unsigned old_size = wk->cache ? 1U << wk->cache_bits : 0;
+    dccache_item_t* old_cache = wk->cache;
+
+    wk->cache_bits = old_cache ? wk->cache_bits + 1 : DCCACHE_INIT_BITS;
+    const unsigned new_mask = (1U << wk->cache_bits) - 1U;
+    wk->cache = calloc(new_mask + 1U, sizeof(dccache_item_t));
+
+    for(unsigned i = 0; i < old_size; i++) {
+        if(old_cache[i].rec) {
+            unsigned slot = dccache_slot(old_cache[i].rec, wk->cache_bits);
+            while(wk->cache[slot].rec)
+                slot = (slot + 1) & new_mask;
+            wk->cache[slot] = old_cache[i];
+        }
+    }
+
+    free(old_cache);
+}
+
+// Retval < 0 means the record is corrupt
+F_NONNULL F_WUNUSED
+static int get_dclist_cached(worker_t* wk, const uint32_t rec) {
+    dmn_assert(wk); dmn_assert(rec);
+
+    // keep the load factor at or under 1/2
+    if(wk->cache_count >= (wk->cache ? (1U << wk->cache_bits) >> 1 : 0))
+        dccache_grow(wk);
+
+    const unsigned mask = (1U << wk->cache_bits) - 1U;
+    unsigned slot = dccache_slot(rec, wk->cache_bits);
+    while(wk->cache[slot].rec) {
+        if(wk->cache[slot].rec == rec)
+            return (int)wk->cache[slot].dclist;
+        slot = (slot + 1) & mask;
+    }
+
+    tasks_t* tasks = wk->tasks;
+    const dbwalk_cfg_t* cfg = tasks->cfg;
+    unsigned raw_lat = 0;
+    unsigned raw_lon = 0;
+    int dclist = cfg->get_dclist(cfg->db, rec, &raw_lat, &raw_lon);
+    if(dclist == -1) {
+        // This can add to the shared dclists, and is the only part
+        //   of the translation which the threads have to take turns on
+        pthread_mutex_lock(&tasks->auto_lock);
+        dclist = dclists_city_auto_map(cfg->dclists, cfg->map_name, raw_lat, raw_lon);
+        pthread_mutex_unlock(&tasks->auto_lock);
+    }
+    else if(dclist < 0) {
+        return dclist;
+    }
+
+    wk->cache[slot].rec = rec;
+    wk->cache[slot].dclist = (unsigned)dclist;
+    wk->cache_count++;
+    return dclist;
+}
+
+F_NONNULL
+static task_t* task_new(tasks_t* tasks) {
+    dmn_assert(tasks);
+
+    if(tasks->count == tasks->alloc) {
+        tasks->alloc = tasks->alloc ? tasks->alloc * 2 : 128;
+        tasks->tasks = realloc(tasks->tasks, tasks->alloc * sizeof(task_t));
+    }
+    task_t* task = &tasks->tasks[tasks->count++];
+    memset(task, 0, sizeof(*task));
+    task->nl = nlist_new(tasks->cfg->map_name, true);
+    return task;
+}
+
+// skip v4-like spaces as applicable...
+F_NONNULL F_PURE
+static bool skip_v4like(const dbwalk_cfg_t* cfg, const uint8_t* ipv6, const unsigned depth) {
+    dmn_assert(cfg); dmn_assert(ipv6);
+
+    if(depth == 32) {
+        if(!memcmp(ipv6, start_v4compat, 12) && cfg->v4o_flag == V4O_PRIMARY)
+            return true;
+        else if(!memcmp(ipv6, start_v4mapped, 12))
+            return true;
+        else if(!memcmp(ipv6, start_siit, 12))
+            return true;
+    }
+    else if(depth == 96 && !memcmp(ipv6, start_teredo, 4)) {
+        return true;
+    }
+    else if(depth == 112 && !memcmp(ipv6, start_6to4, 2)) {
+        return true;
+    }
+    return false;
+}
+
+// Walks the subtree at node/ip/depth, appending its leaves to "nl" in
+//   address order.  Retval true means the tree is corrupt: a node index
+//   out of range, a path that doesn't reach a leaf within the address
+//   length, or a bad leaf record.
+F_NONNULL F_WUNUSED
+static bool walk(worker_t* wk, nlist_t* nl, struct in6_addr ip, const unsigned depth, const uint32_t node) {
+    dmn_assert(wk); dmn_assert(nl);
+    dmn_assert(depth < 129);
+
+    const dbwalk_cfg_t* cfg = wk->tasks->cfg;
+
+    if(unlikely(depth < 1 || node >= cfg->node_count))
+        return true;
+
+    if(skip_v4like(cfg, ip.s6_addr, depth))
+        return false;
+
+    uint32_t recs[2];
+    cfg->read_node(cfg->db, node, &recs[0], &recs[1]);
+
+    const unsigned next_depth = depth - 1;
+    const unsigned mask = 128U - next_depth;
+
+    for(unsigned i = 0; i < 2; i++) {
+        if(i)
+            SETBIT_v6(ip.s6_addr, mask - 1);
+        if(recs[i] >= cfg->leaf_min) {
+            const int dclist = get_dclist_cached(wk, recs[i]);
+            if(dclist < 0)
+                return true;
+            nlist_append(nl, ip.s6_addr, mask, (unsigned)dclist);
+        }
+        else if(walk(wk, nl, ip, next_depth, recs[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// As above, but for the top of the tree: subtrees below DBWALK_SPLIT_BITS
+//   branchings are queued as tasks rather than walked, and the leaves
+//   found before then are translated into leaf-run tasks between them.
+F_NONNULL F_WUNUSED
+static bool walk_top(worker_t* wk, struct in6_addr ip, const unsigned depth, const uint32_t node, const unsigned branchings) {
+    dmn_assert(wk);
+    dmn_assert(depth < 129);
+
+    tasks_t* tasks = wk->tasks;
+    const dbwalk_cfg_t* cfg = tasks->cfg;
+
+    if(unlikely(depth < 1 || node >= cfg->node_count))
+        return true;
+
+    if(skip_v4like(cfg, ip.s6_addr, depth))
+        return false;
+
+    uint32_t recs[2];
+    cfg->read_node(cfg->db, node, &recs[0], &recs[1]);
+
+    const unsigned next_depth = depth - 1;
+    const unsigned mask = 128U - next_depth;
+    const unsigned next_branchings = branchings
+        + (recs[0] < cfg->leaf_min && recs[1] < cfg->leaf_min);
+
+    for(unsigned i = 0; i < 2; i++) {
+        if(i)
+            SETBIT_v6(ip.s6_addr, mask - 1);
+        const uint32_t rec = recs[i];
+        if(rec >= cfg->leaf_min) {
+            const int dclist = get_dclist_cached(wk, rec);
+            if(dclist < 0)
+                return true;
+            task_t* run = tasks->count ? &tasks->tasks[tasks->count - 1] : NULL;
+            if(!run || run->is_subtree)
+                run = task_new(tasks);
+            nlist_append(run->nl, ip.s6_addr, mask, (unsigned)dclist);
+        }
+        else if(next_branchings == DBWALK_SPLIT_BITS) {
+            task_t* sub = task_new(tasks);
+            sub->ip = ip;
+            sub->depth = next_depth;
+            sub->node = rec;
+            sub->is_subtree = true;
+            tasks->subtrees++;
+        }
+        else if(walk_top(wk, ip, next_depth, rec, next_branchings)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void* worker(void* wk_asvoid) {
+    worker_t* wk = wk_asvoid;
+    dmn_assert(wk);
+
+    tasks_t* tasks = wk->tasks;
+    while(1) {
+        const unsigned i = __sync_fetch_and_add(&tasks->next, 1U);
+        if(i >= tasks->count)
+            break;
+        task_t* task = &tasks->tasks[i];
+        if(task->is_subtree && walk(wk, task->nl, task->ip, task->depth, task->node)) {
+            task->err = true;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+nlist_t* dbwalk_make_list(const dbwalk_cfg_t* cfg) {
+    dmn_assert(cfg);
+    dmn_assert(cfg->start_depth == 128 || cfg->start_depth == 32);
+    dmn_assert(cfg->leaf_min >= cfg->node_count);
+
+    tasks_t tasks;
+    memset(&tasks, 0, sizeof(tasks));
+    tasks.cfg = cfg;
+    pthread_mutex_init(&tasks.auto_lock, NULL);
+
+    worker_t workers[DBWALK_MAX_THREADS];
+    memset(workers, 0, sizeof(workers));
+    for(unsigned i = 0; i < DBWALK_MAX_THREADS; i++)
+        workers[i].tasks = &tasks;
+
+    // this thread walks the top of the tree and is also the first worker
+    bool err = walk_top(&workers[0], ip6_zero, cfg->start_depth, 0, 0);
+
+    if(!err) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned nthreads = ncpus > 0 ? (unsigned)ncpus : 1U;
+        if(nthreads > DBWALK_MAX_THREADS)
+            nthreads = DBWALK_MAX_THREADS;
+        if(nthreads > tasks.subtrees)
+            nthreads = tasks.subtrees;
+
+        pthread_t threads[DBWALK_MAX_THREADS];
+        unsigned started = 0;
+        for(unsigned i = 1; i < nthreads; i++) {
+            int pthread_err = pthread_create(&threads[started], NULL, worker, &workers[i]);
+            if(pthread_err)
+                log_err("plugin_geoip: map '%s': pthread_create() failed, continuing with fewer threads: %s", cfg->map_name, logf_errnum(pthread_err));
+            else
+                started++;
+        }
+
+        worker(&workers[0]);
+
+        for(unsigned i = 0; i < started; i++) {
+            int pthread_err = pthread_join(threads[i], NULL);
+            if(pthread_err)
+                log_fatal("plugin_geoip: map '%s': pthread_join() failed: %s", cfg->map_name, logf_errnum(pthread_err));
+        }
+
+        for(unsigned i = 0; i < tasks.count; i++)
+            err |= tasks.tasks[i].err;
+    }
+
+    // The tasks cover the address space in order, so concatenating
+    //   their lists leaves the result pre-normalized as well
+    nlist_t* nl = NULL;
+    if(err) {
+        log_err("plugin_geoip: map '%s': Error traversing GeoIP database, corrupt?", cfg->map_name);
+    }
+    else {
+        nl = nlist_new(cfg->map_name, true);
+        for(unsigned i = 0; i < tasks.count; i++)
+            nlist_append_list(nl, tasks.tasks[i].nl);
+    }
+
+    for(unsigned i = 0; i < tasks.count; i++)
+        nlist_destroy(tasks.tasks[i].nl);
+    free(tasks.tasks);
+    for(unsigned i = 0; i < DBWALK_MAX_THREADS; i++)
+        free(workers[i].cache);
+    pthread_mutex_destroy(&tasks.auto_lock);
+
+    return nl;
+}
@@ -0,0 +1,73 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DBWALK_H
+#define DBWALK_H
+
+#include "config.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <gdnsd/compiler.h>
+#include "gdgeoip.h"
+#include "dclists.h"
+#include "nlist.h"
+
+/*
+ * Translator for the binary search trees of the GeoIP and MaxMind DB
+ *   formats into an nlist_t.  In both, a node is a pair of records (for
+ *   the 0 and 1 branches), each of which is either another node index or
+ *   a value >= some database-specific threshold indicating a leaf.
+ * The tree is split into independent subtrees a few branchings below the
+ *   root, which a pool of threads walk concurrently.  Each subtree's
+ *   leaves are translated to dclists (with a per-thread cache of
+ *   translations by leaf record) into an nlist of its own, and these are
+ *   concatenated in address order at the end, so the result is
+ *   pre-normalized.  The only serialized step of the translation is
+ *   adding new City auto_dc_coords results to the dclists.
+ * The v4-like subspaces of IPv6 are skipped just as ntree expects.
+ */
+
+// Read the two records of node "node".  Only called with node < node_count.
+typedef void (*dbwalk_read_node_t)(const void* db, const uint32_t node, uint32_t* zero, uint32_t* one);
+
+// Translate leaf record "rec" to a dclist, as with dcmap_lookup_loc(): -1
+//   means the City coordinates in *raw_lat/*raw_lon are to be mapped by
+//   dclists_city_auto_map(), and -2 means the record is corrupt (which
+//   the callback should log).  Called concurrently from all threads, so
+//   it must not modify anything.
+typedef int (*dbwalk_get_dclist_t)(const void* db, const uint32_t rec, unsigned* raw_lat, unsigned* raw_lon);
+
+typedef struct {
+    const void* db;
+    dbwalk_read_node_t read_node;
+    dbwalk_get_dclist_t get_dclist;
+    dclists_t* dclists;
+    const char* map_name;
+    uint32_t node_count; // records < node_count are nodes
+    uint32_t leaf_min;   // records >= leaf_min are leaves
+    unsigned start_depth; // 128 for IPv6 trees, 32 for IPv4
+    gdgeoip_v4o_t v4o_flag;
+} dbwalk_cfg_t;
+
+// Returns the (not yet nlist_finish()'d) list, or NULL (after logging)
+//   if the database is corrupt.
+F_NONNULL F_WUNUSED
+nlist_t* dbwalk_make_list(const dbwalk_cfg_t* cfg);
+
+#endif // DBWALK_H
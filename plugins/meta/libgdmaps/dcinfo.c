@@ -45,12 +45,18 @@
 //  array of doubles is twice as long as the names array, and stores
 //  a latitude follow by a longitude for each datacenter, in
 //  radian units.
+// For city-auto-mode distance comparisons, the same coordinates are
+//  also stored as unit vectors on the sphere, in "vecs".  This is four
+//  consecutive arrays of num_dcs doubles: the x, y, and z components,
+//  and a bias term which is -3.0 for datacenters without coordinates
+//  (and zero otherwise).  See dclists_city_auto_map() for usage.
 
 struct _dcinfo {
     unsigned num_dcs;    // count of datacenters
     unsigned auto_limit; // lesser of num_dcs and dc_auto_limit cfg
     char** names;        // #num_dcs, ordered map
     double* coords;      // #(num_dcs * 2, lat then lon, in radians)
+    double* vecs;        // #(num_dcs * 4, x[], y[], z[], bias[])
 };
 
 // Technically we could/should check for duplicates here.  The plugin will
@@ -118,9 +124,28 @@ dcinfo_t* dcinfo_new(const vscf_data_t* dc_cfg, const vscf_data_t* dc_auto_cfg,
             info->coords[(dcidx * 2)] = lat * DEG2RAD;
             info->coords[(dcidx * 2) + 1] = lon * DEG2RAD;
         }
+
+        info->vecs = malloc(num_dcs * 4 * sizeof(double));
+        for(unsigned i = 0; i < num_dcs; i++) {
+            const double lat_rad = info->coords[i * 2];
+            const double lon_rad = info->coords[(i * 2) + 1];
+            if(isnan(lat_rad)) {
+                info->vecs[i] = 0.0;
+                info->vecs[num_dcs + i] = 0.0;
+                info->vecs[(num_dcs * 2) + i] = 0.0;
+                info->vecs[(num_dcs * 3) + i] = -3.0;
+            }
+            else {
+                info->vecs[i] = cos(lat_rad) * cos(lon_rad);
+                info->vecs[num_dcs + i] = cos(lat_rad) * sin(lon_rad);
+                info->vecs[(num_dcs * 2) + i] = sin(lat_rad);
+                info->vecs[(num_dcs * 3) + i] = 0.0;
+            }
+        }
     }
     else {
         info->coords = NULL;
+        info->vecs = NULL;
     }
 
     if(dc_auto_limit_cfg) {
@@ -148,10 +173,10 @@ unsigned dcinfo_get_limit(const dcinfo_t* info) {
     return info->auto_limit;
 }
 
-const double* dcinfo_get_coords(const dcinfo_t* info, const unsigned dcnum) {
+const double* dcinfo_get_vecs(const dcinfo_t* info) {
     dmn_assert(info);
-    dmn_assert(dcnum < info->num_dcs);
-    return &info->coords[dcnum * 2];
+    dmn_assert(info->vecs);
+    return info->vecs;
 }
 
 unsigned dcinfo_name2num(const dcinfo_t* info, const char* dcname) {
@@ -179,5 +204,7 @@ void dcinfo_destroy(dcinfo_t* info) {
     free(info->names);
     if(info->coords)
         free(info->coords);
+    if(info->vecs)
+        free(info->vecs);
     free(info);
 }
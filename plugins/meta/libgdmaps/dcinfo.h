@@ -38,8 +38,9 @@ F_NONNULL F_PURE
 unsigned dcinfo_get_count(const dcinfo_t* info);
 F_NONNULL F_PURE
 unsigned dcinfo_get_limit(const dcinfo_t* info);
+// Only valid when auto_dc_coords was configured, see dcinfo.c for layout
 F_NONNULL F_PURE
-const double* dcinfo_get_coords(const dcinfo_t* info, const unsigned dcnum);
+const double* dcinfo_get_vecs(const dcinfo_t* info);
 F_NONNULLX(1) F_PURE
 unsigned dcinfo_name2num(const dcinfo_t* info, const char* dcname);
 F_NONNULL F_PURE
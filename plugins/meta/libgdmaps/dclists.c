@@ -58,12 +58,28 @@
 //  be aborted, and the destruct-all-strings form is
 //  used on true shutdown of the whole gdmap (only debug
 //  mode for the real plugin).
+// City-auto-mode results are memoized per distinct raw coordinate
+//  pair in "auto_memo", an open-addressed hash of coordinates ->
+//  list index, which is cloned along with the lists so that reloads
+//  only have to compute results for coordinates new to the database.
+
+// Keys are (raw_lat << 32 | raw_lon), and raw values are < 2^22
+#define AUTO_MEMO_EMPTY UINT64_MAX
+#define AUTO_MEMO_INIT_BITS 10U
+
+typedef struct {
+    uint64_t coords;
+    unsigned idx;
+} auto_memo_t;
 
 struct _dclists {
     unsigned count; // count of unique result lists
     unsigned old_count; // count from object we cloned from
     uint8_t** list;    // strings of dc numbers
     const dcinfo_t* info; // dclists_t doesn't own "info", just uses it for reference a lot
+    auto_memo_t* auto_memo; // NULL until first city_auto_map()
+    unsigned auto_memo_bits;
+    unsigned auto_memo_count;
 };
 
 dclists_t* dclists_new(const dcinfo_t* info) {
@@ -79,6 +95,9 @@ dclists_t* dclists_new(const dcinfo_t* info) {
     newdcl->list = malloc(sizeof(uint8_t*));
     newdcl->list[0] = deflist;
     newdcl->info = info;
+    newdcl->auto_memo = NULL;
+    newdcl->auto_memo_bits = 0;
+    newdcl->auto_memo_count = 0;
 
     return newdcl;
 }
@@ -90,6 +109,16 @@ dclists_t* dclists_clone(const dclists_t* old) {
     dcl_clone->old_count = old->count;
     dcl_clone->list = malloc(dcl_clone->count * sizeof(uint8_t*));
     memcpy(dcl_clone->list, old->list, dcl_clone->count * sizeof(uint8_t*));
+    dcl_clone->auto_memo_bits = old->auto_memo_bits;
+    dcl_clone->auto_memo_count = old->auto_memo_count;
+    if(old->auto_memo) {
+        const size_t memo_size = (1U << old->auto_memo_bits) * sizeof(auto_memo_t);
+        dcl_clone->auto_memo = malloc(memo_size);
+        memcpy(dcl_clone->auto_memo, old->auto_memo, memo_size);
+    }
+    else {
+        dcl_clone->auto_memo = NULL;
+    }
     return dcl_clone;
 }
 
@@ -118,6 +147,12 @@ static unsigned dclists_find_or_add_raw(dclists_t* lists, const uint8_t* newlist
         if(!strcmp((const char*)newlist, (const char*)(lists->list[i])))
             return i;
 
+    return dclists_append_raw(lists, newlist, map_name);
+}
+
+unsigned dclists_append_raw(dclists_t* lists, const uint8_t* newlist, const char* map_name) {
+    dmn_assert(lists); dmn_assert(newlist); dmn_assert(map_name);
+
     // it's actually unsigned, but the top bit is reserved for nnode_t
     //   to use to flag the difference between node recursion and a
     //   terminal dclist, and the special value INT32_MAX - 1 (also
@@ -137,6 +172,12 @@ void dclists_replace_list0(dclists_t* lists, uint8_t* newlist) {
     dmn_assert(lists); dmn_assert(newlist);
     free(lists->list[0]);
     lists->list[0] = newlist;
+
+    // auto-mode results are sorted from list0, so they're all stale now
+    free(lists->auto_memo);
+    lists->auto_memo = NULL;
+    lists->auto_memo_bits = 0;
+    lists->auto_memo_count = 0;
 }
 
 // We should probably check for dupes in these map dclists, but really the fallout
@@ -171,29 +212,48 @@ int dclists_find_or_add_vscf(dclists_t* lists, const vscf_data_t* vscf_list, con
     return status ? status : (int)dclists_find_or_add_raw(lists, newlist, map_name);
 }
 
-// Geographic distance between two lat/long points.
-// Because we only care about rough distance comparison rather than
-//  the precise values themselves, input is specified in radians
-//  and output in units of the earth's diameter.
 F_CONST
-static double haversine(double lat1, double lon1, double lat2, double lon2) {
-    double a = pow(sin((lat2 - lat1) * 0.5), 2.0)
-        + cos(lat1) * cos(lat2) * pow(sin((lon2 - lon1) * 0.5), 2.0);
-    return atan2(sqrt(a), sqrt(1.0 - a));
+static unsigned auto_memo_slot(const uint64_t coords, const unsigned bits) {
+    return (coords * UINT64_C(0x9E3779B97F4A7C15)) >> (64U - bits);
 }
 
-unsigned dclists_city_auto_map(dclists_t* lists, const char* map_name, const unsigned raw_lat, const unsigned raw_lon) {
+F_NONNULL
+static void auto_memo_grow(dclists_t* lists) {
     dmn_assert(lists);
 
-    // Generally speaking, seems that almost all records
-    //  in City DB have lat/lon with the exception of
-    //  those in continent -- (countries --,O1,A1,A2)
-    //  and the US Military regions AE/AP/AA, all of
-    //  which show up as lat:0 lon:0.
+    const unsigned old_size = lists->auto_memo ? 1U << lists->auto_memo_bits : 0;
+    auto_memo_t* old_memo = lists->auto_memo;
+
+    lists->auto_memo_bits = old_memo ? lists->auto_memo_bits + 1 : AUTO_MEMO_INIT_BITS;
+    const unsigned new_mask = (1U << lists->auto_memo_bits) - 1U;
+    lists->auto_memo = malloc((new_mask + 1U) * sizeof(auto_memo_t));
+    for(unsigned i = 0; i <= new_mask; i++)
+        lists->auto_memo[i].coords = AUTO_MEMO_EMPTY;
+
+    for(unsigned i = 0; i < old_size; i++) {
+        if(old_memo[i].coords != AUTO_MEMO_EMPTY) {
+            unsigned slot = auto_memo_slot(old_memo[i].coords, lists->auto_memo_bits);
+            while(lists->auto_memo[slot].coords != AUTO_MEMO_EMPTY)
+                slot = (slot + 1) & new_mask;
+            lists->auto_memo[slot] = old_memo[i];
+        }
+    }
 
-    // default for 0/0 coords
-    if(raw_lat == 1800000 && raw_lon == 1800000)
-        return 0;
+    free(old_memo);
+}
+
+// Sorts the default list by distance from the given point, capped at
+//   the auto_limit, and finds or adds the result in the lists.
+// Distance comparison uses unit vectors on the sphere: the dot product
+//   of two such vectors is the cosine of the central angle between the
+//   points, which is all we need for ordering by great-circle distance.
+//   Datacenters without coordinates get a bias of -3.0, putting them
+//   behind all the others (as a dot product is never below -1.0).  The
+//   datacenter vectors are stored as separate x/y/z/bias arrays, so
+//   the scoring loop is trivially vectorizable by the compiler.
+F_NONNULL
+static unsigned city_auto_compute(dclists_t* lists, const char* map_name, const unsigned raw_lat, const unsigned raw_lon) {
+    dmn_assert(lists); dmn_assert(map_name);
 
     // Copy the default datacenter list to local storage for sorting
     const unsigned num_dcs = dcinfo_get_count(lists->info);
@@ -201,30 +261,34 @@ unsigned dclists_city_auto_map(dclists_t* lists, const char* map_name, const uns
     uint8_t sortlist[store_len];
     memcpy(sortlist, lists->list[0], store_len);
 
-    // convert raw form to double radians
+    // convert raw form to double radians, then to a unit vector
     const double lat_rad = (raw_lat - 1800000.0) / 10000.0 * DEG2RAD;
     const double lon_rad = (raw_lon - 1800000.0) / 10000.0 * DEG2RAD;
+    const double x = cos(lat_rad) * cos(lon_rad);
+    const double y = cos(lat_rad) * sin(lon_rad);
+    const double z = sin(lat_rad);
 
-    // calculate the target's distance from each datacenter.
-    // note the first element of 'dists' is unused, and
+    // calculate the target's closeness to each datacenter (higher is
+    //  closer).  note the first element of 'scores' is unused, and
     //  storage is offset by one.  This is so that the actual
     //  1-based dcnums in 'sortlist' can be used as direct
-    //  indices into 'dists'
-    double dists[store_len];
-    for(unsigned i = 0; i < num_dcs; i++) {
-        const double* coords = dcinfo_get_coords(lists->info, i);
-        if (!isnan(coords[0]))
-            dists[i + 1] = haversine(lat_rad, lon_rad, coords[0], coords[1]);
-        else
-            dists[i + 1] = +INFINITY;
-    }
+    //  indices into 'scores'
+    const double* vecs = dcinfo_get_vecs(lists->info);
+    const double* dc_x = vecs;
+    const double* dc_y = &vecs[num_dcs];
+    const double* dc_z = &vecs[num_dcs * 2];
+    const double* dc_bias = &vecs[num_dcs * 3];
+    double scores[store_len];
+    double* dc_scores = &scores[1];
+    for(unsigned i = 0; i < num_dcs; i++)
+        dc_scores[i] = x * dc_x[i] + y * dc_y[i] + z * dc_z[i] + dc_bias[i];
 
     // Given the relatively small num_dcs of most configs,
     //  this simple insertion sort is probably reasonably quick
     for(unsigned i = 1; i < num_dcs; i++) {
         unsigned temp = sortlist[i];
         int j = i - 1;
-        while(j >= 0 && (dists[temp] < dists[sortlist[j]])) {
+        while(j >= 0 && (scores[temp] > scores[sortlist[j]])) {
             sortlist[j + 1] = sortlist[j];
             j--;
         }
@@ -237,6 +301,41 @@ unsigned dclists_city_auto_map(dclists_t* lists, const char* map_name, const uns
     return dclists_find_or_add_raw(lists, sortlist, map_name);
 }
 
+unsigned dclists_city_auto_map(dclists_t* lists, const char* map_name, const unsigned raw_lat, const unsigned raw_lon) {
+    dmn_assert(lists);
+
+    // Generally speaking, seems that almost all records
+    //  in City DB have lat/lon with the exception of
+    //  those in continent -- (countries --,O1,A1,A2)
+    //  and the US Military regions AE/AP/AA, all of
+    //  which show up as lat:0 lon:0.
+
+    // default for 0/0 coords
+    if(raw_lat == 1800000 && raw_lon == 1800000)
+        return 0;
+
+    // Many records share the same location (e.g. all those for a
+    //  given city), so results are memoized per coordinate pair,
+    //  with the load factor kept at or under 1/2.
+    if(lists->auto_memo_count >= (lists->auto_memo ? (1U << lists->auto_memo_bits) >> 1 : 0))
+        auto_memo_grow(lists);
+
+    const uint64_t coords = ((uint64_t)raw_lat << 32) | raw_lon;
+    const unsigned mask = (1U << lists->auto_memo_bits) - 1U;
+    unsigned slot = auto_memo_slot(coords, lists->auto_memo_bits);
+    while(lists->auto_memo[slot].coords != AUTO_MEMO_EMPTY) {
+        if(lists->auto_memo[slot].coords == coords)
+            return lists->auto_memo[slot].idx;
+        slot = (slot + 1) & mask;
+    }
+
+    const unsigned idx = city_auto_compute(lists, map_name, raw_lat, raw_lon);
+    lists->auto_memo[slot].coords = coords;
+    lists->auto_memo[slot].idx = idx;
+    lists->auto_memo_count++;
+    return idx;
+}
+
 void dclists_destroy(dclists_t* lists, dclists_destroy_depth_t depth) {
     dmn_assert(lists);
     switch(depth) {
@@ -253,5 +352,6 @@ void dclists_destroy(dclists_t* lists, dclists_destroy_depth_t depth) {
             break;
     }
     free(lists->list);
+    free(lists->auto_memo);
     free(lists);
 }
@@ -42,6 +42,10 @@ F_NONNULL F_PURE
 unsigned dclists_get_count(const dclists_t* lists);
 F_NONNULL F_PURE
 const uint8_t* dclists_get_list(const dclists_t* lists, const unsigned idx);
+// Appends a copy of newlist without checking for an existing match,
+//  returning the new index.  For restoring lists saved by ntcache.
+F_NONNULL
+unsigned dclists_append_raw(dclists_t* lists, const uint8_t* newlist, const char* map_name);
 F_NONNULL
 void dclists_replace_list0(dclists_t* lists, uint8_t* newlist);
 F_NONNULL
@@ -19,6 +19,7 @@
 
 #include "config.h"
 #include "gdgeoip.h"
+#include "dbwalk.h"
 
 #include <inttypes.h>
 #include <stdbool.h>
@@ -133,23 +134,11 @@ static const char continent_list[NUM_CONTINENTS][3] = {
 };
 
 typedef struct {
-    unsigned offset;
-    unsigned dclist;
-} offset_cache_item_t;
-#define OFFSET_CACHE_SIZE 129113 // prime
-
-struct _geoip_db;
-typedef struct _geoip_db geoip_db_t;
-
-typedef unsigned (*dclist_get_func_t)(const geoip_db_t* db, const unsigned offset);
-
-struct _geoip_db {
     const char* pathname;
     const char* map_name;
     const fips_t* fips;
     const dcmap_t* dcmap;
-    dclists_t* dclists;
-    dclist_get_func_t dclist_get_func;
+    dbwalk_get_dclist_t dclist_get_func;
     uint8_t* data;
     unsigned base;
     unsigned size;
@@ -159,8 +148,7 @@ struct _geoip_db {
     bool ipv6;
     bool city_auto_mode;
     bool city_no_region;
-    offset_cache_item_t *offset_cache[OFFSET_CACHE_SIZE];
-};
+} geoip_db_t;
 
 void validate_country_code(const char* cc, const char* map_name) {
     dmn_assert(cc); dmn_assert(map_name);
@@ -184,10 +172,11 @@ void validate_continent_code(const char* cc, const char* map_name) {
 
 
 F_NONNULL
-static unsigned country_get_dclist(const geoip_db_t* db, const unsigned offset) {
+static int country_get_dclist(const void* db_asvoid, const uint32_t offset, unsigned* raw_lat F_UNUSED, unsigned* raw_lon F_UNUSED) {
+    const geoip_db_t* db = db_asvoid;
     dmn_assert(db); dmn_assert(offset >= db->base);
 
-    unsigned rv = 0;
+    int rv = 0;
     if(db->dcmap) {
         const unsigned ccid = offset - db->base;
         char locstr[7];
@@ -207,10 +196,11 @@ static unsigned country_get_dclist(const geoip_db_t* db, const unsigned offset)
 }
 
 F_NONNULL
-static unsigned region_get_dclist(const geoip_db_t* db, const unsigned offset) {
+static int region_get_dclist(const void* db_asvoid, const uint32_t offset, unsigned* raw_lat F_UNUSED, unsigned* raw_lon F_UNUSED) {
+    const geoip_db_t* db = db_asvoid;
     dmn_assert(db); dmn_assert(offset >= db->base);
 
-    unsigned rv = 0;
+    int rv = 0;
     if(db->dcmap) {
         const unsigned ccid = offset - db->base;
         char locstr[10];
@@ -266,12 +256,12 @@ static unsigned region_get_dclist(const geoip_db_t* db, const unsigned offset) {
 }
 
 F_NONNULL
-static unsigned city_get_dclist(const geoip_db_t* db, unsigned int offs) {
+static int city_get_dclist(const void* db_asvoid, uint32_t offs, unsigned* raw_lat, unsigned* raw_lon) {
+    const geoip_db_t* db = db_asvoid;
     dmn_assert(db); dmn_assert(offs >= db->base);
+    dmn_assert(raw_lat); dmn_assert(raw_lon);
 
     char locstr[256];
-    unsigned raw_lat = 0;
-    unsigned raw_lon = 0;
 
     if(!db->city_auto_mode && !db->dcmap)
         return 0;
@@ -288,8 +278,8 @@ static unsigned city_get_dclist(const geoip_db_t* db, unsigned int offs) {
             locstr[6] = '\0';
         }
         // 1800000 == 0.0 when raw is converted to floating-point degrees
-        raw_lat = 1800000;
-        raw_lon = 1800000;
+        *raw_lat = 1800000;
+        *raw_lon = 1800000;
     }
     else {
         offs += 5 * db->base;
@@ -364,106 +354,31 @@ static unsigned city_get_dclist(const geoip_db_t* db, unsigned int offs) {
         rec++;
 
         for(int j = 0; j < 3; ++j)
-            raw_lat += (rec[j] << (j * 8));
+            *raw_lat += (rec[j] << (j * 8));
         rec += 3;
 
         for(int j = 0; j < 3; ++j)
-            raw_lon += (rec[j] << (j * 8));
+            *raw_lon += (rec[j] << (j * 8));
 
         if(db->dcmap)
             locstr[loc_pos] = '\0';
     }
 
-    int dclist = db->dcmap ? dcmap_lookup_loc(db->dcmap, locstr) : -1;
-    if(dclist < 0) {
-        dmn_assert(db->city_auto_mode);
-        dmn_assert(dclist == -1);
-        dclist = dclists_city_auto_map(db->dclists, db->map_name, raw_lat, raw_lon);
-    }
-
-    dmn_assert(dclist > -1);
+    // -1 here (auto_dc_coords) is mapped from raw_lat/raw_lon by the caller
+    const int dclist = db->dcmap ? dcmap_lookup_loc(db->dcmap, locstr) : -1;
+    dmn_assert(dclist > -1 || db->city_auto_mode);
     return dclist;
 }
 
 F_NONNULL
-static unsigned get_dclist_cached(geoip_db_t* db, const unsigned offset) {
-    dmn_assert(db);
-
-    unsigned bucket_size = 0;
-    const unsigned ndx = offset % OFFSET_CACHE_SIZE;
-
-    if(db->offset_cache[ndx]) {
-        for(bucket_size = 0; db->offset_cache[ndx][bucket_size].offset; bucket_size++)
-            if(db->offset_cache[ndx][bucket_size].offset == offset)
-                return db->offset_cache[ndx][bucket_size].dclist;
-    }
-
-    unsigned dclist = db->dclist_get_func(db, offset);
-    db->offset_cache[ndx] = realloc(db->offset_cache[ndx], sizeof(offset_cache_item_t) * (bucket_size + 2));
-    dmn_assert(db->offset_cache[ndx]);
-    db->offset_cache[ndx][bucket_size].offset = offset;
-    db->offset_cache[ndx][bucket_size].dclist = dclist;
-    db->offset_cache[ndx][bucket_size + 1].offset = 0;
-    return dclist;
-}
-
-F_NONNULL
-static bool list_xlate_recurse(geoip_db_t* db, nlist_t* nl, struct in6_addr ip, const int depth, const unsigned db_off) {
-    dmn_assert(db); dmn_assert(nl);
-    dmn_assert(depth < 129);
-
-    bool rv = false;
-
-    do {
-        if(unlikely(depth < 1 || ((3 * 2 * db_off) + 6) > db->size)) {
-            log_err("plugin_geoip: map '%s': Error traversing GeoIP database, corrupt?", db->map_name);
-            rv = true;
-            break;
-        }
-
-        // skip v4-like spaces as applicable...
-        if(depth == 32) {
-            if(!memcmp(ip.s6_addr, start_v4compat, 12) && db->v4o_flag == V4O_PRIMARY)
-                break;
-            else if(!memcmp(ip.s6_addr, start_v4mapped, 12))
-                break;
-            else if(!memcmp(ip.s6_addr, start_siit, 12))
-                break;
-        }
-        else if(depth == 96 && !memcmp(ip.s6_addr, start_teredo, 4)) {
-            break;
-        }
-        else if(depth == 112 && !memcmp(ip.s6_addr, start_6to4, 2)) {
-            break;
-        }
-
-        const unsigned char *db_buf = db->data + 3 * 2 * db_off;
-        const unsigned db_zero_off = db_buf[0] + (db_buf[1] << 8) + (db_buf[2] << 16);
-        const unsigned db_one_off = db_buf[3] + (db_buf[4] << 8) + (db_buf[5] << 16);
-
-        const int next_depth = depth - 1;
-        const unsigned mask = 128U - next_depth;
-
-        if(db_zero_off >= db->base) {
-            nlist_append(nl, ip.s6_addr, mask, get_dclist_cached(db, db_zero_off));
-        }
-        else if(list_xlate_recurse(db, nl, ip, next_depth, db_zero_off)) {
-            rv = true;
-            break;
-        }
-
-        SETBIT_v6(ip.s6_addr, mask - 1);
-
-        if(db_one_off >= db->base) {
-            nlist_append(nl, ip.s6_addr, mask, get_dclist_cached(db, db_one_off));
-        }
-        else if(list_xlate_recurse(db, nl, ip, next_depth, db_one_off)) {
-            rv = true;
-            break;
-        }
-    } while(0);
-
-    return rv;
+static void geoip_read_node(const void* db_asvoid, const uint32_t node, uint32_t* zero, uint32_t* one) {
+    const geoip_db_t* db = db_asvoid;
+    dmn_assert(db); dmn_assert(zero); dmn_assert(one);
+    dmn_assert((3 * 2 * node) + 6 <= db->size);
+
+    const unsigned char *db_buf = db->data + 3 * 2 * node;
+    *zero = db_buf[0] + (db_buf[1] << 8) + (db_buf[2] << 16);
+    *one = db_buf[3] + (db_buf[4] << 8) + (db_buf[5] << 16);
 }
 
 F_NONNULL
@@ -484,22 +399,19 @@ static bool geoip_db_close(geoip_db_t* db) {
         }
     }
 
-    for (unsigned i = 0; i < OFFSET_CACHE_SIZE; i++)
-        free(db->offset_cache[i]);
     free(db);
 
     return rv;
 }
 
-F_NONNULLX(1,2,3)
-static geoip_db_t* geoip_db_open(const char* pathname, const char* map_name, dclists_t* dclists, const dcmap_t* dcmap, const fips_t* fips, const gdgeoip_v4o_t v4o_flag, const bool city_auto_mode, const bool city_no_region) {
-    dmn_assert(pathname); dmn_assert(map_name); dmn_assert(dclists);
+F_NONNULLX(1,2)
+static geoip_db_t* geoip_db_open(const char* pathname, const char* map_name, const dcmap_t* dcmap, const fips_t* fips, const gdgeoip_v4o_t v4o_flag, const bool city_auto_mode, const bool city_no_region) {
+    dmn_assert(pathname); dmn_assert(map_name);
 
     geoip_db_t* db = calloc(1, sizeof(geoip_db_t));
     db->fd = -1;
     db->pathname = pathname;
     db->map_name = map_name;
-    db->dclists = dclists;
     db->dcmap = dcmap;
     db->v4o_flag = v4o_flag;
     db->city_auto_mode = city_auto_mode;
@@ -635,20 +547,37 @@ nlist_t* gdgeoip_make_list(const char* pathname, const char* map_name, dclists_t
 
     nlist_t* nl = NULL;
 
-    geoip_db_t* geodb = geoip_db_open(pathname, map_name, dclists, dcmap, fips, v4o_flag, city_auto_mode, city_no_region);
+    geoip_db_t* geodb = geoip_db_open(pathname, map_name, dcmap, fips, v4o_flag, city_auto_mode, city_no_region);
     if(geodb) {
-        nl = nlist_new(map_name, true);
+        // Nodes must fit in the file, and can't reach the leaf range
+        unsigned node_count = geodb->size / 6U;
+        if(node_count > geodb->base)
+            node_count = geodb->base;
+
+        const dbwalk_cfg_t walk_cfg = {
+            .db = geodb,
+            .read_node = geoip_read_node,
+            .get_dclist = geodb->dclist_get_func,
+            .dclists = dclists,
+            .map_name = map_name,
+            .node_count = node_count,
+            .leaf_min = geodb->base,
+            .start_depth = geodb->ipv6 ? 128 : 32,
+            .v4o_flag = v4o_flag,
+        };
+
+        nl = dbwalk_make_list(&walk_cfg);
 
-        const unsigned start_depth = geodb->ipv6 ? 128 : 32;
-        const bool rec_rv = list_xlate_recurse(geodb, nl, ip6_zero, start_depth, 0);
         const bool close_rv = geoip_db_close(geodb);
 
-        if(rec_rv || close_rv) {
-            nlist_destroy(nl);
-            nl = NULL;
-        }
-        else {
-            nlist_finish(nl);
+        if(nl) {
+            if(close_rv) {
+                nlist_destroy(nl);
+                nl = NULL;
+            }
+            else {
+                nlist_finish(nl);
+            }
         }
     }
 
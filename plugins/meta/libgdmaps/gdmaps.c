@@ -29,6 +29,8 @@
 #include "ntree.h"
 #include "nets.h"
 #include "gdgeoip.h"
+#include "gdmmdb.h"
+#include "ntcache.h"
 
 #include <inttypes.h>
 #include <stdbool.h>
@@ -67,6 +69,7 @@ typedef struct {
     char* geoip_path;
     char* geoip_v4o_path;
     char* nets_path;
+    char* cache_path; // tree cache file, optional
     const fips_t* fips;
     dcinfo_t* dcinfo; // basic datacenter list/info
     dcmap_t* dcmap; // map of locinfo -> dclist
@@ -79,6 +82,11 @@ typedef struct {
     nlist_t* geoip_v4o_list; // optional v4 overlay
     nlist_t* nets_list; // net overrides, optional
     ntree_t* tree; // merged->translated from the lists above
+    stats_t gen; // bumped with every swap of ->tree, for lookup caches
+    uint64_t cfg_hash; // for tree cache keys
+    ntcache_stamp_t geoip_stamp; // input file stamps as of their last load
+    ntcache_stamp_t geoip_v4o_stamp;
+    ntcache_stamp_t nets_stamp;
     ev_stat* geoip_stat_watcher;
     ev_stat* geoip_v4o_stat_watcher;
     ev_stat* nets_stat_watcher;
@@ -98,7 +106,7 @@ static bool _gdmap_badkey(const char* key, unsigned klen V_UNUSED, const vscf_da
 }
 
 F_NONNULLX(1,2)
-static gdmap_t* gdmap_new(const char* name, const vscf_data_t* map_cfg, const fips_t* fips) {
+static gdmap_t* gdmap_new(const char* name, const vscf_data_t* map_cfg, const fips_t* fips, const char* cache_dir, const uint64_t cfg_seed) {
     dmn_assert(name); dmn_assert(map_cfg);
 
     // basics
@@ -108,6 +116,14 @@ static gdmap_t* gdmap_new(const char* name, const vscf_data_t* map_cfg, const fi
     if(!vscf_is_hash(map_cfg))
         log_fatal("plugin_geoip: value for map '%s' must be a hash", name);
 
+    // tree cache
+    if(cache_dir) {
+        const size_t cache_path_len = strlen(cache_dir) + strlen(name) + 10;
+        gdmap->cache_path = malloc(cache_path_len);
+        snprintf(gdmap->cache_path, cache_path_len, "%s/%s.ntcache", cache_dir, name);
+        gdmap->cfg_hash = ntcache_hash_vscf(cfg_seed, map_cfg);
+    }
+
     // datacenters config
     const vscf_data_t* dc_cfg = vscf_hash_get_data_byconstkey(map_cfg, "datacenters", true);
     if(!dc_cfg)
@@ -176,6 +192,42 @@ static gdmap_t* gdmap_new(const char* name, const vscf_data_t* map_cfg, const fi
     return gdmap;
 }
 
+F_NONNULL F_PURE
+static uint64_t gdmap_cache_key(const gdmap_t* gdmap) {
+    dmn_assert(gdmap);
+    uint64_t key = gdmap->cfg_hash;
+    key = ntcache_hash(key, &gdmap->geoip_stamp, sizeof(ntcache_stamp_t));
+    key = ntcache_hash(key, &gdmap->geoip_v4o_stamp, sizeof(ntcache_stamp_t));
+    key = ntcache_hash(key, &gdmap->nets_stamp, sizeof(ntcache_stamp_t));
+    return key;
+}
+
+// Swaps in a new tree along with ->dclists_pend
+F_NONNULL
+static void gdmap_tree_install(gdmap_t* gdmap, ntree_t* new_tree) {
+    dmn_assert(gdmap); dmn_assert(new_tree);
+    dmn_assert(gdmap->dclists_pend);
+
+    ntree_t* old_tree = gdmap->tree;
+    dclists_t* old_lists = gdmap->dclists;
+
+    gdnsd_prcu_upd_lock();
+    gdnsd_prcu_upd_assign(gdmap->dclists, gdmap->dclists_pend);
+    gdnsd_prcu_upd_assign(gdmap->tree, new_tree);
+    // Before the unlock, so that no reader can still match a cached
+    //   pointer into old_lists by the time they're destroyed below
+    stats_own_inc(&gdmap->gen);
+    gdnsd_prcu_upd_unlock();
+
+    gdmap->dclists_pend = NULL;
+    if(old_tree)
+        ntree_destroy(old_tree);
+    if(old_lists)
+        dclists_destroy(old_lists, KILL_NO_LISTS);
+
+    log_info("plugin_geoip: map '%s' runtime db updated. nets: %u dclists: %u", gdmap->name, gdmap->tree->count + 1, dclists_get_count(gdmap->dclists));
+}
+
 F_NONNULL
 static void gdmap_tree_update(gdmap_t* gdmap) {
     dmn_assert(gdmap);
@@ -195,26 +247,20 @@ static void gdmap_tree_update(gdmap_t* gdmap) {
         merged = nlist_xlate_tree(gdmap->nets_list);
     }
 
-    ntree_t* old_tree = gdmap->tree;
-    dclists_t* old_lists = gdmap->dclists;
-
-    gdnsd_prcu_upd_lock();
-    gdnsd_prcu_upd_assign(gdmap->dclists, gdmap->dclists_pend);
-    gdnsd_prcu_upd_assign(gdmap->tree, merged);
-    gdnsd_prcu_upd_unlock();
+    gdmap_tree_install(gdmap, merged);
 
-    gdmap->dclists_pend = NULL;
-    if(old_tree)
-        ntree_destroy(old_tree);
-    if(old_lists)
-        dclists_destroy(old_lists, KILL_NO_LISTS);
-
-    log_info("plugin_geoip: map '%s' runtime db updated. nets: %u dclists: %u", gdmap->name, gdmap->tree->count + 1, dclists_get_count(gdmap->dclists));
+    if(gdmap->cache_path)
+        ntcache_save(gdmap->cache_path, gdmap_cache_key(gdmap), gdmap->tree, gdmap->dclists, gdmap->name);
 }
 
 F_NONNULL
-static bool gdmap_update_geoip(gdmap_t* gdmap, const char* path, nlist_t** out_list_ptr, gdgeoip_v4o_t v4o_flag) {
-    dmn_assert(gdmap); dmn_assert(path); dmn_assert(out_list_ptr);
+static bool gdmap_update_geoip(gdmap_t* gdmap, const char* path, nlist_t** out_list_ptr, ntcache_stamp_t* out_stamp, gdgeoip_v4o_t v4o_flag) {
+    dmn_assert(gdmap); dmn_assert(path); dmn_assert(out_list_ptr); dmn_assert(out_stamp);
+
+    // stamped before reading, so that a change during the read
+    //   can't be missed by the tree cache key
+    ntcache_stamp_t stamp;
+    ntcache_stamp(path, &stamp);
 
     dclists_t* update_dclists;
 
@@ -226,16 +272,26 @@ static bool gdmap_update_geoip(gdmap_t* gdmap, const char* path, nlist_t** out_l
         update_dclists = gdmap->dclists_pend;
     }
 
-    nlist_t* new_list = gdgeoip_make_list(
-        path,
-        gdmap->name,
-        update_dclists,
-        gdmap->dcmap,
-        gdmap->fips,
-        v4o_flag,
-        gdmap->city_auto_mode,
-        gdmap->city_no_region
-    );
+    nlist_t* new_list = gdmmdb_is_mmdb(path)
+        ? gdmmdb_make_list(
+            path,
+            gdmap->name,
+            update_dclists,
+            gdmap->dcmap,
+            v4o_flag,
+            gdmap->city_auto_mode,
+            gdmap->city_no_region
+        )
+        : gdgeoip_make_list(
+            path,
+            gdmap->name,
+            update_dclists,
+            gdmap->dcmap,
+            gdmap->fips,
+            v4o_flag,
+            gdmap->city_auto_mode,
+            gdmap->city_no_region
+        );
 
     bool rv = false;
 
@@ -251,6 +307,7 @@ static bool gdmap_update_geoip(gdmap_t* gdmap, const char* path, nlist_t** out_l
         if(*out_list_ptr)
             nlist_destroy(*out_list_ptr);
         *out_list_ptr = new_list;
+        *out_stamp = stamp;
     }
 
     return rv;
@@ -261,6 +318,9 @@ static bool gdmap_update_nets(gdmap_t* gdmap) {
     dmn_assert(gdmap);
     dmn_assert(gdmap->nets_path);
 
+    ntcache_stamp_t stamp;
+    ntcache_stamp(gdmap->nets_path, &stamp);
+
     dclists_t* update_dclists;
 
     if(!gdmap->dclists_pend) {
@@ -306,34 +366,76 @@ static bool gdmap_update_nets(gdmap_t* gdmap) {
         if(gdmap->nets_list)
             nlist_destroy(gdmap->nets_list);
         gdmap->nets_list = new_list;
+        gdmap->nets_stamp = stamp;
     }
 
     return rv;
 }
 
-F_NONNULL
-static void gdmap_initial_load_all(gdmap_t* gdmap) {
+// Loads any of the input lists not already loaded.  This is all of them
+//   on a normal initial load, and none of them afterwards, unless the
+//   initial load came from the tree cache, in which case the first
+//   runtime update needs them all in order to merge a new tree.
+F_NONNULL F_WUNUSED
+static bool gdmap_load_missing_lists(gdmap_t* gdmap) {
     dmn_assert(gdmap);
     dmn_assert(gdmap->dclists_pend);
-    dmn_assert(!gdmap->geoip_list);
 
     if(gdmap->geoip_path) {
         const bool v4o = !!gdmap->geoip_v4o_path;
 
-        if(gdmap_update_geoip(gdmap, gdmap->geoip_path, &gdmap->geoip_list, v4o ? V4O_PRIMARY : V4O_NONE))
-            log_fatal("plugin_geoip: map '%s': cannot continue initial load", gdmap->name);
+        if(!gdmap->geoip_list)
+            if(gdmap_update_geoip(gdmap, gdmap->geoip_path, &gdmap->geoip_list, &gdmap->geoip_stamp, v4o ? V4O_PRIMARY : V4O_NONE))
+                return true;
 
-        if(gdmap->geoip_v4o_path)
-            if(gdmap_update_geoip(gdmap, gdmap->geoip_v4o_path, &gdmap->geoip_v4o_list, V4O_SECONDARY))
-                log_fatal("plugin_geoip: map '%s': cannot continue initial load", gdmap->name);
+        if(gdmap->geoip_v4o_path && !gdmap->geoip_v4o_list)
+            if(gdmap_update_geoip(gdmap, gdmap->geoip_v4o_path, &gdmap->geoip_v4o_list, &gdmap->geoip_v4o_stamp, V4O_SECONDARY))
+                return true;
     }
 
     if(!gdmap->nets_list) {
         dmn_assert(gdmap->nets_path);
         if(gdmap_update_nets(gdmap))
-            log_fatal("plugin_geoip: map '%s': cannot continue initial load", gdmap->name);
+            return true;
     }
 
+    return false;
+}
+
+// Installs the tree from the cache file, if it matches the current inputs
+F_NONNULL F_WUNUSED
+static bool gdmap_tree_cache_load(gdmap_t* gdmap) {
+    dmn_assert(gdmap);
+    dmn_assert(gdmap->cache_path);
+    dmn_assert(gdmap->dclists_pend);
+
+    if(gdmap->geoip_path)
+        ntcache_stamp(gdmap->geoip_path, &gdmap->geoip_stamp);
+    if(gdmap->geoip_v4o_path)
+        ntcache_stamp(gdmap->geoip_v4o_path, &gdmap->geoip_v4o_stamp);
+    if(gdmap->nets_path)
+        ntcache_stamp(gdmap->nets_path, &gdmap->nets_stamp);
+
+    ntree_t* tree = ntcache_load(gdmap->cache_path, gdmap_cache_key(gdmap), gdmap->dclists_pend, gdmap->name);
+    if(!tree)
+        return false;
+
+    gdmap_tree_install(gdmap, tree);
+    return true;
+}
+
+F_NONNULL
+static void gdmap_initial_load_all(gdmap_t* gdmap) {
+    dmn_assert(gdmap);
+    dmn_assert(gdmap->dclists_pend);
+    dmn_assert(!gdmap->geoip_list);
+
+    if(gdmap->cache_path && gdmap_tree_cache_load(gdmap))
+        return;
+
+    if(gdmap_load_missing_lists(gdmap))
+        log_fatal("plugin_geoip: map '%s': cannot continue initial load", gdmap->name);
+
     gdmap_tree_update(gdmap);
 }
 
@@ -359,7 +461,7 @@ static void gdmap_geoip_reload_timer_cb(struct ev_loop* loop, ev_timer* w V_UNUS
 
     ev_timer_stop(loop, gdmap->geoip_reload_timer);
 
-    if(!gdmap_update_geoip(gdmap, gdmap->geoip_path, &gdmap->geoip_list, v4o ? V4O_PRIMARY : V4O_NONE)) {
+    if(!gdmap_update_geoip(gdmap, gdmap->geoip_path, &gdmap->geoip_list, &gdmap->geoip_stamp, v4o ? V4O_PRIMARY : V4O_NONE)) {
         dmn_assert(gdmap->dclists_pend);
         gdmap_kick_tree_update(gdmap, loop);
     }
@@ -375,7 +477,7 @@ static void gdmap_geoip_v4o_reload_timer_cb(struct ev_loop* loop, ev_timer* w V_
 
     ev_timer_stop(loop, gdmap->geoip_reload_timer);
 
-    if(!gdmap_update_geoip(gdmap, gdmap->geoip_v4o_path, &gdmap->geoip_v4o_list, V4O_SECONDARY)) {
+    if(!gdmap_update_geoip(gdmap, gdmap->geoip_v4o_path, &gdmap->geoip_v4o_list, &gdmap->geoip_v4o_stamp, V4O_SECONDARY)) {
         dmn_assert(gdmap->dclists_pend);
         gdmap_kick_tree_update(gdmap, loop);
     }
@@ -454,7 +556,10 @@ static void gdmap_tree_update_cb(struct ev_loop* loop, ev_timer* w, int revents
     gdmap_t* gdmap = (gdmap_t*)w->data;
     dmn_assert(gdmap);
     ev_timer_stop(loop, gdmap->tree_update_timer);
-    gdmap_tree_update(gdmap);
+    if(gdmap_load_missing_lists(gdmap))
+        log_err("plugin_geoip: map '%s': runtime db update failed, retaining the previous data", gdmap->name);
+    else
+        gdmap_tree_update(gdmap);
 }
 
 F_NONNULL
@@ -534,14 +639,65 @@ static const char* gdmap_get_name(const gdmap_t* gdmap) {
     return gdmap->name;
 }
 
+/*
+ * Per-thread, direct-mapped cache of recent lookup results.  A lookup
+ *   result (dclist + scope_mask) is the same for every address sharing
+ *   the first scope_mask bits with the looked-up address (that's what
+ *   the scope mask means), so entries store the looked-up address
+ *   truncated to its scope, and hit for any address within that
+ *   network.  Slots are chosen by the map and the first
+ *   LCACHE_V4_PFX/LCACHE_V6_PFX bits of the address, so entries for
+ *   networks at least that wide are shared by all their addresses.
+ * Entries are only valid for the gdmap generation they were created
+ *   in, as the cached dclist points into that generation's dclists.
+ */
+
+#define LCACHE_BITS 12U
+#define LCACHE_SIZE (1U << LCACHE_BITS)
+#define LCACHE_V4_PFX 24U
+#define LCACHE_V6_PFX 48U
+
+typedef struct {
+    const gdmap_t* gdmap;
+    const uint8_t* dclist;
+    stats_uint_t gen;
+    uint64_t hi; // address, truncated to scope_mask bits
+    uint64_t lo;
+    unsigned scope_mask;
+    bool is_v6;
+} lcache_ent_t;
+
+static pthread_key_t lcache_key;
+static pthread_once_t lcache_key_once = PTHREAD_ONCE_INIT;
+static void lcache_make_key(void) { pthread_key_create(&lcache_key, free); }
+
+F_WUNUSED
+static lcache_ent_t* lcache_get(void) {
+    pthread_once(&lcache_key_once, lcache_make_key);
+    lcache_ent_t* lcache = pthread_getspecific(lcache_key);
+    if(unlikely(!lcache)) {
+        lcache = calloc(LCACHE_SIZE, sizeof(lcache_ent_t));
+        pthread_setspecific(lcache_key, lcache);
+    }
+    return lcache;
+}
+
+// truncate the 128-bit hi:lo to its first "bits" bits
 F_NONNULL
-static const uint8_t* gdmap_lookup(gdmap_t* gdmap, const client_info_t* client, unsigned* scope_mask) {
-    dmn_assert(gdmap); dmn_assert(client);
+static void lcache_truncate(uint64_t* hi, uint64_t* lo, const unsigned bits) {
+    dmn_assert(hi); dmn_assert(lo); dmn_assert(bits <= 128);
+    if(bits <= 64) {
+        *lo = 0;
+        *hi = bits ? *hi & (~0ULL << (64 - bits)) : 0;
+    }
+    else {
+        *lo &= (~0ULL << (128 - bits));
+    }
+}
 
-    // gdnsd_prcu_rdr_online() + gdnsd_prcu_rdr_lock()
-    //   is handled by the iothread and dns lookup code
-    //   in the main daemon, in a far outer scope from
-    //   this code in runtime terms.
+F_NONNULL
+static const uint8_t* gdmap_lookup_tree(gdmap_t* gdmap, const client_info_t* client, unsigned* scope_mask) {
+    dmn_assert(gdmap); dmn_assert(client); dmn_assert(scope_mask);
 
     const unsigned dclist_u = ntree_lookup(
         gdnsd_prcu_rdr_deref(gdmap->tree),
@@ -557,6 +713,72 @@ static const uint8_t* gdmap_lookup(gdmap_t* gdmap, const client_info_t* client,
     return dclist_u8;
 }
 
+F_NONNULL
+static const uint8_t* gdmap_lookup(gdmap_t* gdmap, const client_info_t* client, unsigned* scope_mask) {
+    dmn_assert(gdmap); dmn_assert(client);
+
+    // gdnsd_prcu_rdr_online() + gdnsd_prcu_rdr_lock()
+    //   is handled by the iothread and dns lookup code
+    //   in the main daemon, in a far outer scope from
+    //   this code in runtime terms.
+
+    // same address selection as ntree_lookup()
+    const anysin_t* addr = client->edns_client_mask
+        ? &client->edns_client
+        : &client->dns_source;
+
+    uint64_t hi;
+    uint64_t lo;
+    unsigned pfx;
+    const bool is_v6 = (addr->sa.sa_family == AF_INET6);
+    if(is_v6) {
+        const uint8_t* a = addr->sin6.sin6_addr.s6_addr;
+        hi = ((uint64_t)ntohl(gdnsd_get_una32(&a[0])) << 32) | ntohl(gdnsd_get_una32(&a[4]));
+        lo = ((uint64_t)ntohl(gdnsd_get_una32(&a[8])) << 32) | ntohl(gdnsd_get_una32(&a[12]));
+        pfx = LCACHE_V6_PFX;
+    }
+    else {
+        dmn_assert(addr->sa.sa_family == AF_INET);
+        hi = (uint64_t)ntohl(addr->sin.sin_addr.s_addr) << 32;
+        lo = 0;
+        pfx = LCACHE_V4_PFX;
+    }
+
+    const uint64_t slot_key = ((hi >> (64 - pfx)) ^ ((uintptr_t)gdmap >> 4) ^ is_v6)
+        * 0x9E3779B97F4A7C15ULL;
+    lcache_ent_t* ent = &lcache_get()[slot_key >> (64 - LCACHE_BITS)];
+
+    const stats_uint_t gen = stats_get(&gdmap->gen);
+    dmn_assert(gen); // tree_update() has happened at least once
+
+    if(ent->gen == gen && ent->gdmap == gdmap && ent->is_v6 == is_v6) {
+        uint64_t t_hi = hi;
+        uint64_t t_lo = lo;
+        lcache_truncate(&t_hi, &t_lo, ent->scope_mask);
+        if(t_hi == ent->hi && t_lo == ent->lo) {
+            *scope_mask = ent->scope_mask;
+            return ent->dclist;
+        }
+    }
+
+    // Entries are labeled with the gen loaded above, so the tree we walk
+    //   must be at least as new as that: pairs with the ordering of the
+    //   tree/dclists assignment before the gen bump in tree_update()
+    __sync_synchronize();
+    const uint8_t* dclist = gdmap_lookup_tree(gdmap, client, scope_mask);
+
+    lcache_truncate(&hi, &lo, *scope_mask);
+    ent->gdmap = gdmap;
+    ent->dclist = dclist;
+    ent->gen = gen;
+    ent->hi = hi;
+    ent->lo = lo;
+    ent->scope_mask = *scope_mask;
+    ent->is_v6 = is_v6;
+
+    return dclist;
+}
+
 // In practice, the real plugin running in a daemon doesn't bother destroying
 //  gdmap_t's, so there is no race here on pthread_cancel() of i/o
 //  thread doing rdlock lookups and lock destruction here.
@@ -574,6 +796,8 @@ static void gdmap_destroy(gdmap_t* gdmap) {
         nlist_destroy(gdmap->geoip_v4o_list);
     if(gdmap->nets_path)
         free(gdmap->nets_path);
+    if(gdmap->cache_path)
+        free(gdmap->cache_path);
     if(gdmap->geoip_v4o_path)
         free(gdmap->geoip_v4o_path);
     if(gdmap->geoip_path)
@@ -611,6 +835,8 @@ struct _gdmaps_t {
     unsigned count;
     struct ev_loop* reload_loop;
     fips_t* fips;
+    char* cache_dir; // "tree_cache_dir", optional
+    uint64_t cfg_seed; // tree cache key inputs common to all maps
     gdmap_t** maps;
 };
 
@@ -619,7 +845,7 @@ static bool _gdmaps_new_iter(const char* key, unsigned klen V_UNUSED, const vscf
     dmn_assert(key); dmn_assert(val); dmn_assert(data);
     gdmaps_t* gdmaps = data;
     gdmaps->maps = realloc(gdmaps->maps, sizeof(gdmap_t*) * (gdmaps->count + 1));
-    gdmaps->maps[gdmaps->count++] = gdmap_new(key, val, gdmaps->fips);
+    gdmaps->maps[gdmaps->count++] = gdmap_new(key, val, gdmaps->fips, gdmaps->cache_dir, gdmaps->cfg_seed);
     return true;
 }
 
@@ -635,9 +861,20 @@ gdmaps_t* gdmaps_new(const vscf_data_t* maps_cfg) {
             log_fatal("plugin_geoip: 'city_region_names' must be a filename as a simple string value");
         char* fips_path = gdnsd_resolve_path_cfg(vscf_simple_get_data(crn_cfg), "geoip");
         gdmaps->fips = fips_init(fips_path);
+        // the region names file affects translation of every map
+        ntcache_stamp_t fips_stamp;
+        ntcache_stamp(fips_path, &fips_stamp);
+        gdmaps->cfg_seed = ntcache_hash(gdmaps->cfg_seed, &fips_stamp, sizeof(fips_stamp));
         free(fips_path);
     }
 
+    const vscf_data_t* tcd_cfg = vscf_hash_get_data_byconstkey(maps_cfg, "tree_cache_dir", true);
+    if(tcd_cfg) {
+        if(!vscf_is_simple(tcd_cfg) || !vscf_simple_get_len(tcd_cfg))
+            log_fatal("plugin_geoip: 'tree_cache_dir' must be a directory name as a non-empty string value");
+        gdmaps->cache_dir = gdnsd_resolve_path_cfg(vscf_simple_get_data(tcd_cfg), "geoip");
+    }
+
     vscf_hash_iterate(maps_cfg, true, _gdmaps_new_iter, gdmaps);
     return gdmaps;
 }
@@ -777,6 +1014,8 @@ void gdmaps_destroy(gdmaps_t* gdmaps) {
     for(unsigned i = 0; i < gdmaps->count; i++)
         gdmap_destroy(gdmaps->maps[i]);
     free(gdmaps->maps);
+    if(gdmaps->cache_dir)
+        free(gdmaps->cache_dir);
     if(gdmaps->fips)
         fips_destroy(gdmaps->fips);
     free(gdmaps);
@@ -0,0 +1,704 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "gdmmdb.h"
+#include "dbwalk.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <gdnsd/dmn.h>
+#include <gdnsd/log.h>
+#include <gdnsd/misc.h>
+
+/*****************************************************************************
+ * Reader for the MaxMind DB file format (GeoIP2 / GeoLite2 ".mmdb"), per
+ * the public specification at http://maxmind.github.io/MaxMind-DB/ .
+ *
+ * The layout is: a binary search tree of node_count nodes, each holding
+ * two record_size-bit records; 16 zero bytes; a data section of typed,
+ * self-describing values; and finally a metadata marker followed by a
+ * metadata map in the same encoding as the data section.  A record value
+ * less than node_count is a node index, exactly node_count means "no
+ * data", and anything larger is (value - node_count - 16) as an offset
+ * into the data section.
+ *
+ * The tree walk and translation are done by dbwalk, whose threads each
+ * take a subtree and decode its data records (once per thread for each
+ * distinct record) into dclists via mmdb_get_dclist().
+ ****************************************************************************/
+
+#define MMDB_META_MARKER "\xAB\xCD\xEFMaxMind.com"
+#define MMDB_META_MARKER_LEN 14U
+#define MMDB_META_MAXSIZE 131072U
+#define MMDB_MAX_NEST 32U
+
+// doff value for leaves with no data record
+#define MMDB_NO_DATA UINT32_MAX
+
+typedef enum {
+    MMDB_T_EXTENDED = 0,
+    MMDB_T_POINTER  = 1,
+    MMDB_T_STRING   = 2,
+    MMDB_T_DOUBLE   = 3,
+    MMDB_T_BYTES    = 4,
+    MMDB_T_UINT16   = 5,
+    MMDB_T_UINT32   = 6,
+    MMDB_T_MAP      = 7,
+    MMDB_T_INT32    = 8,
+    MMDB_T_UINT64   = 9,
+    MMDB_T_UINT128  = 10,
+    MMDB_T_ARRAY    = 11,
+    MMDB_T_CACHE    = 12,
+    MMDB_T_END      = 13,
+    MMDB_T_BOOLEAN  = 14,
+    MMDB_T_FLOAT    = 15,
+} mmdb_type_t;
+
+// A data section (the main one, or the metadata), which is the
+//   addressing base for offsets and pointers within it.
+typedef struct {
+    const uint8_t* base;
+    uint32_t size;
+} mmdb_sect_t;
+
+// A decoded value header.  "off" is the start of the payload (or of the
+//   first child for maps and arrays), "size" is the payload length (or
+//   child count, or the boolean value).  "via_ptr" indicates the value
+//   was reached through a pointer.
+typedef struct {
+    unsigned type;
+    uint32_t size;
+    uint32_t off;
+    bool via_ptr;
+} mmdb_entry_t;
+
+typedef struct {
+    const char* pathname;
+    const char* map_name;
+    const dcmap_t* dcmap;
+    uint8_t* data;
+    size_t size;
+    mmdb_sect_t dsect;
+    mmdb_sect_t msect;
+    uint32_t node_count;
+    unsigned node_bytes;
+    unsigned record_size;
+    int fd;
+    gdgeoip_v4o_t v4o_flag;
+    bool ipv6;
+    bool is_city;
+    bool city_auto_mode;
+    bool city_no_region;
+} mmdb_t;
+
+bool gdmmdb_is_mmdb(const char* pathname) {
+    dmn_assert(pathname);
+    const unsigned len = strlen(pathname);
+    return len > 5 && !strcmp(&pathname[len - 5], ".mmdb");
+}
+
+/********************************
+ * Data section decoding
+ ********************************/
+
+// Decodes the value header at "off" into "e", and sets *next to the
+//   offset following this value's header and payload (for maps and
+//   arrays, that's the first child, which callers must skip).  Pointers
+//   are followed transparently, in which case *next is the offset after
+//   the pointer itself.  Retval true means corrupt data.
+F_NONNULL F_WUNUSED
+static bool mmdb_decode(const mmdb_sect_t* s, uint32_t off, mmdb_entry_t* e, uint32_t* next) {
+    dmn_assert(s); dmn_assert(e); dmn_assert(next);
+
+    const uint8_t* b = s->base;
+    bool followed = false;
+
+    while(1) {
+        if(off >= s->size)
+            return true;
+        const unsigned ctrl = b[off++];
+        unsigned type = ctrl >> 5;
+
+        if(type == MMDB_T_POINTER) {
+            if(followed) // pointer to pointer is illegal
+                return true;
+            const unsigned ss = (ctrl >> 3) & 3U;
+            if(off + ss + 1 > s->size)
+                return true;
+            uint32_t ptr;
+            switch(ss) {
+                case 0:
+                    ptr = ((ctrl & 7U) << 8) | b[off];
+                    break;
+                case 1:
+                    ptr = (((ctrl & 7U) << 16) | (b[off] << 8) | b[off + 1]) + 2048U;
+                    break;
+                case 2:
+                    ptr = (((ctrl & 7U) << 24) | (b[off] << 16) | (b[off + 1] << 8) | b[off + 2]) + 526336U;
+                    break;
+                default:
+                    ptr = ((uint32_t)b[off] << 24) | (b[off + 1] << 16) | (b[off + 2] << 8) | b[off + 3];
+                    break;
+            }
+            *next = off + ss + 1;
+            followed = true;
+            off = ptr;
+            continue;
+        }
+
+        if(type == MMDB_T_EXTENDED) {
+            if(off >= s->size)
+                return true;
+            type = 7U + b[off++];
+            if(type < MMDB_T_INT32 || type > MMDB_T_FLOAT)
+                return true;
+        }
+
+        uint32_t size = ctrl & 0x1FU;
+        if(size >= 29U) {
+            const unsigned extra = size - 28U;
+            if(off + extra > s->size)
+                return true;
+            if(size == 29U)
+                size = 29U + b[off];
+            else if(size == 30U)
+                size = 285U + ((b[off] << 8) | b[off + 1]);
+            else
+                size = 65821U + ((b[off] << 16) | (b[off + 1] << 8) | b[off + 2]);
+            off += extra;
+        }
+
+        e->type = type;
+        e->size = size;
+        e->off = off;
+        e->via_ptr = followed;
+
+        uint32_t payload;
+        switch(type) {
+            case MMDB_T_MAP:
+            case MMDB_T_ARRAY:
+            case MMDB_T_BOOLEAN:
+                payload = 0;
+                break;
+            case MMDB_T_DOUBLE:
+                if(size != 8U)
+                    return true;
+                payload = size;
+                break;
+            case MMDB_T_FLOAT:
+                if(size != 4U)
+                    return true;
+                payload = size;
+                break;
+            default:
+                payload = size;
+                break;
+        }
+
+        if(off + payload > s->size || off + payload < off)
+            return true;
+        if(!followed)
+            *next = off + payload;
+        return false;
+    }
+}
+
+// Sets *next to the offset following the complete value at "off"
+F_NONNULL F_WUNUSED
+static bool mmdb_skip(const mmdb_sect_t* s, const uint32_t off, uint32_t* next, const unsigned nest) {
+    dmn_assert(s); dmn_assert(next);
+
+    if(nest > MMDB_MAX_NEST)
+        return true;
+
+    mmdb_entry_t e;
+    uint32_t after;
+    if(mmdb_decode(s, off, &e, &after))
+        return true;
+
+    // If we followed a pointer, "after" is already past the pointer
+    //   and none of the children need to be walked
+    if(!e.via_ptr && (e.type == MMDB_T_MAP || e.type == MMDB_T_ARRAY)) {
+        const uint32_t children = e.type == MMDB_T_MAP ? e.size * 2U : e.size;
+        for(uint32_t i = 0; i < children; i++)
+            if(mmdb_skip(s, after, &after, nest + 1))
+                return true;
+    }
+
+    *next = after;
+    return false;
+}
+
+// Finds "key" in the map "m", decoding its value into "val".
+//   Retval true means not found or corrupt.
+F_NONNULL F_WUNUSED
+static bool mmdb_map_get(const mmdb_sect_t* s, const mmdb_entry_t* m, const char* key, mmdb_entry_t* val) {
+    dmn_assert(s); dmn_assert(m); dmn_assert(key); dmn_assert(val);
+
+    if(m->type != MMDB_T_MAP)
+        return true;
+
+    const unsigned klen = strlen(key);
+    uint32_t off = m->off;
+    for(uint32_t i = 0; i < m->size; i++) {
+        mmdb_entry_t k;
+        if(mmdb_decode(s, off, &k, &off) || k.type != MMDB_T_STRING)
+            return true;
+        if(k.size == klen && !memcmp(&s->base[k.off], key, klen)) {
+            uint32_t unused;
+            return mmdb_decode(s, off, val, &unused);
+        }
+        if(mmdb_skip(s, off, &off, 0))
+            return true;
+    }
+
+    return true;
+}
+
+// Walks a NULL-terminated path of map keys from "m".  A key of "0"
+//   selects the first element of an array.
+F_NONNULL F_WUNUSED
+static bool mmdb_path_get(const mmdb_sect_t* s, const mmdb_entry_t* m, const char* const* path, mmdb_entry_t* val) {
+    dmn_assert(s); dmn_assert(m); dmn_assert(path); dmn_assert(val);
+
+    mmdb_entry_t cur = *m;
+    for(unsigned i = 0; path[i]; i++) {
+        mmdb_entry_t sub;
+        if(cur.type == MMDB_T_ARRAY && !strcmp(path[i], "0")) {
+            uint32_t unused;
+            if(!cur.size || mmdb_decode(s, cur.off, &sub, &unused))
+                return true;
+        }
+        else if(mmdb_map_get(s, &cur, path[i], &sub)) {
+            return true;
+        }
+        cur = sub;
+    }
+
+    *val = cur;
+    return false;
+}
+
+F_NONNULL F_WUNUSED
+static bool mmdb_get_uint(const mmdb_sect_t* s, const mmdb_entry_t* e, uint64_t* out) {
+    dmn_assert(s); dmn_assert(e); dmn_assert(out);
+
+    if((e->type != MMDB_T_UINT16 && e->type != MMDB_T_UINT32 && e->type != MMDB_T_UINT64) || e->size > 8U)
+        return true;
+
+    uint64_t v = 0;
+    for(uint32_t i = 0; i < e->size; i++)
+        v = (v << 8) | s->base[e->off + i];
+    *out = v;
+    return false;
+}
+
+F_NONNULL F_WUNUSED
+static bool mmdb_get_double(const mmdb_sect_t* s, const mmdb_entry_t* e, double* out) {
+    dmn_assert(s); dmn_assert(e); dmn_assert(out);
+
+    if(e->type != MMDB_T_DOUBLE)
+        return true;
+
+    uint64_t v = 0;
+    for(unsigned i = 0; i < 8U; i++)
+        v = (v << 8) | s->base[e->off + i];
+    memcpy(out, &v, sizeof(*out));
+    return false;
+}
+
+// Copies a string value at path into buf as a NUL-terminated string,
+//   returning its length, or zero if missing, empty, or oversized.
+F_NONNULL
+static unsigned mmdb_get_str(const mmdb_sect_t* s, const mmdb_entry_t* m, const char* const* path, char* buf, const unsigned bufsize) {
+    dmn_assert(s); dmn_assert(m); dmn_assert(path); dmn_assert(buf);
+
+    mmdb_entry_t e;
+    if(mmdb_path_get(s, m, path, &e) || e.type != MMDB_T_STRING || e.size >= bufsize)
+        return 0;
+    memcpy(buf, &s->base[e.off], e.size);
+    buf[e.size] = '\0';
+    return e.size;
+}
+
+/********************************
+ * Data record -> dclist
+ ********************************/
+
+static const char* const path_continent[] = { "continent", "code", NULL };
+static const char* const path_country[] = { "country", "iso_code", NULL };
+static const char* const path_reg_country[] = { "registered_country", "iso_code", NULL };
+static const char* const path_subdiv[] = { "subdivisions", "0", "iso_code", NULL };
+static const char* const path_city[] = { "city", "names", "en", NULL };
+static const char* const path_lat[] = { "location", "latitude", NULL };
+static const char* const path_lon[] = { "location", "longitude", NULL };
+
+// Converts floating point degrees to the legacy GeoIP City
+//   fixed-point representation used by dclists_city_auto_map()
+F_CONST
+static unsigned mmdb_raw_coord(const double deg) {
+    return (unsigned)((deg + 180.0) * 10000.0 + 0.5);
+}
+
+// Appends "str" (or "--" if empty) to locstr at *pos
+F_NONNULL
+static void mmdb_loc_add(char* locstr, unsigned* pos, const char* str, const unsigned len) {
+    dmn_assert(locstr); dmn_assert(pos); dmn_assert(str);
+    if(len) {
+        memcpy(&locstr[*pos], str, len);
+        *pos += len;
+    }
+    else {
+        locstr[(*pos)++] = '-';
+        locstr[(*pos)++] = '-';
+    }
+    locstr[(*pos)++] = '\0';
+}
+
+// Converts a leaf record to a data section offset
+F_NONNULL F_PURE
+static uint32_t mmdb_rec_doff(const mmdb_t* db, const uint32_t rec) {
+    dmn_assert(db); dmn_assert(rec >= db->node_count);
+
+    if(rec == db->node_count)
+        return MMDB_NO_DATA;
+
+    const uint32_t off = rec - db->node_count - 16U;
+    if(rec - db->node_count < 16U || off >= db->dsect.size)
+        return db->dsect.size; // invalid
+    return off;
+}
+
+// Translates a leaf record for dbwalk, which calls this concurrently
+//   from all of its threads
+F_NONNULL
+static int mmdb_get_dclist(const void* db_asvoid, const uint32_t leaf, unsigned* raw_lat_out, unsigned* raw_lon_out) {
+    const mmdb_t* db = db_asvoid;
+    dmn_assert(db); dmn_assert(raw_lat_out); dmn_assert(raw_lon_out);
+
+    const uint32_t doff = mmdb_rec_doff(db, leaf);
+    if(doff == db->dsect.size) {
+        log_err("plugin_geoip: map '%s': MaxMind DB '%s': invalid data record pointer, corrupt?", db->map_name, logf_pathname(db->pathname));
+        return -2;
+    }
+
+    if(!db->city_auto_mode && !db->dcmap)
+        return 0;
+
+    const mmdb_sect_t* s = &db->dsect;
+
+    // 1800000 == 0.0 when raw is converted to floating-point degrees
+    unsigned raw_lat = 1800000;
+    unsigned raw_lon = 1800000;
+    char locstr[256];
+    unsigned loc_pos = 0;
+    char cont[8] = "";
+    char cc[8] = "";
+    char region[128] = "";
+    char city[128] = "";
+    unsigned cont_len = 0;
+    unsigned cc_len = 0;
+    unsigned region_len = 0;
+    unsigned city_len = 0;
+
+    mmdb_entry_t rec;
+    uint32_t unused;
+    if(doff != MMDB_NO_DATA && !mmdb_decode(s, doff, &rec, &unused) && rec.type == MMDB_T_MAP) {
+        cont_len = mmdb_get_str(s, &rec, path_continent, cont, sizeof(cont));
+        cc_len = mmdb_get_str(s, &rec, path_country, cc, sizeof(cc));
+        if(!cc_len)
+            cc_len = mmdb_get_str(s, &rec, path_reg_country, cc, sizeof(cc));
+        if(db->is_city) {
+            if(!db->city_no_region)
+                region_len = mmdb_get_str(s, &rec, path_subdiv, region, sizeof(region));
+            city_len = mmdb_get_str(s, &rec, path_city, city, sizeof(city));
+            mmdb_entry_t lat_e, lon_e;
+            double lat, lon;
+            if(!mmdb_path_get(s, &rec, path_lat, &lat_e) && !mmdb_get_double(s, &lat_e, &lat)
+                && !mmdb_path_get(s, &rec, path_lon, &lon_e) && !mmdb_get_double(s, &lon_e, &lon)
+                && lat >= -90.0 && lat <= 90.0 && lon >= -180.0 && lon <= 180.0) {
+                raw_lat = mmdb_raw_coord(lat);
+                raw_lon = mmdb_raw_coord(lon);
+            }
+        }
+    }
+
+    // Anything but two-letter codes is treated as unknown
+    if(cont_len != 2U)
+        cont_len = 0;
+    if(cc_len != 2U)
+        cc_len = 0;
+
+    int dclist = -1;
+    if(db->dcmap) {
+        mmdb_loc_add(locstr, &loc_pos, cont, cont_len);
+        mmdb_loc_add(locstr, &loc_pos, cc, cc_len);
+        // As with legacy City data, the region level is always present
+        //   (possibly as "--") unless city_no_region, and the city level
+        //   only if known.
+        if(db->is_city && cc_len) {
+            if(!db->city_no_region)
+                mmdb_loc_add(locstr, &loc_pos, region, region_len);
+            if(city_len)
+                mmdb_loc_add(locstr, &loc_pos, city, city_len);
+        }
+        locstr[loc_pos] = '\0';
+        dclist = dcmap_lookup_loc(db->dcmap, locstr);
+    }
+
+    // -1 (auto_dc_coords) is mapped from the coordinates by dbwalk
+    dmn_assert(dclist > -1 || db->city_auto_mode);
+    *raw_lat_out = raw_lat;
+    *raw_lon_out = raw_lon;
+    return dclist;
+}
+
+/********************************
+ * Search tree walking
+ ********************************/
+
+F_NONNULL
+static void mmdb_read_node(const void* db_asvoid, const uint32_t node, uint32_t* zero, uint32_t* one) {
+    const mmdb_t* db = db_asvoid;
+    dmn_assert(db); dmn_assert(zero); dmn_assert(one);
+    dmn_assert(node < db->node_count);
+
+    const uint8_t* n = &db->data[(size_t)node * db->node_bytes];
+    switch(db->record_size) {
+        case 24:
+            *zero = (n[0] << 16) | (n[1] << 8) | n[2];
+            *one = (n[3] << 16) | (n[4] << 8) | n[5];
+            break;
+        case 28:
+            *zero = ((uint32_t)(n[3] & 0xF0U) << 20) | (n[0] << 16) | (n[1] << 8) | n[2];
+            *one = ((uint32_t)(n[3] & 0x0FU) << 24) | (n[4] << 16) | (n[5] << 8) | n[6];
+            break;
+        default:
+            dmn_assert(db->record_size == 32);
+            *zero = ((uint32_t)n[0] << 24) | (n[1] << 16) | (n[2] << 8) | n[3];
+            *one = ((uint32_t)n[4] << 24) | (n[5] << 16) | (n[6] << 8) | n[7];
+            break;
+    }
+}
+
+/********************************
+ * Open/close
+ ********************************/
+
+F_NONNULL
+static bool mmdb_close(mmdb_t* db) {
+    dmn_assert(db);
+    bool rv = false;
+
+    if(db->fd != -1) {
+        if(db->data) {
+            if(-1 == munmap(db->data, db->size)) {
+                log_err("plugin_geoip: munmap() of '%s' failed: %s", logf_pathname(db->pathname), logf_errno());
+                rv = true;
+            }
+        }
+        if(close(db->fd) == -1) {
+            log_err("plugin_geoip: close() of '%s' failed: %s", logf_pathname(db->pathname), logf_errno());
+            rv = true;
+        }
+    }
+
+    free(db);
+
+    return rv;
+}
+
+static const char* const path_node_count[] = { "node_count", NULL };
+static const char* const path_record_size[] = { "record_size", NULL };
+static const char* const path_ip_version[] = { "ip_version", NULL };
+static const char* const path_db_type[] = { "database_type", NULL };
+
+F_NONNULL F_WUNUSED
+static bool mmdb_read_meta(mmdb_t* db) {
+    dmn_assert(db);
+
+    // The metadata marker is the last occurrence within the final 128K
+    const size_t search_start = db->size > MMDB_META_MAXSIZE ? db->size - MMDB_META_MAXSIZE : 0;
+    size_t marker = db->size - MMDB_META_MARKER_LEN + 1;
+    bool found = false;
+    while(marker-- > search_start) {
+        if(!memcmp(&db->data[marker], MMDB_META_MARKER, MMDB_META_MARKER_LEN)) {
+            found = true;
+            break;
+        }
+    }
+    if(!found) {
+        log_err("plugin_geoip: map '%s': '%s' is not a MaxMind DB file (metadata not found)", db->map_name, logf_pathname(db->pathname));
+        return true;
+    }
+
+    db->msect.base = &db->data[marker + MMDB_META_MARKER_LEN];
+    db->msect.size = db->size - marker - MMDB_META_MARKER_LEN;
+
+    mmdb_entry_t meta;
+    mmdb_entry_t e;
+    uint32_t unused;
+    uint64_t node_count, record_size, ip_version;
+    if(mmdb_decode(&db->msect, 0, &meta, &unused)
+        || mmdb_path_get(&db->msect, &meta, path_node_count, &e) || mmdb_get_uint(&db->msect, &e, &node_count)
+        || mmdb_path_get(&db->msect, &meta, path_record_size, &e) || mmdb_get_uint(&db->msect, &e, &record_size)
+        || mmdb_path_get(&db->msect, &meta, path_ip_version, &e) || mmdb_get_uint(&db->msect, &e, &ip_version)) {
+        log_err("plugin_geoip: map '%s': MaxMind DB '%s': corrupt metadata", db->map_name, logf_pathname(db->pathname));
+        return true;
+    }
+
+    char db_type[128];
+    if(!mmdb_get_str(&db->msect, &meta, path_db_type, db_type, sizeof(db_type)))
+        db_type[0] = '\0';
+    db->is_city = strstr(db_type, "City") || strstr(db_type, "Enterprise");
+
+    if(record_size != 24 && record_size != 28 && record_size != 32) {
+        log_err("plugin_geoip: map '%s': MaxMind DB '%s': unsupported record size %" PRIu64, db->map_name, logf_pathname(db->pathname), record_size);
+        return true;
+    }
+    if(ip_version != 4 && ip_version != 6) {
+        log_err("plugin_geoip: map '%s': MaxMind DB '%s': unsupported IP version %" PRIu64, db->map_name, logf_pathname(db->pathname), ip_version);
+        return true;
+    }
+
+    db->record_size = record_size;
+    db->node_bytes = record_size / 4U;
+    db->ipv6 = (ip_version == 6);
+
+    const size_t tree_size = (size_t)node_count * db->node_bytes;
+    if(!node_count || node_count >= (1ULL << record_size) || tree_size + 16U > marker) {
+        log_err("plugin_geoip: map '%s': MaxMind DB '%s': search tree size is invalid", db->map_name, logf_pathname(db->pathname));
+        return true;
+    }
+    db->node_count = node_count;
+    db->dsect.base = &db->data[tree_size + 16U];
+    db->dsect.size = marker - tree_size - 16U;
+
+    log_debug("plugin_geoip: map '%s': MaxMind DB '%s': type '%s', IPv%" PRIu64 ", %" PRIu64 " nodes of %" PRIu64 " bits", db->map_name, logf_pathname(db->pathname), db_type, ip_version, node_count, record_size);
+    return false;
+}
+
+F_NONNULLX(1,2)
+static mmdb_t* mmdb_open(const char* pathname, const char* map_name, const dcmap_t* dcmap, const gdgeoip_v4o_t v4o_flag, const bool city_auto_mode, const bool city_no_region) {
+    dmn_assert(pathname); dmn_assert(map_name);
+
+    mmdb_t* db = calloc(1, sizeof(mmdb_t));
+    db->fd = -1;
+    db->pathname = pathname;
+    db->map_name = map_name;
+    db->dcmap = dcmap;
+    db->v4o_flag = v4o_flag;
+    db->city_auto_mode = city_auto_mode;
+    db->city_no_region = city_no_region;
+
+    if((db->fd = open(pathname, O_RDONLY)) == -1) {
+        log_err("plugin_geoip: map '%s': Cannot open '%s' for reading: %s", map_name, logf_pathname(pathname), logf_errno());
+        mmdb_close(db);
+        return NULL;
+    }
+
+    struct stat db_stat;
+    if(fstat(db->fd, &db_stat) == -1) {
+        log_err("plugin_geoip: map '%s': Cannot fstat '%s': %s", map_name, logf_pathname(pathname), logf_errno());
+        mmdb_close(db);
+        return NULL;
+    }
+
+    db->size = db_stat.st_size;
+
+    if(db->size < MMDB_META_MARKER_LEN + 16U || db_stat.st_size > (off_t)UINT32_MAX) {
+        log_err("plugin_geoip: map '%s': MaxMind DB '%s' has invalid size", map_name, logf_pathname(pathname));
+        mmdb_close(db);
+        return NULL;
+    }
+
+    if((db->data = mmap(NULL, db->size, PROT_READ, MAP_SHARED, db->fd, 0)) == MAP_FAILED) {
+        db->data = 0;
+        log_err("plugin_geoip: map '%s': Failed to mmap MaxMind DB '%s': %s", map_name, logf_pathname(pathname), logf_errno());
+        mmdb_close(db);
+        return NULL;
+    }
+
+    if(mmdb_read_meta(db)) {
+        mmdb_close(db);
+        return NULL;
+    }
+
+    if(city_auto_mode && !db->is_city) {
+        log_err("plugin_geoip: map '%s': MaxMind DB '%s' is not a City-level database and this map uses auto_dc_coords", map_name, logf_pathname(pathname));
+        mmdb_close(db);
+        return NULL;
+    }
+
+    if((v4o_flag == V4O_PRIMARY) && !db->ipv6) {
+        log_err("plugin_geoip: map '%s': Primary MaxMind DB '%s' is not an IPv6 database and this map uses geoip_v4_overlay", map_name, logf_pathname(pathname));
+        mmdb_close(db);
+        return NULL;
+    }
+    else if((v4o_flag == V4O_SECONDARY) && db->ipv6) {
+        log_err("plugin_geoip: map '%s': geoip_v4_overlay database '%s' is not an IPv4 database", map_name, logf_pathname(pathname));
+        mmdb_close(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+nlist_t* gdmmdb_make_list(const char* pathname, const char* map_name, dclists_t* dclists, const dcmap_t* dcmap, const gdgeoip_v4o_t v4o_flag, const bool city_auto_mode, const bool city_no_region) {
+    dmn_assert(pathname); dmn_assert(map_name); dmn_assert(dclists);
+
+    log_info("plugin_geoip: map '%s': Processing MaxMind DB '%s'", map_name, logf_pathname(pathname));
+
+    nlist_t* nl = NULL;
+
+    mmdb_t* db = mmdb_open(pathname, map_name, dcmap, v4o_flag, city_auto_mode, city_no_region);
+    if(db) {
+        const dbwalk_cfg_t walk_cfg = {
+            .db = db,
+            .read_node = mmdb_read_node,
+            .get_dclist = mmdb_get_dclist,
+            .dclists = dclists,
+            .map_name = map_name,
+            .node_count = db->node_count,
+            .leaf_min = db->node_count,
+            .start_depth = db->ipv6 ? 128 : 32,
+            .v4o_flag = v4o_flag,
+        };
+        nl = dbwalk_make_list(&walk_cfg);
+
+        if(mmdb_close(db) && nl) {
+            nlist_destroy(nl);
+            nl = NULL;
+        }
+
+        if(nl)
+            nlist_finish(nl);
+    }
+
+    return nl;
+}
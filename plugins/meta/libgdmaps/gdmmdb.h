@@ -0,0 +1,40 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GDMMDB_H
+#define GDMMDB_H
+
+#include <gdnsd/log.h>
+#include "gdgeoip.h"
+#include "dclists.h"
+#include "dcmap.h"
+#include "nlist.h"
+
+// True if pathname names a MaxMind DB (GeoIP2/GeoLite2) file, which
+//   is determined solely by the ".mmdb" filename extension.
+F_NONNULL F_PURE
+bool gdmmdb_is_mmdb(const char* pathname);
+
+// The MaxMind DB equivalent of gdgeoip_make_list(), with the same
+//   semantics for all common arguments.  There is no FIPS argument,
+//   as MaxMind DB subdivisions are already ISO 3166-2 codes.
+F_NONNULLX(1,2,3)
+nlist_t* gdmmdb_make_list(const char* pathname, const char* map_name, dclists_t* dclists, const dcmap_t* dcmap, const gdgeoip_v4o_t v4o_flag, const bool city_auto_mode, const bool city_no_region);
+
+#endif // GDMMDB_H
@@ -215,6 +215,34 @@ void nlist_append(nlist_t* nl, const uint8_t* ipv6, const unsigned mask, const u
     }
 }
 
+void nlist_append_list(nlist_t* nl, const nlist_t* other) {
+    dmn_assert(nl); dmn_assert(other);
+    dmn_assert(nl->normalized); dmn_assert(other->normalized);
+
+    // Only the head of "other" can merge into the tail of "nl": once
+    //   one of its nets goes in unmerged, the rest are already in
+    //   normalized form after it and can simply be copied.
+    unsigned i = 0;
+    while(i < other->count) {
+        const unsigned old_count = nl->count;
+        const net_t* this_net = &other->nets[i++];
+        nlist_append(nl, this_net->ipv6, this_net->mask, this_net->dclist);
+        if(nl->count > old_count)
+            break;
+    }
+
+    const unsigned rest = other->count - i;
+    if(rest) {
+        if(nl->count + rest > nl->alloc) {
+            while(nl->count + rest > nl->alloc)
+                nl->alloc <<= 1U;
+            nl->nets = realloc(nl->nets, sizeof(net_t) * nl->alloc);
+        }
+        memcpy(&nl->nets[nl->count], &other->nets[i], sizeof(net_t) * rest);
+        nl->count += rest;
+    }
+}
+
 F_NONNULL F_PURE
 static bool net_eq(const net_t* na, const net_t* nb) {
     dmn_assert(na); dmn_assert(nb);
@@ -42,6 +42,11 @@ void nlist_destroy(nlist_t* nl);
 F_NONNULL
 void nlist_append(nlist_t* nl, const uint8_t* ipv6, const unsigned mask, const unsigned dclist);
 
+// Appends all of "other" to "nl".  Both must be pre_norm, and the
+//   first net of "other" must follow the last net of "nl" in order.
+F_NONNULL
+void nlist_append_list(nlist_t* nl, const nlist_t* other);
+
 // Call this when all nlist_append() are complete.  For lists
 //   which are not "pre_norm", this does a bunch of normalization
 //   transformations on the data first (which can fail, hence
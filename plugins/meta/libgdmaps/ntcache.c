@@ -0,0 +1,407 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "ntcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <gdnsd/dmn.h>
+#include <gdnsd/log.h>
+
+/*
+ * File layout, all in host byte order:
+ *   ntc_hdr_t
+ *   nnode_t store[count]
+ *   uint32_t dp_v4[1 << NT_DP_BITS]
+ *   uint32_t dp_v6[1 << NT_DP_BITS]
+ *   ntpnode_t pnodes[pnode_count]
+ *   ntleaf_t leaves[leaf_count]
+ *   dclist_count NUL-terminated dclists, dclists_len bytes in total
+ * Each section after the header is zero-padded to a multiple of 8
+ *   bytes, which keeps every array aligned in the mapping.  The checksum
+ *   covers everything after the header, including the padding.
+ */
+
+#define NTC_MAGIC "gdnsdNTC"
+#define NTC_VERSION 1U
+#define NTC_ALIGN(_x) (((_x) + 7U) & ~(size_t)7U)
+#define NTC_HASH_PRIME UINT64_C(0x100000001B3)
+
+typedef struct {
+    char magic[8];
+    uint64_t layout;   // see ntc_layout_sig()
+    uint64_t key;
+    uint64_t checksum;
+    uint32_t ipv4;
+    uint32_t count;
+    uint32_t pnode_count;
+    uint32_t leaf_count;
+    uint32_t dclist_count;
+    uint32_t dclists_len;
+} ntc_hdr_t;
+
+typedef struct {
+    size_t store;
+    size_t dp_v4;
+    size_t dp_v6;
+    size_t pnodes;
+    size_t leaves;
+    size_t dclists;
+    size_t total;
+} ntc_offsets_t;
+
+uint64_t ntcache_hash(uint64_t h, const void* data, const size_t len) {
+    dmn_assert(data);
+    const uint8_t* bytes = data;
+    for(size_t i = 0; i < len; i++) {
+        h ^= bytes[i];
+        h *= NTC_HASH_PRIME;
+    }
+    return h;
+}
+
+uint64_t ntcache_hash_vscf(uint64_t h, const vscf_data_t* cfg) {
+    dmn_assert(cfg);
+
+    if(vscf_is_simple(cfg)) {
+        const unsigned len = vscf_simple_get_len(cfg);
+        h = ntcache_hash(h, "s", 1);
+        h = ntcache_hash(h, &len, sizeof(len));
+        h = ntcache_hash(h, vscf_simple_get_data(cfg), len);
+    }
+    else if(vscf_is_array(cfg)) {
+        const unsigned len = vscf_array_get_len(cfg);
+        h = ntcache_hash(h, "a", 1);
+        h = ntcache_hash(h, &len, sizeof(len));
+        for(unsigned i = 0; i < len; i++)
+            h = ntcache_hash_vscf(h, vscf_array_get_data(cfg, i));
+    }
+    else {
+        dmn_assert(vscf_is_hash(cfg));
+        const unsigned len = vscf_hash_get_len(cfg);
+        h = ntcache_hash(h, "h", 1);
+        h = ntcache_hash(h, &len, sizeof(len));
+        for(unsigned i = 0; i < len; i++) {
+            unsigned klen;
+            const char* key = vscf_hash_get_key_byindex(cfg, i, &klen);
+            h = ntcache_hash(h, &klen, sizeof(klen));
+            h = ntcache_hash(h, key, klen);
+            h = ntcache_hash_vscf(h, vscf_hash_get_data_byindex(cfg, i));
+        }
+    }
+
+    return h;
+}
+
+void ntcache_stamp(const char* path, ntcache_stamp_t* stamp) {
+    dmn_assert(path); dmn_assert(stamp);
+
+    struct stat st;
+    if(stat(path, &st)) {
+        stamp->mtime = 0;
+        stamp->size = 0;
+    }
+    else {
+        stamp->mtime = (uint64_t)st.st_mtime;
+        stamp->size = (uint64_t)st.st_size;
+    }
+}
+
+// Changes whenever the file layout or the structures it contains do,
+//   including byte order.
+F_PURE
+static uint64_t ntc_layout_sig(void) {
+    const uint32_t sig[] = {
+        NTC_VERSION,
+        0x01020304U,
+        sizeof(ntc_hdr_t),
+        sizeof(nnode_t),
+        sizeof(ntpnode_t),
+        sizeof(ntleaf_t),
+        NT_DP_BITS,
+        NT_PT_STRIDE,
+    };
+    return ntcache_hash(0, sig, sizeof(sig));
+}
+
+F_NONNULL
+static void ntc_offsets(const ntc_hdr_t* hdr, ntc_offsets_t* o) {
+    dmn_assert(hdr); dmn_assert(o);
+
+    o->store = NTC_ALIGN(sizeof(ntc_hdr_t));
+    o->dp_v4 = o->store + NTC_ALIGN((size_t)hdr->count * sizeof(nnode_t));
+    o->dp_v6 = o->dp_v4 + NTC_ALIGN((1U << NT_DP_BITS) * sizeof(uint32_t));
+    o->pnodes = o->dp_v6 + NTC_ALIGN((1U << NT_DP_BITS) * sizeof(uint32_t));
+    o->leaves = o->pnodes + NTC_ALIGN((size_t)hdr->pnode_count * sizeof(ntpnode_t));
+    o->dclists = o->leaves + NTC_ALIGN((size_t)hdr->leaf_count * sizeof(ntleaf_t));
+    o->total = o->dclists + NTC_ALIGN(hdr->dclists_len);
+}
+
+// Word-at-a-time FNV-style checksum, with a trailing partial word
+//   zero-padded just as it is in the file.
+F_NONNULL F_PURE
+static uint64_t ntc_checksum(uint64_t h, const void* data, const size_t len) {
+    dmn_assert(data);
+
+    const uint8_t* bytes = data;
+    const size_t whole = len & ~(size_t)7U;
+    for(size_t i = 0; i < whole; i += 8) {
+        uint64_t word;
+        memcpy(&word, &bytes[i], 8);
+        h ^= word;
+        h *= NTC_HASH_PRIME;
+    }
+    if(len != whole) {
+        uint64_t word = 0;
+        memcpy(&word, &bytes[whole], len - whole);
+        h ^= word;
+        h *= NTC_HASH_PRIME;
+    }
+    return h;
+}
+
+F_NONNULL F_WUNUSED
+static bool ntc_write(FILE* f, const void* data, const size_t len, uint64_t* csum) {
+    dmn_assert(f); dmn_assert(data); dmn_assert(csum);
+
+    static const uint8_t zeros[8] = { 0 };
+    const size_t pad = NTC_ALIGN(len) - len;
+
+    *csum = ntc_checksum(*csum, data, len);
+    if(len && fwrite(data, len, 1, f) != 1)
+        return true;
+    if(pad && fwrite(zeros, pad, 1, f) != 1)
+        return true;
+    return false;
+}
+
+void ntcache_save(const char* path, const uint64_t key, const ntree_t* tree, const dclists_t* lists, const char* map_name) {
+    dmn_assert(path); dmn_assert(tree); dmn_assert(lists); dmn_assert(map_name);
+    dmn_assert(!tree->alloc); // ntree_finish() was called
+
+    ntc_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, NTC_MAGIC, sizeof(hdr.magic));
+    hdr.layout = ntc_layout_sig();
+    hdr.key = key;
+    hdr.ipv4 = tree->ipv4;
+    hdr.count = tree->count;
+    hdr.pnode_count = tree->pnode_count;
+    hdr.leaf_count = tree->leaf_count;
+    hdr.dclist_count = dclists_get_count(lists);
+
+    size_t dclists_len = 0;
+    for(unsigned i = 0; i < hdr.dclist_count; i++)
+        dclists_len += strlen((const char*)dclists_get_list(lists, i)) + 1;
+    hdr.dclists_len = dclists_len;
+    uint8_t* dclists_buf = malloc(dclists_len);
+    uint8_t* dcl_out = dclists_buf;
+    for(unsigned i = 0; i < hdr.dclist_count; i++) {
+        const uint8_t* dcl = dclists_get_list(lists, i);
+        const size_t dcl_len = strlen((const char*)dcl) + 1;
+        memcpy(dcl_out, dcl, dcl_len);
+        dcl_out += dcl_len;
+    }
+
+    const size_t tmp_len = strlen(path) + 5;
+    char* tmp_path = malloc(tmp_len);
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    bool err = false;
+    FILE* f = fopen(tmp_path, "w");
+    if(!f) {
+        log_err("plugin_geoip: map '%s': cannot open tree cache file '%s' for writing: %s", map_name, logf_pathname(tmp_path), logf_errno());
+        err = true;
+    }
+    else {
+        uint64_t csum = 0;
+        if(fwrite(&hdr, sizeof(hdr), 1, f) != 1
+            || ntc_write(f, tree->store, (size_t)tree->count * sizeof(nnode_t), &csum)
+            || ntc_write(f, tree->dp_v4, (1U << NT_DP_BITS) * sizeof(uint32_t), &csum)
+            || ntc_write(f, tree->dp_v6, (1U << NT_DP_BITS) * sizeof(uint32_t), &csum)
+            || ntc_write(f, tree->pnodes, (size_t)tree->pnode_count * sizeof(ntpnode_t), &csum)
+            || ntc_write(f, tree->leaves, (size_t)tree->leaf_count * sizeof(ntleaf_t), &csum)
+            || ntc_write(f, dclists_buf, dclists_len, &csum)) {
+            err = true;
+        }
+        else {
+            // rewrite the header with the final checksum
+            hdr.checksum = csum;
+            if(fseek(f, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+                err = true;
+        }
+        if(fclose(f))
+            err = true;
+        if(err)
+            log_err("plugin_geoip: map '%s': failed writing tree cache file '%s': %s", map_name, logf_pathname(tmp_path), logf_errno());
+        else if(rename(tmp_path, path)) {
+            log_err("plugin_geoip: map '%s': cannot rename '%s' to '%s': %s", map_name, logf_pathname(tmp_path), logf_pathname(path), logf_errno());
+            err = true;
+        }
+        if(err)
+            unlink(tmp_path);
+    }
+
+    if(!err)
+        log_info("plugin_geoip: map '%s': saved runtime db to tree cache file '%s'", map_name, logf_pathname(path));
+
+    free(tmp_path);
+    free(dclists_buf);
+}
+
+// Validates everything in the mapped file other than the key, logging
+//   and returning true if it's unusable.  The checksum protects the
+//   tree's internal references, which we wrote ourselves; the checks
+//   beyond it are for the things it refers to outside of itself.
+F_NONNULL F_WUNUSED
+static bool ntc_validate(const uint8_t* map, const size_t map_len, const ntc_offsets_t* o, const char* path, const char* map_name) {
+    dmn_assert(map); dmn_assert(o); dmn_assert(path); dmn_assert(map_name);
+
+    const ntc_hdr_t* hdr = (const ntc_hdr_t*)map;
+
+    if(o->total != map_len) {
+        log_warn("plugin_geoip: map '%s': tree cache file '%s' has the wrong size, ignoring it", map_name, logf_pathname(path));
+        return true;
+    }
+
+    if(ntc_checksum(0, &map[o->store], o->total - o->store) != hdr->checksum) {
+        log_warn("plugin_geoip: map '%s': tree cache file '%s' failed checksum, ignoring it", map_name, logf_pathname(path));
+        return true;
+    }
+
+    const uint8_t* dcl = &map[o->dclists];
+    const uint8_t* dcl_end = dcl + hdr->dclists_len;
+    unsigned dcl_count = 0;
+    while(dcl < dcl_end) {
+        const uint8_t* nul = memchr(dcl, 0, (size_t)(dcl_end - dcl));
+        if(!nul)
+            break;
+        dcl = nul + 1;
+        dcl_count++;
+    }
+
+    bool bad = !hdr->count || !hdr->leaf_count || dcl != dcl_end || dcl_count != hdr->dclist_count;
+    if(!bad && !NN_IS_DCLIST(hdr->ipv4) && hdr->ipv4 >= hdr->count)
+        bad = true;
+    const ntleaf_t* leaves = (const ntleaf_t*)&map[o->leaves];
+    for(unsigned i = 0; !bad && i < hdr->leaf_count; i++)
+        if(leaves[i].dclist != NN_UNDEF && NN_GET_DCLIST(leaves[i].dclist) >= hdr->dclist_count)
+            bad = true;
+
+    if(bad)
+        log_warn("plugin_geoip: map '%s': tree cache file '%s' is inconsistent, ignoring it", map_name, logf_pathname(path));
+    return bad;
+}
+
+ntree_t* ntcache_load(const char* path, const uint64_t key, dclists_t* lists, const char* map_name) {
+    dmn_assert(path); dmn_assert(lists); dmn_assert(map_name);
+
+    const int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        if(errno == ENOENT)
+            log_info("plugin_geoip: map '%s': no tree cache file at '%s'", map_name, logf_pathname(path));
+        else
+            log_warn("plugin_geoip: map '%s': cannot open tree cache file '%s': %s", map_name, logf_pathname(path), logf_errno());
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(ntc_hdr_t)) {
+        log_warn("plugin_geoip: map '%s': tree cache file '%s' is unreadable or truncated, ignoring it", map_name, logf_pathname(path));
+        close(fd);
+        return NULL;
+    }
+
+    const size_t map_len = (size_t)st.st_size;
+    uint8_t* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        log_warn("plugin_geoip: map '%s': cannot mmap tree cache file '%s': %s", map_name, logf_pathname(path), logf_errno());
+        return NULL;
+    }
+
+    const ntc_hdr_t* hdr = (const ntc_hdr_t*)map;
+    ntc_offsets_t o;
+    ntc_offsets(hdr, &o);
+
+    bool fail = false;
+    if(memcmp(hdr->magic, NTC_MAGIC, sizeof(hdr->magic)) || hdr->layout != ntc_layout_sig()) {
+        log_info("plugin_geoip: map '%s': tree cache file '%s' is from an incompatible version, ignoring it", map_name, logf_pathname(path));
+        fail = true;
+    }
+    else if(hdr->key != key) {
+        log_info("plugin_geoip: map '%s': tree cache file '%s' is stale, ignoring it", map_name, logf_pathname(path));
+        fail = true;
+    }
+    else {
+        fail = ntc_validate(map, map_len, &o, path, map_name);
+    }
+
+    // The lists we already have (from the map config) must be the
+    //   leading lists of the saved set, which they always are unless
+    //   there's a hash collision on the key.
+    const unsigned have_count = dclists_get_count(lists);
+    const uint8_t* dcl = &map[o.dclists];
+    if(!fail) {
+        if(have_count > hdr->dclist_count)
+            fail = true;
+        for(unsigned i = 0; !fail && i < have_count; i++) {
+            if(strcmp((const char*)dcl, (const char*)dclists_get_list(lists, i)))
+                fail = true;
+            dcl += strlen((const char*)dcl) + 1;
+        }
+        if(fail)
+            log_info("plugin_geoip: map '%s': tree cache file '%s' does not match the configured datacenter lists, ignoring it", map_name, logf_pathname(path));
+    }
+
+    if(fail) {
+        munmap(map, map_len);
+        return NULL;
+    }
+
+    for(unsigned i = have_count; i < hdr->dclist_count; i++) {
+        dclists_append_raw(lists, dcl, map_name);
+        dcl += strlen((const char*)dcl) + 1;
+    }
+
+    ntree_t* tree = malloc(sizeof(ntree_t));
+    tree->store = (nnode_t*)&map[o.store];
+    tree->ipv4 = hdr->ipv4;
+    tree->count = hdr->count;
+    tree->alloc = 0;
+    tree->dp_v4 = (uint32_t*)&map[o.dp_v4];
+    tree->dp_v6 = (uint32_t*)&map[o.dp_v6];
+    tree->pnodes = (ntpnode_t*)&map[o.pnodes];
+    tree->leaves = (ntleaf_t*)&map[o.leaves];
+    tree->pnode_count = hdr->pnode_count;
+    tree->leaf_count = hdr->leaf_count;
+    tree->map = map;
+    tree->map_len = map_len;
+
+    log_info("plugin_geoip: map '%s': loaded runtime db from tree cache file '%s'", map_name, logf_pathname(path));
+    return tree;
+}
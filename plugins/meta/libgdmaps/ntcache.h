@@ -0,0 +1,71 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NTCACHE_H
+#define NTCACHE_H
+
+#include "config.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <gdnsd/vscf.h>
+#include "ntree.h"
+#include "dclists.h"
+
+/*
+ * On-disk cache of a map's finished ntree_t and the dclists it refers
+ *   to, so that a restart with unchanged inputs can skip translating the
+ *   GeoIP databases and nets data entirely.  The file is simply mmap()ed
+ *   and the tree's arrays point directly into the mapping.
+ * Cache files are only valid for the exact same inputs, which is
+ *   expressed as a 64-bit key built by the caller from a hash of the
+ *   map's configuration and the stamps (mtime + size) of its input files
+ *   at the time they were read.  The file also carries a checksum of its
+ *   contents, and a layout signature so that files from builds with
+ *   different structure layouts are rejected rather than misread.
+ */
+
+typedef struct {
+    uint64_t mtime;
+    uint64_t size;
+} ntcache_stamp_t;
+
+// Hashing for building cache keys.  Start with h == 0.
+F_NONNULL F_PURE F_WUNUSED
+uint64_t ntcache_hash(uint64_t h, const void* data, const size_t len);
+F_NONNULL F_WUNUSED
+uint64_t ntcache_hash_vscf(uint64_t h, const vscf_data_t* cfg);
+
+// Fills *stamp from stat(path), or with zeros if that fails
+F_NONNULL
+void ntcache_stamp(const char* path, ntcache_stamp_t* stamp);
+
+// Writes tree + lists to "path" (atomically, via rename()).  Failures
+//   are logged, and are otherwise harmless.
+F_NONNULL
+void ntcache_save(const char* path, const uint64_t key, const ntree_t* tree, const dclists_t* lists, const char* map_name);
+
+// Loads the tree from "path" if it exists and is valid for "key", and
+//   its saved dclists are an extension of the current contents of
+//   "lists", appending the remainder to "lists".  Returns NULL (after
+//   logging why at an appropriate level) if the cache can't be used,
+//   in which case "lists" is unmodified.
+F_NONNULL F_WUNUSED
+ntree_t* ntcache_load(const char* path, const uint64_t key, dclists_t* lists, const char* map_name);
+
+#endif // NTCACHE_H
@@ -19,6 +19,7 @@
 
 #include "config.h"
 #include "ntree.h"
+#include <sys/mman.h>
 #include <gdnsd/log.h>
 
 // Initial node allocation count,
@@ -30,12 +31,29 @@ ntree_t* ntree_new(void) {
     newtree->store = malloc(NT_SIZE_INIT * sizeof(nnode_t));
     newtree->count = 0;
     newtree->alloc = NT_SIZE_INIT; // set to zero on fixation
+    newtree->dp_v4 = NULL;
+    newtree->dp_v6 = NULL;
+    newtree->pnodes = NULL;
+    newtree->leaves = NULL;
+    newtree->pnode_count = 0;
+    newtree->leaf_count = 0;
+    newtree->map = NULL;
+    newtree->map_len = 0;
     return newtree;
 }
 
 void ntree_destroy(ntree_t* tree) {
     dmn_assert(tree);
-    free(tree->store);
+    if(tree->map) {
+        munmap(tree->map, tree->map_len);
+    }
+    else {
+        free(tree->store);
+        free(tree->dp_v4);
+        free(tree->dp_v6);
+        free(tree->pnodes);
+        free(tree->leaves);
+    }
     free(tree);
 }
 
@@ -71,11 +89,211 @@ static unsigned ntree_find_v4root(const ntree_t* tree) {
     return offset;
 }
 
+/*** Compilation of the multibit lookup form, see ntree.h ***/
+
+#ifdef HAVE_BUILTIN_CLZ
+#  define nt_popcount64(_x) ((unsigned)__builtin_popcountll(_x))
+#else
+F_CONST
+static inline unsigned nt_popcount64(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (unsigned)((x * 0x0101010101010101ULL) >> 56);
+}
+#endif
+
+F_CONST
+static inline unsigned nt_stride(const unsigned depth, const unsigned width) {
+    dmn_assert(depth < width);
+    const unsigned remain = width - depth;
+    return remain < NT_PT_STRIDE ? remain : NT_PT_STRIDE;
+}
+
+// Addresses are handled as 128-bit hi:lo pairs in host order, with
+//   v4 addresses left-aligned in "hi" (and a width of 32).  This
+//   returns the "count" bits starting at bit "depth" (MSB == 0).
+F_CONST
+static inline unsigned nt_getbits(const uint64_t hi, const uint64_t lo, const unsigned depth, const unsigned count) {
+    dmn_assert(count && count <= NT_DP_BITS);
+    dmn_assert(depth + count <= 128);
+    const unsigned end = depth + count;
+    const uint64_t mask = (1ULL << count) - 1;
+    if(end <= 64)
+        return (unsigned)((hi >> (64 - end)) & mask);
+    if(depth >= 64)
+        return (unsigned)((lo >> (128 - end)) & mask);
+    return (unsigned)(((hi << (end - 64)) | (lo >> (128 - end))) & mask);
+}
+
+// Walks the binary tree from "val" (a node offset or a dclist), which is
+//   at bit depth "depth", following up to "count" bits of "bits" (MSB
+//   first).  Returns the terminal dclist reached, with *mask_out set
+//   to its depth, or the node reached after consuming all "count" bits.
+F_NONNULL
+static uint32_t nt_walk(const ntree_t* tree, uint32_t val, const unsigned depth, const unsigned bits, const unsigned count, unsigned* mask_out) {
+    dmn_assert(tree); dmn_assert(mask_out);
+
+    unsigned i = 0;
+    while(!NN_IS_DCLIST(val) && i < count) {
+        dmn_assert(val < tree->count);
+        const nnode_t* current = &tree->store[val];
+        val = (bits & (1U << (count - 1 - i))) ? current->one : current->zero;
+        i++;
+    }
+
+    *mask_out = depth + i;
+    return val;
+}
+
+typedef struct {
+    ntree_t* tree;
+    unsigned pnode_alloc;
+    unsigned leaf_alloc;
+} ntc_t;
+
+F_NONNULL
+static unsigned ntc_add_pnodes(ntc_t* ntc, const unsigned count) {
+    dmn_assert(ntc);
+    ntree_t* tree = ntc->tree;
+    const unsigned rv = tree->pnode_count;
+    tree->pnode_count += count;
+    dmn_assert(tree->pnode_count < (1U << 31));
+    if(tree->pnode_count > ntc->pnode_alloc) {
+        while(tree->pnode_count > ntc->pnode_alloc)
+            ntc->pnode_alloc <<= 1;
+        tree->pnodes = realloc(tree->pnodes, ntc->pnode_alloc * sizeof(ntpnode_t));
+    }
+    return rv;
+}
+
+F_NONNULL
+static unsigned ntc_add_leaf(ntc_t* ntc, const uint32_t dclist, const unsigned mask) {
+    dmn_assert(ntc); dmn_assert(NN_IS_DCLIST(dclist));
+    ntree_t* tree = ntc->tree;
+    if(tree->leaf_count == ntc->leaf_alloc) {
+        ntc->leaf_alloc <<= 1;
+        tree->leaves = realloc(tree->leaves, ntc->leaf_alloc * sizeof(ntleaf_t));
+    }
+    const unsigned rv = tree->leaf_count++;
+    dmn_assert(rv < (1U << 31));
+    tree->leaves[rv].dclist = dclist;
+    tree->leaves[rv].mask = mask;
+    return rv;
+}
+
+// Fills in the already-allocated poptrie node "pidx", which covers the
+//   binary subtree at node offset "offset", at bit depth "depth".
+F_NONNULL
+static void ntc_fill_pnode(ntc_t* ntc, const unsigned pidx, const uint32_t offset, const unsigned depth, const unsigned width) {
+    dmn_assert(ntc); dmn_assert(!NN_IS_DCLIST(offset));
+
+    const unsigned stride = nt_stride(depth, width);
+    const unsigned slots = 1U << stride;
+    uint32_t vals[1U << NT_PT_STRIDE];
+    unsigned masks[1U << NT_PT_STRIDE];
+
+    uint64_t vector = 0;
+    uint64_t leafvec = 0;
+    unsigned num_children = 0;
+    const unsigned base0 = ntc->tree->leaf_count;
+    bool have_leaf = false;
+    uint32_t last_dclist = 0;
+    unsigned last_mask = 0;
+
+    for(unsigned i = 0; i < slots; i++) {
+        vals[i] = nt_walk(ntc->tree, offset, depth, i, stride, &masks[i]);
+        if(!NN_IS_DCLIST(vals[i])) {
+            vector |= (1ULL << i);
+            num_children++;
+        }
+        else if(!have_leaf || vals[i] != last_dclist || masks[i] != last_mask) {
+            leafvec |= (1ULL << i);
+            ntc_add_leaf(ntc, vals[i], masks[i]);
+            have_leaf = true;
+            last_dclist = vals[i];
+            last_mask = masks[i];
+        }
+    }
+
+    const unsigned base1 = num_children ? ntc_add_pnodes(ntc, num_children) : 0;
+
+    ntpnode_t* pn = &ntc->tree->pnodes[pidx];
+    pn->vector = vector;
+    pn->leafvec = leafvec;
+    pn->base0 = base0;
+    pn->base1 = base1;
+
+    unsigned child = base1;
+    for(unsigned i = 0; i < slots; i++)
+        if(!NN_IS_DCLIST(vals[i]))
+            ntc_fill_pnode(ntc, child++, vals[i], depth + stride, width);
+}
+
+// Builds the direct-pointing table for the binary (sub)tree at "root"
+//   (a node offset or a dclist), of total bit depth "width".
+F_NONNULL F_WUNUSED
+static uint32_t* ntc_build_dp(ntc_t* ntc, const uint32_t root, const unsigned width) {
+    dmn_assert(ntc); dmn_assert(width > NT_DP_BITS);
+
+    const unsigned slots = 1U << NT_DP_BITS;
+    uint32_t* dp = malloc(slots * sizeof(uint32_t));
+
+    bool have_leaf = false;
+    uint32_t last_dclist = 0;
+    unsigned last_mask = 0;
+    unsigned last_leaf = 0;
+
+    for(unsigned i = 0; i < slots; i++) {
+        unsigned mask;
+        const uint32_t val = nt_walk(ntc->tree, root, 0, i, NT_DP_BITS, &mask);
+        if(NN_IS_DCLIST(val)) {
+            if(!have_leaf || val != last_dclist || mask != last_mask) {
+                last_leaf = ntc_add_leaf(ntc, val, mask);
+                have_leaf = true;
+                last_dclist = val;
+                last_mask = mask;
+            }
+            dp[i] = NT_DP_SET_LEAF(last_leaf);
+        }
+        else {
+            const unsigned pidx = ntc_add_pnodes(ntc, 1);
+            ntc_fill_pnode(ntc, pidx, val, NT_DP_BITS, width);
+            dp[i] = pidx;
+        }
+    }
+
+    return dp;
+}
+
+F_NONNULL
+static void ntree_compile(ntree_t* tree) {
+    dmn_assert(tree);
+
+    ntc_t ntc = {
+        .tree = tree,
+        .pnode_alloc = NT_SIZE_INIT,
+        .leaf_alloc = NT_SIZE_INIT,
+    };
+    tree->pnode_count = 0;
+    tree->leaf_count = 0;
+    tree->pnodes = malloc(ntc.pnode_alloc * sizeof(ntpnode_t));
+    tree->leaves = malloc(ntc.leaf_alloc * sizeof(ntleaf_t));
+
+    tree->dp_v6 = ntc_build_dp(&ntc, 0, 128);
+    tree->dp_v4 = ntc_build_dp(&ntc, tree->ipv4, 32);
+
+    if(tree->pnode_count)
+        tree->pnodes = realloc(tree->pnodes, tree->pnode_count * sizeof(ntpnode_t));
+    tree->leaves = realloc(tree->leaves, tree->leaf_count * sizeof(ntleaf_t));
+}
+
 void ntree_finish(ntree_t* tree) {
     dmn_assert(tree);
     tree->alloc = 0; // flag fixed, will fail asserts on add_node, etc now
     tree->store = realloc(tree->store, tree->count * sizeof(nnode_t));
     tree->ipv4 = ntree_find_v4root(tree);
+    ntree_compile(tree);
 }
 
 #ifndef NDEBUG // debug dump code
@@ -136,6 +354,70 @@ void ntree_assert_optimal(const ntree_t* tree) {
 #define ntree_assert_optimal(x)
 #endif
 
+// Lookup in the compiled form, for either family (see ntree_compile())
+F_NONNULL
+static unsigned ntree_lookup_compiled(const ntree_t* tree, const uint32_t* dp, const uint64_t hi, const uint64_t lo, const unsigned width, unsigned* mask_out) {
+    dmn_assert(tree); dmn_assert(dp); dmn_assert(mask_out);
+
+    uint32_t entry = dp[nt_getbits(hi, lo, 0, NT_DP_BITS)];
+    unsigned leaf_idx;
+
+    if(NT_DP_IS_LEAF(entry)) {
+        leaf_idx = NT_DP_GET(entry);
+    }
+    else {
+        unsigned depth = NT_DP_BITS;
+        while(1) {
+            dmn_assert(entry < tree->pnode_count);
+            const ntpnode_t* pn = &tree->pnodes[entry];
+            const unsigned stride = nt_stride(depth, width);
+            const unsigned slot = nt_getbits(hi, lo, depth, stride);
+            const uint64_t upto = (2ULL << slot) - 1; // bits 0 -> slot
+            if(!(pn->vector & (1ULL << slot))) {
+                leaf_idx = pn->base0 + nt_popcount64(pn->leafvec & upto) - 1;
+                break;
+            }
+            entry = pn->base1 + nt_popcount64(pn->vector & upto) - 1;
+            depth += stride;
+        }
+    }
+
+    dmn_assert(leaf_idx < tree->leaf_count);
+    const ntleaf_t* leaf = &tree->leaves[leaf_idx];
+    *mask_out = leaf->mask;
+    dmn_assert(leaf->dclist != NN_UNDEF); // the special v4-like undefined areas
+    return NN_GET_DCLIST(leaf->dclist);
+}
+
+F_NONNULL
+static unsigned ntree_lookup_v6(const ntree_t* tree, const uint8_t* ip, unsigned* mask_out) {
+    dmn_assert(tree); dmn_assert(ip); dmn_assert(mask_out);
+
+    const uint64_t hi = ((uint64_t)ntohl(gdnsd_get_una32(&ip[0])) << 32)
+        | ntohl(gdnsd_get_una32(&ip[4]));
+    const uint64_t lo = ((uint64_t)ntohl(gdnsd_get_una32(&ip[8])) << 32)
+        | ntohl(gdnsd_get_una32(&ip[12]));
+    return ntree_lookup_compiled(tree, tree->dp_v6, hi, lo, 128, mask_out);
+}
+
+// lookup_v4's "mask_out" is within the range /0 -> /32 and needs adjusting
+//   for the various v4-like v6 spaces.  As a result we never return a supernet
+//   mask for these (e.g. /41 for a lookup on v4compat space, or /2 for a lookup
+//   on teredo, etc...), even if that would technically be more optimal.  It's far
+//   more confusing and not worth optimizing for.
+F_NONNULL
+static unsigned ntree_lookup_v4(const ntree_t* tree, const uint32_t ip, unsigned* mask_out) {
+    dmn_assert(tree); dmn_assert(mask_out);
+    dmn_assert(tree->ipv4);
+
+    return ntree_lookup_compiled(tree, tree->dp_v4, (uint64_t)ip << 32, 0, 32, mask_out);
+}
+
+#ifndef NDEBUG
+
+// The original bit-at-a-time lookups on the binary tree, used in
+//   debug builds to cross-check every compiled lookup.
+
 F_NONNULL
 static inline bool CHKBIT_v6(const uint8_t* ipv6, const unsigned bit) {
     dmn_assert(ipv6);
@@ -144,7 +426,7 @@ static inline bool CHKBIT_v6(const uint8_t* ipv6, const unsigned bit) {
 }
 
 F_NONNULL
-static unsigned ntree_lookup_v6(const ntree_t* tree, const uint8_t* ip, unsigned* mask_out) {
+static unsigned ntree_lookup_v6_binary(const ntree_t* tree, const uint8_t* ip, unsigned* mask_out) {
     dmn_assert(tree); dmn_assert(ip); dmn_assert(mask_out);
 
     unsigned chkbit = 0;
@@ -167,13 +449,8 @@ static inline bool CHKBIT_v4(const uint32_t ip, const unsigned maskbit) {
     return ip & (1U << (31U - maskbit));
 }
 
-// lookup_v4's "mask_out" is within the range /0 -> /32 and needs adjusting
-//   for the various v4-like v6 spaces.  As a result we never return a supernet
-//   mask for these (e.g. /41 for a lookup on v4compat space, or /2 for a lookup
-//   on teredo, etc...), even if that would technically be more optimal.  It's far
-//   more confusing and not worth optimizing for.
 F_NONNULL
-static unsigned ntree_lookup_v4(const ntree_t* tree, const uint32_t ip, unsigned* mask_out) {
+static unsigned ntree_lookup_v4_binary(const ntree_t* tree, const uint32_t ip, unsigned* mask_out) {
     dmn_assert(tree); dmn_assert(mask_out);
     dmn_assert(tree->ipv4);
 
@@ -192,6 +469,8 @@ static unsigned ntree_lookup_v4(const ntree_t* tree, const uint32_t ip, unsigned
     return NN_GET_DCLIST(offset);
 }
 
+#endif // NDEBUG
+
 // if "addr" is in any v4-compatible spaces other than
 //   v4compat (our canonical one), convert to v4compat,
 //   and return a mask_adj to v4_compat.
@@ -225,8 +504,16 @@ static unsigned ntree_lookup_inner(const ntree_t* tree, const anysin_t* client_a
 
     unsigned rv;
 
+#ifndef NDEBUG
+    unsigned check_rv;
+    unsigned check_mask;
+#endif
+
     if(client_addr->sa.sa_family == AF_INET) {
         rv = ntree_lookup_v4(tree, ntohl(client_addr->sin.sin_addr.s_addr), scope_mask);
+#ifndef NDEBUG
+        check_rv = ntree_lookup_v4_binary(tree, ntohl(client_addr->sin.sin_addr.s_addr), &check_mask);
+#endif
     }
     else {
         dmn_assert(client_addr->sa.sa_family == AF_INET6);
@@ -236,12 +523,24 @@ static unsigned ntree_lookup_inner(const ntree_t* tree, const anysin_t* client_a
             unsigned temp_mask;
             rv = ntree_lookup_v4(tree, ipv4, &temp_mask);
             *scope_mask = temp_mask + mask_adj;
+#ifndef NDEBUG
+            check_rv = ntree_lookup_v4_binary(tree, ipv4, &check_mask);
+            check_mask += mask_adj;
+#endif
         }
         else {
             rv = ntree_lookup_v6(tree, client_addr->sin6.sin6_addr.s6_addr, scope_mask);
+#ifndef NDEBUG
+            check_rv = ntree_lookup_v6_binary(tree, client_addr->sin6.sin6_addr.s6_addr, &check_mask);
+#endif
         }
     }
 
+#ifndef NDEBUG
+    dmn_assert(rv == check_rv);
+    dmn_assert(*scope_mask == check_mask);
+#endif
+
     return rv;
 }
 
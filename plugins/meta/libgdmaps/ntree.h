@@ -108,12 +108,56 @@ typedef struct {
     uint32_t one;
 } nnode_t;
 
+/*
+ * ntree_finish() also compiles the binary tree above into a multibit
+ *   form for lookups: per address family, a direct-pointing table
+ *   indexed by the first NT_DP_BITS bits of the address, followed by
+ *   poptrie-style nodes of NT_PT_STRIDE bits each.  Every terminal
+ *   (leaf) remembers the bit depth at which the binary tree ended,
+ *   which is the lookup's scope mask, so results (including masks)
+ *   are identical to walking the binary tree one bit at a time.
+ * An address family's depth is 32 for the v4 tree (rooted at
+ *   ntree_t.ipv4) and 128 for the full v6 tree, and the final
+ *   poptrie stride is shortened as necessary to fit.
+ */
+
+#define NT_DP_BITS 16U
+#define NT_PT_STRIDE 6U
+
+// direct-pointing table entries: high bit set -> leaf index, else node index
+#define NT_DP_IS_LEAF(x) ((x) & (1U << 31U))
+#define NT_DP_GET(x) ((x) & ~(1U << 31U))
+#define NT_DP_SET_LEAF(x) ((x) | (1U << 31U))
+
+typedef struct {
+    uint64_t vector;  // bit N set -> slot N is an internal node
+    uint64_t leafvec; // bit N set -> slot N starts a run of identical leaves
+    uint32_t base0;   // leaf index of first run
+    uint32_t base1;   // node index of first internal child (children are contiguous)
+} ntpnode_t;
+
+typedef struct {
+    uint32_t dclist; // as in nnode_t, high bit set
+    uint32_t mask;   // scope mask in the family's depth
+} ntleaf_t;
+
 typedef struct {
     nnode_t* store;
     unsigned ipv4;  // cached ipv4 lookup hint
     unsigned count; // raw nodes, including interior ones
     unsigned alloc; // current allocation of store during construction,
                     //   set to zero after _finish()
+    // compiled lookup structures, built by _finish()
+    uint32_t* dp_v4;     // [1 << NT_DP_BITS]
+    uint32_t* dp_v6;     // [1 << NT_DP_BITS]
+    ntpnode_t* pnodes;
+    ntleaf_t* leaves;
+    unsigned pnode_count;
+    unsigned leaf_count;
+    // If non-NULL, all of the arrays above point into this read-only
+    //   mapping of a tree cache file (see ntcache.h), not malloc'd memory
+    void* map;
+    size_t map_len;
 } ntree_t;
 
 ntree_t* ntree_new(void);
@@ -0,0 +1,190 @@
+/* Copyright © 2026 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Benchmark for GeoIP City database translation (gdgeoip_make_list()),
+//   over a generated City Rev1 database with a configurable number of
+//   leaf networks and distinct location records.  The map is configured
+//   like a typical production one: a dcmap covering some countries, and
+//   auto_dc_coords for the rest, so that every distinct record goes
+//   through the offset cache, the dcmap, and (for about half of them)
+//   the city auto-mapping.  This is not part of "make check"; run it via
+//   "make bench".
+
+#include "config.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <gdnsd/dmn.h>
+#include <gdnsd/log.h>
+#include <gdnsd/vscf.h>
+
+#include "dcinfo.h"
+#include "dclists.h"
+#include "dcmap.h"
+#include "gdgeoip.h"
+#include "nlist.h"
+
+#define DEF_DEPTH 21U        // 2^21 leaf networks, like a real City DB
+#define DEF_RECORDS 1000000U // distinct location records
+#define CITY_REC_SIZE 14U
+
+// GeoIP country ids for US, GB, DE (all mapped by the dcmap below)
+//   and JP, BR, AU (left to auto_dc_coords)
+static const uint8_t bench_countries[] = { 225, 77, 56, 111, 31, 16 };
+#define NUM_BENCH_COUNTRIES (sizeof(bench_countries) / sizeof(bench_countries[0]))
+
+F_NONNULL
+static void put24(uint8_t* p, const unsigned v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+}
+
+// Writes a complete tree of the given depth under the v4 space, with
+//   each leaf pointing at a random one of nrec location records.
+F_NONNULL
+static void make_db(FILE* f, const unsigned depth, const unsigned nrec) {
+    dmn_assert(f);
+
+    const unsigned nodes = (1U << depth) - 1U;
+    const unsigned base = nodes;
+    const size_t tree_size = (size_t)nodes * 6U;
+    const size_t size = tree_size + (size_t)nrec * CITY_REC_SIZE + 7U;
+    uint8_t* db = calloc(1, size);
+
+    // nodes are numbered breadth-first, children of n are 2n+1, 2n+2
+    unsigned seed = 12345;
+    for(unsigned n = 0; n < nodes; n++) {
+        for(unsigned i = 0; i < 2; i++) {
+            const unsigned child = 2 * n + 1 + i;
+            unsigned rec;
+            if(child < nodes) {
+                rec = child;
+            }
+            else {
+                seed = seed * 1103515245U + 12345U;
+                rec = base + ((seed >> 8) % nrec) * CITY_REC_SIZE;
+            }
+            put24(&db[n * 6U + i * 3U], rec);
+        }
+    }
+
+    // location records: country, region, city, postal, lat, lon
+    for(unsigned r = 0; r < nrec; r++) {
+        uint8_t* rec = &db[tree_size + (size_t)r * CITY_REC_SIZE];
+        rec[0] = bench_countries[r % NUM_BENCH_COUNTRIES];
+        memcpy(&rec[1], "CA\0SF\0\0", 7);
+        put24(&rec[8], 1800000U + (r % 900000U));
+        put24(&rec[11], 1800000U + (r % 1800000U));
+    }
+
+    // structure info: marker, type (City Rev1), segment (== base)
+    uint8_t* si = &db[size - 7U];
+    si[0] = si[1] = si[2] = 0xFF;
+    si[3] = 2;
+    put24(&si[4], base);
+
+    if(fwrite(db, size, 1, f) != 1 || fflush(f))
+        log_fatal("Failed to write generated database: %s", logf_errno());
+    free(db);
+}
+
+int main(int argc, char* argv[]) {
+    dmn_init_log("gdmaps_bench", true);
+
+    const unsigned depth = argc > 1 ? (unsigned)atoi(argv[1]) : DEF_DEPTH;
+    const unsigned nrec = argc > 2 ? (unsigned)atoi(argv[2]) : DEF_RECORDS;
+    if(depth < 2 || depth > 22 || !nrec || nrec > (1U << 20))
+        log_fatal("Usage: %s [tree_depth(2-22) [num_records(1-1048576)]]", argv[0]);
+    if((1U << depth) + nrec * CITY_REC_SIZE >= (1U << 24))
+        log_fatal("tree_depth and num_records too large for 24-bit record pointers");
+
+    char path[] = "/tmp/gdmaps_bench.XXXXXX";
+    const int fd = mkstemp(path);
+    if(fd < 0)
+        log_fatal("mkstemp() failed: %s", logf_errno());
+    FILE* f = fdopen(fd, "w");
+    if(!f)
+        log_fatal("fdopen() failed: %s", logf_errno());
+    make_db(f, depth, nrec);
+    fclose(f);
+
+    // datacenters => [ dc1, dc2, dc3 ]
+    // auto_dc_coords => { dc1 => [ 38.9, -77.0 ], dc2 => [ 50.1, 8.7 ], dc3 => [ 35.7, 139.7 ] }
+    // map => { NA => { US => { CA => [ dc1 ] } }, EU => { DE => [ dc2 ], GB => [ dc2, dc1 ] } }
+    vscf_data_t* dc_cfg = vscf_array_new();
+    vscf_data_t* auto_cfg = vscf_hash_new();
+    for(unsigned i = 0; i < 3; i++) {
+        static const char* const dc_names[] = { "dc1", "dc2", "dc3" };
+        static const char* const dc_coords[][2] = { { "38.9", "-77.0" }, { "50.1", "8.7" }, { "35.7", "139.7" } };
+        vscf_array_add_val(dc_cfg, vscf_simple_new(dc_names[i], 3));
+        vscf_data_t* coords = vscf_array_new();
+        vscf_array_add_val(coords, vscf_simple_new(dc_coords[i][0], strlen(dc_coords[i][0])));
+        vscf_array_add_val(coords, vscf_simple_new(dc_coords[i][1], strlen(dc_coords[i][1])));
+        vscf_hash_add_val(dc_names[i], 3, auto_cfg, coords);
+    }
+
+    vscf_data_t* map_cfg = vscf_hash_new();
+    vscf_data_t* na_cfg = vscf_hash_new();
+    vscf_data_t* us_cfg = vscf_hash_new();
+    vscf_data_t* eu_cfg = vscf_hash_new();
+    vscf_data_t* ca_list = vscf_array_new();
+    vscf_array_add_val(ca_list, vscf_simple_new("dc1", 3));
+    vscf_hash_add_val("CA", 2, us_cfg, ca_list);
+    vscf_hash_add_val("US", 2, na_cfg, us_cfg);
+    vscf_hash_add_val("NA", 2, map_cfg, na_cfg);
+    vscf_data_t* de_list = vscf_array_new();
+    vscf_array_add_val(de_list, vscf_simple_new("dc2", 3));
+    vscf_hash_add_val("DE", 2, eu_cfg, de_list);
+    vscf_data_t* gb_list = vscf_array_new();
+    vscf_array_add_val(gb_list, vscf_simple_new("dc2", 3));
+    vscf_array_add_val(gb_list, vscf_simple_new("dc1", 3));
+    vscf_hash_add_val("GB", 2, eu_cfg, gb_list);
+    vscf_hash_add_val("EU", 2, map_cfg, eu_cfg);
+
+    dcinfo_t* info = dcinfo_new(dc_cfg, auto_cfg, NULL, "bench");
+    dclists_t* lists = dclists_new(info);
+    dcmap_t* dcmap = dcmap_new(map_cfg, lists, 0, 0, "bench", true);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nlist_t* nl = gdgeoip_make_list(path, "bench", lists, dcmap, NULL, V4O_NONE, true, false);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    unlink(path);
+
+    if(!nl)
+        log_fatal("Translation of generated database failed");
+
+    const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%u leaf networks, %u distinct records, %u dclists: %.3fs (%.0f leaves/s)\n",
+        1U << depth, nrec, dclists_get_count(lists), secs, (1U << depth) / secs);
+
+    nlist_destroy(nl);
+    dcmap_destroy(dcmap);
+    dclists_destroy(lists, KILL_ALL_LISTS);
+    dcinfo_destroy(info);
+    vscf_destroy(map_cfg);
+    vscf_destroy(auto_cfg);
+    vscf_destroy(dc_cfg);
+    return 0;
+}
@@ -178,9 +178,15 @@ void gdmaps_test_lookup_check(const unsigned tnum, const gdmaps_t* gdmaps, const
 
 gdmaps_t* gdmaps_test_init(const char* input_rootdir) {
 
-    dmn_init_log("gdmaps_test", true);
+    // may be called again (after gdmaps_destroy()) to re-load the
+    //   same config, e.g. to test state saved by the first instance
+    static bool initialized = false;
+    if(!initialized) {
+        dmn_init_log("gdmaps_test", true);
+        gdnsd_set_rootdir(input_rootdir);
+        initialized = true;
+    }
 
-    gdnsd_set_rootdir(input_rootdir);
     const vscf_data_t* cfg_root = conf_load_vscf();
     conf_options(cfg_root);
 
@@ -0,0 +1,86 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Unit test for gdmaps tree cache files
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include <gdnsd/log.h>
+#include "gdmaps_test.h"
+
+// relative to the test rootdir
+#define NETS_PATH "etc/geoip/t24_treecache.nets"
+#define CACHE_PATH "etc/geoip/my_prod_map.ntcache"
+
+static void check_lookups(const gdmaps_t* gdmaps) {
+    unsigned tnum = 0;
+    gdmaps_test_lookup_check(tnum++, gdmaps, "my_prod_map", "10.1.2.3", "\3", 16);
+    gdmaps_test_lookup_check(tnum++, gdmaps, "my_prod_map", "10.2.3.4", "\2\3", 15);
+    gdmaps_test_lookup_check(tnum++, gdmaps, "my_prod_map", "10.200.1.1", "\2\3", 9);
+    gdmaps_test_lookup_check(tnum++, gdmaps, "my_prod_map", "192.0.2.1", "\2", 24);
+    gdmaps_test_lookup_check(tnum++, gdmaps, "my_prod_map", "8.8.8.8", "\1\2\3", 7);
+    gdmaps_test_lookup_check(tnum++, gdmaps, "my_prod_map", "::10.1.2.3", "\3", 112); // v4-compat
+    gdmaps_test_lookup_check(tnum++, gdmaps, "my_prod_map", "2001:db8::1", "\3\1", 32);
+    gdmaps_test_lookup_check(tnum++, gdmaps, "my_prod_map", "2600::1", "\1\2\3", 6);
+}
+
+// Overwrites the nets file with a same-sized comment, which would parse
+//   as empty nets data, and restores its mtime, so that the tree cache
+//   key is unchanged and the cache is the only source of the real data.
+static void scramble_nets(void) {
+    struct stat st;
+    if(stat(NETS_PATH, &st))
+        log_fatal("Cannot stat '%s': %s", NETS_PATH, logf_errno());
+
+    FILE* f = fopen(NETS_PATH, "w");
+    if(!f)
+        log_fatal("Cannot open '%s' for writing: %s", NETS_PATH, logf_errno());
+    for(off_t i = 1; i < st.st_size; i++)
+        fputc('#', f);
+    fputc('\n', f);
+    if(fclose(f))
+        log_fatal("Cannot write '%s': %s", NETS_PATH, logf_errno());
+
+    struct utimbuf times = { .actime = st.st_atime, .modtime = st.st_mtime };
+    if(utime(NETS_PATH, &times))
+        log_fatal("Cannot reset mtime of '%s': %s", NETS_PATH, logf_errno());
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 2)
+        log_fatal("root directory must be set on commandline");
+
+    // first load translates the nets file and writes the cache
+    gdmaps_t* gdmaps = gdmaps_test_init(argv[1]);
+    check_lookups(gdmaps);
+    gdmaps_destroy(gdmaps);
+
+    struct stat st;
+    if(stat(CACHE_PATH, &st))
+        log_fatal("Tree cache file '%s' was not written", CACHE_PATH);
+
+    // second load must come from the cache
+    scramble_nets();
+    gdmaps = gdmaps_test_init(argv[1]);
+    check_lookups(gdmaps);
+    gdmaps_destroy(gdmaps);
+}
@@ -0,0 +1,410 @@
+/* Copyright © 2026 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd-plugin-geoip.
+ *
+ * gdnsd-plugin-geoip is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd-plugin-geoip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Unit test for the MaxMind DB reader.  Rather than relying on
+//   downloaded data, this writes its own tiny IPv4 databases: a valid
+//   one at each record size for the lookup checks, and then a series
+//   of damaged copies which must all be rejected.
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <gdnsd/log.h>
+#include <gdnsd/vscf.h>
+#include "gdmaps_test.h"
+#include "gdmmdb.h"
+
+// relative to the test rootdir
+#define DB_FMT "etc/geoip/t25_mmdb%u.mmdb"
+#define BAD_PATH "etc/geoip/t25_bad.mmdb"
+
+#define MARKER "\xAB\xCD\xEFMaxMind.com"
+#define MARKER_LEN 14U
+
+// MaxMind DB data types used here
+#define T_POINTER 1U
+#define T_STRING 2U
+#define T_UINT16 5U
+#define T_UINT32 6U
+#define T_MAP 7U
+
+/********************************
+ * Database writer
+ ********************************/
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t alloc;
+} mbuf_t;
+
+static void mbuf_add(mbuf_t* b, const void* data, const size_t len) {
+    if(b->len + len > b->alloc) {
+        b->alloc = (b->len + len) * 2;
+        b->data = realloc(b->data, b->alloc);
+    }
+    memcpy(&b->data[b->len], data, len);
+    b->len += len;
+}
+
+static void mbuf_byte(mbuf_t* b, const unsigned val) {
+    const uint8_t byte = val;
+    mbuf_add(b, &byte, 1);
+}
+
+// Only the non-extended types with sizes < 29 are needed here
+static void enc_ctrl(mbuf_t* b, const unsigned type, const unsigned size) {
+    dmn_assert(type < 8U && size < 29U);
+    mbuf_byte(b, (type << 5) | size);
+}
+
+static void enc_str(mbuf_t* b, const char* str) {
+    const unsigned len = strlen(str);
+    enc_ctrl(b, T_STRING, len);
+    mbuf_add(b, str, len);
+}
+
+static void enc_uint(mbuf_t* b, const unsigned type, const uint32_t val) {
+    unsigned size = 0;
+    while(size < 4U && (val >> (size * 8U)))
+        size++;
+    enc_ctrl(b, type, size);
+    for(unsigned i = size; i--; )
+        mbuf_byte(b, val >> (i * 8U));
+}
+
+// The short (11-bit) pointer form, which is always two bytes
+static void enc_ptr(uint8_t* out, const uint32_t off) {
+    dmn_assert(off < 2048U);
+    out[0] = (T_POINTER << 5) | (off >> 8);
+    out[1] = off & 0xFFU;
+}
+
+// { continent => { code => cont }, cc_key => { iso_code => cc } }
+static uint32_t enc_loc(mbuf_t* d, const char* cont, const char* cc_key, const char* cc, uint32_t* cont_off) {
+    const uint32_t off = d->len;
+    enc_ctrl(d, T_MAP, 2);
+    enc_str(d, "continent");
+    if(cont_off)
+        *cont_off = d->len;
+    enc_ctrl(d, T_MAP, 1);
+    enc_str(d, "code");
+    enc_str(d, cont);
+    enc_str(d, cc_key);
+    enc_ctrl(d, T_MAP, 1);
+    enc_str(d, "iso_code");
+    enc_str(d, cc);
+    return off;
+}
+
+// Search tree records while building: node indices, data record
+//   numbers offset by REC_LEAF_BASE, or REC_NO_DATA
+#define REC_LEAF_BASE 0x80000000U
+#define REC_NO_DATA UINT32_MAX
+#define MAX_NODES 128U
+
+typedef struct {
+    uint32_t rec[2];
+} tnode_t;
+
+typedef struct {
+    tnode_t nodes[MAX_NODES];
+    uint32_t count;
+} tree_t;
+
+// Less-specific networks must be inserted first
+static void tree_insert(tree_t* t, const uint32_t addr, const unsigned len, const uint32_t leaf) {
+    uint32_t node = 0;
+    for(unsigned i = 0; i < len; i++) {
+        const unsigned bit = (addr >> (31U - i)) & 1U;
+        if(i == len - 1U) {
+            t->nodes[node].rec[bit] = leaf;
+            break;
+        }
+        uint32_t next = t->nodes[node].rec[bit];
+        if(next >= REC_LEAF_BASE) {
+            dmn_assert(t->count < MAX_NODES);
+            next = t->count++;
+            t->nodes[next].rec[0] = t->nodes[next].rec[1] = t->nodes[node].rec[bit];
+            t->nodes[node].rec[bit] = next;
+        }
+        node = next;
+    }
+}
+
+static void put_rec(uint8_t* n, const unsigned record_size, const unsigned which, const uint32_t val) {
+    switch(record_size) {
+        case 24:
+            n += which * 3U;
+            n[0] = val >> 16; n[1] = val >> 8; n[2] = val;
+            break;
+        case 28:
+            if(which) {
+                n[3] = (n[3] & 0xF0U) | ((val >> 24) & 0x0FU);
+                n[4] = val >> 16; n[5] = val >> 8; n[6] = val;
+            }
+            else {
+                n[3] = (n[3] & 0x0FU) | ((val >> 20) & 0xF0U);
+                n[0] = val >> 16; n[1] = val >> 8; n[2] = val;
+            }
+            break;
+        default:
+            dmn_assert(record_size == 32);
+            n += which * 4U;
+            n[0] = val >> 24; n[1] = val >> 16; n[2] = val >> 8; n[3] = val;
+            break;
+    }
+}
+
+typedef enum {
+    META_OK,
+    META_BAD_RECSIZE,  // record_size 20
+    META_HUGE_TREE,    // node_count implies a tree larger than the file
+    META_PTR_TO_PTR,   // node_count reached through a pointer to a pointer
+} meta_mode_t;
+
+typedef struct {
+    mbuf_t file;
+    uint32_t node_count;
+    unsigned node_bytes;
+    uint32_t dsect_size;
+    size_t marker_off;
+} img_t;
+
+// Data records: US, DE, a registered_country-only FR, and a CA whose
+//   continent is a pointer to the US record's continent map (NA).
+static const struct {
+    uint32_t addr;
+    unsigned len;
+} nets[] = {
+    { 0x0A000000U, 8U },  // 10.0.0.0/8
+    { 0x0A010000U, 16U }, // 10.1.0.0/16
+    { 0xC0000200U, 24U }, // 192.0.2.0/24
+    { 0xC6336400U, 24U }, // 198.51.100.0/24
+};
+#define NUM_NETS (sizeof(nets) / sizeof(nets[0]))
+
+static void build_db(img_t* img, const unsigned record_size, const meta_mode_t meta_mode) {
+    memset(img, 0, sizeof(*img));
+
+    mbuf_t d = { NULL, 0, 0 };
+    uint32_t doffs[NUM_NETS];
+    uint32_t na_off;
+    doffs[0] = enc_loc(&d, "NA", "country", "US", &na_off);
+    doffs[1] = enc_loc(&d, "EU", "country", "DE", NULL);
+    doffs[2] = enc_loc(&d, "EU", "registered_country", "FR", NULL);
+    doffs[3] = d.len;
+    enc_ctrl(&d, T_MAP, 2);
+    enc_str(&d, "continent");
+    uint8_t ptr[2];
+    enc_ptr(ptr, na_off);
+    mbuf_add(&d, ptr, 2);
+    enc_str(&d, "country");
+    enc_ctrl(&d, T_MAP, 1);
+    enc_str(&d, "iso_code");
+    enc_str(&d, "CA");
+
+    tree_t* t = calloc(1, sizeof(tree_t));
+    t->count = 1;
+    t->nodes[0].rec[0] = t->nodes[0].rec[1] = REC_NO_DATA;
+    for(unsigned i = 0; i < NUM_NETS; i++)
+        tree_insert(t, nets[i].addr, nets[i].len, REC_LEAF_BASE + i);
+
+    img->node_count = t->count;
+    img->node_bytes = record_size / 4U;
+    img->dsect_size = d.len;
+
+    const size_t tree_size = (size_t)img->node_count * img->node_bytes;
+    uint8_t* tree_bytes = calloc(1, tree_size + 16U);
+    for(uint32_t i = 0; i < t->count; i++) {
+        for(unsigned j = 0; j < 2; j++) {
+            const uint32_t r = t->nodes[i].rec[j];
+            uint32_t val;
+            if(r == REC_NO_DATA)
+                val = img->node_count;
+            else if(r >= REC_LEAF_BASE)
+                val = img->node_count + 16U + doffs[r - REC_LEAF_BASE];
+            else
+                val = r;
+            put_rec(&tree_bytes[i * img->node_bytes], record_size, j, val);
+        }
+    }
+    free(t);
+
+    mbuf_add(&img->file, tree_bytes, tree_size + 16U);
+    free(tree_bytes);
+    mbuf_add(&img->file, d.data, d.len);
+    free(d.data);
+
+    img->marker_off = img->file.len;
+    mbuf_add(&img->file, MARKER, MARKER_LEN);
+
+    mbuf_t m = { NULL, 0, 0 };
+    enc_ctrl(&m, T_MAP, 4);
+    enc_str(&m, "node_count");
+    size_t ptr_pos = 0;
+    if(meta_mode == META_PTR_TO_PTR) {
+        ptr_pos = m.len;
+        mbuf_add(&m, ptr, 2); // placeholder
+    }
+    else {
+        enc_uint(&m, T_UINT32, meta_mode == META_HUGE_TREE ? 0xFFFFFFU : img->node_count);
+    }
+    enc_str(&m, "record_size");
+    enc_uint(&m, T_UINT16, meta_mode == META_BAD_RECSIZE ? 20U : record_size);
+    enc_str(&m, "ip_version");
+    enc_uint(&m, T_UINT16, 4);
+    enc_str(&m, "database_type");
+    enc_str(&m, "GeoLite2-Country");
+    if(meta_mode == META_PTR_TO_PTR) {
+        enc_ptr(&m.data[ptr_pos], m.len);
+        enc_ptr(ptr, m.len + 2U);
+        mbuf_add(&m, ptr, 2);
+        enc_uint(&m, T_UINT32, img->node_count);
+    }
+    mbuf_add(&img->file, m.data, m.len);
+    free(m.data);
+}
+
+static void write_file(const char* path, const uint8_t* data, const size_t len) {
+    FILE* f = fopen(path, "w");
+    if(!f)
+        log_fatal("Cannot open '%s' for writing: %s", path, logf_errno());
+    if(fwrite(data, 1, len, f) != len || fclose(f))
+        log_fatal("Cannot write '%s': %s", path, logf_errno());
+}
+
+/********************************
+ * Tests
+ ********************************/
+
+static const unsigned record_sizes[] = { 24U, 28U, 32U };
+#define NUM_RECORD_SIZES (sizeof(record_sizes) / sizeof(record_sizes[0]))
+
+static void check_lookups(const gdmaps_t* gdmaps, const char* map) {
+    unsigned tnum = 0;
+    // datacenters => [ dc01, dc02, dc03 ]
+    gdmaps_test_lookup_check(tnum++, gdmaps, map, "10.2.3.4", "\1\2", 15); // NA/US
+    gdmaps_test_lookup_check(tnum++, gdmaps, map, "10.1.2.3", "\2\3", 16); // EU/DE
+    gdmaps_test_lookup_check(tnum++, gdmaps, map, "192.0.2.1", "\3", 24); // EU/FR, registered
+    gdmaps_test_lookup_check(tnum++, gdmaps, map, "198.51.100.1", "\1\2", 24); // NA/CA, via pointer
+    gdmaps_test_lookup_check(tnum++, gdmaps, map, "8.8.8.8", "\3\1", 7); // no data
+    gdmaps_test_lookup_check(tnum++, gdmaps, map, "::10.1.2.3", "\2\3", 112); // v4-compat
+}
+
+// Writes a damaged image and checks that the reader rejects it
+static void check_reject(const unsigned tnum, dclists_t* dclists, const char* desc, const img_t* img, const size_t len) {
+    log_info("Subtest %u starting: %s", tnum, desc);
+    write_file(BAD_PATH, img->file.data, len);
+    nlist_t* nl = gdmmdb_make_list(BAD_PATH, "t25_bad", dclists, NULL, V4O_NONE, false, false);
+    if(nl)
+        log_fatal("Subtest %u failed: database with %s was accepted", tnum, desc);
+}
+
+static void check_rejects(void) {
+    vscf_data_t* dc_cfg = vscf_array_new();
+    vscf_array_add_val(dc_cfg, vscf_simple_new("dc01", 4));
+    dcinfo_t* dcinfo = dcinfo_new(dc_cfg, NULL, NULL, "t25_bad");
+    dclists_t* dclists = dclists_new(dcinfo);
+
+    unsigned tnum = 100;
+    img_t img;
+
+    // sanity-check the harness itself with an undamaged image
+    build_db(&img, 24, META_OK);
+    log_info("Subtest %u starting: undamaged", tnum);
+    write_file(BAD_PATH, img.file.data, img.file.len);
+    nlist_t* nl = gdmmdb_make_list(BAD_PATH, "t25_bad", dclists, NULL, V4O_NONE, false, false);
+    if(!nl)
+        log_fatal("Subtest %u failed: undamaged database was rejected", tnum);
+    nlist_destroy(nl);
+    tnum++;
+
+    // truncations
+    check_reject(tnum++, dclists, "no metadata marker", &img, img.marker_off + MARKER_LEN / 2U);
+    check_reject(tnum++, dclists, "truncated metadata", &img, img.marker_off + MARKER_LEN + 6U);
+    check_reject(tnum++, dclists, "truncated file", &img, 20U);
+
+    // search tree records: root's zero branch as a leaf pointing at
+    //   the end of the data section, or into the 16-byte separator,
+    //   and as a loop back to the root, which never reaches a leaf
+    //   within the 32 levels of an IPv4 tree.
+    const uint32_t bad_recs[] = {
+        img.node_count + 16U + img.dsect_size,
+        img.node_count + 16U + img.dsect_size + 1000U,
+        img.node_count + 8U,
+        0,
+    };
+    const char* const bad_rec_descs[] = {
+        "data pointer at the end of the data section",
+        "data pointer past the data section",
+        "data pointer into the separator",
+        "search tree loop",
+    };
+    for(unsigned i = 0; i < sizeof(bad_recs) / sizeof(bad_recs[0]); i++) {
+        for(unsigned j = 0; j < NUM_RECORD_SIZES; j++) {
+            img_t rimg;
+            build_db(&rimg, record_sizes[j], META_OK);
+            put_rec(rimg.file.data, record_sizes[j], 0, bad_recs[i]);
+            check_reject(tnum++, dclists, bad_rec_descs[i], &rimg, rimg.file.len);
+            free(rimg.file.data);
+        }
+    }
+    free(img.file.data);
+
+    // metadata contents
+    build_db(&img, 24, META_BAD_RECSIZE);
+    check_reject(tnum++, dclists, "unsupported record size", &img, img.file.len);
+    free(img.file.data);
+    build_db(&img, 24, META_HUGE_TREE);
+    check_reject(tnum++, dclists, "oversized search tree", &img, img.file.len);
+    free(img.file.data);
+    build_db(&img, 24, META_PTR_TO_PTR);
+    check_reject(tnum++, dclists, "metadata pointer to pointer", &img, img.file.len);
+    free(img.file.data);
+
+    dclists_destroy(dclists, KILL_ALL_LISTS);
+    dcinfo_destroy(dcinfo);
+    vscf_destroy(dc_cfg);
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 2)
+        log_fatal("root directory must be set on commandline");
+
+    // The config refers to these, so they must exist before init
+    for(unsigned i = 0; i < NUM_RECORD_SIZES; i++) {
+        img_t img;
+        build_db(&img, record_sizes[i], META_OK);
+        char path[256];
+        snprintf(path, sizeof(path), "%s/" DB_FMT, argv[1], record_sizes[i]);
+        write_file(path, img.file.data, img.file.len);
+        free(img.file.data);
+    }
+
+    gdmaps_t* gdmaps = gdmaps_test_init(argv[1]);
+    check_lookups(gdmaps, "map24");
+    check_lookups(gdmaps, "map28");
+    check_lookups(gdmaps, "map32");
+    gdmaps_destroy(gdmaps);
+
+    check_rejects();
+}
@@ -460,28 +460,15 @@ int CB_MAP_C(const char* resname, const uint8_t* origin) {
 }
 #endif
 
+// Resolves resource "res" against the already-looked-up "dclist",
+//   shared by CB_RES_A and CB_RES_A_BATCH below.
 F_NONNULL
-bool CB_RES_A(unsigned threadnum V_UNUSED, unsigned resnum, const client_info_t* cinfo, dynaddr_result_t* result) {
-    dmn_assert(cinfo); dmn_assert(result);
-
-    // extract and clear any datacenter index from upper 8 bits
-    //  (used for synthetic resname/dcname resources)
-    const unsigned synth_dc = (resnum & DC_MASK) >> DC_SHIFT;
-    const uint8_t synth_dclist[2] = { synth_dc, 0 };
-    resnum &= RES_MASK;
-
-    const resource_t* res = &resources[resnum];
+static bool resolve_dynaddr_dclist(unsigned threadnum, const resource_t* res, const uint8_t* dclist, const unsigned scope_mask_out, const client_info_t* cinfo, dynaddr_result_t* result) {
+    dmn_assert(res); dmn_assert(dclist); dmn_assert(cinfo); dmn_assert(result);
 
     // save ttl across multiple lower-level wipe/recalls
     unsigned saved_ttl = result->ttl;
 
-    unsigned scope_mask_out = 0;
-    const uint8_t* dclist;
-    if(synth_dc)
-        dclist = synth_dclist;
-    else
-        dclist = map_get_dclist(res->map, cinfo, &scope_mask_out);
-
     bool rv = true;
 
     // empty dclist -> no results
@@ -517,6 +504,90 @@ bool CB_RES_A(unsigned threadnum V_UNUSED, unsigned resnum, const client_info_t*
     return rv;
 }
 
+F_NONNULL
+bool CB_RES_A(unsigned threadnum V_UNUSED, unsigned resnum, const client_info_t* cinfo, dynaddr_result_t* result) {
+    dmn_assert(cinfo); dmn_assert(result);
+
+    // extract and clear any datacenter index from upper 8 bits
+    //  (used for synthetic resname/dcname resources)
+    const unsigned synth_dc = (resnum & DC_MASK) >> DC_SHIFT;
+    const uint8_t synth_dclist[2] = { synth_dc, 0 };
+    resnum &= RES_MASK;
+
+    const resource_t* res = &resources[resnum];
+
+    unsigned scope_mask_out = 0;
+    const uint8_t* dclist;
+    if(synth_dc)
+        dclist = synth_dclist;
+    else
+        dclist = map_get_dclist(res->map, cinfo, &scope_mask_out);
+
+    return resolve_dynaddr_dclist(threadnum, res, dclist, scope_mask_out, cinfo, result);
+}
+
+// true if map lookups for "a" and "b" must return the same dclist and scope,
+//   which is the case when the address actually used for the lookup
+//   (edns-client-subnet if present, else the source address) is identical.
+F_NONNULL F_PURE
+static bool cinfo_same_lookup(const client_info_t* a, const client_info_t* b) {
+    dmn_assert(a); dmn_assert(b);
+
+    if(a->edns_client_mask != b->edns_client_mask)
+        return false;
+
+    const anysin_t* a_addr = a->edns_client_mask ? &a->edns_client : &a->dns_source;
+    const anysin_t* b_addr = b->edns_client_mask ? &b->edns_client : &b->dns_source;
+
+    if(a_addr->sa.sa_family != b_addr->sa.sa_family)
+        return false;
+    if(a_addr->sa.sa_family == AF_INET6)
+        return !memcmp(a_addr->sin6.sin6_addr.s6_addr, b_addr->sin6.sin6_addr.s6_addr, 16);
+    return a_addr->sin.sin_addr.s_addr == b_addr->sin.sin_addr.s_addr;
+}
+
+// Batched form of the above: consecutive items that share both the map
+//   and the lookup address (a common case for bursts of queries from the
+//   same resolver) reuse the previous map lookup's dclist and scope.
+F_NONNULL
+void CB_RES_A_BATCH(unsigned threadnum V_UNUSED, unsigned count, const unsigned* resnums, const client_info_t* const* cinfos, dynaddr_result_t* const* results) {
+    dmn_assert(resnums); dmn_assert(cinfos); dmn_assert(results);
+
+    const client_info_t* prev_cinfo = NULL;
+    unsigned prev_map = 0;
+    const uint8_t* prev_dclist = NULL;
+    unsigned prev_scope = 0;
+
+    for(unsigned i = 0; i < count; i++) {
+        unsigned resnum = resnums[i];
+        const client_info_t* cinfo = cinfos[i];
+        const unsigned synth_dc = (resnum & DC_MASK) >> DC_SHIFT;
+        const uint8_t synth_dclist[2] = { synth_dc, 0 };
+        resnum &= RES_MASK;
+
+        const resource_t* res = &resources[resnum];
+
+        unsigned scope_mask_out = 0;
+        const uint8_t* dclist;
+        if(synth_dc) {
+            dclist = synth_dclist;
+        }
+        else if(prev_dclist && prev_map == res->map && cinfo_same_lookup(prev_cinfo, cinfo)) {
+            dclist = prev_dclist;
+            scope_mask_out = prev_scope;
+        }
+        else {
+            dclist = map_get_dclist(res->map, cinfo, &scope_mask_out);
+            prev_cinfo = cinfo;
+            prev_map = res->map;
+            prev_dclist = dclist;
+            prev_scope = scope_mask_out;
+        }
+
+        resolve_dynaddr_dclist(threadnum, res, dclist, scope_mask_out, cinfo, results[i]);
+    }
+}
+
 #if DYNC_OK
 F_NONNULL
 void CB_RES_C(unsigned threadnum V_UNUSED, unsigned resnum, const uint8_t* origin, const client_info_t* cinfo, dyncname_result_t* result) {
@@ -0,0 +1,846 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Monitors DNS servers by sending them a query and checking the
+//   response's rcode and (optionally) answers.  UDP queries for all of
+//   a service type's monitors share a single socket per address family
+//   (or a few, for very large numbers of monitors), and responses are
+//   matched back to their monitors by the query ID, which is random
+//   per query, along with the source address and the question.  With
+//   "tcp = true", each check is instead a separate TCP connection,
+//   as in tcp_connect.c.
+
+#define GDNSD_PLUGIN_NAME dns_query
+
+#include "config.h"
+#include <gdnsd/plugin.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+
+// Used for the TCP send() so that a connection the server has already
+//   closed fails with EPIPE, even when not daemonized.
+#ifdef MSG_NOSIGNAL
+#  define SEND_FLAGS MSG_NOSIGNAL
+#else
+#  define SEND_FLAGS 0
+#endif
+
+// DNS header bits in the 3rd and 4th bytes
+#define DNSQ_QR 0x80U
+#define DNSQ_OPCODE 0x78U
+#define DNSQ_RD 0x01U
+#define DNSQ_RCODE 0x0FU
+
+// Monitors per UDP socket, which keeps the ID space sparse enough
+//   that picking a random unused ID rarely takes more than one try.
+#define DNSQ_SOCK_MONS 16384U
+
+// Max query size: header, max-length qname, qtype, qclass
+#define DNSQ_QUERY_MAX (12U + 255U + 4U)
+
+// Max UDP response size we'll read
+#define DNSQ_RESP_MAX 4096U
+
+typedef struct _dnsq_mon dnsq_mon_t;
+
+typedef struct {
+    int fd;
+    ev_io* read_watcher; // only active while queries are outstanding
+    unsigned num_mons;   // monitors assigned to this socket
+    unsigned pending;    // outstanding queries
+    dnsq_mon_t** by_id;  // outstanding queries by ID, 64K entries
+} udp_sock_t;
+
+typedef struct {
+    const char* name;
+    uint8_t query[DNSQ_QUERY_MAX]; // ID left zero
+    unsigned query_len;
+    unsigned qtype;
+    unsigned rcode;
+    unsigned min_answers;
+    unsigned num_expect_v4;
+    unsigned num_expect_v6;
+    uint8_t* expect_v4; // 4 bytes each
+    uint8_t* expect_v6; // 16 bytes each
+    unsigned port;
+    unsigned timeout;
+    unsigned interval;
+    bool tcp;
+    // UDP sockets, per address family (index is isv6)
+    unsigned num_socks[2];
+    udp_sock_t** socks[2];
+} dnsq_svc_t;
+
+typedef enum {
+    DNSQ_STATE_WAITING = 0,
+    DNSQ_STATE_UDP,
+    DNSQ_STATE_TCP_CONNECTING,
+    DNSQ_STATE_TCP_READING
+} dnsq_state_t;
+
+struct _dnsq_mon {
+    dnsq_svc_t* dnsq_svc;
+    udp_sock_t* usock; // UDP only
+    ev_io* tcp_watcher; // TCP only
+    gdnsd_mon_timer_t timeout_timer;
+    gdnsd_mon_timer_t interval_timer;
+    mon_smgr_t* smgr;
+    anysin_t addr;
+    dnsq_state_t dnsq_state;
+    int tcp_sock;
+    uint8_t* tcp_resp;     // allocated once the length prefix is read
+    unsigned tcp_resp_len; // from the length prefix
+    unsigned tcp_done;     // bytes read so far, including the prefix
+    uint8_t tcp_prefix[2];
+    uint16_t id;
+};
+
+static unsigned num_dnsq_svcs = 0;
+static unsigned int num_mons = 0;
+static dnsq_svc_t* service_types = NULL;
+static dnsq_mon_t** mons = NULL;
+static gdnsd_rstate_t* rstate = NULL;
+
+/*************************************************************************/
+// Response checking
+
+// Returns the offset just past the (possibly compressed) name at "offset",
+//   or zero if it runs off the end of the packet
+F_NONNULL F_PURE
+static unsigned skip_name(const uint8_t* pkt, const unsigned len, unsigned offset) {
+    dmn_assert(pkt);
+    while(offset < len) {
+        const unsigned llen = pkt[offset];
+        if(!llen)
+            return offset + 1U;
+        if((llen & 0xC0U) == 0xC0U)
+            return (offset + 2U <= len) ? offset + 2U : 0U;
+        if(llen & 0xC0U)
+            return 0U; // extended label types
+        offset += llen + 1U;
+    }
+    return 0U;
+}
+
+// Case-insensitive comparison of the response's question to ours.
+//   Length bytes are all < 64, so tolower-ing them is harmless.
+F_NONNULL F_PURE
+static bool question_matches(const uint8_t* a, const uint8_t* b, const unsigned len) {
+    dmn_assert(a); dmn_assert(b);
+    for(unsigned i = 0; i < len; i++) {
+        uint8_t x = a[i];
+        uint8_t y = b[i];
+        if(x >= 'A' && x <= 'Z')
+            x |= 0x20U;
+        if(y >= 'A' && y <= 'Z')
+            y |= 0x20U;
+        if(x != y)
+            return false;
+    }
+    return true;
+}
+
+// Looks for an A or AAAA answer matching any of the expected addresses
+F_NONNULL F_PURE
+static bool answers_match(const dnsq_svc_t* svc, const uint8_t* pkt, const unsigned len, unsigned offset, unsigned ancount) {
+    dmn_assert(svc); dmn_assert(pkt);
+
+    while(ancount--) {
+        offset = skip_name(pkt, len, offset);
+        if(!offset || offset + 10U > len)
+            return false;
+        const unsigned rrtype = ((unsigned)pkt[offset] << 8) | pkt[offset + 1U];
+        const unsigned rrclass = ((unsigned)pkt[offset + 2U] << 8) | pkt[offset + 3U];
+        const unsigned rdlen = ((unsigned)pkt[offset + 8U] << 8) | pkt[offset + 9U];
+        offset += 10U;
+        if(offset + rdlen > len)
+            return false;
+        if(rrclass == 1U) {
+            if(rrtype == 1U && rdlen == 4U) {
+                for(unsigned i = 0; i < svc->num_expect_v4; i++)
+                    if(!memcmp(&pkt[offset], &svc->expect_v4[i * 4U], 4U))
+                        return true;
+            }
+            else if(rrtype == 28U && rdlen == 16U) {
+                for(unsigned i = 0; i < svc->num_expect_v6; i++)
+                    if(!memcmp(&pkt[offset], &svc->expect_v6[i * 16U], 16U))
+                        return true;
+            }
+        }
+        offset += rdlen;
+    }
+
+    return false;
+}
+
+// The ID has already been matched by the caller
+F_NONNULL
+static bool check_response(const dnsq_mon_t* md, const uint8_t* pkt, const unsigned len) {
+    dmn_assert(md); dmn_assert(pkt);
+
+    const dnsq_svc_t* svc = md->dnsq_svc;
+    const unsigned qlen = svc->query_len - 12U;
+
+    if(len < svc->query_len
+        || !(pkt[2] & DNSQ_QR)
+        || (pkt[2] & DNSQ_OPCODE)
+        || pkt[4] || pkt[5] != 1U
+        || !question_matches(&pkt[12], &svc->query[12], qlen)) {
+        log_debug("plugin_dns_query: State poll of %s failed: malformed response", md->smgr->desc);
+        return false;
+    }
+
+    const unsigned rcode = pkt[3] & DNSQ_RCODE;
+    if(rcode != svc->rcode) {
+        log_debug("plugin_dns_query: State poll of %s failed: rcode %u", md->smgr->desc, rcode);
+        return false;
+    }
+
+    const unsigned ancount = ((unsigned)pkt[6] << 8) | pkt[7];
+    if(ancount < svc->min_answers) {
+        log_debug("plugin_dns_query: State poll of %s failed: %u answers", md->smgr->desc, ancount);
+        return false;
+    }
+
+    if((svc->num_expect_v4 || svc->num_expect_v6)
+        && !answers_match(svc, pkt, len, svc->query_len, ancount)) {
+        log_debug("plugin_dns_query: State poll of %s failed: no expected answer", md->smgr->desc);
+        return false;
+    }
+
+    return true;
+}
+
+/*************************************************************************/
+// UDP
+
+F_NONNULL
+static void udp_finish(struct ev_loop* loop, dnsq_mon_t* md) {
+    dmn_assert(loop); dmn_assert(md);
+    dmn_assert(md->dnsq_state == DNSQ_STATE_UDP);
+
+    udp_sock_t* us = md->usock;
+    dmn_assert(us->by_id[md->id] == md);
+    us->by_id[md->id] = NULL;
+    if(!--us->pending)
+        ev_io_stop(loop, us->read_watcher);
+    md->dnsq_state = DNSQ_STATE_WAITING;
+}
+
+F_NONNULL
+static bool same_source(const anysin_t* a, const anysin_t* from) {
+    dmn_assert(a); dmn_assert(from);
+    if(a->sa.sa_family != from->sa.sa_family)
+        return false;
+    if(a->sa.sa_family == AF_INET)
+        return a->sin.sin_port == from->sin.sin_port
+            && a->sin.sin_addr.s_addr == from->sin.sin_addr.s_addr;
+    return a->sin6.sin6_port == from->sin6.sin6_port
+        && !memcmp(a->sin6.sin6_addr.s6_addr, from->sin6.sin6_addr.s6_addr, 16);
+}
+
+F_NONNULL
+static void udp_read_cb(struct ev_loop* loop, struct ev_io* io, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(io);
+    dmn_assert(revents == EV_READ);
+
+    udp_sock_t* us = (udp_sock_t*)io->data;
+
+    while(us->pending) { // loop on all immediately-available responses
+        uint8_t pkt[DNSQ_RESP_MAX];
+        anysin_t from;
+        from.len = ANYSIN_MAXLEN;
+        const ssize_t rv = recvfrom(us->fd, pkt, DNSQ_RESP_MAX, 0, &from.sa, &from.len);
+        if(rv < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                log_err("plugin_dns_query: recvfrom() failed: %s", logf_errno());
+            return;
+        }
+        if(rv < 12)
+            continue;
+
+        const unsigned id = ((unsigned)pkt[0] << 8) | pkt[1];
+        dnsq_mon_t* md = us->by_id[id];
+        if(!md || !same_source(&md->addr, &from))
+            continue; // late, or not for us at all
+
+        const bool success = check_response(md, pkt, (unsigned)rv);
+        udp_finish(loop, md);
+        gdnsd_mon_timer_stop(&md->timeout_timer);
+        gdnsd_mon_state_updater(md->smgr, success);
+    }
+}
+
+F_NONNULL
+static void udp_send(struct ev_loop* loop, dnsq_mon_t* md) {
+    dmn_assert(loop); dmn_assert(md);
+
+    udp_sock_t* us = md->usock;
+    const dnsq_svc_t* svc = md->dnsq_svc;
+
+    unsigned id;
+    do {
+        id = gdnsd_rand_get32(rstate) & 0xFFFFU;
+    } while(us->by_id[id]);
+
+    uint8_t query[DNSQ_QUERY_MAX];
+    memcpy(query, svc->query, svc->query_len);
+    query[0] = id >> 8;
+    query[1] = id & 0xFF;
+
+    if(unlikely(sendto(us->fd, query, svc->query_len, 0, &md->addr.sa, md->addr.len) != (ssize_t)svc->query_len)) {
+        log_debug("plugin_dns_query: State poll of %s failed: sendto(): %s", md->smgr->desc, logf_errno());
+        gdnsd_mon_state_updater(md->smgr, false);
+        return;
+    }
+
+    md->id = id;
+    us->by_id[id] = md;
+    if(!us->pending++)
+        ev_io_start(loop, us->read_watcher);
+    md->dnsq_state = DNSQ_STATE_UDP;
+    gdnsd_mon_timer_start(loop, &md->timeout_timer, svc->timeout, 0);
+}
+
+/*************************************************************************/
+// TCP
+
+F_NONNULL
+static void tcp_finish(struct ev_loop* loop, dnsq_mon_t* md) {
+    dmn_assert(loop); dmn_assert(md);
+    dmn_assert(md->tcp_sock > -1);
+
+    ev_io_stop(loop, md->tcp_watcher);
+    shutdown(md->tcp_sock, SHUT_RDWR);
+    close(md->tcp_sock);
+    md->tcp_sock = -1;
+    free(md->tcp_resp);
+    md->tcp_resp = NULL;
+    md->dnsq_state = DNSQ_STATE_WAITING;
+}
+
+F_NONNULL
+static void tcp_connected(struct ev_loop* loop, dnsq_mon_t* md) {
+    dmn_assert(loop); dmn_assert(md);
+
+    int so_error = 0;
+    unsigned int so_error_len = sizeof(so_error);
+    (void)getsockopt(md->tcp_sock, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len);
+    if(unlikely(so_error)) {
+        log_debug("plugin_dns_query: State poll of %s failed: connect(): %s", md->smgr->desc, logf_errnum(so_error));
+        tcp_finish(loop, md);
+        gdnsd_mon_timer_stop(&md->timeout_timer);
+        gdnsd_mon_state_updater(md->smgr, false);
+        return;
+    }
+
+    // The query is small enough that it always fits in a fresh
+    //   connection's send buffer in one go.
+    const dnsq_svc_t* svc = md->dnsq_svc;
+    uint8_t query[DNSQ_QUERY_MAX + 2U];
+    query[0] = svc->query_len >> 8;
+    query[1] = svc->query_len & 0xFF;
+    memcpy(&query[2], svc->query, svc->query_len);
+    md->id = gdnsd_rand_get32(rstate) & 0xFFFFU;
+    query[2] = md->id >> 8;
+    query[3] = md->id & 0xFF;
+
+    const ssize_t len = svc->query_len + 2U;
+    if(unlikely(send(md->tcp_sock, query, len, SEND_FLAGS) != len)) {
+        log_debug("plugin_dns_query: State poll of %s failed: send(): %s", md->smgr->desc, logf_errno());
+        tcp_finish(loop, md);
+        gdnsd_mon_timer_stop(&md->timeout_timer);
+        gdnsd_mon_state_updater(md->smgr, false);
+        return;
+    }
+
+    md->tcp_done = 0;
+    md->dnsq_state = DNSQ_STATE_TCP_READING;
+    ev_io_stop(loop, md->tcp_watcher);
+    ev_io_set(md->tcp_watcher, md->tcp_sock, EV_READ);
+    ev_io_start(loop, md->tcp_watcher);
+}
+
+F_NONNULL
+static void tcp_cb(struct ev_loop* loop, struct ev_io* io, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(io);
+
+    dnsq_mon_t* md = (dnsq_mon_t*)io->data;
+
+    dmn_assert(md);
+    dmn_assert(md->tcp_sock > -1);
+    dmn_assert(gdnsd_mon_timer_active(&md->timeout_timer));
+
+    if(md->dnsq_state == DNSQ_STATE_TCP_CONNECTING) {
+        dmn_assert(revents == EV_WRITE);
+        tcp_connected(loop, md);
+        return;
+    }
+
+    dmn_assert(md->dnsq_state == DNSQ_STATE_TCP_READING);
+    dmn_assert(revents == EV_READ);
+
+    // The 2-byte length prefix, then the response itself
+    ssize_t rv;
+    if(md->tcp_done < 2U) {
+        rv = recv(md->tcp_sock, &md->tcp_prefix[md->tcp_done], 2U - md->tcp_done, 0);
+    }
+    else {
+        dmn_assert(md->tcp_resp);
+        rv = recv(md->tcp_sock, &md->tcp_resp[md->tcp_done - 2U], md->tcp_resp_len + 2U - md->tcp_done, 0);
+    }
+
+    if(rv < 1) {
+        if(rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return;
+        if(rv < 0)
+            log_debug("plugin_dns_query: State poll of %s failed: recv(): %s", md->smgr->desc, logf_errno());
+        else
+            log_debug("plugin_dns_query: State poll of %s failed: connection closed", md->smgr->desc);
+        tcp_finish(loop, md);
+        gdnsd_mon_timer_stop(&md->timeout_timer);
+        gdnsd_mon_state_updater(md->smgr, false);
+        return;
+    }
+
+    md->tcp_done += rv;
+    if(md->tcp_done == 2U) {
+        md->tcp_resp_len = ((unsigned)md->tcp_prefix[0] << 8) | md->tcp_prefix[1];
+        if(md->tcp_resp_len < 12U) {
+            log_debug("plugin_dns_query: State poll of %s failed: malformed response", md->smgr->desc);
+            tcp_finish(loop, md);
+            gdnsd_mon_timer_stop(&md->timeout_timer);
+            gdnsd_mon_state_updater(md->smgr, false);
+            return;
+        }
+        md->tcp_resp = malloc(md->tcp_resp_len);
+    }
+
+    if(md->tcp_done > 2U && md->tcp_done == md->tcp_resp_len + 2U) {
+        const unsigned id = ((unsigned)md->tcp_resp[0] << 8) | md->tcp_resp[1];
+        bool success = false;
+        if(id != md->id)
+            log_debug("plugin_dns_query: State poll of %s failed: response ID mismatch", md->smgr->desc);
+        else
+            success = check_response(md, md->tcp_resp, md->tcp_resp_len);
+        tcp_finish(loop, md);
+        gdnsd_mon_timer_stop(&md->timeout_timer);
+        gdnsd_mon_state_updater(md->smgr, success);
+    }
+}
+
+F_NONNULL
+static void tcp_start(struct ev_loop* loop, dnsq_mon_t* md) {
+    dmn_assert(loop); dmn_assert(md);
+
+    const bool isv6 = md->addr.sa.sa_family == AF_INET6;
+
+    const int sock = socket(isv6 ? PF_INET6 : PF_INET, SOCK_STREAM, gdnsd_getproto_tcp());
+    if(unlikely(sock == -1)) {
+        log_err("plugin_dns_query: Failed to create monitoring socket: %s", logf_errno());
+        return;
+    }
+
+    if(unlikely(fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0)) | O_NONBLOCK) == -1)) {
+        log_err("plugin_dns_query: Failed to set O_NONBLOCK on monitoring socket: %s", logf_errno());
+        close(sock);
+        return;
+    }
+
+    // Even if connect() succeeds immediately, the writability
+    //   callback will get to it shortly.
+    if(connect(sock, &md->addr.sa, md->addr.len) == -1 && errno != EINPROGRESS) {
+        switch(errno) {
+            case EPIPE:
+            case ECONNREFUSED:
+            case ETIMEDOUT:
+            case EHOSTUNREACH:
+            case EHOSTDOWN:
+            case ENETUNREACH:
+                log_debug("plugin_dns_query: State poll of %s failed very quickly", md->smgr->desc);
+                break;
+            default:
+                log_err("plugin_dns_query: Failed to connect() monitoring socket to remote server, possible local problem: %s", logf_errno());
+        }
+        close(sock);
+        gdnsd_mon_state_updater(md->smgr, false);
+        return;
+    }
+
+    md->tcp_sock = sock;
+    md->dnsq_state = DNSQ_STATE_TCP_CONNECTING;
+    ev_io_set(md->tcp_watcher, sock, EV_WRITE);
+    ev_io_start(loop, md->tcp_watcher);
+    gdnsd_mon_timer_start(loop, &md->timeout_timer, md->dnsq_svc->timeout, 0);
+}
+
+/*************************************************************************/
+
+F_NONNULL
+static void mon_interval_cb(struct ev_loop* loop, gdnsd_mon_timer_t* t) {
+    dmn_assert(loop); dmn_assert(t);
+
+    dnsq_mon_t* md = (dnsq_mon_t*)t->data;
+
+    dmn_assert(md);
+
+    if(unlikely(md->dnsq_state != DNSQ_STATE_WAITING)) {
+        log_warn("plugin_dns_query: A monitoring request attempt seems to have "
+            "lasted longer than the monitoring interval. "
+            "Skipping this round of monitoring - are you "
+            "starved for CPU time?");
+        return;
+    }
+
+    dmn_assert(!gdnsd_mon_timer_active(&md->timeout_timer));
+
+    log_debug("plugin_dns_query: Starting state poll of %s", md->smgr->desc);
+
+    if(md->dnsq_svc->tcp)
+        tcp_start(loop, md);
+    else
+        udp_send(loop, md);
+}
+
+F_NONNULL
+static void mon_timeout_cb(struct ev_loop* loop, gdnsd_mon_timer_t* t) {
+    dmn_assert(loop); dmn_assert(t);
+
+    dnsq_mon_t* md = (dnsq_mon_t*)t->data;
+
+    dmn_assert(md);
+    dmn_assert(md->dnsq_state != DNSQ_STATE_WAITING);
+
+    log_debug("plugin_dns_query: State poll of %s timed out", md->smgr->desc);
+    if(md->dnsq_state == DNSQ_STATE_UDP)
+        udp_finish(loop, md);
+    else
+        tcp_finish(loop, md);
+    gdnsd_mon_state_updater(md->smgr, false);
+}
+
+/*************************************************************************/
+// Configuration
+
+#define SVC_OPT_UINT(_hash, _typnam, _loc, _min, _max) \
+    do { \
+        const vscf_data_t* _data = vscf_hash_get_data_byconstkey(_hash, #_loc, true); \
+        if(_data) { \
+            unsigned long _val; \
+            if(!vscf_is_simple(_data) \
+            || !vscf_simple_get_as_ulong(_data, &_val)) \
+                log_fatal("plugin_dns_query: Service type '%s': option '%s': Value must be a positive integer", _typnam, #_loc); \
+            if(_val < _min || _val > _max) \
+                log_fatal("plugin_dns_query: Service type '%s': option '%s': Value out of range (%lu, %lu)", _typnam, #_loc, _min, _max); \
+            _loc = (unsigned) _val; \
+        } \
+    } while(0)
+
+#define SVC_OPT_STR(_hash, _typnam, _loc) \
+    do { \
+        const vscf_data_t* _data = vscf_hash_get_data_byconstkey(_hash, #_loc, true); \
+        if(_data) { \
+            if(!vscf_is_simple(_data)) \
+                log_fatal("plugin_dns_query: Service type '%s': option %s: Wrong type (should be string)", _typnam, #_loc); \
+            _loc = vscf_simple_get_data(_data); \
+        } \
+    } while(0)
+
+#define SVC_OPT_BOOL(_hash, _typnam, _loc) \
+    do { \
+        const vscf_data_t* _data = vscf_hash_get_data_byconstkey(_hash, #_loc, true); \
+        if(_data) { \
+            if(!vscf_is_simple(_data) \
+            || !vscf_simple_get_as_bool(_data, &_loc)) \
+                log_fatal("plugin_dns_query: Service type '%s': option '%s': Value must be 'true' or 'false'", _typnam, #_loc); \
+        } \
+    } while(0)
+
+static const struct {
+    const char* name;
+    unsigned val;
+} qtype_names[] = {
+    { "A", 1U },
+    { "NS", 2U },
+    { "CNAME", 5U },
+    { "SOA", 6U },
+    { "PTR", 12U },
+    { "MX", 15U },
+    { "TXT", 16U },
+    { "AAAA", 28U },
+    { "SRV", 33U },
+    { "NAPTR", 35U },
+    { "DS", 43U },
+    { "DNSKEY", 48U },
+    { "ANY", 255U },
+};
+
+static const char* rcode_names[] = {
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+};
+
+F_NONNULL
+static unsigned parse_qtype(const char* svc_name, const char* qtype) {
+    dmn_assert(svc_name); dmn_assert(qtype);
+
+    for(unsigned i = 0; i < (sizeof(qtype_names) / sizeof(qtype_names[0])); i++)
+        if(!strcasecmp(qtype, qtype_names[i].name))
+            return qtype_names[i].val;
+
+    // RFC 3597 "TYPE<n>"
+    char* endptr;
+    if(!strncasecmp(qtype, "TYPE", 4)) {
+        const unsigned long val = strtoul(qtype + 4, &endptr, 10);
+        if(endptr != qtype + 4 && !*endptr && val && val < 65536LU)
+            return (unsigned)val;
+    }
+
+    log_fatal("plugin_dns_query: Service type '%s': option 'qtype': invalid value '%s'", svc_name, qtype);
+}
+
+F_NONNULL
+static unsigned parse_rcode(const char* svc_name, const char* rcode) {
+    dmn_assert(svc_name); dmn_assert(rcode);
+
+    for(unsigned i = 0; i < (sizeof(rcode_names) / sizeof(rcode_names[0])); i++)
+        if(!strcasecmp(rcode, rcode_names[i]))
+            return i;
+
+    log_fatal("plugin_dns_query: Service type '%s': option 'rcode': invalid value '%s'", svc_name, rcode);
+}
+
+F_NONNULL
+static void add_expect(dnsq_svc_t* svc, const vscf_data_t* addr_cfg) {
+    dmn_assert(svc); dmn_assert(addr_cfg);
+
+    if(!vscf_is_simple(addr_cfg))
+        log_fatal("plugin_dns_query: Service type '%s': option 'expect': values must be IP addresses", svc->name);
+
+    const char* addr_txt = vscf_simple_get_data(addr_cfg);
+    anysin_t addr;
+    const int addr_err = gdnsd_anysin_getaddrinfo(addr_txt, NULL, &addr);
+    if(addr_err)
+        log_fatal("plugin_dns_query: Service type '%s': option 'expect': could not parse '%s' as an IP address: %s", svc->name, addr_txt, gai_strerror(addr_err));
+
+    if(addr.sa.sa_family == AF_INET) {
+        svc->expect_v4 = realloc(svc->expect_v4, (svc->num_expect_v4 + 1U) * 4U);
+        memcpy(&svc->expect_v4[svc->num_expect_v4++ * 4U], &addr.sin.sin_addr.s_addr, 4U);
+    }
+    else {
+        dmn_assert(addr.sa.sa_family == AF_INET6);
+        svc->expect_v6 = realloc(svc->expect_v6, (svc->num_expect_v6 + 1U) * 16U);
+        memcpy(&svc->expect_v6[svc->num_expect_v6++ * 16U], addr.sin6.sin6_addr.s6_addr, 16U);
+    }
+}
+
+void plugin_dns_query_add_svctype(const char* name, const vscf_data_t* svc_cfg, const unsigned interval, const unsigned timeout) {
+    dmn_assert(name);
+
+    // defaults
+    const char* qname = NULL;
+    const char* qtype = "SOA";
+    const char* rcode = "NOERROR";
+    unsigned port = 53U;
+    unsigned min_answers = 0U;
+    bool min_answers_set = false;
+    bool recurse = false;
+    bool tcp = false;
+
+    service_types = realloc(service_types, (num_dnsq_svcs + 1) * sizeof(dnsq_svc_t));
+    dnsq_svc_t* this_svc = &service_types[num_dnsq_svcs++];
+    memset(this_svc, 0, sizeof(dnsq_svc_t));
+
+    this_svc->name = strdup(name);
+
+    if(svc_cfg) {
+        SVC_OPT_STR(svc_cfg, name, qname);
+        SVC_OPT_STR(svc_cfg, name, qtype);
+        SVC_OPT_STR(svc_cfg, name, rcode);
+        SVC_OPT_UINT(svc_cfg, name, port, 1LU, 65534LU);
+        const vscf_data_t* min_answers_cfg = vscf_hash_get_data_byconstkey(svc_cfg, "min_answers", true);
+        if(min_answers_cfg) {
+            unsigned long val;
+            if(!vscf_is_simple(min_answers_cfg)
+                || !vscf_simple_get_as_ulong(min_answers_cfg, &val)
+                || val > 65535LU)
+                log_fatal("plugin_dns_query: Service type '%s': option 'min_answers': Value must be an integer (0-65535)", name);
+            min_answers = (unsigned)val;
+            min_answers_set = true;
+        }
+        SVC_OPT_BOOL(svc_cfg, name, recurse);
+        SVC_OPT_BOOL(svc_cfg, name, tcp);
+        const vscf_data_t* expect_cfg = vscf_hash_get_data_byconstkey(svc_cfg, "expect", true);
+        if(expect_cfg) {
+            const unsigned num_expect = vscf_array_get_len(expect_cfg);
+            for(unsigned i = 0; i < num_expect; i++)
+                add_expect(this_svc, vscf_array_get_data(expect_cfg, i));
+        }
+    }
+
+    if(!qname)
+        log_fatal("plugin_dns_query: service type '%s' must have a 'qname' parameter", name);
+
+    uint8_t dname[256];
+    const gdnsd_dname_status_t dnstat = gdnsd_dname_from_string(dname, (const uint8_t*)qname, strlen(qname));
+    if(dnstat == DNAME_INVALID)
+        log_fatal("plugin_dns_query: Service type '%s': option 'qname': invalid domainname '%s'", name, qname);
+    if(dnstat == DNAME_PARTIAL)
+        gdnsd_dname_terminate(dname);
+
+    this_svc->qtype = parse_qtype(name, qtype);
+    this_svc->rcode = parse_rcode(name, rcode);
+
+    // By default, a NOERROR response must also have an answer
+    if(!min_answers_set)
+        min_answers = this_svc->rcode ? 0U : 1U;
+
+    if((this_svc->num_expect_v4 || this_svc->num_expect_v6) && this_svc->qtype != 1U && this_svc->qtype != 28U && this_svc->qtype != 255U)
+        log_fatal("plugin_dns_query: Service type '%s': option 'expect' requires a qtype of A, AAAA, or ANY", name);
+
+    // The query, other than the ID
+    uint8_t* q = this_svc->query;
+    q[2] = recurse ? DNSQ_RD : 0U;
+    q[5] = 1U; // QDCOUNT
+    memcpy(&q[12], &dname[1], dname[0]);
+    unsigned qlen = 12U + dname[0];
+    q[qlen++] = this_svc->qtype >> 8;
+    q[qlen++] = this_svc->qtype & 0xFF;
+    q[qlen++] = 0U;
+    q[qlen++] = 1U; // class IN
+    this_svc->query_len = qlen;
+
+    this_svc->min_answers = min_answers;
+    this_svc->tcp = tcp;
+    this_svc->port = port;
+    this_svc->timeout = timeout;
+    this_svc->interval = interval;
+}
+
+// Assigns the monitor a UDP socket for its service type and family,
+//   creating a new one when the last one is full
+F_NONNULL
+static udp_sock_t* get_udp_sock(dnsq_svc_t* svc, const bool isv6) {
+    dmn_assert(svc);
+
+    const unsigned n = svc->num_socks[isv6];
+    if(n && svc->socks[isv6][n - 1]->num_mons < DNSQ_SOCK_MONS) {
+        udp_sock_t* us = svc->socks[isv6][n - 1];
+        us->num_mons++;
+        return us;
+    }
+
+    const int sock = socket(isv6 ? PF_INET6 : PF_INET, SOCK_DGRAM, gdnsd_getproto_udp());
+    if(sock == -1)
+        log_fatal("plugin_dns_query: Failed to create monitoring socket: %s", logf_errno());
+    if(fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0)) | O_NONBLOCK) == -1)
+        log_fatal("plugin_dns_query: Failed to set O_NONBLOCK on monitoring socket: %s", logf_errno());
+    if(fcntl(sock, F_SETFD, FD_CLOEXEC) == -1)
+        log_fatal("plugin_dns_query: Failed to set FD_CLOEXEC on monitoring socket: %s", logf_errno());
+
+    udp_sock_t* us = calloc(1, sizeof(udp_sock_t));
+    us->fd = sock;
+    us->num_mons = 1;
+    us->by_id = calloc(65536U, sizeof(dnsq_mon_t*));
+    us->read_watcher = malloc(sizeof(ev_io));
+    ev_io_init(us->read_watcher, &udp_read_cb, sock, EV_READ);
+    us->read_watcher->data = us;
+
+    svc->socks[isv6] = realloc(svc->socks[isv6], (n + 1) * sizeof(udp_sock_t*));
+    svc->socks[isv6][n] = us;
+    svc->num_socks[isv6]++;
+    return us;
+}
+
+void plugin_dns_query_add_monitor(const char* svc_name, mon_smgr_t* smgr) {
+    dmn_assert(svc_name); dmn_assert(smgr);
+
+    dnsq_mon_t* this_mon = calloc(1, sizeof(dnsq_mon_t));
+
+    for(unsigned i = 0; i < num_dnsq_svcs; i++) {
+        if(!strcmp(service_types[i].name, svc_name)) {
+            this_mon->dnsq_svc = &service_types[i];
+            break;
+        }
+    }
+
+    dmn_assert(this_mon->dnsq_svc);
+
+    memcpy(&this_mon->addr, &smgr->addr, sizeof(anysin_t));
+    const bool isv6 = this_mon->addr.sa.sa_family == AF_INET6;
+    if(!isv6) {
+        this_mon->addr.sin.sin_port = htons(this_mon->dnsq_svc->port);
+    }
+    else {
+        dmn_assert(this_mon->addr.sa.sa_family == AF_INET6);
+        this_mon->addr.sin6.sin6_port = htons(this_mon->dnsq_svc->port);
+    }
+
+    this_mon->smgr = smgr;
+    this_mon->dnsq_state = DNSQ_STATE_WAITING;
+    this_mon->tcp_sock = -1;
+
+    if(this_mon->dnsq_svc->tcp) {
+        this_mon->tcp_watcher = malloc(sizeof(ev_io));
+        ev_io_init(this_mon->tcp_watcher, &tcp_cb, -1, 0);
+        this_mon->tcp_watcher->data = this_mon;
+    }
+    else {
+        this_mon->usock = get_udp_sock(this_mon->dnsq_svc, isv6);
+    }
+
+    gdnsd_mon_timer_init(&this_mon->timeout_timer, &mon_timeout_cb, this_mon);
+    gdnsd_mon_timer_init(&this_mon->interval_timer, &mon_interval_cb, this_mon);
+
+    mons = realloc(mons, sizeof(dnsq_mon_t*) * (num_mons + 1));
+    mons[num_mons++] = this_mon;
+}
+
+void plugin_dns_query_init_monitors(struct ev_loop* mon_loop) {
+    dmn_assert(mon_loop);
+
+    rstate = gdnsd_rand_init();
+
+    // spread the initial round out a bit, if there are a lot of them
+    for(unsigned int i = 0; i < num_mons; i++) {
+        dnsq_mon_t* mon = mons[i];
+        dmn_assert(mon->dnsq_state == DNSQ_STATE_WAITING);
+        const double spread = gdnsd_mon_init_spread(num_mons, mon->dnsq_svc->interval);
+        gdnsd_mon_timer_start(mon_loop, &mon->interval_timer, spread * gdnsd_mon_jitter(mon->smgr->desc), 0);
+    }
+}
+
+void plugin_dns_query_start_monitors(struct ev_loop* mon_loop) {
+    dmn_assert(mon_loop);
+
+    for(unsigned int i = 0; i < num_mons; i++) {
+        dnsq_mon_t* mon = mons[i];
+        dmn_assert(mon->dnsq_state == DNSQ_STATE_WAITING);
+        const unsigned ival = mon->dnsq_svc->interval;
+        const double stagger = gdnsd_mon_jitter(mon->smgr->desc) * ival;
+        gdnsd_mon_timer_start(mon_loop, &mon->interval_timer, stagger, ival);
+    }
+}
@@ -29,38 +29,79 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <net/if.h>
 #include <fcntl.h>
 
+// Used for send() so that a kept-alive connection that the server
+//   has since closed fails with EPIPE, even when not daemonized.
+#ifdef MSG_NOSIGNAL
+#  define SEND_FLAGS MSG_NOSIGNAL
+#else
+#  define SEND_FLAGS 0
+#endif
+
+// Longest response line we store; anything longer is truncated, which
+//   is harmless as all we care about is the start of a few headers.
+#define RESP_LINE_MAX 256U
+
 typedef struct {
     const char* name;
     unsigned long* ok_codes;
-    char* req_data;
+    char* req_data; // NULL if it's per-monitor, see add_monitor
+    const char* url_path;
     unsigned req_data_len;
     unsigned num_ok_codes;
     unsigned port;
     unsigned timeout;
     unsigned interval;
+    bool keepalive;
 } http_svc_t;
 
 typedef enum {
     HTTP_STATE_WAITING = 0,   // waiting for interval to expire before next send
+    HTTP_STATE_IDLE,     // as above, but with a kept-alive connection open
     HTTP_STATE_WRITING,   // trying to send the request
     HTTP_STATE_READING  // trying to receive the response
 } http_state_t;
 
+// Response parsing state.  Without keepalive we're done as soon as
+//   we have the status line, but to re-use a connection we have to
+//   consume the whole response, to find the start of the next one.
+typedef enum {
+    RESP_STATUS = 0,  // status line
+    RESP_HEADERS,     // header lines
+    RESP_BODY,        // Content-Length body
+    RESP_CHUNK_SIZE,  // chunked body, chunk-size line
+    RESP_CHUNK_DATA,  // chunked body, chunk-data
+    RESP_CHUNK_END,   // chunked body, the CRLF after chunk-data
+    RESP_TRAILERS,    // chunked body, trailer lines
+} resp_state_t;
+
 typedef struct {
     http_svc_t* http_svc;
     ev_io* read_watcher;
     ev_io* write_watcher;
-    ev_timer* timeout_watcher;
-    ev_timer* interval_watcher;
+    gdnsd_mon_timer_t timeout_timer;
+    gdnsd_mon_timer_t interval_timer;
     mon_smgr_t* smgr;
     anysin_t addr;
-    char res_buf[14];
+    char* req_data;
+    unsigned req_data_len;
     int sock;
     http_state_t hstate;
     unsigned done;
     bool already_connected;
+    bool reused;   // this request was sent on a kept-alive connection
+    bool got_data; // any of the response has been received
+    // response parsing
+    resp_state_t rstate;
+    unsigned status;
+    unsigned long remaining; // of the body or current chunk
+    bool chunked;
+    bool has_length;
+    bool conn_close; // the connection can't be re-used after this response
+    unsigned line_len;
+    char line[RESP_LINE_MAX];
 } http_events_t;
 
 static unsigned num_http_svcs = 0;
@@ -68,16 +109,142 @@ static unsigned int num_mons = 0;
 static http_svc_t* service_types = NULL;
 static http_events_t** mons = NULL;
 
+// Connections aren't kept during the initial round of checks, which
+//   is expected to finish with no watchers left in the loop.
+static bool keep_conns = false;
+
+// Creates a new monitoring socket and starts connecting it,
+//   returns false on immediate failure.
+F_NONNULL
+static bool mon_connect(http_events_t* md) {
+    dmn_assert(md);
+    dmn_assert(md->sock == -1);
+
+    const bool isv6 = md->addr.sa.sa_family == AF_INET6;
+
+    const int sock = socket(isv6 ? PF_INET6 : PF_INET, SOCK_STREAM, gdnsd_getproto_tcp());
+    if(unlikely(sock < 0)) {
+        log_err("plugin_http_status: Failed to create monitoring socket: %s", logf_errno());
+        return false;
+    }
+
+    if(unlikely(fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0)) | O_NONBLOCK) == -1)) {
+        log_err("plugin_http_status: Failed to set O_NONBLOCK on monitoring socket: %s", logf_errno());
+        close(sock);
+        return false;
+    }
+
+    md->already_connected = true;
+    if(likely(connect(sock, &md->addr.sa, md->addr.len) == -1)) {
+        if(likely(errno == EINPROGRESS)) { md->already_connected = false; }
+        else {
+            switch(errno) {
+                case EPIPE:
+                case ECONNREFUSED:
+                case ETIMEDOUT:
+                case EHOSTUNREACH:
+                case EHOSTDOWN:
+                case ENETUNREACH:
+                    break;
+                default:
+                    log_err("plugin_http_status: Failed to connect() monitoring socket to remote server, possible local problem: %s", logf_errno());
+            }
+            close(sock);
+            return false;
+        }
+    }
+
+    md->sock = sock;
+    return true;
+}
+
+// Starts sending the request on md->sock, new or kept-alive
 F_NONNULL
-static void mon_interval_cb(struct ev_loop* loop, struct ev_timer* t, const int revents V_UNUSED) {
+static void mon_send_request(struct ev_loop* loop, http_events_t* md) {
+    dmn_assert(loop); dmn_assert(md);
+    dmn_assert(md->sock > -1);
+
+    md->hstate = HTTP_STATE_WRITING;
+    md->done = 0;
+    md->got_data = false;
+    md->rstate = RESP_STATUS;
+    md->status = 0;
+    md->remaining = 0;
+    md->chunked = false;
+    md->has_length = false;
+    md->conn_close = !md->http_svc->keepalive;
+    md->line_len = 0;
+    ev_io_set(md->write_watcher, md->sock, EV_WRITE);
+    ev_io_start(loop, md->write_watcher);
+}
+
+F_NONNULL
+static void mon_close(struct ev_loop* loop, http_events_t* md) {
+    dmn_assert(loop); dmn_assert(md);
+
+    ev_io_stop(loop, md->read_watcher);
+    ev_io_stop(loop, md->write_watcher);
+    if(md->sock != -1) {
+        shutdown(md->sock, SHUT_RDWR);
+        close(md->sock);
+        md->sock = -1;
+    }
+}
+
+// Ends the current state poll, keeping the connection open
+//   for the next one if that's allowed.
+F_NONNULL
+static void mon_finish(struct ev_loop* loop, http_events_t* md, const bool success, const bool keep) {
+    dmn_assert(loop); dmn_assert(md);
+
+    log_debug("plugin_http_status: State poll of %s %s", md->smgr->desc, success ? "succeeded" : "failed");
+    gdnsd_mon_timer_stop(&md->timeout_timer);
+    if(keep && keep_conns) {
+        // Watch the idle connection, so that we notice (and close our
+        //   end) when the server closes it.
+        ev_io_stop(loop, md->write_watcher);
+        ev_io_stop(loop, md->read_watcher);
+        ev_io_set(md->read_watcher, md->sock, EV_READ);
+        ev_io_start(loop, md->read_watcher);
+        md->hstate = HTTP_STATE_IDLE;
+    }
+    else {
+        mon_close(loop, md);
+        md->hstate = HTTP_STATE_WAITING;
+    }
+    gdnsd_mon_state_updater(md->smgr, success);
+}
+
+// The server may close a kept-alive connection at any time, including
+//   just as we send a new request on it.  If that happens before we've
+//   seen any of the response, retry once on a new connection, within
+//   the original timeout.  Returns false if this wasn't such a case.
+F_NONNULL
+static bool mon_retry(struct ev_loop* loop, http_events_t* md) {
+    dmn_assert(loop); dmn_assert(md);
+
+    if(!md->reused || md->got_data)
+        return false;
+
+    log_debug("plugin_http_status: Kept-alive connection to %s was closed, reconnecting", md->smgr->desc);
+    mon_close(loop, md);
+    md->reused = false;
+    if(mon_connect(md))
+        mon_send_request(loop, md);
+    else
+        mon_finish(loop, md, false, false);
+    return true;
+}
+
+F_NONNULL
+static void mon_interval_cb(struct ev_loop* loop, gdnsd_mon_timer_t* t) {
     dmn_assert(loop); dmn_assert(t);
-    dmn_assert(revents == EV_TIMER);
 
     http_events_t* md = (http_events_t*)t->data;
 
     dmn_assert(md);
 
-    if(unlikely(md->hstate != HTTP_STATE_WAITING)) {
+    if(unlikely(md->hstate != HTTP_STATE_WAITING && md->hstate != HTTP_STATE_IDLE)) {
         log_warn("plugin_http_status: A monitoring request attempt seems to have "
             "lasted longer than the monitoring interval. "
             "Skipping this round of monitoring - are you "
@@ -85,62 +252,27 @@ static void mon_interval_cb(struct ev_loop* loop, struct ev_timer* t, const int
         return;
     }
 
-    dmn_assert(md->sock == -1);
-    dmn_assert(!ev_is_active(md->read_watcher));
+    dmn_assert(md->hstate == HTTP_STATE_IDLE || md->sock == -1);
+    dmn_assert(md->hstate == HTTP_STATE_IDLE || !ev_is_active(md->read_watcher));
     dmn_assert(!ev_is_active(md->write_watcher));
-    dmn_assert(!ev_is_active(md->timeout_watcher) && !ev_is_pending(md->timeout_watcher));
+    dmn_assert(!gdnsd_mon_timer_active(&md->timeout_timer));
 
     log_debug("plugin_http_status: Starting state poll of %s", md->smgr->desc);
 
-    do {
-        const bool isv6 = md->addr.sa.sa_family == AF_INET6;
-
-        const int sock = socket(isv6 ? PF_INET6 : PF_INET, SOCK_STREAM, gdnsd_getproto_tcp());
-        if(unlikely(sock < 0)) {
-            log_err("plugin_http_status: Failed to create monitoring socket: %s", logf_errno());
-            break;
-        }
-
-        if(unlikely(fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0)) | O_NONBLOCK) == -1)) {
-            log_err("plugin_http_status: Failed to set O_NONBLOCK on monitoring socket: %s", logf_errno());
-            close(sock);
-            break;
-        }
-
+    md->reused = (md->hstate == HTTP_STATE_IDLE);
+    if(md->reused) {
+        ev_io_stop(loop, md->read_watcher);
         md->already_connected = true;
-        if(likely(connect(sock, &md->addr.sa, md->addr.len) == -1)) {
-            if(likely(errno == EINPROGRESS)) { md->already_connected = false; }
-            else {
-                switch(errno) {
-                    case EPIPE:
-                    case ECONNREFUSED:
-                    case ETIMEDOUT:
-                    case EHOSTUNREACH:
-                    case EHOSTDOWN:
-                    case ENETUNREACH:
-                        break;
-                    default:
-                        log_err("plugin_http_status: Failed to connect() monitoring socket to remote server, possible local problem: %s", logf_errno());
-                }
-                close(sock);
-                break;
-            }
-        }
-
-        md->sock = sock;
-        md->hstate = HTTP_STATE_WRITING;
-        md->done = 0;
-        ev_io_set(md->write_watcher, sock, EV_WRITE);
-        ev_io_start(loop, md->write_watcher);
-        ev_timer_set(md->timeout_watcher, md->http_svc->timeout, 0);
-        ev_timer_start(loop, md->timeout_watcher);
+    }
+    else if(!mon_connect(md)) {
+        log_debug("plugin_http_status: State poll of %s failed very quickly", md->smgr->desc);
+        md->hstate = HTTP_STATE_WAITING;
+        gdnsd_mon_state_updater(md->smgr, false);
         return;
-    } while(0);
+    }
 
-    // This is only reachable via "break"'s above, which indicate an immediate failure
-    log_debug("plugin_http_status: State poll of %s failed very quickly", md->smgr->desc);
-    md->hstate = HTTP_STATE_WAITING;
-    gdnsd_mon_state_updater(md->smgr, false);
+    mon_send_request(loop, md);
+    gdnsd_mon_timer_start(loop, &md->timeout_timer, md->http_svc->timeout, 0);
 }
 
 F_NONNULL
@@ -154,7 +286,7 @@ static void mon_write_cb(struct ev_loop* loop, struct ev_io* io, const int reven
     dmn_assert(md->hstate == HTTP_STATE_WRITING);
     dmn_assert(!ev_is_active(md->read_watcher));
     dmn_assert(ev_is_active(md->write_watcher));
-    dmn_assert(ev_is_active(md->timeout_watcher) || ev_is_pending(md->timeout_watcher));
+    dmn_assert(gdnsd_mon_timer_active(&md->timeout_timer));
     dmn_assert(md->sock > -1);
 
     int sock = md->sock;
@@ -177,18 +309,14 @@ static void mon_write_cb(struct ev_loop* loop, struct ev_io* io, const int reven
             }
 
             log_debug("plugin_http_status: State poll of %s failed quickly: %s", md->smgr->desc, logf_errnum(so_error));
-            close(sock); md->sock = -1;
-            ev_io_stop(loop, md->write_watcher);
-            ev_timer_stop(loop, md->timeout_watcher);
-            md->hstate = HTTP_STATE_WAITING;
-            gdnsd_mon_state_updater(md->smgr, false);
+            mon_finish(loop, md, false, false);
             return;
         }
         md->already_connected = true;
     }
 
-    const unsigned to_send = md->http_svc->req_data_len - md->done;
-    const int sent = send(sock, md->http_svc->req_data + md->done, md->http_svc->req_data_len, 0);
+    const unsigned to_send = md->req_data_len - md->done;
+    const int sent = send(sock, md->req_data + md->done, to_send, SEND_FLAGS);
     if(unlikely(sent == -1)) {
         switch(errno) {
             case EAGAIN:
@@ -200,17 +328,14 @@ static void mon_write_cb(struct ev_loop* loop, struct ev_io* io, const int reven
             case EHOSTUNREACH:
             case ENETUNREACH:
             case EPIPE:
+                if(mon_retry(loop, md))
+                    return;
                 break;
             default:
                 log_err("plugin_http_status: write() to monitoring socket failed, possible local problem: %s", logf_errno());
         }
-        shutdown(sock, SHUT_RDWR);
-        close(sock);
-        md->sock = -1;
-        ev_io_stop(loop, md->write_watcher);
-        ev_timer_stop(loop, md->timeout_watcher);
-        md->hstate = HTTP_STATE_WAITING;
-        gdnsd_mon_state_updater(md->smgr, false);
+        mon_finish(loop, md, false, false);
+        return;
     }
     if(unlikely(sent != (signed)to_send)) {
         md->done += sent;
@@ -224,6 +349,133 @@ static void mon_write_cb(struct ev_loop* loop, struct ev_io* io, const int reven
     ev_io_start(loop, md->read_watcher);
 }
 
+F_NONNULL
+static bool status_ok(const http_svc_t* svc, const unsigned status) {
+    dmn_assert(svc);
+    for(unsigned i = 0; i < svc->num_ok_codes; i++)
+        if(status == svc->ok_codes[i])
+            return true;
+    return false;
+}
+
+// Handles one complete line of the response, returns true if
+//   the response is complete.
+F_NONNULL
+static bool resp_line(http_events_t* md) {
+    dmn_assert(md);
+
+    char* line = md->line;
+    switch(md->rstate) {
+        case RESP_STATUS: {
+            char vers[2] = { 0 };
+            char code_str[4] = { 0 };
+            if(2 != sscanf(line, "HTTP/1.%1[01]%*1[ ]%3c", vers, code_str)) {
+                md->status = 0;
+                md->conn_close = true;
+                return true;
+            }
+            md->status = strtoul(code_str, NULL, 10);
+            if(vers[0] == '0')
+                md->conn_close = true; // HTTP/1.0 keep-alive isn't worth the trouble
+            if(md->conn_close && md->status >= 200)
+                return true;
+            md->rstate = RESP_HEADERS;
+            return false;
+        }
+        case RESP_HEADERS:
+            if(!*line) {
+                // end of headers, now to find the end of the body
+                if(md->status < 200) {
+                    md->rstate = RESP_STATUS; // interim 1xx response
+                    return false;
+                }
+                if(md->status == 204 || md->status == 304)
+                    return true;
+                if(md->chunked) {
+                    md->rstate = RESP_CHUNK_SIZE;
+                    return false;
+                }
+                if(md->has_length) {
+                    md->rstate = RESP_BODY;
+                    return !md->remaining;
+                }
+                // body delimited by the server closing the connection
+                md->conn_close = true;
+                return true;
+            }
+            for(char* c = line; *c; c++)
+                if(*c >= 'A' && *c <= 'Z')
+                    *c |= 0x20;
+            if(!strncmp(line, "content-length:", 15)) {
+                md->remaining = strtoul(line + 15, NULL, 10);
+                md->has_length = true;
+            }
+            else if(!strncmp(line, "transfer-encoding:", 18)) {
+                md->chunked = !!strstr(line + 18, "chunked");
+            }
+            else if(!strncmp(line, "connection:", 11)) {
+                if(strstr(line + 11, "close"))
+                    md->conn_close = true;
+            }
+            return false;
+        case RESP_CHUNK_SIZE:
+            md->remaining = strtoul(line, NULL, 16);
+            md->rstate = md->remaining ? RESP_CHUNK_DATA : RESP_TRAILERS;
+            return false;
+        case RESP_CHUNK_END:
+            md->rstate = RESP_CHUNK_SIZE;
+            return false;
+        case RESP_TRAILERS:
+            return !*line;
+        default:
+            dmn_assert(0);
+            return true;
+    }
+}
+
+// Consumes received response data, returns true if the response
+//   is complete.
+F_NONNULL
+static bool resp_parse(http_events_t* md, const char* data, const unsigned len) {
+    dmn_assert(md); dmn_assert(data);
+
+    bool complete = false;
+    unsigned i = 0;
+    while(i < len && !complete) {
+        if(md->rstate == RESP_BODY || md->rstate == RESP_CHUNK_DATA) {
+            const unsigned avail = len - i;
+            const unsigned skip = md->remaining < avail ? md->remaining : avail;
+            md->remaining -= skip;
+            i += skip;
+            if(!md->remaining) {
+                if(md->rstate == RESP_BODY)
+                    complete = true;
+                else
+                    md->rstate = RESP_CHUNK_END;
+            }
+            continue;
+        }
+
+        const char c = data[i++];
+        if(c != '\n') {
+            if(md->line_len < RESP_LINE_MAX - 1U)
+                md->line[md->line_len++] = c;
+            continue;
+        }
+        if(md->line_len && md->line[md->line_len - 1U] == '\r')
+            md->line_len--;
+        md->line[md->line_len] = '\0';
+        md->line_len = 0;
+        complete = resp_line(md);
+    }
+
+    // Anything after the response means we've lost track of the stream
+    if(complete && i < len)
+        md->conn_close = true;
+
+    return complete;
+}
+
 F_NONNULL
 static void mon_read_cb(struct ev_loop* loop, struct ev_io* io, const int revents V_UNUSED) {
     dmn_assert(loop); dmn_assert(io);
@@ -232,14 +484,22 @@ static void mon_read_cb(struct ev_loop* loop, struct ev_io* io, const int revent
     http_events_t* md = (http_events_t*)io->data;
 
     dmn_assert(md);
-    dmn_assert(md->hstate == HTTP_STATE_READING);
+    dmn_assert(md->hstate == HTTP_STATE_READING || md->hstate == HTTP_STATE_IDLE);
     dmn_assert(ev_is_active(md->read_watcher));
     dmn_assert(!ev_is_active(md->write_watcher));
     dmn_assert(md->sock > -1);
 
-    bool final_status = false;
-    const int to_recv = 13 - md->done;
-    const int recvd = recv(md->sock, md->res_buf + md->done, to_recv, 0);
+    // Between polls, readability means the server closed the connection
+    //   (or sent something unsolicited), either way we're done with it.
+    if(md->hstate == HTTP_STATE_IDLE) {
+        log_debug("plugin_http_status: Kept-alive connection to %s closed by server", md->smgr->desc);
+        mon_close(loop, md);
+        md->hstate = HTTP_STATE_WAITING;
+        return;
+    }
+
+    char buf[1024];
+    const int recvd = recv(md->sock, buf, sizeof(buf), 0);
     if(unlikely(recvd == -1)) {
         switch(errno) {
             case EAGAIN:
@@ -254,41 +514,21 @@ static void mon_read_cb(struct ev_loop* loop, struct ev_io* io, const int revent
                 log_err("plugin_http_status: read() from monitoring socket failed, possible local problem: %s", logf_errno());
         }
     }
-    else if(recvd < to_recv) {
-        md->done += recvd;
+    else if(recvd) {
+        md->got_data = true;
+        if(resp_parse(md, buf, (unsigned)recvd))
+            mon_finish(loop, md, status_ok(md->http_svc, md->status), !md->conn_close);
         return;
     }
-    else {
-        md->res_buf[13] = '\0';
-        char code_str[4] = { 0 };
-        if(1 == sscanf(md->res_buf, "HTTP/1.%*1[01]%*1[ ]%3c%*1[ ]", code_str)) {
-            unsigned long lcode = strtoul(code_str, NULL, 10);
-            for(unsigned i = 0; i < md->http_svc->num_ok_codes; i++) {
-                if(lcode == md->http_svc->ok_codes[i]) {
-                    final_status = true;
-                    break;
-                }
-            }
-        }
-    }
-
-    // I don't believe we actually need to read the rest of the response before
-    //   shutdown/close in order to avoid bad TCP behavior, but I could be wrong.
 
-    log_debug("plugin_http_status: State poll of %s %s", md->smgr->desc, final_status ? "succeeded" : "failed");
-    shutdown(md->sock, SHUT_RDWR);
-    close(md->sock);
-    md->sock = -1;
-    ev_io_stop(loop, md->read_watcher);
-    ev_timer_stop(loop, md->timeout_watcher);
-    md->hstate = HTTP_STATE_WAITING;
-    gdnsd_mon_state_updater(md->smgr, final_status);
+    // Error or EOF before the end of the response
+    if(!mon_retry(loop, md))
+        mon_finish(loop, md, false, false);
 }
 
 F_NONNULL
-static void mon_timeout_cb(struct ev_loop* loop, struct ev_timer* t, const int revents V_UNUSED) {
+static void mon_timeout_cb(struct ev_loop* loop, gdnsd_mon_timer_t* t) {
     dmn_assert(loop); dmn_assert(t);
-    dmn_assert(revents == EV_TIMER);
 
     http_events_t* md = (http_events_t*)t->data;
 
@@ -299,12 +539,9 @@ static void mon_timeout_cb(struct ev_loop* loop, struct ev_timer* t, const int r
      || (md->hstate == HTTP_STATE_WRITING && ev_is_active(md->write_watcher))
     );
 
+    // The connection is in an unknown state, so it can't be re-used
     log_debug("plugin_http_status: State poll of %s timed out", md->smgr->desc);
-    if(md->hstate == HTTP_STATE_READING) ev_io_stop(loop, md->read_watcher);
-    else if(md->hstate == HTTP_STATE_WRITING) ev_io_stop(loop, md->write_watcher);
-    shutdown(md->sock, SHUT_RDWR);
-    close(md->sock);
-    md->sock = -1;
+    mon_close(loop, md);
     md->hstate = HTTP_STATE_WAITING;
     gdnsd_mon_state_updater(md->smgr, false);
 }
@@ -333,20 +570,35 @@ static void mon_timeout_cb(struct ev_loop* loop, struct ev_timer* t, const int r
         } \
     } while(0)
 
+#define SVC_OPT_BOOL(_hash, _typnam, _loc) \
+    do { \
+        const vscf_data_t* _data = vscf_hash_get_data_byconstkey(_hash, #_loc, true); \
+        if(_data) { \
+            if(!vscf_is_simple(_data) \
+            || !vscf_simple_get_as_bool(_data, &_loc)) \
+                log_fatal("plugin_http_status: Service type '%s': option '%s': Value must be 'true' or 'false'", _typnam, #_loc); \
+        } \
+    } while(0)
+
+// HTTP/1.1 (which requires a Host: header) is only used for keepalive
 F_NONNULLX(1, 2)
-static void make_req_data(http_svc_t* s, const char* url_path, const char* vhost) {
-    dmn_assert(s); dmn_assert(url_path);
+static unsigned make_req_data(char** req_data, const char* url_path, const char* host, const bool keepalive) {
+    dmn_assert(req_data); dmn_assert(url_path);
+    dmn_assert(host || !keepalive);
+    const char* vers = keepalive ? "1.1" : "1.0";
     const unsigned url_len = strlen(url_path);
-    if(vhost) {
-        s->req_data_len = 25 + url_len + strlen(vhost);
-        s->req_data = malloc(s->req_data_len + 1);
-        snprintf(s->req_data, s->req_data_len + 1, "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", url_path, vhost);
+    unsigned req_data_len;
+    if(host) {
+        req_data_len = 25 + url_len + strlen(host);
+        *req_data = malloc(req_data_len + 1);
+        snprintf(*req_data, req_data_len + 1, "GET %s HTTP/%s\r\nHost: %s\r\n\r\n", url_path, vers, host);
     }
     else {
-        s->req_data_len = 17 + url_len;
-        s->req_data = malloc(s->req_data_len + 1);
-        snprintf(s->req_data, s->req_data_len + 1, "GET %s HTTP/1.0\r\n\r\n", url_path);
+        req_data_len = 17 + url_len;
+        *req_data = malloc(req_data_len + 1);
+        snprintf(*req_data, req_data_len + 1, "GET %s HTTP/%s\r\n\r\n", url_path, vers);
     }
+    return req_data_len;
 }
 
 void plugin_http_status_add_svctype(const char* name, const vscf_data_t* svc_cfg, const unsigned interval, const unsigned timeout) {
@@ -356,6 +608,7 @@ void plugin_http_status_add_svctype(const char* name, const vscf_data_t* svc_cfg
     const char* url_path = "/";
     const char* vhost = NULL;
     unsigned port = 80;
+    bool keepalive = false;
 
     service_types = realloc(service_types, (num_http_svcs + 1) * sizeof(http_svc_t));
     http_svc_t* this_svc = &service_types[num_http_svcs++];
@@ -369,6 +622,7 @@ void plugin_http_status_add_svctype(const char* name, const vscf_data_t* svc_cfg
         SVC_OPT_STR(svc_cfg, name, url_path);
         SVC_OPT_STR(svc_cfg, name, vhost);
         SVC_OPT_UINT(svc_cfg, name, port, 1LU, 65534LU);
+        SVC_OPT_BOOL(svc_cfg, name, keepalive);
         const vscf_data_t* ok_codes_cfg = vscf_hash_get_data_byconstkey(svc_cfg, "ok_codes", true);
         if(ok_codes_cfg) {
             ok_codes_set = true;
@@ -391,7 +645,14 @@ void plugin_http_status_add_svctype(const char* name, const vscf_data_t* svc_cfg
         this_svc->ok_codes[0] = 200LU;
     }
 
-    make_req_data(this_svc, url_path, vhost);
+    // Without a vhost, keepalive's HTTP/1.1 requests get a per-monitor
+    //   Host: header of the monitored address, see add_monitor.
+    if(vhost || !keepalive)
+        this_svc->req_data_len = make_req_data(&this_svc->req_data, url_path, vhost, keepalive);
+    else
+        this_svc->req_data = NULL;
+    this_svc->url_path = strdup(url_path);
+    this_svc->keepalive = keepalive;
     this_svc->port = port;
     this_svc->timeout = timeout;
     this_svc->interval = interval;
@@ -420,6 +681,24 @@ void plugin_http_status_add_monitor(const char* svc_name, mon_smgr_t* smgr) {
         this_mon->addr.sin6.sin6_port = htons(this_mon->http_svc->port);
     }
 
+    if(this_mon->http_svc->req_data) {
+        this_mon->req_data = this_mon->http_svc->req_data;
+        this_mon->req_data_len = this_mon->http_svc->req_data_len;
+    }
+    else {
+        char addr_str[INET6_ADDRSTRLEN + IF_NAMESIZE];
+        char host[INET6_ADDRSTRLEN + IF_NAMESIZE + 8];
+        const int name_err = getnameinfo(&smgr->addr.sa, smgr->addr.len, addr_str, sizeof(addr_str), NULL, 0, NI_NUMERICHOST);
+        if(name_err)
+            log_fatal("plugin_http_status: getnameinfo() failed on monitored address: %s", gai_strerror(name_err));
+        const bool isv6 = this_mon->addr.sa.sa_family == AF_INET6;
+        if(this_mon->http_svc->port == 80)
+            snprintf(host, sizeof(host), isv6 ? "[%s]" : "%s", addr_str);
+        else
+            snprintf(host, sizeof(host), isv6 ? "[%s]:%u" : "%s:%u", addr_str, this_mon->http_svc->port);
+        this_mon->req_data_len = make_req_data(&this_mon->req_data, this_mon->http_svc->url_path, host, true);
+    }
+
     this_mon->smgr = smgr;
     this_mon->hstate = HTTP_STATE_WAITING;
     this_mon->sock = -1;
@@ -432,13 +711,8 @@ void plugin_http_status_add_monitor(const char* svc_name, mon_smgr_t* smgr) {
     ev_io_init(this_mon->write_watcher, &mon_write_cb, -1, 0);
     this_mon->write_watcher->data = this_mon;
 
-    this_mon->timeout_watcher = malloc(sizeof(ev_timer));
-    ev_timer_init(this_mon->timeout_watcher, &mon_timeout_cb, 0, 0);
-    this_mon->timeout_watcher->data = this_mon;
-
-    this_mon->interval_watcher = malloc(sizeof(ev_timer));
-    ev_timer_init(this_mon->interval_watcher, &mon_interval_cb, 0, 0);
-    this_mon->interval_watcher->data = this_mon;
+    gdnsd_mon_timer_init(&this_mon->timeout_timer, &mon_timeout_cb, this_mon);
+    gdnsd_mon_timer_init(&this_mon->interval_timer, &mon_interval_cb, this_mon);
 
     mons = realloc(mons, sizeof(http_events_t*) * (num_mons + 1));
     mons[num_mons++] = this_mon;
@@ -447,24 +721,24 @@ void plugin_http_status_add_monitor(const char* svc_name, mon_smgr_t* smgr) {
 void plugin_http_status_init_monitors(struct ev_loop* mon_loop) {
     dmn_assert(mon_loop);
 
+    // spread the initial round out a bit, if there are a lot of them
     for(unsigned int i = 0; i < num_mons; i++) {
-        ev_timer* ival_watcher = mons[i]->interval_watcher;
-        dmn_assert(mons[i]->sock == -1);
-        ev_timer_set(ival_watcher, 0, 0);
-        ev_timer_start(mon_loop, ival_watcher);
+        http_events_t* mon = mons[i];
+        dmn_assert(mon->sock == -1);
+        const double spread = gdnsd_mon_init_spread(num_mons, mon->http_svc->interval);
+        gdnsd_mon_timer_start(mon_loop, &mon->interval_timer, spread * gdnsd_mon_jitter(mon->smgr->desc), 0);
     }
 }
 
 void plugin_http_status_start_monitors(struct ev_loop* mon_loop) {
     dmn_assert(mon_loop);
 
+    keep_conns = true;
     for(unsigned int i = 0; i < num_mons; i++) {
         http_events_t* mon = mons[i];
         dmn_assert(mon->sock == -1);
         const unsigned ival = mon->http_svc->interval;
-        const double stagger = (((double)i) / ((double)num_mons)) * ((double)ival);
-        ev_timer* ival_watcher = mon->interval_watcher;
-        ev_timer_set(ival_watcher, stagger, ival);
-        ev_timer_start(mon_loop, ival_watcher);
+        const double stagger = gdnsd_mon_jitter(mon->smgr->desc) * ival;
+        gdnsd_mon_timer_start(mon_loop, &mon->interval_timer, stagger, ival);
     }
 }
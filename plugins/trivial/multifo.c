@@ -53,6 +53,20 @@ typedef struct {
 static res_t* resources = NULL;
 static unsigned num_resources = 0;
 
+// Per-thread, per-resource copy of the last computed result, which stays
+//  valid until the monitoring generation (gdnsd_mon_gen) changes.
+typedef struct {
+    stats_uint_t gen;
+    bool rv;
+    bool cut_ttl;
+    unsigned count_v4;
+    unsigned count_v6;
+    uint32_t* addrs_v4;
+    uint8_t* addrs_v6;
+} res_cache_t;
+
+static res_cache_t** thread_caches = NULL;
+
 static mon_list_t mon_list = { 0, NULL };
 
 /*********************************/
@@ -369,24 +383,72 @@ static bool resolve(const addrset_t* aset, dynaddr_result_t* result, bool* cut_t
     return rv;
 }
 
-bool plugin_multifo_resolve_dynaddr(unsigned threadnum V_UNUSED, unsigned resnum, const client_info_t* cinfo V_UNUSED, dynaddr_result_t* result) {
+void plugin_multifo_full_config(unsigned num_threads) {
+    thread_caches = calloc(num_threads, sizeof(res_cache_t*));
+}
+
+void plugin_multifo_iothread_init(unsigned threadnum) {
+    res_cache_t* caches = thread_caches[threadnum] = calloc(num_resources, sizeof(res_cache_t));
+    for(unsigned i = 0; i < num_resources; i++) {
+        const res_t* res = &resources[i];
+        if(res->aset_v4)
+            caches[i].addrs_v4 = malloc(res->aset_v4->count * sizeof(uint32_t));
+        if(res->aset_v6)
+            caches[i].addrs_v6 = malloc(res->aset_v6->count * 16);
+    }
+}
+
+F_NONNULL
+static void rebuild_cache(const res_t* res, res_cache_t* cache) {
+    dmn_assert(res); dmn_assert(cache);
+
+    dynaddr_result_t tmp;
+    tmp.count_v4 = 0;
+    tmp.count_v6 = 0;
+
     bool rv = true;
     bool cut_ttl = false;
-    res_t* res = &resources[resnum];
 
     if(res->aset_v4) {
-        rv &= resolve(res->aset_v4, result, &cut_ttl, &result->count_v4);
-        dmn_assert(result->count_v4);
+        rv &= resolve(res->aset_v4, &tmp, &cut_ttl, &tmp.count_v4);
+        dmn_assert(tmp.count_v4);
+        dmn_assert(tmp.count_v4 <= res->aset_v4->count);
+        memcpy(cache->addrs_v4, tmp.addrs_v4, tmp.count_v4 * sizeof(uint32_t));
     }
 
     if(res->aset_v6) {
-        rv &= resolve(res->aset_v6, result, &cut_ttl, &result->count_v6);
-        dmn_assert(result->count_v6);
+        rv &= resolve(res->aset_v6, &tmp, &cut_ttl, &tmp.count_v6);
+        dmn_assert(tmp.count_v6);
+        dmn_assert(tmp.count_v6 <= res->aset_v6->count);
+        memcpy(cache->addrs_v6, tmp.addrs_v6, tmp.count_v6 * 16);
+    }
+
+    cache->rv = rv;
+    cache->cut_ttl = cut_ttl;
+    cache->count_v4 = tmp.count_v4;
+    cache->count_v6 = tmp.count_v6;
+}
+
+bool plugin_multifo_resolve_dynaddr(unsigned threadnum, unsigned resnum, const client_info_t* cinfo V_UNUSED, dynaddr_result_t* result) {
+    res_cache_t* cache = &thread_caches[threadnum][resnum];
+    if(gdnsd_mon_gen_stale(&cache->gen))
+        rebuild_cache(&resources[resnum], cache);
+
+    if(cache->count_v4) {
+        dmn_assert(result->count_v4 + cache->count_v4 <= 64);
+        memcpy(&result->addrs_v4[result->count_v4], cache->addrs_v4, cache->count_v4 * sizeof(uint32_t));
+        result->count_v4 += cache->count_v4;
+    }
+
+    if(cache->count_v6) {
+        dmn_assert(result->count_v6 + cache->count_v6 <= 64);
+        memcpy(&result->addrs_v6[result->count_v6 * 16], cache->addrs_v6, cache->count_v6 * 16);
+        result->count_v6 += cache->count_v6;
     }
 
     // Cut TTL in half if any were in DOWN or DANGER states
-    if(cut_ttl)
+    if(cache->cut_ttl)
         result->ttl >>= 1;
 
-    return rv;
+    return cache->rv;
 }
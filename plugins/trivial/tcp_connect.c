@@ -50,8 +50,8 @@ typedef enum {
 typedef struct {
     tcp_svc_t* tcp_svc;
     ev_io* connect_watcher;
-    ev_timer* timeout_watcher;
-    ev_timer* interval_watcher;
+    gdnsd_mon_timer_t timeout_timer;
+    gdnsd_mon_timer_t interval_timer;
     mon_smgr_t* smgr;
     anysin_t addr;
     tcp_state_t tcp_state;
@@ -64,9 +64,8 @@ static tcp_svc_t* service_types = NULL;
 static tcp_events_t** mons = NULL;
 
 F_NONNULL
-static void mon_interval_cb(struct ev_loop* loop, struct ev_timer* t, const int revents V_UNUSED) {
+static void mon_interval_cb(struct ev_loop* loop, gdnsd_mon_timer_t* t) {
     dmn_assert(loop); dmn_assert(t);
-    dmn_assert(revents == EV_TIMER);
 
     tcp_events_t* md = (tcp_events_t*)t->data;
 
@@ -82,7 +81,7 @@ static void mon_interval_cb(struct ev_loop* loop, struct ev_timer* t, const int
 
     dmn_assert(md->sock == -1);
     dmn_assert(!ev_is_active(md->connect_watcher));
-    dmn_assert(!ev_is_active(md->timeout_watcher) && !ev_is_pending(md->timeout_watcher));
+    dmn_assert(!gdnsd_mon_timer_active(&md->timeout_timer));
 
     log_debug("plugin_tcp_connect: Starting state poll of %s", md->smgr->desc);
 
@@ -110,8 +109,7 @@ static void mon_interval_cb(struct ev_loop* loop, struct ev_timer* t, const int
                 md->tcp_state = TCP_STATE_CONNECTING;
                 ev_io_set(md->connect_watcher, sock, EV_WRITE);
                 ev_io_start(loop, md->connect_watcher);
-                ev_timer_set(md->timeout_watcher, md->tcp_svc->timeout, 0);
-                ev_timer_start(loop, md->timeout_watcher);
+                gdnsd_mon_timer_start(loop, &md->timeout_timer, md->tcp_svc->timeout, 0);
                 return; // don't do socket/status finishing actions below...
                 break; // redundant
             case EPIPE:
@@ -145,7 +143,7 @@ static void mon_connect_cb(struct ev_loop* loop, struct ev_io* io, const int rev
     dmn_assert(md);
     dmn_assert(md->tcp_state == TCP_STATE_CONNECTING);
     dmn_assert(ev_is_active(md->connect_watcher));
-    dmn_assert(ev_is_active(md->timeout_watcher) || ev_is_pending(md->timeout_watcher));
+    dmn_assert(gdnsd_mon_timer_active(&md->timeout_timer));
     dmn_assert(md->sock > -1);
 
     // nonblocking connect() just finished, need to check status
@@ -176,15 +174,14 @@ static void mon_connect_cb(struct ev_loop* loop, struct ev_io* io, const int rev
     close(sock);
     md->sock = -1;
     ev_io_stop(loop, md->connect_watcher);
-    ev_timer_stop(loop, md->timeout_watcher);
+    gdnsd_mon_timer_stop(&md->timeout_timer);
     md->tcp_state = TCP_STATE_WAITING;
     gdnsd_mon_state_updater(md->smgr, success);
 }
 
 F_NONNULL
-static void mon_timeout_cb(struct ev_loop* loop, struct ev_timer* t, const int revents V_UNUSED) {
+static void mon_timeout_cb(struct ev_loop* loop, gdnsd_mon_timer_t* t) {
     dmn_assert(loop); dmn_assert(t);
-    dmn_assert(revents == EV_TIMER);
 
     tcp_events_t* md = (tcp_events_t*)t->data;
 
@@ -267,13 +264,8 @@ void plugin_tcp_connect_add_monitor(const char* svc_name, mon_smgr_t* smgr) {
     ev_io_init(this_mon->connect_watcher, &mon_connect_cb, -1, 0);
     this_mon->connect_watcher->data = this_mon;
 
-    this_mon->timeout_watcher = malloc(sizeof(ev_timer));
-    ev_timer_init(this_mon->timeout_watcher, &mon_timeout_cb, 0, 0);
-    this_mon->timeout_watcher->data = this_mon;
-
-    this_mon->interval_watcher = malloc(sizeof(ev_timer));
-    ev_timer_init(this_mon->interval_watcher, &mon_interval_cb, 0, 0);
-    this_mon->interval_watcher->data = this_mon;
+    gdnsd_mon_timer_init(&this_mon->timeout_timer, &mon_timeout_cb, this_mon);
+    gdnsd_mon_timer_init(&this_mon->interval_timer, &mon_interval_cb, this_mon);
 
     mons = realloc(mons, sizeof(tcp_events_t*) * (num_mons + 1));
     mons[num_mons++] = this_mon;
@@ -282,11 +274,12 @@ void plugin_tcp_connect_add_monitor(const char* svc_name, mon_smgr_t* smgr) {
 void plugin_tcp_connect_init_monitors(struct ev_loop* mon_loop) {
     dmn_assert(mon_loop);
 
+    // spread the initial round out a bit, if there are a lot of them
     for(unsigned int i = 0; i < num_mons; i++) {
-        ev_timer* ival_watcher = mons[i]->interval_watcher;
-        dmn_assert(mons[i]->sock == -1);
-        ev_timer_set(ival_watcher, 0, 0);
-        ev_timer_start(mon_loop, ival_watcher);
+        tcp_events_t* mon = mons[i];
+        dmn_assert(mon->sock == -1);
+        const double spread = gdnsd_mon_init_spread(num_mons, mon->tcp_svc->interval);
+        gdnsd_mon_timer_start(mon_loop, &mon->interval_timer, spread * gdnsd_mon_jitter(mon->smgr->desc), 0);
     }
 }
 
@@ -297,9 +290,7 @@ void plugin_tcp_connect_start_monitors(struct ev_loop* mon_loop) {
         tcp_events_t* mon = mons[i];
         dmn_assert(mon->sock == -1);
         const unsigned ival = mon->tcp_svc->interval;
-        const double stagger = (((double)i) / ((double)num_mons)) * ((double)ival);
-        ev_timer* ival_watcher = mon->interval_watcher;
-        ev_timer_set(ival_watcher, stagger, ival);
-        ev_timer_start(mon_loop, ival_watcher);
+        const double stagger = gdnsd_mon_jitter(mon->smgr->desc) * ival;
+        gdnsd_mon_timer_start(mon_loop, &mon->interval_timer, stagger, ival);
     }
 }
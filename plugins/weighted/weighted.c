@@ -86,6 +86,8 @@ typedef struct {
 
 typedef struct {
     res_citem_t* items;
+    unsigned* probs; // alias table over items[].weight, static
+    unsigned* aliases;
     unsigned count;
     unsigned weight;
 } cnset_t;
@@ -128,6 +130,90 @@ static uint64_t get_rand(const unsigned tnum, const uint64_t modval) {
     return gdnsd_rand_get64(per_thread_rstates[tnum]) % modval;
 }
 
+// Per-thread cache of the monitoring-dependent part of resolve() for
+//   each address set: the dynamic weights after DOWN addresses have
+//   been zeroed out, plus the derived sums and maxima.  These only
+//   change when some monitored state does, so they're rebuilt only
+//   when gdnsd_mon_gen changes, leaving just the random choices for
+//   each query.
+typedef struct {
+    stats_uint_t gen;
+    unsigned items_sum; // sum of item_sums[]
+    unsigned items_max; // max of item_sums[]
+    unsigned* item_sums; // sum of addr_weights[N][]
+    unsigned* item_maxs; // max of addr_weights[N][]
+    // addr cfg weight or 0, depends on status, stride cfg_max_addrs_per_group:
+    unsigned* addr_weights;
+    // Alias tables (see alias_build()) for the O(1) weighted choices:
+    //   !multi: one over the items, by item_sums[]
+    //   multi: one per item over its addrs, by addr_weights[N][] (same stride)
+    unsigned* probs;
+    unsigned* aliases;
+    bool rv;
+    bool cut_ttl;
+} aset_dyn_t;
+
+typedef struct {
+    aset_dyn_t v4;
+    aset_dyn_t v6;
+} res_dyn_t;
+
+static res_dyn_t** per_thread_dyns;
+
+// Builds a Walker alias table over the "n" weights in "weights", whose
+//   sum is the non-zero "total".  alias_pick() then makes a weighted
+//   choice among them in constant time.  This is Vose's construction in
+//   integer space (weights scaled by n, so the average bucket is exactly
+//   "total"), which makes the resulting distribution exact.
+static void alias_build(const unsigned* weights, const unsigned n, const unsigned total, unsigned* probs, unsigned* aliases) {
+    dmn_assert(weights); dmn_assert(n); dmn_assert(total);
+    dmn_assert(probs); dmn_assert(aliases);
+
+    uint64_t scaled[n];
+    unsigned small[n];
+    unsigned large[n];
+    unsigned num_small = 0;
+    unsigned num_large = 0;
+
+    for(unsigned i = 0; i < n; i++) {
+        scaled[i] = (uint64_t)weights[i] * n;
+        if(scaled[i] < total)
+            small[num_small++] = i;
+        else
+            large[num_large++] = i;
+    }
+
+    while(num_small && num_large) {
+        const unsigned sm = small[--num_small];
+        const unsigned lg = large[--num_large];
+        probs[sm] = (unsigned)scaled[sm];
+        aliases[sm] = lg;
+        scaled[lg] -= (total - scaled[sm]);
+        if(scaled[lg] < total)
+            small[num_small++] = lg;
+        else
+            large[num_large++] = lg;
+    }
+
+    // With exact integer math, the leftovers are all exactly full
+    dmn_assert(!num_small);
+    while(num_large) {
+        const unsigned lg = large[--num_large];
+        dmn_assert(scaled[lg] == total);
+        probs[lg] = total;
+        aliases[lg] = lg;
+    }
+}
+
+// A single random draw in [0, n*total) picks both the bucket and
+//   the position within it.
+static unsigned alias_pick(const unsigned tnum, const unsigned n, const unsigned total, const unsigned* probs, const unsigned* aliases) {
+    dmn_assert(n); dmn_assert(total); dmn_assert(probs); dmn_assert(aliases);
+    const uint64_t r = get_rand(tnum, (uint64_t)n * total);
+    const unsigned idx = (unsigned)(r / total);
+    return ((unsigned)(r % total) < probs[idx]) ? idx : aliases[idx];
+}
+
 // Main config code starts here
 
 F_NONNULL
@@ -498,6 +584,13 @@ static void config_cnameset(const char* res_name, const char* stanza, cnset_t* c
     }
 
     dmn_assert(cnset->weight);
+
+    unsigned cweights[cnset->count];
+    for(unsigned i = 0; i < cnset->count; i++)
+        cweights[i] = cnset->items[i].weight;
+    cnset->probs = malloc(cnset->count * sizeof(unsigned));
+    cnset->aliases = malloc(cnset->count * sizeof(unsigned));
+    alias_build(cweights, cnset->count, cnset->weight, cnset->probs, cnset->aliases);
 }
 
 F_NONNULL
@@ -662,6 +755,7 @@ mon_list_t* plugin_weighted_load_config(const vscf_data_t* config) {
 void plugin_weighted_full_config(const unsigned num_threads) {
     dmn_assert(num_threads);
     init_rand_storage(num_threads);
+    per_thread_dyns = malloc(num_threads * sizeof(res_dyn_t*));
 }
 
 int plugin_weighted_map_resource_dyna(const char* resname) {
@@ -718,7 +812,28 @@ int plugin_weighted_map_resource_dync(const char* resname, const uint8_t* origin
     return -1;
 }
 
-void plugin_weighted_iothread_init(const unsigned threadnum) { init_rand(threadnum); }
+F_NONNULL
+static void aset_dyn_init(aset_dyn_t* dyn, const addrset_t* aset) {
+    dmn_assert(dyn); dmn_assert(aset);
+    dyn->item_sums = malloc(aset->count * sizeof(unsigned));
+    dyn->item_maxs = malloc(aset->count * sizeof(unsigned));
+    dyn->addr_weights = malloc(aset->count * cfg_max_addrs_per_group * sizeof(unsigned));
+    const unsigned alias_size = aset->multi ? aset->count * cfg_max_addrs_per_group : aset->count;
+    dyn->probs = malloc(alias_size * sizeof(unsigned));
+    dyn->aliases = malloc(alias_size * sizeof(unsigned));
+}
+
+void plugin_weighted_iothread_init(const unsigned threadnum) {
+    init_rand(threadnum);
+
+    res_dyn_t* dyns = per_thread_dyns[threadnum] = calloc(num_resources, sizeof(res_dyn_t));
+    for(unsigned i = 0; i < num_resources; i++) {
+        if(resources[i].addrs_v4)
+            aset_dyn_init(&dyns[i].v4, resources[i].addrs_v4);
+        if(resources[i].addrs_v6)
+            aset_dyn_init(&dyns[i].v6, resources[i].addrs_v6);
+    }
+}
 
 void plugin_weighted_resolve_dyncname(unsigned threadnum, unsigned resnum, const uint8_t* origin, const client_info_t* cinfo V_UNUSED, dyncname_result_t* result) {
     dmn_assert(origin); dmn_assert(result);
@@ -729,16 +844,8 @@ void plugin_weighted_resolve_dyncname(unsigned threadnum, unsigned resnum, const
     dmn_assert(cnset);
     dmn_assert(cnset->weight);
 
-    const unsigned item_rand = get_rand(threadnum, cnset->weight);
-    unsigned running_total = 0;
-    unsigned chosen = 0;
-    for(unsigned j = 0; j < cnset->count; j++) {
-        running_total += cnset->items[j].weight;
-        if(item_rand < running_total) {
-            chosen = j;
-            break;
-        }
-    }
+    const unsigned chosen = alias_pick(threadnum, cnset->count, cnset->weight, cnset->probs, cnset->aliases);
+    dmn_assert(chosen < cnset->count);
 
     const uint8_t* dname = cnset->items[chosen].cname;
     dname_copy(result->dname, dname);
@@ -749,21 +856,23 @@ void plugin_weighted_resolve_dyncname(unsigned threadnum, unsigned resnum, const
 }
 
 F_NONNULL
-static bool resolve(const unsigned threadnum, const addrset_t* aset, dynaddr_result_t* result, bool* cut_ttl_ptr) {
-    dmn_assert(aset); dmn_assert(result); dmn_assert(cut_ttl_ptr);
+static void aset_dyn_rebuild(const addrset_t* aset, aset_dyn_t* dyn) {
+    dmn_assert(aset); dmn_assert(dyn);
 
     const unsigned num_items = aset->count;
-    unsigned dyn_items_sum = 0; // sum of dyn_item_sums[]
-    unsigned dyn_items_max = 0; // max of dyn_item_sums[]
-    unsigned dyn_item_sums[cfg_max_items_per_res]; // sum of dyn_addr_weights[N][]
-    unsigned dyn_item_maxs[cfg_max_items_per_res]; // max of dyn_addr_weights[N][]
-    // addr cfg weight or 0, depends on status:
-    unsigned dyn_addr_weights[cfg_max_items_per_res][cfg_max_addrs_per_group];
+    const unsigned stride = cfg_max_addrs_per_group;
+    unsigned dyn_items_sum = 0;
+    unsigned dyn_items_max = 0;
+    unsigned* dyn_item_sums = dyn->item_sums;
+    unsigned* dyn_item_maxs = dyn->item_maxs;
+    unsigned* dyn_addr_weights = dyn->addr_weights;
     bool rv = true;
+    bool cut_ttl = false;
 
     // Get dynamic info about each item
-    for(unsigned item_idx = 0; item_idx < aset->count; item_idx++) {
+    for(unsigned item_idx = 0; item_idx < num_items; item_idx++) {
         const res_aitem_t* res_item = &aset->items[item_idx];
+        unsigned* item_weights = &dyn_addr_weights[item_idx * stride];
         dyn_item_sums[item_idx] = 0;
         dyn_item_maxs[item_idx] = 0;
         for(unsigned addr_idx = 0; addr_idx < res_item->count; addr_idx++) {
@@ -771,21 +880,21 @@ static bool resolve(const unsigned threadnum, const addrset_t* aset, dynaddr_res
             const mon_state_uint_t addr_state
                 = gdnsd_mon_get_min_state(addr->states, aset->num_svcs);
             if(addr_state != MON_STATE_UP)
-                *cut_ttl_ptr = true;
+                cut_ttl = true;
             if(addr_state != MON_STATE_DOWN) {
-                dyn_addr_weights[item_idx][addr_idx] = addr->weight;
+                item_weights[addr_idx] = addr->weight;
                 dyn_item_sums[item_idx] += addr->weight;
                 if(addr->weight > dyn_item_maxs[item_idx])
                     dyn_item_maxs[item_idx] = addr->weight;
             }
             else {
-                dyn_addr_weights[item_idx][addr_idx] = 0;
+                item_weights[addr_idx] = 0;
             }
         }
     }
 
     // summarize dynamic info at the resource level
-    for(unsigned item_idx = 0; item_idx < aset->count; item_idx++) {
+    for(unsigned item_idx = 0; item_idx < num_items; item_idx++) {
         const unsigned isum = dyn_item_sums[item_idx];
         dyn_items_sum += isum;
         if(dyn_items_max < isum)
@@ -799,10 +908,11 @@ static bool resolve(const unsigned threadnum, const addrset_t* aset, dynaddr_res
         dyn_items_max = aset->max_weight;
         for(unsigned item_idx = 0; item_idx < num_items; item_idx++) {
             const res_aitem_t* res_item = &aset->items[item_idx];
+            unsigned* item_weights = &dyn_addr_weights[item_idx * stride];
             dyn_item_sums[item_idx] = res_item->weight;
             dyn_item_maxs[item_idx] = res_item->max_weight;
             for(unsigned addr_idx = 0; addr_idx < res_item->count; addr_idx++)
-                dyn_addr_weights[item_idx][addr_idx] = res_item->as[addr_idx].weight;
+                item_weights[addr_idx] = res_item->as[addr_idx].weight;
         }
     }
 
@@ -810,48 +920,72 @@ static bool resolve(const unsigned threadnum, const addrset_t* aset, dynaddr_res
     dmn_assert(dyn_items_max);
 
     if(aset->multi) {
-        // Outer decision: choose multiple items based on dyn_items_max
+        for(unsigned item_idx = 0; item_idx < num_items; item_idx++)
+            if(dyn_item_sums[item_idx])
+                alias_build(&dyn_addr_weights[item_idx * stride],
+                    aset->items[item_idx].count, dyn_item_sums[item_idx],
+                    &dyn->probs[item_idx * stride], &dyn->aliases[item_idx * stride]);
+    }
+    else {
+        alias_build(dyn_item_sums, num_items, dyn_items_sum, dyn->probs, dyn->aliases);
+    }
+
+    dyn->items_sum = dyn_items_sum;
+    dyn->items_max = dyn_items_max;
+    dyn->rv = dyn_items_sum < aset->up_weight ? false : rv;
+    dyn->cut_ttl = cut_ttl;
+}
+
+F_NONNULL
+static bool resolve(const unsigned threadnum, const addrset_t* aset, aset_dyn_t* dyn, dynaddr_result_t* result, bool* cut_ttl_ptr) {
+    dmn_assert(aset); dmn_assert(dyn); dmn_assert(result); dmn_assert(cut_ttl_ptr);
+
+    if(gdnsd_mon_gen_stale(&dyn->gen))
+        aset_dyn_rebuild(aset, dyn);
+
+    const unsigned num_items = aset->count;
+    const unsigned stride = cfg_max_addrs_per_group;
+    const unsigned* dyn_item_sums = dyn->item_sums;
+    const unsigned* dyn_item_maxs = dyn->item_maxs;
+    const unsigned* dyn_addr_weights = dyn->addr_weights;
+
+    if(dyn->cut_ttl)
+        *cut_ttl_ptr = true;
+
+    if(aset->multi) {
+        // Outer decision: choose multiple items based on dyn->items_max
         for(unsigned item_idx = 0; item_idx < num_items; item_idx++) {
             const res_aitem_t* res_item = &aset->items[item_idx];
-            const unsigned item_rand = get_rand(threadnum, dyn_items_max);
+            const unsigned item_rand = get_rand(threadnum, dyn->items_max);
             const unsigned isum = dyn_item_sums[item_idx];
             if(item_rand < isum) {
                 dmn_assert(isum); // given that they're both uints
                 // Inner decision: choose one addr based on dyn_item->sum
-                const unsigned addr_rand = get_rand(threadnum, isum);
-                unsigned addr_running_total = 0;
-                for(unsigned addr_idx = 0; addr_idx < res_item->count; addr_idx++) {
-                    addr_running_total += dyn_addr_weights[item_idx][addr_idx];
-                    if(addr_rand < addr_running_total) {
-                        gdnsd_dynaddr_add_result_anysin(result, &res_item->as[addr_idx].addr);
-                        break;
-                    }
-                }
+                const unsigned addr_idx = alias_pick(threadnum, res_item->count, isum,
+                    &dyn->probs[item_idx * stride], &dyn->aliases[item_idx * stride]);
+                dmn_assert(addr_idx < res_item->count);
+                gdnsd_dynaddr_add_result_anysin(result, &res_item->as[addr_idx].addr);
             }
         }
     }
     else {
-        // Outer decision: choose one item based on dyn_items_sum
-        const unsigned item_rand = get_rand(threadnum, dyn_items_sum);
-        unsigned item_running_total = 0;
-        for(unsigned item_idx = 0; item_idx < num_items; item_idx++) {
-            item_running_total += dyn_item_sums[item_idx];
-            if(item_rand < item_running_total) {
-                const res_aitem_t* chosen = &aset->items[item_idx];
-                // Inner decision: choose multiple addrs based on chosen's dynamic max
-                const unsigned addr_max = dyn_item_maxs[item_idx];
-                dmn_assert(addr_max);
-                for(unsigned addr_idx = 0; addr_idx < chosen->count; addr_idx++) {
-                    const unsigned addr_rand = get_rand(threadnum, addr_max);
-                    if(addr_rand < dyn_addr_weights[item_idx][addr_idx])
-                        gdnsd_dynaddr_add_result_anysin(result, &chosen->as[addr_idx].addr);
-                }
-                break;
-            }
+        // Outer decision: choose one item based on dyn->items_sum
+        const unsigned item_idx = alias_pick(threadnum, num_items, dyn->items_sum, dyn->probs, dyn->aliases);
+        dmn_assert(item_idx < num_items);
+        dmn_assert(dyn_item_sums[item_idx]);
+        const res_aitem_t* chosen = &aset->items[item_idx];
+        const unsigned* item_weights = &dyn_addr_weights[item_idx * stride];
+        // Inner decision: choose multiple addrs based on chosen's dynamic max
+        const unsigned addr_max = dyn_item_maxs[item_idx];
+        dmn_assert(addr_max);
+        for(unsigned addr_idx = 0; addr_idx < chosen->count; addr_idx++) {
+            const unsigned addr_rand = get_rand(threadnum, addr_max);
+            if(addr_rand < item_weights[addr_idx])
+                gdnsd_dynaddr_add_result_anysin(result, &chosen->as[addr_idx].addr);
         }
     }
 
-    return dyn_items_sum < aset->up_weight ? false : rv;
+    return dyn->rv;
 }
 
 bool plugin_weighted_resolve_dynaddr(unsigned threadnum, unsigned resnum, const client_info_t* cinfo V_UNUSED, dynaddr_result_t* result) {
@@ -861,16 +995,17 @@ bool plugin_weighted_resolve_dynaddr(unsigned threadnum, unsigned resnum, const
     dmn_assert(resource);
     dmn_assert(resource->addrs_v4 || resource->addrs_v6);
 
+    res_dyn_t* dyn = &per_thread_dyns[threadnum][resnum];
     bool cut_ttl = false;
     bool rv = true;
 
     if(resource->addrs_v4) {
-        rv &= resolve(threadnum, resource->addrs_v4, result, &cut_ttl);
+        rv &= resolve(threadnum, resource->addrs_v4, &dyn->v4, result, &cut_ttl);
         dmn_assert(result->count_v4);
     }
 
     if(resource->addrs_v6) {
-        rv &= resolve(threadnum, resource->addrs_v6, result, &cut_ttl);
+        rv &= resolve(threadnum, resource->addrs_v6, &dyn->v6, result, &cut_ttl);
         dmn_assert(result->count_v6);
     }
 
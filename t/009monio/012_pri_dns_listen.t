@@ -0,0 +1,86 @@
+
+# dns_query monitoring against a live responder
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+use File::Temp qw/tmpnam/;
+use Test::More tests => 11;
+
+# We use dns_port_2 as a custom DNS listener
+#  for something to monitor
+my $dns_port = $_GDT::EXTRA_PORT;
+my $state_file = tmpnam();
+my $server_script = File::Spec->catfile($FindBin::Bin, 'dns_server.pl');
+my $dns_pid = fork();
+if(!defined $dns_pid) { diag "Fork failed: $!"; BAIL_OUT($!); }
+if(!$dns_pid) { # child, execute test DNS server
+    exec($^X, $server_script, $dns_port, $state_file);
+}
+
+# Avoid racing the test DNS server
+while(!-f $state_file) {
+    select(undef, undef, undef, 0.1); # 100ms
+}
+
+unlink($state_file);
+
+my $pid = _GDT->test_spawn_daemon('etc012');
+
+_GDT->test_dns(
+    qname => 'ns1.example.com', qtype => 'A',
+    answer => 'ns1.example.com 86400 A 192.0.2.254',
+);
+
+# Primary up: the expected answer was found
+_GDT->test_dns(
+    qname => 'dyn.example.com', qtype => 'A',
+    answer => 'dyn.example.com 120 A 127.0.0.1',
+);
+
+_GDT->test_dns(
+    qname => 'ok.example.com', qtype => 'A',
+    answer => 'ok.example.com 60 A 127.0.0.1',
+);
+
+_GDT->test_dns(
+    qname => 'tcp.example.com', qtype => 'A',
+    answer => 'tcp.example.com 60 A 127.0.0.1',
+);
+
+# A non-default rcode, when configured, is success
+_GDT->test_dns(
+    qname => 'rcode.example.com', qtype => 'A',
+    answer => 'rcode.example.com 60 A 127.0.0.1',
+);
+
+# The rest fail even on the primary, so all addresses are returned
+_GDT->test_dns(
+    qname => 'badexpect.example.com', qtype => 'A',
+    answer => [
+        'badexpect.example.com 60 A 127.0.0.1',
+        'badexpect.example.com 60 A 192.0.2.1',
+    ]
+);
+
+_GDT->test_dns(
+    qname => 'badrcode.example.com', qtype => 'A',
+    answer => [
+        'badrcode.example.com 60 A 127.0.0.1',
+        'badrcode.example.com 60 A 192.0.2.1',
+    ]
+);
+
+# NOERROR, but without the default minimum of one answer
+_GDT->test_dns(
+    qname => 'noanswer.example.com', qtype => 'A',
+    answer => [
+        'noanswer.example.com 60 A 127.0.0.1',
+        'noanswer.example.com 60 A 192.0.2.1',
+    ]
+);
+
+_GDT->test_kill_daemon($pid);
+_GDT->test_kill_daemon($dns_pid);
+
+END { kill(9, $dns_pid) if($dns_pid && kill(0, $dns_pid)) }
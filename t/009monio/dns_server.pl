@@ -0,0 +1,107 @@
+# A minimal authoritative DNS responder for the dns_query monitor tests,
+#  over both UDP and TCP on the same port:
+#    example.com A         -> NOERROR, 192.0.2.77
+#    refused.example.com * -> REFUSED
+#    anything else         -> NXDOMAIN
+
+use strict;
+use warnings;
+use IO::Socket::INET;
+use IO::Select;
+use Socket qw/inet_aton/;
+
+my ($portnum, $statef) = @ARGV;
+
+$SIG{PIPE} = 'IGNORE';
+
+my $udp = IO::Socket::INET->new(
+    LocalAddr => '0.0.0.0',
+    LocalPort => $portnum,
+    Proto => 'udp',
+    ReuseAddr => 1,
+) or die "Cannot bind UDP 0.0.0.0:${portnum}: $!";
+
+my $tcp = IO::Socket::INET->new(
+    LocalAddr => '0.0.0.0',
+    LocalPort => $portnum,
+    Proto => 'tcp',
+    Listen => 16,
+    ReuseAddr => 1,
+) or die "Cannot listen on TCP 0.0.0.0:${portnum}: $!";
+
+open(my $statefh, '>', $statef);
+print $statefh "$$\n";
+close($statefh);
+
+sub respond {
+    my $q = shift;
+    return undef if length($q) < 17;
+
+    my ($id, $flags, $qdcount) = unpack('n n n', $q);
+    return undef if ($flags & 0x8000) || $qdcount != 1;
+
+    my $off = 12;
+    my @labels;
+    while(1) {
+        return undef if $off >= length($q);
+        my $llen = ord(substr($q, $off++, 1));
+        last if !$llen;
+        push(@labels, lc(substr($q, $off, $llen)));
+        $off += $llen;
+    }
+    return undef if $off + 4 > length($q);
+    my $qname = join('.', @labels);
+    my $qtype = unpack('n', substr($q, $off, 2));
+    my $question = substr($q, 12, $off + 4 - 12);
+
+    my $rcode = 3; # NXDOMAIN
+    my @answers;
+    if($qname eq 'example.com') {
+        $rcode = 0;
+        push(@answers, '192.0.2.77') if $qtype == 1;
+    }
+    elsif($qname eq 'refused.example.com') {
+        $rcode = 5;
+    }
+
+    # QR, AA, copy RD
+    my $rflags = 0x8400 | ($flags & 0x0100) | $rcode;
+    my $resp = pack('n n n n n n', $id, $rflags, 1, scalar(@answers), 0, 0) . $question;
+    foreach my $addr (@answers) {
+        $resp .= pack('n n n N n', 0xC00C, 1, 1, 60, 4) . inet_aton($addr);
+    }
+    return $resp;
+}
+
+sub read_exact {
+    my ($sock, $len) = @_;
+    my $buf = '';
+    while(length($buf) < $len) {
+        my $got = sysread($sock, $buf, $len - length($buf), length($buf));
+        return undef if !$got;
+    }
+    return $buf;
+}
+
+my $sel = IO::Select->new($udp, $tcp);
+while(1) {
+    foreach my $ready ($sel->can_read()) {
+        if($ready == $udp) {
+            my $q;
+            my $peer = $udp->recv($q, 4096);
+            next if !defined $peer;
+            my $resp = respond($q);
+            $udp->send($resp, 0, $peer) if defined $resp;
+        }
+        else {
+            my $c = $tcp->accept() or next;
+            my $lenbytes = read_exact($c, 2);
+            if(defined $lenbytes) {
+                my $q = read_exact($c, unpack('n', $lenbytes));
+                my $resp = defined $q ? respond($q) : undef;
+                syswrite($c, pack('n', length($resp)) . $resp) if defined $resp;
+            }
+            close($c);
+        }
+    }
+}
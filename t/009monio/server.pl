@@ -1,8 +1,21 @@
 
 use HTTP::Daemon;
 use HTTP::Status;
+use HTTP::Response;
 
-my ($portnum, $statef) = @ARGV;
+my ($portnum, $statef, $keepalive, $countf) = @ARGV;
+
+# If $countf is given, it's rewritten after each request with the
+#  number of connections accepted and requests served so far
+my $conns = 0;
+my $reqs = 0;
+sub write_counts {
+    return if !$countf;
+    open(my $countfh, '>', "$countf.tmp");
+    print $countfh "$conns $reqs\n";
+    close($countfh);
+    rename("$countf.tmp", $countf);
+}
 
 $SIG{PIPE} = 'IGNORE';
 
@@ -20,15 +33,24 @@ print $statefh "$$\n";
 close($statefh);
 
 while (my $c = $d->accept) {
+    $conns++;
     while (my $r = $c->get_request) {
+        $reqs++;
         if ($r->method eq 'GET') {
-            $c->send_basic_header();
-            $c->send_crlf();
-            $c->send_crlf();
+            if ($keepalive) {
+                # With a Content-Length, so the connection can be re-used
+                $c->send_response(HTTP::Response->new(RC_OK, 'OK', undef, 'OK'));
+            }
+            else {
+                $c->send_basic_header();
+                $c->send_crlf();
+                $c->send_crlf();
+            }
         }
         else {
             $c->send_error(RC_FORBIDDEN)
         }
+        write_counts();
     }
     $c->close;
     undef($c);
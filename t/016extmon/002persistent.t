@@ -0,0 +1,33 @@
+
+# Persistent-mode extmon workers
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+use Net::DNS;
+use Test::More tests => 6;
+
+my $pid = _GDT->test_spawn_daemon('etc002');
+
+_GDT->test_dns(
+    qname => 'pup.example.com', qtype => 'A',
+    answer => 'pup.example.com 50 A 127.0.0.1',
+);
+
+_GDT->test_dns(
+    qname => 'pdown.example.com', qtype => 'A',
+    answer => 'pdown.example.com 25 A 127.0.0.1',
+);
+
+_GDT->test_dns(
+    qname => 'pexit.example.com', qtype => 'A',
+    answer => 'pexit.example.com 25 A 127.0.0.1',
+);
+
+# Only the late results are successes
+_GDT->test_dns(
+    qname => 'pstale.example.com', qtype => 'A',
+    answer => 'pstale.example.com 25 A 127.0.0.1',
+);
+
+_GDT->test_kill_daemon($pid);
@@ -0,0 +1,123 @@
+# DNS-over-TLS: single and pipelined queries on one connection,
+#  interleaved with another connection on the same thread.
+
+use _GDT ();
+use Net::DNS;
+use Test::More;
+
+BEGIN {
+    eval { require IO::Socket::SSL; };
+    plan(skip_all => 'IO::Socket::SSL is required for the DNS-over-TLS tests') if $@;
+    my $usage = qx{$_GDT::GDNSD_BIN 2>&1};
+    plan(skip_all => 'This build of gdnsd lacks DNS-over-TLS support')
+        unless $usage =~ /^Optional compile-time features:.*\btls\b/m;
+    plan(tests => 9);
+}
+
+my $tls_port = $_GDT::EXTRA_PORT;
+my $num_pipelined = 2000;
+
+sub tls_connect {
+    my $sock = IO::Socket::SSL->new(
+        PeerAddr => '127.0.0.1',
+        PeerPort => $tls_port,
+        SSL_verify_mode => IO::Socket::SSL::SSL_VERIFY_NONE(),
+        Timeout => 10,
+    ) or die "TLS connect failed: $! " . IO::Socket::SSL::errstr();
+    return $sock;
+}
+
+sub tls_query_raw {
+    my ($qname, $id) = @_;
+    my $q = Net::DNS::Packet->new($qname, 'A');
+    $q->header->id($id);
+    $q->header->rd(0);
+    my $data = $q->data;
+    return pack('n', length($data)) . $data;
+}
+
+sub tls_write_all {
+    my ($sock, $data) = @_;
+    my $done = 0;
+    while($done < length($data)) {
+        my $rv = $sock->syswrite($data, length($data) - $done, $done);
+        die "TLS write failed: $! " . IO::Socket::SSL::errstr() unless $rv;
+        $done += $rv;
+    }
+}
+
+sub tls_read_exact {
+    my ($sock, $len) = @_;
+    my $buf = '';
+    while(length($buf) < $len) {
+        my $rv = $sock->sysread($buf, $len - length($buf), length($buf));
+        die "TLS read failed: $! " . IO::Socket::SSL::errstr() unless $rv;
+    }
+    return $buf;
+}
+
+sub tls_read_response {
+    my $sock = shift;
+    my $len = unpack('n', tls_read_exact($sock, 2));
+    my $raw = tls_read_exact($sock, $len);
+    my $pkt = Net::DNS::Packet->new(\$raw)
+        or die "Failed to parse TLS DNS response";
+    return $pkt;
+}
+
+# Checks a response to tls_query_raw('www.example.com', $id)
+sub tls_check_www {
+    my ($pkt, $id) = @_;
+    die "Wrong ID: wanted $id, got " . $pkt->header->id
+        unless $pkt->header->id == $id;
+    die "Wrong rcode: " . $pkt->header->rcode
+        unless $pkt->header->rcode eq 'NOERROR' && $pkt->header->aa;
+    my @ans = $pkt->answer;
+    die "Wrong answer: " . join(', ', map { $_->string } @ans)
+        unless @ans == 1 && $ans[0]->type eq 'A' && $ans[0]->address eq '192.0.2.10';
+    _GDT->stats_inc(qw/tcp_reqs noerror/);
+}
+
+my $pid = _GDT->test_spawn_daemon();
+
+_GDT->test_dns(
+    qname => 'www.example.com', qtype => 'A',
+    answer => 'www.example.com 86400 A 192.0.2.10',
+);
+
+# A single query
+eval {
+    my $sock = tls_connect();
+    tls_write_all($sock, tls_query_raw('www.example.com', 1234));
+    tls_check_www(tls_read_response($sock), 1234);
+    close($sock);
+};
+ok(!$@) or diag $@;
+_GDT->test_stats();
+
+# Many queries in one write, which all arrive decrypted and buffered
+#  together, answered in order on the same connection
+eval {
+    my $sock = tls_connect();
+    tls_write_all($sock, join('', map { tls_query_raw('www.example.com', $_) } (1 .. $num_pipelined)));
+    tls_check_www(tls_read_response($sock), $_) for (1 .. $num_pipelined);
+    close($sock);
+};
+ok(!$@) or diag $@;
+_GDT->test_stats();
+
+# Another client is still served while one has a long pipeline in flight
+eval {
+    my $busy = tls_connect();
+    tls_write_all($busy, join('', map { tls_query_raw('www.example.com', $_) } (1 .. $num_pipelined)));
+    my $other = tls_connect();
+    tls_write_all($other, tls_query_raw('www.example.com', 4321));
+    tls_check_www(tls_read_response($other), 4321);
+    close($other);
+    tls_check_www(tls_read_response($busy), $_) for (1 .. $num_pipelined);
+    close($busy);
+};
+ok(!$@) or diag $@;
+_GDT->test_stats();
+
+_GDT->test_kill_daemon($pid);
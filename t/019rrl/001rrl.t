@@ -0,0 +1,99 @@
+
+# Response rate limiting: one client flooding one name past
+#  rrl_burst gets some of its replies dropped and the rest slipped
+#  back truncated, while TCP is never limited.
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+use Test::More tests => 9;
+
+my $flood = 20;
+my $burst = 5;
+
+my $_id = 7777;
+sub make_query {
+    my $qname = shift;
+    return pack("nCCnnnna*nn",
+        $_id++,
+        0, # flags1
+        0, # flags2
+        1, # qdcount
+        0, # ancount
+        0, # nscount
+        0, # arcount
+        $qname,
+        1, # qtype A
+        1, # qclass
+    );
+}
+
+# Sends all of the queries at once, then collects replies until none
+#  arrive for a second.  Returns the counts of full replies (with the
+#  expected rcode and no TC bit), and of slipped ones (TC bit, nothing
+#  in any section).  Anything else fails the test.
+sub flood {
+    my ($queries, $rcode) = @_;
+    my $sock = IO::Socket::INET->new(
+        PeerAddr => '127.0.0.1:' . $_GDT::DNS_PORT,
+        Proto => 'udp',
+    ) or die "Cannot create UDP socket: $!";
+    send($sock, $_, 0) foreach (@$queries);
+
+    my ($full, $slipped, $bad) = (0, 0, 0);
+    my $rin = '';
+    vec($rin, fileno($sock), 1) = 1;
+    while(select(my $rout = $rin, undef, undef, 1)) {
+        my $res_raw;
+        defined(recv($sock, $res_raw, 4096, 0)) or last;
+        my ($id, $flags1, $flags2, $qd, $an, $ns, $ar) = unpack("nCCnnnn", $res_raw);
+        if(($flags2 & 0xF) != $rcode) {
+            $bad++;
+        }
+        elsif($flags1 & 0x2) {
+            ($an || $ns || $ar) ? $bad++ : $slipped++;
+        }
+        else {
+            $full++;
+        }
+    }
+    close($sock);
+    return ($full, $slipped, $bad);
+}
+
+sub check_flood {
+    my ($desc, $full, $slipped, $bad) = @_;
+    local $Test::Builder::Level = $Test::Builder::Level + 1;
+    my $limited = $flood - $full;
+    # rrl_rate = 1 might let one more through, if the flood is slow
+    ok($full >= $burst && $full <= $burst + 1, "$desc: only the burst was answered")
+        or diag "$full full replies";
+    # every rrl_slip'th limited response is slipped, the rest dropped
+    ok(abs($slipped - $limited / 2) <= 1, "$desc: half of the limited replies slipped")
+        or diag "$slipped slipped replies of $limited limited";
+    is($bad, 0, "$desc: no unexpected replies");
+}
+
+my $pid = _GDT->test_spawn_daemon();
+
+# Just www.example.com over and over
+my @www = map { make_query("\x03www\x07example\x03com\x00") } (1 .. $flood);
+check_flood('NOERROR', flood(\@www, 0));
+_GDT->stats_inc(qw/udp_reqs noerror/) foreach (@www);
+
+# A different nonexistent name every time, which all share the
+#  zone's NXDOMAIN limit
+my @nx = map { make_query("\x04nx$_\x07example\x03com\x00") } (10 .. $flood + 9);
+check_flood('NXDOMAIN', flood(\@nx, 3));
+_GDT->stats_inc(qw/udp_reqs nxdomain/) foreach (@nx);
+
+# TCP is never limited
+_GDT->test_dns(
+    qname => 'www.example.com', qtype => 'A',
+    answer => 'www.example.com 86400 A 192.0.2.1',
+    resopts => { usevc => 1 },
+    stats => [qw/tcp_reqs noerror/],
+    v4_only => 1,
+);
+
+_GDT->test_kill_daemon($pid);